@@ -0,0 +1,84 @@
+#include "much/arena.h"
+#include "much/util.h"
+
+#define ARENA_ALIGNMENT 64
+
+static arena_block_t *new_arena_block(size_t size) {
+  arena_block_t *block = (arena_block_t *)malloc(sizeof(arena_block_t));
+  if (block == NULL) {
+    raise_error(NullPointer, "malloc failed to allocate arena block");
+  }
+  block->base = (unsigned char *)aligned_alloc(ARENA_ALIGNMENT, size);
+  if (block->base == NULL) {
+    raise_error(NullPointer, "aligned_alloc failed to allocate arena storage");
+  }
+  block->next = NULL;
+  block->size = size;
+  block->used = 0;
+  return block;
+}
+
+static void free_arena_blocks(arena_block_t *block) {
+  while (block != NULL) {
+    arena_block_t *next = block->next;
+    free(block->base);
+    free(block);
+    block = next;
+  }
+}
+
+static size_t align_up(size_t size) {
+  return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+arena_t *new_arena(size_t initial_size) {
+  arena_t *ret = (arena_t *)malloc(sizeof(arena_t));
+  if (ret == NULL) {
+    raise_error(NullPointer, "malloc failed to allocate arena_t");
+  }
+  ret->capacity = align_up(initial_size > 0 ? initial_size : ARENA_ALIGNMENT);
+  ret->blocks = new_arena_block(ret->capacity);
+  return ret;
+}
+
+void free_arena(arena_t *self) {
+  if (self != NULL) {
+    free_arena_blocks(self->blocks);
+    free(self);
+  }
+}
+
+void *arena_alloc(arena_t *self, size_t size) {
+  if (self == NULL) {
+    raise_error(NullPointer, "arena_t* self is NULL");
+  }
+  size = align_up(size > 0 ? size : 1);
+
+  arena_block_t *block = self->blocks;
+  if (block->size - block->used < size) {
+    // Overflow blocks are chained in front and folded into one larger block
+    // on the next reset, so a steady workload stops allocating after the
+    // first few steps.
+    size_t block_size = block->size > size ? block->size : size;
+    arena_block_t *grown = new_arena_block(block_size);
+    grown->next = block;
+    self->blocks = grown;
+    self->capacity += block_size;
+    block = grown;
+  }
+
+  void *ret = block->base + block->used;
+  block->used += size;
+  return ret;
+}
+
+void arena_reset(arena_t *self) {
+  if (self == NULL) {
+    return;
+  }
+  if (self->blocks->next != NULL) {
+    free_arena_blocks(self->blocks);
+    self->blocks = new_arena_block(self->capacity);
+  }
+  self->blocks->used = 0;
+}
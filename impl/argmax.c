@@ -1,12 +1,18 @@
 #include "much/argmax.h"
 
 uint64_t argmax(float* data, uint64_t len) {
+    return argmax_stride(data, len, 1);
+}
+
+// Index of the largest of `len` values spaced `stride` apart, e.g. one
+// column of a [classes, batch] tensor.
+uint64_t argmax_stride(float* data, uint64_t len, uint64_t stride) {
     if (len == 0) {
         return 0;
     }
     uint64_t max_index = 0;
     for (uint64_t i = 1; i < len; i++) {
-        if (data[i] > data[max_index]) {
+        if (data[i * stride] > data[max_index * stride]) {
             max_index = i;
         }
     }
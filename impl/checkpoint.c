@@ -0,0 +1,453 @@
+#include "much/checkpoint.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "checkpoints are read and written in host byte order, which must be little-endian"
+#endif
+
+_Static_assert(sizeof(checkpoint_header_t) == 64, "checkpoint header must be 64 bytes");
+_Static_assert(sizeof(checkpoint_entry_t) == 128, "checkpoint entry must be 128 bytes");
+
+static uint64_t align_up(uint64_t value) {
+    return (value + CHECKPOINT_ALIGN - 1) & ~(uint64_t)(CHECKPOINT_ALIGN - 1);
+}
+
+static uint64_t entry_dtype_size(uint32_t dtype) {
+    switch (dtype) {
+    case CHECKPOINT_F32:
+        return sizeof(float);
+    case CHECKPOINT_I64:
+        return sizeof(int64_t);
+    case CHECKPOINT_BF16:
+    case CHECKPOINT_F16:
+        return sizeof(uint16_t);
+    default:
+        return 0;
+    }
+}
+
+static checkpoint_dtype_t entry_dtype(dtype_t dtype) {
+    switch (dtype) {
+    case DTYPE_BF16:
+        return CHECKPOINT_BF16;
+    case DTYPE_F16:
+        return CHECKPOINT_F16;
+    default:
+        return CHECKPOINT_F32;
+    }
+}
+
+static dtype_t tensor_dtype(uint32_t dtype) {
+    switch (dtype) {
+    case CHECKPOINT_F32:
+        return DTYPE_F32;
+    case CHECKPOINT_BF16:
+        return DTYPE_BF16;
+    case CHECKPOINT_F16:
+        return DTYPE_F16;
+    default:
+        raise_error(ValueError, "checkpoint entry is not a tensor");
+        return DTYPE_F32;
+    }
+}
+
+static void join_name(char* out, const char* prefix, const char* suffix) {
+    if (snprintf(out, CHECKPOINT_NAME_SIZE, "%s.%s", prefix, suffix) >= CHECKPOINT_NAME_SIZE) {
+        raise_error(ValueError, "checkpoint entry name is too long");
+    }
+}
+
+checkpoint_writer_t* new_checkpoint_writer() {
+    checkpoint_writer_t* writer = (checkpoint_writer_t*)calloc(1, sizeof(checkpoint_writer_t));
+    if (writer == NULL) {
+        raise_error(NullPointer, "malloc failed to allocate checkpoint_writer_t");
+    }
+    return writer;
+}
+
+void free_checkpoint_writer(checkpoint_writer_t* writer) {
+    if (writer != NULL) {
+        checkpoint_wait(writer);
+        free(writer->entries);
+        free(writer->payload);
+        free(writer);
+    }
+}
+
+void checkpoint_writer_clear(checkpoint_writer_t* writer) {
+    if (writer->saving == CBOOL_TRUE) {
+        raise_error(RuntimeError, "checkpoint writer modified while saving");
+    }
+    writer->num_entries = 0;
+    writer->payload_size = 0;
+}
+
+static void add_entry(checkpoint_writer_t* writer, const char* name, checkpoint_dtype_t dtype,
+                      const void* data, const uint64_t* shape, uint64_t num_dims) {
+    if (writer->saving == CBOOL_TRUE) {
+        raise_error(RuntimeError, "checkpoint writer modified while saving");
+    }
+    if (strlen(name) >= CHECKPOINT_NAME_SIZE) {
+        raise_error(ValueError, "checkpoint entry name is too long");
+    }
+    if (num_dims > CHECKPOINT_MAX_DIMS) {
+        raise_error(ValueError, "too many dimensions for a checkpoint entry");
+    }
+
+    if (writer->num_entries == writer->entries_capacity) {
+        uint64_t capacity = writer->entries_capacity == 0 ? 16 : writer->entries_capacity * 2;
+        checkpoint_entry_t* entries =
+            (checkpoint_entry_t*)realloc(writer->entries, capacity * sizeof(checkpoint_entry_t));
+        if (entries == NULL) {
+            raise_error(NullPointer, "malloc failed to grow checkpoint entries");
+        }
+        writer->entries = entries;
+        writer->entries_capacity = capacity;
+    }
+
+    checkpoint_entry_t* entry = &writer->entries[writer->num_entries++];
+    memset(entry, 0, sizeof(checkpoint_entry_t));
+    strcpy(entry->name, name);
+    entry->dtype = dtype;
+    entry->num_dims = (uint32_t)num_dims;
+    uint64_t count = 1;
+    for (uint64_t i = 0; i < num_dims; i++) {
+        entry->dims[i] = shape[i];
+        count *= shape[i];
+    }
+    entry->size = count * entry_dtype_size(dtype);
+
+    // Offsets are relative to the payload until the table size is known.
+    uint64_t offset = align_up(writer->payload_size);
+    uint64_t end = offset + entry->size;
+    if (end > writer->payload_capacity) {
+        uint64_t capacity = writer->payload_capacity == 0 ? 4096 : writer->payload_capacity;
+        while (capacity < end) {
+            capacity *= 2;
+        }
+        uint8_t* payload = (uint8_t*)realloc(writer->payload, capacity);
+        if (payload == NULL) {
+            raise_error(NullPointer, "malloc failed to grow checkpoint payload");
+        }
+        writer->payload = payload;
+        writer->payload_capacity = capacity;
+    }
+    memset(writer->payload + writer->payload_size, 0, offset - writer->payload_size);
+    memcpy(writer->payload + offset, data, entry->size);
+    entry->offset = offset;
+    writer->payload_size = end;
+}
+
+void checkpoint_add_f32(checkpoint_writer_t* writer, const char* name, const float* data,
+                        const uint64_t* shape, uint64_t num_dims) {
+    add_entry(writer, name, CHECKPOINT_F32, data, shape, num_dims);
+}
+
+void checkpoint_add_i64(checkpoint_writer_t* writer, const char* name, int64_t value) {
+    add_entry(writer, name, CHECKPOINT_I64, &value, (uint64_t[]){1}, 1);
+}
+
+void checkpoint_add_tensor(checkpoint_writer_t* writer, const char* name, tensor_f32_t* tensor) {
+    if (tensor_is_contiguous(tensor) != CBOOL_TRUE) {
+        raise_error(ValueError, "checkpoint tensors must be contiguous");
+    }
+    add_entry(writer, name, entry_dtype(tensor->meta.dtype), tensor->data, tensor->meta.shape,
+              tensor->meta.shape_length);
+}
+
+void checkpoint_add_layer(checkpoint_writer_t* writer, const char* prefix, linear_layer_t* layer) {
+    char name[CHECKPOINT_NAME_SIZE];
+    join_name(name, prefix, "weight");
+    checkpoint_add_tensor(writer, name, layer->weight);
+    join_name(name, prefix, "bias");
+    checkpoint_add_tensor(writer, name, layer->bias);
+}
+
+void checkpoint_add_optimizer(checkpoint_writer_t* writer, const char* prefix, optimizer_t* optimizer) {
+    char name[CHECKPOINT_NAME_SIZE];
+    join_name(name, prefix, "type");
+    checkpoint_add_i64(writer, name, optimizer->type);
+    join_name(name, prefix, "t");
+    checkpoint_add_i64(writer, name, optimizer->t);
+    if (optimizer->m != NULL) {
+        join_name(name, prefix, "m");
+        checkpoint_add_f32(writer, name, optimizer->m, &optimizer->num_params, 1);
+    }
+    if (optimizer->v != NULL) {
+        join_name(name, prefix, "v");
+        checkpoint_add_f32(writer, name, optimizer->v, &optimizer->num_params, 1);
+    }
+    if (optimizer->master != NULL) {
+        join_name(name, prefix, "master");
+        checkpoint_add_f32(writer, name, optimizer->master, &optimizer->num_params, 1);
+    }
+}
+
+cbool_t checkpoint_save(checkpoint_writer_t* writer, const char* path) {
+    uint64_t table_end = sizeof(checkpoint_header_t) + writer->num_entries * sizeof(checkpoint_entry_t);
+    uint64_t payload_start = align_up(table_end);
+
+    checkpoint_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.num_entries = (uint32_t)writer->num_entries;
+    header.file_size = payload_start + writer->payload_size;
+
+    size_t tmp_size = strlen(path) + 5;
+    char* tmp_path = (char*)malloc(tmp_size);
+    if (tmp_path == NULL) {
+        return CBOOL_FALSE;
+    }
+    snprintf(tmp_path, tmp_size, "%s.tmp", path);
+    FILE* file = fopen(tmp_path, "wb");
+    if (file == NULL) {
+        free(tmp_path);
+        return CBOOL_FALSE;
+    }
+
+    static const uint8_t zeros[CHECKPOINT_ALIGN] = {0};
+    cbool_t ok = fwrite(&header, sizeof(header), 1, file) == 1 ? CBOOL_TRUE : CBOOL_FALSE;
+    for (uint64_t i = 0; i < writer->num_entries && ok == CBOOL_TRUE; i++) {
+        checkpoint_entry_t entry = writer->entries[i];
+        entry.offset += payload_start;
+        ok = fwrite(&entry, sizeof(entry), 1, file) == 1 ? CBOOL_TRUE : CBOOL_FALSE;
+    }
+    if (ok == CBOOL_TRUE && payload_start > table_end) {
+        ok = fwrite(zeros, payload_start - table_end, 1, file) == 1 ? CBOOL_TRUE : CBOOL_FALSE;
+    }
+    if (ok == CBOOL_TRUE && writer->payload_size > 0) {
+        ok = fwrite(writer->payload, writer->payload_size, 1, file) == 1 ? CBOOL_TRUE : CBOOL_FALSE;
+    }
+    if (fclose(file) != 0) {
+        ok = CBOOL_FALSE;
+    }
+    if (ok == CBOOL_TRUE && rename(tmp_path, path) != 0) {
+        ok = CBOOL_FALSE;
+    }
+    if (ok != CBOOL_TRUE) {
+        remove(tmp_path);
+    }
+    free(tmp_path);
+    return ok;
+}
+
+static void* save_thread(void* arg) {
+    checkpoint_writer_t* writer = (checkpoint_writer_t*)arg;
+    writer->failed = checkpoint_save(writer, writer->path) == CBOOL_TRUE ? CBOOL_FALSE : CBOOL_TRUE;
+    return NULL;
+}
+
+void checkpoint_save_async(checkpoint_writer_t* writer, const char* path) {
+    if (writer->saving == CBOOL_TRUE) {
+        raise_error(RuntimeError, "checkpoint writer is already saving");
+    }
+    writer->path = strdup(path);
+    if (writer->path == NULL) {
+        raise_error(NullPointer, "malloc failed to copy checkpoint path");
+    }
+    writer->failed = CBOOL_FALSE;
+    writer->saving = CBOOL_TRUE;
+    if (pthread_create(&writer->thread, NULL, save_thread, writer) != 0) {
+        raise_error(RuntimeError, "failed to start checkpoint writer");
+    }
+}
+
+cbool_t checkpoint_wait(checkpoint_writer_t* writer) {
+    if (writer->saving != CBOOL_TRUE) {
+        return CBOOL_TRUE;
+    }
+    pthread_join(writer->thread, NULL);
+    writer->saving = CBOOL_FALSE;
+    free(writer->path);
+    writer->path = NULL;
+    return writer->failed == CBOOL_TRUE ? CBOOL_FALSE : CBOOL_TRUE;
+}
+
+checkpoint_t* checkpoint_open(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        raise_error(RuntimeError, "Could not open checkpoint");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(checkpoint_header_t)) {
+        raise_error(RuntimeError, "Checkpoint is too small");
+    }
+    void* map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        raise_error(RuntimeError, "Could not mmap checkpoint");
+    }
+
+    uint64_t size = (uint64_t)st.st_size;
+    const checkpoint_header_t* header = (const checkpoint_header_t*)map;
+    if (memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) != 0) {
+        raise_error(RuntimeError, "Invalid magic number in checkpoint");
+    }
+    if (header->version != CHECKPOINT_VERSION) {
+        raise_error(RuntimeError, "Unsupported checkpoint version");
+    }
+    if (header->file_size != size ||
+        (size - sizeof(checkpoint_header_t)) / sizeof(checkpoint_entry_t) < header->num_entries) {
+        raise_error(RuntimeError, "Checkpoint is truncated");
+    }
+
+    const checkpoint_entry_t* entries = (const checkpoint_entry_t*)(header + 1);
+    for (uint32_t i = 0; i < header->num_entries; i++) {
+        const checkpoint_entry_t* entry = &entries[i];
+        if (memchr(entry->name, '\0', CHECKPOINT_NAME_SIZE) == NULL || entry_dtype_size(entry->dtype) == 0 ||
+            entry->num_dims > CHECKPOINT_MAX_DIMS || entry->offset % CHECKPOINT_ALIGN != 0 ||
+            entry->offset > size || size - entry->offset < entry->size) {
+            raise_error(RuntimeError, "Invalid entry in checkpoint");
+        }
+        uint64_t count = 1;
+        for (uint32_t d = 0; d < entry->num_dims; d++) {
+            count *= entry->dims[d];
+        }
+        if (count * entry_dtype_size(entry->dtype) != entry->size) {
+            raise_error(RuntimeError, "Checkpoint entry size does not match its shape");
+        }
+    }
+
+    checkpoint_t* checkpoint = (checkpoint_t*)malloc(sizeof(checkpoint_t));
+    if (checkpoint == NULL) {
+        raise_error(NullPointer, "malloc failed to allocate checkpoint_t");
+    }
+    checkpoint->map = map;
+    checkpoint->map_size = size;
+    checkpoint->header = header;
+    checkpoint->entries = entries;
+    return checkpoint;
+}
+
+void checkpoint_close(checkpoint_t* checkpoint) {
+    if (checkpoint != NULL) {
+        munmap(checkpoint->map, (size_t)checkpoint->map_size);
+        free(checkpoint);
+    }
+}
+
+const checkpoint_entry_t* checkpoint_find(checkpoint_t* checkpoint, const char* name) {
+    for (uint32_t i = 0; i < checkpoint->header->num_entries; i++) {
+        if (strcmp(checkpoint->entries[i].name, name) == 0) {
+            return &checkpoint->entries[i];
+        }
+    }
+    return NULL;
+}
+
+void* checkpoint_data(checkpoint_t* checkpoint, const checkpoint_entry_t* entry) {
+    return (uint8_t*)checkpoint->map + entry->offset;
+}
+
+static const checkpoint_entry_t* require_entry(checkpoint_t* checkpoint, const char* name,
+                                               checkpoint_dtype_t dtype) {
+    const checkpoint_entry_t* entry = checkpoint_find(checkpoint, name);
+    if (entry == NULL) {
+        raise_error(ValueError, "checkpoint entry not found");
+    }
+    if (entry->dtype != (uint32_t)dtype) {
+        raise_error(ValueError, "checkpoint entry has the wrong dtype");
+    }
+    return entry;
+}
+
+int64_t checkpoint_get_i64(checkpoint_t* checkpoint, const char* name) {
+    const checkpoint_entry_t* entry = require_entry(checkpoint, name, CHECKPOINT_I64);
+    if (entry->size != sizeof(int64_t)) {
+        raise_error(ValueError, "checkpoint entry is not a scalar");
+    }
+    return *(const int64_t*)checkpoint_data(checkpoint, entry);
+}
+
+tensor_f32_t* checkpoint_map_tensor(checkpoint_t* checkpoint, const char* name, cbool_t require_grad) {
+    const checkpoint_entry_t* entry = checkpoint_find(checkpoint, name);
+    if (entry == NULL) {
+        raise_error(ValueError, "checkpoint entry not found");
+    }
+    uint64_t shape[CHECKPOINT_MAX_DIMS];
+    for (uint32_t i = 0; i < entry->num_dims; i++) {
+        shape[i] = entry->dims[i];
+    }
+    return tensor_wrap_dtype(checkpoint_data(checkpoint, entry), shape, entry->num_dims,
+                             tensor_dtype(entry->dtype), require_grad);
+}
+
+linear_layer_t* checkpoint_map_layer(checkpoint_t* checkpoint, const char* prefix, cbool_t require_grad) {
+    linear_layer_t* layer = (linear_layer_t*)malloc(sizeof(linear_layer_t));
+    if (layer == NULL) {
+        raise_error(NullPointer, "malloc failed to allocate linear_layer_t");
+    }
+    char name[CHECKPOINT_NAME_SIZE];
+    join_name(name, prefix, "weight");
+    layer->weight = checkpoint_map_tensor(checkpoint, name, require_grad);
+    join_name(name, prefix, "bias");
+    layer->bias = checkpoint_map_tensor(checkpoint, name, require_grad);
+    return layer;
+}
+
+static void load_f32(checkpoint_t* checkpoint, const char* name, float* dst, uint64_t count) {
+    const checkpoint_entry_t* entry = require_entry(checkpoint, name, CHECKPOINT_F32);
+    if (entry->size != count * sizeof(float)) {
+        raise_error(ValueError, "checkpoint entry size does not match");
+    }
+    memcpy(dst, checkpoint_data(checkpoint, entry), entry->size);
+}
+
+void checkpoint_load_tensor(checkpoint_t* checkpoint, const char* name, tensor_f32_t* tensor) {
+    const checkpoint_entry_t* entry = require_entry(checkpoint, name, entry_dtype(tensor->meta.dtype));
+    if (entry->num_dims != tensor->meta.shape_length) {
+        raise_error(ValueError, "checkpoint entry shape does not match");
+    }
+    for (uint32_t i = 0; i < entry->num_dims; i++) {
+        if (entry->dims[i] != tensor->meta.shape[i]) {
+            raise_error(ValueError, "checkpoint entry shape does not match");
+        }
+    }
+    if (tensor_is_contiguous(tensor) != CBOOL_TRUE) {
+        raise_error(ValueError, "checkpoint tensors must be contiguous");
+    }
+    memcpy(tensor->data, checkpoint_data(checkpoint, entry), entry->size);
+}
+
+void checkpoint_load_layer(checkpoint_t* checkpoint, const char* prefix, linear_layer_t* layer) {
+    char name[CHECKPOINT_NAME_SIZE];
+    join_name(name, prefix, "weight");
+    checkpoint_load_tensor(checkpoint, name, layer->weight);
+    join_name(name, prefix, "bias");
+    checkpoint_load_tensor(checkpoint, name, layer->bias);
+}
+
+void checkpoint_load_optimizer(checkpoint_t* checkpoint, const char* prefix, optimizer_t* optimizer) {
+    char name[CHECKPOINT_NAME_SIZE];
+    join_name(name, prefix, "type");
+    if (checkpoint_get_i64(checkpoint, name) != optimizer->type) {
+        raise_error(ValueError, "checkpoint was saved with a different optimizer");
+    }
+    join_name(name, prefix, "t");
+    optimizer->t = (int)checkpoint_get_i64(checkpoint, name);
+    if (optimizer->m != NULL) {
+        join_name(name, prefix, "m");
+        load_f32(checkpoint, name, optimizer->m, optimizer->num_params);
+    }
+    if (optimizer->v != NULL) {
+        join_name(name, prefix, "v");
+        load_f32(checkpoint, name, optimizer->v, optimizer->num_params);
+    }
+    join_name(name, prefix, "master");
+    if (checkpoint_find(checkpoint, name) != NULL) {
+        if (optimizer->master == NULL) {
+            optimizer->master = (float*)malloc(optimizer->num_params * sizeof(float));
+            if (optimizer->master == NULL) {
+                raise_error(NullPointer, "malloc failed to allocate master weights");
+            }
+        }
+        load_f32(checkpoint, name, optimizer->master, optimizer->num_params);
+    }
+}
@@ -0,0 +1,712 @@
+#include "much/conv.h"
+#include "much/kernels.h"
+#include "much/parallel.h"
+#include "much/sgemm.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Floats of unfolded input per block of output rows: the im2col matrix of
+// a block stays in L2 while sgemm streams the weight across it.
+#define CONV_COL_FLOATS (1u << 16)
+// Images whose weight gradients one task sums before the tasks' partial
+// sums are added up in a fixed order.
+#define CONV_GRAD_GROUP 8
+
+typedef enum {
+    CONV_SCRATCH_COL,
+    CONV_SCRATCH_DCOL,
+    CONV_SCRATCH_DZ,
+    // Only used by the calling thread, never inside a parallel range.
+    CONV_SCRATCH_PARTIALS,
+    CONV_SCRATCH_SLOTS
+} conv_scratch_slot_t;
+
+// Per-thread scratch, reused across calls.
+static _Thread_local float* conv_scratch[CONV_SCRATCH_SLOTS];
+static _Thread_local uint64_t conv_scratch_capacity[CONV_SCRATCH_SLOTS];
+
+static void release_conv_scratch() {
+    for (int slot = 0; slot < CONV_SCRATCH_SLOTS; slot++) {
+        free(conv_scratch[slot]);
+        conv_scratch[slot] = NULL;
+        conv_scratch_capacity[slot] = 0;
+    }
+}
+
+static float* reserve_conv_scratch(conv_scratch_slot_t slot, uint64_t size) {
+    if (size > conv_scratch_capacity[slot]) {
+        register_thread_scratch(release_conv_scratch);
+        float* scratch = (float*)realloc(conv_scratch[slot], sizeof(float) * size);
+        if (scratch == NULL) {
+            raise_error(NullPointer, "realloc failed to allocate convolution scratch");
+        }
+        conv_scratch[slot] = scratch;
+        conv_scratch_capacity[slot] = size;
+    }
+    return conv_scratch[slot];
+}
+
+uint64_t conv2d_out_size(uint64_t in, uint64_t kernel, uint64_t stride, uint64_t padding) {
+    if (kernel == 0 || stride == 0 || in + 2 * padding < kernel) {
+        raise_error(ValueError, "convolution window does not fit its input");
+    }
+    return (in + 2 * padding - kernel) / stride + 1;
+}
+
+// Float NCHW input. Other dtypes go through a cast node, as do strided
+// layouts unless the caller reads them in place.
+static tensor_f32_t* nchw_input(tensor_f32_t* x, cbool_t any_strides) {
+    if (x->meta.shape_length != 4) {
+        raise_error(ValueError, "convolution and pooling take NCHW input");
+    }
+    if (x->meta.dtype != DTYPE_F32 ||
+        (any_strides != CBOOL_TRUE && tensor_is_contiguous(x) != CBOOL_TRUE)) {
+        return tensor_f32_cast(x, DTYPE_F32);
+    }
+    return x;
+}
+
+typedef struct {
+    uint64_t images;
+    uint64_t channels;
+    uint64_t height;
+    uint64_t width;
+    uint64_t out_channels;
+    uint64_t kernel_h;
+    uint64_t kernel_w;
+    uint64_t out_h;
+    uint64_t out_w;
+    uint64_t stride;
+    uint64_t padding;
+    // Of the input and its gradient, by image, channel, row and column.
+    uint64_t x_strides[4];
+} conv_shape_t;
+
+static uint64_t conv_taps(const conv_shape_t* s) { return s->channels * s->kernel_h * s->kernel_w; }
+
+static uint64_t conv_pixels(const conv_shape_t* s) { return s->out_h * s->out_w; }
+
+static cbool_t conv_dense_images(const conv_shape_t* s) {
+    return s->x_strides[3] == 1 && s->x_strides[2] == s->width &&
+                   s->x_strides[1] == s->height * s->width
+               ? CBOOL_TRUE
+               : CBOOL_FALSE;
+}
+
+// A 1x1 convolution with unit stride and no padding reads each dense
+// image as its own im2col matrix, so nothing is unfolded.
+static cbool_t conv_pointwise(const conv_shape_t* s) {
+    return s->kernel_h == 1 && s->kernel_w == 1 && s->stride == 1 && s->padding == 0 &&
+                   conv_dense_images(s) == CBOOL_TRUE
+               ? CBOOL_TRUE
+               : CBOOL_FALSE;
+}
+
+// Output rows unfolded at a time.
+static uint64_t conv_block_rows(const conv_shape_t* s) {
+    if (conv_pointwise(s) == CBOOL_TRUE) {
+        return s->out_h;
+    }
+    uint64_t rows = CONV_COL_FLOATS / (conv_taps(s) * s->out_w);
+    if (rows == 0) {
+        rows = 1;
+    }
+    return rows < s->out_h ? rows : s->out_h;
+}
+
+// Outputs [lo, hi) along an axis whose tap `tap` lands inside the input
+// rather than in the padding.
+static void conv_valid_range(uint64_t tap, uint64_t in, uint64_t out, uint64_t stride,
+                             uint64_t padding, uint64_t* lo, uint64_t* hi) {
+    *lo = tap >= padding ? 0 : (padding - tap + stride - 1) / stride;
+    *hi = in + padding > tap ? (in + padding - tap + stride - 1) / stride : 0;
+    if (*hi > out) {
+        *hi = out;
+    }
+    if (*lo > *hi) {
+        *lo = *hi;
+    }
+}
+
+// col[tap, pixel] for output rows [oh0, oh1) of one image x [C, H, W],
+// laid out by s->x_strides: the input value each tap of each window reads,
+// or 0 in the padding.
+static void im2col(const conv_shape_t* s, const float* x, uint64_t oh0, uint64_t oh1, float* col) {
+    const uint64_t* xs = s->x_strides;
+    float* dst = col;
+    for (uint64_t c = 0; c < s->channels; c++) {
+        const float* plane = x + c * xs[1];
+        for (uint64_t kh = 0; kh < s->kernel_h; kh++) {
+            uint64_t row_lo, row_hi;
+            conv_valid_range(kh, s->height, s->out_h, s->stride, s->padding, &row_lo, &row_hi);
+            for (uint64_t kw = 0; kw < s->kernel_w; kw++) {
+                uint64_t lo, hi;
+                conv_valid_range(kw, s->width, s->out_w, s->stride, s->padding, &lo, &hi);
+                for (uint64_t oh = oh0; oh < oh1; oh++, dst += s->out_w) {
+                    if (oh < row_lo || oh >= row_hi) {
+                        memset(dst, 0, sizeof(float) * s->out_w);
+                        continue;
+                    }
+                    const float* src = plane + (oh * s->stride + kh - s->padding) * xs[2];
+                    memset(dst, 0, sizeof(float) * lo);
+                    if (s->stride == 1 && xs[3] == 1 && hi > lo) {
+                        memcpy(dst + lo, src + lo + kw - s->padding, sizeof(float) * (hi - lo));
+                    } else {
+                        for (uint64_t ow = lo; ow < hi; ow++) {
+                            dst[ow] = src[(ow * s->stride + kw - s->padding) * xs[3]];
+                        }
+                    }
+                    memset(dst + hi, 0, sizeof(float) * (s->out_w - hi));
+                }
+            }
+        }
+    }
+}
+
+// The reverse of im2col: dx [C, H, W] += each tap's gradient, skipping the
+// padding.
+static void col2im(const conv_shape_t* s, const float* dcol, uint64_t oh0, uint64_t oh1,
+                   float* dx) {
+    const uint64_t* xs = s->x_strides;
+    const float* src = dcol;
+    for (uint64_t c = 0; c < s->channels; c++) {
+        float* plane = dx + c * xs[1];
+        for (uint64_t kh = 0; kh < s->kernel_h; kh++) {
+            uint64_t row_lo, row_hi;
+            conv_valid_range(kh, s->height, s->out_h, s->stride, s->padding, &row_lo, &row_hi);
+            for (uint64_t kw = 0; kw < s->kernel_w; kw++) {
+                uint64_t lo, hi;
+                conv_valid_range(kw, s->width, s->out_w, s->stride, s->padding, &lo, &hi);
+                for (uint64_t oh = oh0; oh < oh1; oh++, src += s->out_w) {
+                    if (oh < row_lo || oh >= row_hi) {
+                        continue;
+                    }
+                    float* dst = plane + (oh * s->stride + kh - s->padding) * xs[2];
+                    for (uint64_t ow = lo; ow < hi; ow++) {
+                        dst[(ow * s->stride + kw - s->padding) * xs[3]] += src[ow];
+                    }
+                }
+            }
+        }
+    }
+}
+
+static float conv_slope(activation_t activation) {
+    return activation == ACTIVATION_RELU ? 0.0f : 0.01f;
+}
+
+// y = activation(y), in place.
+static void conv_activate(const elementwise_kernels_t* k, activation_t activation, float* y,
+                          uint64_t n) {
+    if (activation == ACTIVATION_SIGMOID) {
+        k->sigmoid(y, y, n);
+    } else if (activation != ACTIVATION_NONE) {
+        k->leaky_relu(y, y, conv_slope(activation), n);
+    }
+}
+
+typedef struct {
+    conv_shape_t s;
+    const float* x;
+    const float* w;
+    const float* bias;
+    float* y;
+    activation_t activation;
+} conv_forward_t;
+
+static void conv_forward_range(void* ctx, uint64_t begin, uint64_t end) {
+    conv_forward_t* p = (conv_forward_t*)ctx;
+    const conv_shape_t* s = &p->s;
+    const elementwise_kernels_t* k = get_kernels();
+    uint64_t pixels = conv_pixels(s);
+    uint64_t taps = conv_taps(s);
+    uint64_t block_rows = conv_block_rows(s);
+    cbool_t pointwise = conv_pointwise(s);
+    float* col = pointwise == CBOOL_TRUE
+                     ? NULL
+                     : reserve_conv_scratch(CONV_SCRATCH_COL, taps * block_rows * s->out_w);
+    for (uint64_t n = begin; n < end; n++) {
+        const float* x = p->x + n * s->x_strides[0];
+        float* y = p->y + n * s->out_channels * pixels;
+        // Preload the bias and let sgemm accumulate onto it.
+        float beta = 0.0f;
+        if (p->bias != NULL) {
+            for (uint64_t oc = 0; oc < s->out_channels; oc++) {
+                k->fill(y + oc * pixels, p->bias[oc], pixels);
+            }
+            beta = 1.0f;
+        }
+        for (uint64_t oh = 0; oh < s->out_h; oh += block_rows) {
+            uint64_t oh1 = oh + block_rows < s->out_h ? oh + block_rows : s->out_h;
+            uint64_t p0 = oh * s->out_w;
+            uint64_t block = (oh1 - oh) * s->out_w;
+            if (pointwise == CBOOL_TRUE) {
+                sgemm(SGEMM_NO_TRANS, SGEMM_NO_TRANS, s->out_channels, block, taps, 1.0f, p->w,
+                      taps, x + p0, pixels, beta, y + p0, pixels);
+            } else {
+                im2col(s, x, oh, oh1, col);
+                sgemm(SGEMM_NO_TRANS, SGEMM_NO_TRANS, s->out_channels, block, taps, 1.0f, p->w,
+                      taps, col, block, beta, y + p0, pixels);
+            }
+        }
+        conv_activate(k, p->activation, y, s->out_channels * pixels);
+    }
+}
+
+typedef struct {
+    conv_shape_t s;
+    const float* x;
+    const float* w;
+    const float* y;
+    const float* dy;
+    // NULL when the input needs no gradient.
+    float* dx;
+    cbool_t accumulate_dx;
+    // Per group of images: the weight gradient, then the bias gradient.
+    float* partials;
+    cbool_t weight_grad;
+    cbool_t bias_grad;
+    activation_t activation;
+} conv_backward_t;
+
+static uint64_t conv_partial_size(const conv_shape_t* s) {
+    return s->out_channels * conv_taps(s) + s->out_channels;
+}
+
+static void conv_backward_range(void* ctx, uint64_t begin, uint64_t end) {
+    conv_backward_t* p = (conv_backward_t*)ctx;
+    const conv_shape_t* s = &p->s;
+    const elementwise_kernels_t* k = get_kernels();
+    uint64_t pixels = conv_pixels(s);
+    uint64_t taps = conv_taps(s);
+    uint64_t outputs = s->out_channels * pixels;
+    uint64_t block_rows = conv_block_rows(s);
+    cbool_t pointwise = conv_pointwise(s);
+    float* col = NULL;
+    float* dcol = NULL;
+    if (pointwise != CBOOL_TRUE) {
+        col = reserve_conv_scratch(CONV_SCRATCH_COL, taps * block_rows * s->out_w);
+        dcol = reserve_conv_scratch(CONV_SCRATCH_DCOL, taps * block_rows * s->out_w);
+    }
+    float* dz = p->activation == ACTIVATION_NONE ? NULL
+                                                 : reserve_conv_scratch(CONV_SCRATCH_DZ, outputs);
+
+    for (uint64_t g = begin; g < end; g++) {
+        float* dw = p->partials + g * conv_partial_size(s);
+        float* db = dw + s->out_channels * taps;
+        k->fill(dw, 0.0f, conv_partial_size(s));
+        uint64_t last = (g + 1) * CONV_GRAD_GROUP < s->images ? (g + 1) * CONV_GRAD_GROUP
+                                                              : s->images;
+        for (uint64_t n = g * CONV_GRAD_GROUP; n < last; n++) {
+            const float* x = p->x + n * s->x_strides[0];
+            const float* g_n = p->dy + n * outputs;
+            // dz = dy * activation'(y), recovered from the output.
+            if (p->activation == ACTIVATION_SIGMOID) {
+                k->sigmoid_grad(dz, g_n, p->y + n * outputs, outputs, CBOOL_FALSE);
+                g_n = dz;
+            } else if (p->activation != ACTIVATION_NONE) {
+                k->leaky_relu_grad(dz, g_n, p->y + n * outputs, conv_slope(p->activation),
+                                   outputs, CBOOL_FALSE);
+                g_n = dz;
+            }
+            if (p->bias_grad == CBOOL_TRUE) {
+                for (uint64_t oc = 0; oc < s->out_channels; oc++) {
+                    db[oc] += k->sum(g_n + oc * pixels, pixels);
+                }
+            }
+            // A gradient that is overwritten belongs to a contiguous input
+            // (see tensor_grad_prepare).
+            float* dx = p->dx != NULL ? p->dx + n * s->x_strides[0] : NULL;
+            if (dx != NULL && p->accumulate_dx != CBOOL_TRUE) {
+                k->fill(dx, 0.0f, s->channels * s->height * s->width);
+            }
+            for (uint64_t oh = 0; oh < s->out_h; oh += block_rows) {
+                uint64_t oh1 = oh + block_rows < s->out_h ? oh + block_rows : s->out_h;
+                uint64_t p0 = oh * s->out_w;
+                uint64_t block = (oh1 - oh) * s->out_w;
+                if (p->weight_grad == CBOOL_TRUE) {
+                    // dw += dz * col^T
+                    if (pointwise == CBOOL_TRUE) {
+                        sgemm(SGEMM_NO_TRANS, SGEMM_TRANS, s->out_channels, taps, block, 1.0f,
+                              g_n + p0, pixels, x + p0, pixels, 1.0f, dw, taps);
+                    } else {
+                        im2col(s, x, oh, oh1, col);
+                        sgemm(SGEMM_NO_TRANS, SGEMM_TRANS, s->out_channels, taps, block, 1.0f,
+                              g_n + p0, pixels, col, block, 1.0f, dw, taps);
+                    }
+                }
+                if (dx != NULL) {
+                    // dcol = w^T * dz, folded back onto the image.
+                    if (pointwise == CBOOL_TRUE) {
+                        sgemm(SGEMM_TRANS, SGEMM_NO_TRANS, taps, block, s->out_channels, 1.0f, p->w,
+                              taps, g_n + p0, pixels, 1.0f, dx + p0, pixels);
+                    } else {
+                        sgemm(SGEMM_TRANS, SGEMM_NO_TRANS, taps, block, s->out_channels, 1.0f, p->w,
+                              taps, g_n + p0, pixels, 0.0f, dcol, block);
+                        col2im(s, dcol, oh, oh1, dx);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Adds the groups' partial gradients up in order into `grad`.
+static void reduce_partials(tensor_f32_t* param, const float* partials, uint64_t groups,
+                            uint64_t stride, uint64_t n) {
+    const elementwise_kernels_t* k = get_kernels();
+    cbool_t accumulate = tensor_grad_prepare(param);
+    if (accumulate == CBOOL_TRUE) {
+        k->add(param->grad, param->grad, partials, n);
+    } else {
+        memcpy(param->grad, partials, sizeof(float) * n);
+    }
+    for (uint64_t g = 1; g < groups; g++) {
+        k->add(param->grad, param->grad, partials + g * stride, n);
+    }
+}
+
+// prev = {x, weight, bias}; bias may be NULL. op_args holds the stride,
+// padding and activation.
+void conv2d_backward(tensor_f32_t* self) {
+    tensor_f32_t* x = self->prev[0];
+    tensor_f32_t* w = self->prev[1];
+    tensor_f32_t* bias = self->prev[2];
+    conv_shape_t s = {
+        .images = x->meta.shape[0],
+        .channels = x->meta.shape[1],
+        .height = x->meta.shape[2],
+        .width = x->meta.shape[3],
+        .out_channels = w->meta.shape[0],
+        .kernel_h = w->meta.shape[2],
+        .kernel_w = w->meta.shape[3],
+        .out_h = self->meta.shape[2],
+        .out_w = self->meta.shape[3],
+        .stride = self->op_args[0],
+        .padding = self->op_args[1],
+    };
+    memcpy(s.x_strides, x->meta.strides, sizeof(s.x_strides));
+    uint64_t groups = (s.images + CONV_GRAD_GROUP - 1) / CONV_GRAD_GROUP;
+    conv_backward_t p = {
+        .s = s,
+        .x = x->data,
+        .w = w->data,
+        .y = self->data,
+        .dy = self->grad,
+        .dx = NULL,
+        .accumulate_dx = CBOOL_FALSE,
+        .partials = reserve_conv_scratch(CONV_SCRATCH_PARTIALS, groups * conv_partial_size(&s)),
+        .weight_grad = w->meta.require_grad,
+        .bias_grad = bias != NULL ? bias->meta.require_grad : CBOOL_FALSE,
+        .activation = (activation_t)self->op_args[2],
+    };
+    if (x->meta.require_grad == CBOOL_TRUE) {
+        p.accumulate_dx = tensor_grad_prepare(x);
+        p.dx = x->grad;
+    }
+    uint64_t cost = 4 * s.out_channels * conv_taps(&s) * conv_pixels(&s) * CONV_GRAD_GROUP;
+    parallel_for(0, groups, parallel_grain(cost), conv_backward_range, &p);
+
+    uint64_t weights = s.out_channels * conv_taps(&s);
+    if (p.weight_grad == CBOOL_TRUE) {
+        reduce_partials(w, p.partials, groups, conv_partial_size(&s), weights);
+    }
+    if (p.bias_grad == CBOOL_TRUE) {
+        reduce_partials(bias, p.partials + weights, groups, conv_partial_size(&s), s.out_channels);
+    }
+}
+
+tensor_f32_t* tensor_f32_conv2d(tensor_f32_t* x, tensor_f32_t* weight, tensor_f32_t* bias,
+                                uint64_t stride, uint64_t padding, activation_t activation) {
+    if (weight->meta.shape_length != 4 || weight->meta.dtype != DTYPE_F32 ||
+        tensor_is_contiguous(weight) != CBOOL_TRUE) {
+        raise_error(ValueError, "convolution weights must be contiguous float [out, in, kh, kw]");
+    }
+    if (bias != NULL && (bias->meta.capacity != weight->meta.shape[0] ||
+                         bias->meta.dtype != DTYPE_F32 ||
+                         tensor_is_contiguous(bias) != CBOOL_TRUE)) {
+        raise_error(ValueError, "convolution bias must be contiguous float [out]");
+    }
+    if (activation != ACTIVATION_NONE && activation != ACTIVATION_RELU &&
+        activation != ACTIVATION_LEAKY_RELU && activation != ACTIVATION_SIGMOID) {
+        raise_error(ValueError, "unknown activation");
+    }
+    tensor_f32_t* input = x;
+    x = nchw_input(x, CBOOL_TRUE);
+    if (x->meta.shape[1] != weight->meta.shape[1]) {
+        raise_error(ValueError, "convolution input channels do not match its weight");
+    }
+    conv_shape_t s = {
+        .images = x->meta.shape[0],
+        .channels = x->meta.shape[1],
+        .height = x->meta.shape[2],
+        .width = x->meta.shape[3],
+        .out_channels = weight->meta.shape[0],
+        .kernel_h = weight->meta.shape[2],
+        .kernel_w = weight->meta.shape[3],
+        .stride = stride,
+        .padding = padding,
+    };
+    memcpy(s.x_strides, x->meta.strides, sizeof(s.x_strides));
+    s.out_h = conv2d_out_size(s.height, s.kernel_h, stride, padding);
+    s.out_w = conv2d_out_size(s.width, s.kernel_w, stride, padding);
+
+    uint64_t start = profile_begin();
+    cbool_t require_grad =
+        tensor_grad_enabled() == CBOOL_TRUE &&
+                (x->meta.require_grad == CBOOL_TRUE || weight->meta.require_grad == CBOOL_TRUE ||
+                 (bias != NULL && bias->meta.require_grad == CBOOL_TRUE))
+            ? CBOOL_TRUE
+            : CBOOL_FALSE;
+    tensor_f32_t* ret = new_tensor_f32((uint64_t[]){s.images, s.out_channels, s.out_h, s.out_w},
+                                       4, require_grad);
+    conv_forward_t p = {s, x->data, weight->data, bias != NULL ? bias->data : NULL, ret->data,
+                        activation};
+    parallel_for(0, s.images, parallel_grain(2 * s.out_channels * conv_taps(&s) * conv_pixels(&s)),
+                 conv_forward_range, &p);
+    profile_record(OP_CONV2D, PROFILE_FORWARD, start, s.out_channels, s.images * conv_pixels(&s),
+                   conv_taps(&s), sizeof(float));
+
+    if (require_grad == CBOOL_TRUE) {
+        tensor_f32_set_backward(ret, OP_CONV2D, conv2d_backward,
+                                (tensor_f32_t*[]){x, weight, bias}, 3);
+        ret->op_args[0] = stride;
+        ret->op_args[1] = padding;
+        ret->op_args[2] = (uint64_t)activation;
+    }
+    // The graph holds its own reference to a converted input.
+    if (x != input) {
+        free_tensor_f32(x);
+    }
+    return ret;
+}
+
+// Pooling
+
+typedef struct {
+    uint64_t height;
+    uint64_t width;
+    uint64_t out_h;
+    uint64_t out_w;
+    uint64_t kernel;
+    uint64_t stride;
+    const float* x;
+    // Written by the forward pass, read back by max pooling's backward.
+    float* y;
+    const float* dy;
+    float* dx;
+    cbool_t accumulate;
+} pool_t;
+
+// Selects rather than branches, since on real data which input wins is
+// close to random.
+static void max_pool_range(void* ctx, uint64_t begin, uint64_t end) {
+    pool_t* p = (pool_t*)ctx;
+    for (uint64_t plane = begin; plane < end; plane++) {
+        const float* x = p->x + plane * p->height * p->width;
+        float* y = p->y + plane * p->out_h * p->out_w;
+        for (uint64_t oh = 0; oh < p->out_h; oh++) {
+            for (uint64_t ow = 0; ow < p->out_w; ow++) {
+                const float* window = x + oh * p->stride * p->width + ow * p->stride;
+                float best = window[0];
+                for (uint64_t kh = 0; kh < p->kernel; kh++) {
+                    for (uint64_t kw = 0; kw < p->kernel; kw++) {
+                        float v = window[kh * p->width + kw];
+                        best = v > best ? v : best;
+                    }
+                }
+                y[oh * p->out_w + ow] = best;
+            }
+        }
+    }
+}
+
+// Offset in `window` of its first input equal to its maximum `max`,
+// found by selecting from the back rather than by an early exit.
+static uint64_t window_argmax(const pool_t* p, const float* window, float max) {
+    uint64_t ret = 0;
+    for (uint64_t kh = p->kernel; kh-- > 0;) {
+        for (uint64_t kw = p->kernel; kw-- > 0;) {
+            uint64_t i = kh * p->width + kw;
+            ret = window[i] == max ? i : ret;
+        }
+    }
+    return ret;
+}
+
+static void avg_pool_range(void* ctx, uint64_t begin, uint64_t end) {
+    pool_t* p = (pool_t*)ctx;
+    float scale = 1.0f / (float)(p->kernel * p->kernel);
+    for (uint64_t plane = begin; plane < end; plane++) {
+        const float* x = p->x + plane * p->height * p->width;
+        float* y = p->y + plane * p->out_h * p->out_w;
+        for (uint64_t oh = 0; oh < p->out_h; oh++) {
+            for (uint64_t ow = 0; ow < p->out_w; ow++) {
+                const float* window = x + oh * p->stride * p->width + ow * p->stride;
+                float sum = 0.0f;
+                for (uint64_t kh = 0; kh < p->kernel; kh++) {
+                    for (uint64_t kw = 0; kw < p->kernel; kw++) {
+                        sum += window[kh * p->width + kw];
+                    }
+                }
+                y[oh * p->out_w + ow] = sum * scale;
+            }
+        }
+    }
+}
+
+// Planes are disjoint, so each is written by one thread; windows that
+// overlap within a plane accumulate in order.
+static void max_pool_grad_range(void* ctx, uint64_t begin, uint64_t end) {
+    pool_t* p = (pool_t*)ctx;
+    uint64_t inputs = p->height * p->width;
+    for (uint64_t plane = begin; plane < end; plane++) {
+        const float* x = p->x + plane * inputs;
+        const float* y = p->y + plane * p->out_h * p->out_w;
+        const float* dy = p->dy + plane * p->out_h * p->out_w;
+        float* dx = p->dx + plane * inputs;
+        if (p->accumulate != CBOOL_TRUE) {
+            memset(dx, 0, sizeof(float) * inputs);
+        }
+        for (uint64_t oh = 0; oh < p->out_h; oh++) {
+            for (uint64_t ow = 0; ow < p->out_w; ow++) {
+                uint64_t at = oh * p->stride * p->width + ow * p->stride;
+                uint64_t o = oh * p->out_w + ow;
+                dx[at + window_argmax(p, x + at, y[o])] += dy[o];
+            }
+        }
+    }
+}
+
+static void avg_pool_grad_range(void* ctx, uint64_t begin, uint64_t end) {
+    pool_t* p = (pool_t*)ctx;
+    uint64_t inputs = p->height * p->width;
+    float scale = 1.0f / (float)(p->kernel * p->kernel);
+    for (uint64_t plane = begin; plane < end; plane++) {
+        const float* dy = p->dy + plane * p->out_h * p->out_w;
+        float* dx = p->dx + plane * inputs;
+        if (p->accumulate != CBOOL_TRUE) {
+            memset(dx, 0, sizeof(float) * inputs);
+        }
+        for (uint64_t oh = 0; oh < p->out_h; oh++) {
+            for (uint64_t ow = 0; ow < p->out_w; ow++) {
+                float* window = dx + oh * p->stride * p->width + ow * p->stride;
+                float g = dy[oh * p->out_w + ow] * scale;
+                for (uint64_t kh = 0; kh < p->kernel; kh++) {
+                    for (uint64_t kw = 0; kw < p->kernel; kw++) {
+                        window[kh * p->width + kw] += g;
+                    }
+                }
+            }
+        }
+    }
+}
+
+static pool_t pool_shape(tensor_f32_t* x, uint64_t kernel, uint64_t stride) {
+    pool_t p = {
+        .height = x->meta.shape[2],
+        .width = x->meta.shape[3],
+        .kernel = kernel,
+        .stride = stride,
+        .x = x->data,
+    };
+    p.out_h = conv2d_out_size(p.height, kernel, stride, 0);
+    p.out_w = conv2d_out_size(p.width, kernel, stride, 0);
+    return p;
+}
+
+// prev = {x}; op_args holds the kernel and stride.
+static void pool_backward(tensor_f32_t* self, parallel_range_fn grad_range) {
+    tensor_f32_t* x = self->prev[0];
+    if (x->meta.require_grad != CBOOL_TRUE) {
+        return;
+    }
+    pool_t p = pool_shape(x, self->op_args[0], self->op_args[1]);
+    p.y = self->data;
+    p.dy = self->grad;
+    p.accumulate = tensor_grad_prepare(x);
+    p.dx = x->grad;
+    uint64_t planes = x->meta.shape[0] * x->meta.shape[1];
+    parallel_for(0, planes, parallel_grain(2 * p.height * p.width), grad_range, &p);
+}
+
+void max_pool2d_backward(tensor_f32_t* self) { pool_backward(self, max_pool_grad_range); }
+
+void avg_pool2d_backward(tensor_f32_t* self) { pool_backward(self, avg_pool_grad_range); }
+
+static tensor_f32_t* pool2d(tensor_f32_t* x, uint64_t kernel, uint64_t stride, op_kind_t op) {
+    tensor_f32_t* input = x;
+    x = nchw_input(x, CBOOL_FALSE);
+    pool_t p = pool_shape(x, kernel, stride);
+    uint64_t planes = x->meta.shape[0] * x->meta.shape[1];
+
+    uint64_t start = profile_begin();
+    cbool_t require_grad = tensor_grad_enabled() == CBOOL_TRUE &&
+                                   x->meta.require_grad == CBOOL_TRUE
+                               ? CBOOL_TRUE
+                               : CBOOL_FALSE;
+    tensor_f32_t* ret = new_tensor_f32(
+        (uint64_t[]){x->meta.shape[0], x->meta.shape[1], p.out_h, p.out_w}, 4, require_grad);
+    p.y = ret->data;
+    parallel_for(0, planes, parallel_grain(p.height * p.width),
+                 op == OP_MAX_POOL ? max_pool_range : avg_pool_range, &p);
+    profile_record(op, PROFILE_FORWARD, start, ret->meta.capacity, 1, 0, sizeof(float));
+
+    if (require_grad == CBOOL_TRUE) {
+        tensor_f32_set_backward(ret, op,
+                                op == OP_MAX_POOL ? max_pool2d_backward : avg_pool2d_backward,
+                                (tensor_f32_t*[]){x}, 1);
+        ret->op_args[0] = kernel;
+        ret->op_args[1] = stride;
+    }
+    if (x != input) {
+        free_tensor_f32(x);
+    }
+    return ret;
+}
+
+tensor_f32_t* tensor_f32_max_pool2d(tensor_f32_t* x, uint64_t kernel, uint64_t stride) {
+    return pool2d(x, kernel, stride, OP_MAX_POOL);
+}
+
+tensor_f32_t* tensor_f32_avg_pool2d(tensor_f32_t* x, uint64_t kernel, uint64_t stride) {
+    return pool2d(x, kernel, stride, OP_AVG_POOL);
+}
+
+// Layout views
+
+tensor_f32_t* tensor_f32_to_nchw(tensor_f32_t* x, uint64_t channels, uint64_t height,
+                                 uint64_t width) {
+    if (x->meta.shape_length != 2 || x->meta.shape[0] != channels * height * width) {
+        raise_error(ValueError, "NCHW view needs [channels * height * width, images] input");
+    }
+    tensor_f32_t* dense = tensor_f32_contiguous(x);
+    tensor_f32_t* chwn =
+        tensor_f32_reshape(dense, (uint64_t[]){channels, height, width, x->meta.shape[1]}, 4);
+    // [C, H, W, N] -> [N, H, W, C] -> [N, C, W, H] -> [N, C, H, W]
+    tensor_f32_t* nhwc = tensor_f32_transpose(chwn, 0, 3);
+    tensor_f32_t* ncwh = tensor_f32_transpose(nhwc, 1, 3);
+    tensor_f32_t* ret = tensor_f32_transpose(ncwh, 2, 3);
+    free_tensor_f32(chwn);
+    free_tensor_f32(nhwc);
+    free_tensor_f32(ncwh);
+    if (dense != x) {
+        free_tensor_f32(dense);
+    }
+    return ret;
+}
+
+tensor_f32_t* tensor_f32_to_columns(tensor_f32_t* x) {
+    if (x->meta.shape_length < 2) {
+        raise_error(ValueError, "column view needs [images, ...] input");
+    }
+    uint64_t images = x->meta.shape[0];
+    tensor_f32_t* dense = tensor_f32_contiguous(x);
+    tensor_f32_t* rows = tensor_f32_reshape(dense, (uint64_t[]){images, x->meta.capacity / images}, 2);
+    tensor_f32_t* ret = tensor_f32_transpose(rows, 0, 1);
+    free_tensor_f32(rows);
+    if (dense != x) {
+        free_tensor_f32(dense);
+    }
+    return ret;
+}
@@ -1,36 +1,160 @@
 #include "much/crossentropy.h"
-#include <math.h>
+#include "much/kernels.h"
+#include "much/parallel.h"
+#include <stdlib.h>
+#include <string.h>
 
-void softmax(tensor_f32_t* out, tensor_f32_t* in) {
-    float max_val = in->data[0];
-    for (uint64_t i = 1; i < in->meta.capacity; i++) {
-        if (in->data[i] > max_val) {
-            max_val = in->data[i];
+// Logits are laid out as [classes, batch]; a 1D tensor or a [classes, 1]
+// column is a batch of one.
+static void crossentropy_dims(tensor_f32_t* logits, uint64_t* classes, uint64_t* batch) {
+    if (logits->meta.shape_length == 2) {
+        *classes = logits->meta.shape[0];
+        *batch = logits->meta.shape[1];
+    } else {
+        *classes = logits->meta.capacity;
+        *batch = 1;
+    }
+}
+
+// Offset of class `i` of column `c`. 2D views (e.g. a column slice of a
+// larger batch) are read in place; other shapes are made contiguous first.
+static uint64_t crossentropy_at(tensor_f32_t* t, uint64_t i, uint64_t c, uint64_t batch) {
+    if (t->meta.shape_length == 2) {
+        return i * t->meta.strides[0] + c * t->meta.strides[1];
+    }
+    return i * batch + c;
+}
+
+// Column statistics of the fused softmax: running maxima, sums, then
+// scratch. Reused across calls on the same thread.
+static _Thread_local float* softmax_stats;
+static _Thread_local uint64_t softmax_stats_capacity;
+
+static void release_softmax_stats() {
+    free(softmax_stats);
+    softmax_stats = NULL;
+    softmax_stats_capacity = 0;
+}
+
+static float* reserve_softmax_stats(uint64_t batch) {
+    if (3 * batch > softmax_stats_capacity) {
+        register_thread_scratch(release_softmax_stats);
+        float* stats = (float*)realloc(softmax_stats, sizeof(float) * 3 * batch);
+        if (stats == NULL) {
+            raise_error(NullPointer, "realloc failed to allocate softmax statistics");
         }
+        softmax_stats = stats;
+        softmax_stats_capacity = 3 * batch;
     }
+    return softmax_stats;
+}
+
+// Columns are independent, so large batches split them across the thread
+// pool; each costs about one exp per class.
+#define SOFTMAX_COST_PER_CLASS 16
+
+typedef struct {
+    const float* logits;
+    float* grad;
+    const uint32_t* labels;
+    uint64_t classes;
+    uint64_t batch;
+    float* max;
+    float* sum;
+    float scale;
+} softmax_columns_t;
+
+static uint64_t softmax_grain(uint64_t classes) {
+    return parallel_grain(SOFTMAX_COST_PER_CLASS * classes);
+}
 
-    float sum = 0.0f;
-    for (uint64_t i = 0; i < in->meta.capacity; i++) {
-        out->data[i] = expf(in->data[i] - max_val);
-        sum += out->data[i];
+static void online_softmax_range(void* ctx, uint64_t begin, uint64_t end) {
+    softmax_columns_t* p = (softmax_columns_t*)ctx;
+    const elementwise_kernels_t* k = get_kernels();
+    uint64_t n = end - begin;
+    memcpy(p->max + begin, p->logits + begin, sizeof(float) * n);
+    k->fill(p->sum + begin, 1.0f, n);
+    for (uint64_t i = 1; i < p->classes; i++) {
+        k->softmax_update(p->max + begin, p->sum + begin, p->logits + i * p->batch + begin, n);
     }
+}
+
+// One pass down the rows of dense [classes, batch] logits gives every
+// column's maximum and sum of exp(x - max).
+static void online_softmax(const float* logits, uint64_t classes, uint64_t batch, float* max,
+                           float* sum) {
+    softmax_columns_t p = {
+        .logits = logits, .classes = classes, .batch = batch, .max = max, .sum = sum};
+    parallel_for(0, batch, softmax_grain(classes), online_softmax_range, &p);
+}
 
-    for (uint64_t i = 0; i < in->meta.capacity; i++) {
-        out->data[i] /= sum;
+// Softmax of each column of `in` into a dense [classes, batch] `out`.
+static void softmax_into(float* out, tensor_f32_t* in) {
+    uint64_t classes, batch;
+    crossentropy_dims(in, &classes, &batch);
+
+    if (tensor_is_contiguous(in) == CBOOL_TRUE) {
+        float* max = reserve_softmax_stats(batch);
+        float* sum = max + batch;
+        online_softmax(in->data, classes, batch, max, sum);
+        for (uint64_t c = 0; c < batch; c++) {
+            sum[c] = 1.0f / sum[c];
+        }
+        for (uint64_t i = 0; i < classes; i++) {
+            get_kernels()->softmax_scale(out + i * batch, in->data + i * batch, max, sum, batch);
+        }
+        return;
+    }
+
+    // Strided views: gather x - max densely, exponentiate it all at once.
+    for (uint64_t c = 0; c < batch; c++) {
+        float max_val = in->data[crossentropy_at(in, 0, c, batch)];
+        for (uint64_t i = 1; i < classes; i++) {
+            if (in->data[crossentropy_at(in, i, c, batch)] > max_val) {
+                max_val = in->data[crossentropy_at(in, i, c, batch)];
+            }
+        }
+        for (uint64_t i = 0; i < classes; i++) {
+            out[i * batch + c] = in->data[crossentropy_at(in, i, c, batch)] - max_val;
+        }
+    }
+    get_kernels()->exp(out, out, classes * batch);
+
+    for (uint64_t c = 0; c < batch; c++) {
+        float sum = 0.0f;
+        for (uint64_t i = 0; i < classes; i++) {
+            sum += out[i * batch + c];
+        }
+        for (uint64_t i = 0; i < classes; i++) {
+            out[i * batch + c] /= sum;
+        }
     }
 }
 
+// Softmax over the class axis of each column independently.
+void softmax(tensor_f32_t* out, tensor_f32_t* in) { softmax_into(out->data, in); }
 
 void crossentropy_backward(tensor_f32_t *self) {
     tensor_f32_t *logits = self->prev[0];
     tensor_f32_t *labels = self->prev[1];
-    
+
     if (logits->meta.require_grad == CBOOL_TRUE) {
+        uint64_t classes, batch;
+        crossentropy_dims(logits, &classes, &batch);
+
         tensor_f32_t* softmax_out = new_tensor_f32(logits->meta.shape, logits->meta.shape_length, CBOOL_FALSE);
         softmax(softmax_out, logits);
 
-        for (uint64_t i = 0; i < logits->meta.capacity; i++) {
-            logits->grad[i] += self->grad[0] * (softmax_out->data[i] - labels->data[i]);
+        // The loss is the batch mean, so each column contributes 1/batch.
+        float scale = self->grad[0] / (float)batch;
+        cbool_t accumulate = tensor_grad_prepare(logits);
+        for (uint64_t i = 0; i < classes; i++) {
+            for (uint64_t c = 0; c < batch; c++) {
+                float g = scale * (softmax_out->data[i * batch + c] -
+                                   labels->data[crossentropy_at(labels, i, c, batch)]);
+                float* dst = &logits->grad[crossentropy_at(logits, i, c, batch)];
+                *dst = accumulate == CBOOL_TRUE ? *dst + g : g;
+            }
         }
 
         free_tensor_f32(softmax_out);
@@ -38,22 +162,159 @@ void crossentropy_backward(tensor_f32_t *self) {
 }
 
 void crossentropy_forward(tensor_f32_t* ret, tensor_f32_t* logits, tensor_f32_t* labels) {
+    if (logits->meta.capacity != labels->meta.capacity) {
+        raise_error(ValueError, "tensor shapes are not compatible for crossentropy");
+    }
+    if (labels->meta.dtype != DTYPE_F32) {
+        raise_error(ValueError, "crossentropy labels must be f32");
+    }
+    // Reduced-precision logits are widened through a cast node, which also
+    // makes them contiguous.
+    tensor_f32_t* input = logits;
+    if (logits->meta.dtype != DTYPE_F32 ||
+        (logits->meta.shape_length != 2 && tensor_is_contiguous(logits) != CBOOL_TRUE)) {
+        logits = tensor_f32_cast(logits, DTYPE_F32);
+    }
+    if (labels->meta.shape_length != 2 && tensor_is_contiguous(labels) != CBOOL_TRUE) {
+        raise_error(ValueError, "crossentropy labels must be 2D or contiguous");
+    }
+    uint64_t classes, batch;
+    crossentropy_dims(logits, &classes, &batch);
+
+    uint64_t start = profile_begin();
     tensor_f32_t* softmax_out = new_tensor_f32(logits->meta.shape, logits->meta.shape_length, CBOOL_FALSE);
     softmax(softmax_out, logits);
+    const elementwise_kernels_t* k = get_kernels();
+    k->add_scalar(softmax_out->data, softmax_out->data, 1e-9f, classes * batch);
+    k->log(softmax_out->data, softmax_out->data, classes * batch);
 
     float loss = 0.0f;
-    for (uint64_t i = 0; i < logits->meta.capacity; i++) {
-        loss -= labels->data[i] * logf(softmax_out->data[i] + 1e-9);
+    for (uint64_t i = 0; i < classes; i++) {
+        for (uint64_t c = 0; c < batch; c++) {
+            loss -= labels->data[crossentropy_at(labels, i, c, batch)] * softmax_out->data[i * batch + c];
+        }
     }
-    ret->data[0] = loss;
+    ret->data[0] = loss / (float)batch;
+    profile_record(OP_CROSSENTROPY, PROFILE_FORWARD, start, classes, batch, 0, sizeof(float));
 
-    if (logits->meta.require_grad == CBOOL_TRUE) {
-        ret->backward_fn = crossentropy_backward;
-        ret->num_prev = 2;
-        ret->prev = (tensor_f32_t**)malloc(sizeof(tensor_f32_t*) * 2);
-        ret->prev[0] = logits;
-        ret->prev[1] = labels;
+    if (tensor_grad_enabled() == CBOOL_TRUE && logits->meta.require_grad == CBOOL_TRUE) {
+        tensor_f32_set_backward(ret, OP_CROSSENTROPY, crossentropy_backward,
+                                (tensor_f32_t*[]){logits, labels}, 2);
     }
-    
+    // The graph holds its own reference to the widened logits.
+    if (logits != input) {
+        free_tensor_f32(logits);
+    }
+
     free_tensor_f32(softmax_out);
 }
+
+// Batch mean of -log(p(label) + 1e-9), the same bound crossentropy_forward
+// puts on each column. `scratch` holds `batch` floats.
+static float softmax_nll(const float* logits, const uint32_t* labels, uint64_t classes,
+                         uint64_t batch, const float* max, const float* sum, float* scratch) {
+    const elementwise_kernels_t* k = get_kernels();
+    for (uint64_t c = 0; c < batch; c++) {
+        if (labels[c] >= classes) {
+            raise_error(ValueError, "crossentropy label exceeds the number of classes");
+        }
+        scratch[c] = logits[labels[c] * batch + c] - max[c];
+    }
+    k->exp(scratch, scratch, batch);
+    for (uint64_t c = 0; c < batch; c++) {
+        scratch[c] = scratch[c] / sum[c] + 1e-9f;
+    }
+    k->log(scratch, scratch, batch);
+    return -k->sum(scratch, batch) / (float)batch;
+}
+
+static void softmax_grad_range(void* ctx, uint64_t begin, uint64_t end) {
+    softmax_columns_t* p = (softmax_columns_t*)ctx;
+    const elementwise_kernels_t* k = get_kernels();
+    uint64_t batch = p->batch;
+    for (uint64_t c = begin; c < end; c++) {
+        p->sum[c] = p->scale / p->sum[c];
+    }
+    for (uint64_t i = 0; i < p->classes; i++) {
+        k->softmax_scale(p->grad + i * batch + begin, p->logits + i * batch + begin,
+                         p->max + begin, p->sum + begin, end - begin);
+    }
+    for (uint64_t c = begin; c < end; c++) {
+        p->grad[p->labels[c] * batch + c] -= p->scale;
+    }
+}
+
+// grad = scale * (softmax - onehot(labels)); `sum` is used up.
+static void softmax_grad(float* grad, const float* logits, const uint32_t* labels,
+                         uint64_t classes, uint64_t batch, float* max, float* sum,
+                         float scale) {
+    softmax_columns_t p = {logits, grad, labels, classes, batch, max, sum, scale};
+    parallel_for(0, batch, softmax_grain(classes), softmax_grad_range, &p);
+}
+
+// prev = {logits, d(loss)/d(logits) from the forward pass}.
+void softmax_crossentropy_backward(tensor_f32_t* self) {
+    tensor_f32_t* logits = self->prev[0];
+    tensor_f32_t* cached = self->prev[1];
+    if (logits->meta.require_grad == CBOOL_TRUE) {
+        cbool_t accumulate = tensor_grad_prepare(logits);
+        get_kernels()->scale_grad(logits->grad, cached->data, self->grad[0],
+                                  logits->meta.capacity, accumulate);
+    }
+}
+
+tensor_f32_t* softmax_crossentropy(tensor_f32_t* logits, const uint32_t* labels) {
+    // Reduced-precision or strided logits are made float and contiguous
+    // through a cast node.
+    tensor_f32_t* input = logits;
+    if (logits->meta.dtype != DTYPE_F32 || tensor_is_contiguous(logits) != CBOOL_TRUE) {
+        logits = tensor_f32_cast(logits, DTYPE_F32);
+    }
+    uint64_t classes, batch;
+    crossentropy_dims(logits, &classes, &batch);
+    uint64_t start = profile_begin();
+    float* max = reserve_softmax_stats(batch);
+    float* sum = max + batch;
+    online_softmax(logits->data, classes, batch, max, sum);
+
+    cbool_t require_grad = tensor_grad_enabled() == CBOOL_TRUE &&
+                           logits->meta.require_grad == CBOOL_TRUE;
+    tensor_f32_t* ret = new_tensor_f32((uint64_t[]){1}, 1, require_grad);
+    ret->data[0] = softmax_nll(logits->data, labels, classes, batch, max, sum, sum + batch);
+
+    if (require_grad) {
+        // The probabilities are turned into the gradient right away, so
+        // backward only scales them and the labels need not outlive this
+        // call.
+        tensor_f32_t* cached =
+            new_tensor_f32(logits->meta.shape, logits->meta.shape_length, CBOOL_FALSE);
+        softmax_grad(cached->data, logits->data, labels, classes, batch, max, sum,
+                     1.0f / (float)batch);
+        tensor_f32_set_backward(ret, OP_SOFTMAX_CROSSENTROPY, softmax_crossentropy_backward,
+                                (tensor_f32_t*[]){logits, cached}, 2);
+        free_tensor_f32(cached);
+    }
+    profile_record(OP_SOFTMAX_CROSSENTROPY, PROFILE_FORWARD, start, classes, batch, 0,
+                   sizeof(float));
+    if (logits != input) {
+        free_tensor_f32(logits);
+    }
+    return ret;
+}
+
+float crossentropy_loss_grad(tensor_f32_t* logits, const uint32_t* labels, float* grad) {
+    if (logits->meta.dtype != DTYPE_F32 || tensor_is_contiguous(logits) != CBOOL_TRUE) {
+        raise_error(ValueError, "crossentropy_loss_grad needs contiguous float logits");
+    }
+    uint64_t classes, batch;
+    crossentropy_dims(logits, &classes, &batch);
+    uint64_t start = profile_begin();
+    float* max = reserve_softmax_stats(batch);
+    float* sum = max + batch;
+    online_softmax(logits->data, classes, batch, max, sum);
+    float loss = softmax_nll(logits->data, labels, classes, batch, max, sum, sum + batch);
+    softmax_grad(grad, logits->data, labels, classes, batch, max, sum, 1.0f / (float)batch);
+    profile_record(OP_SOFTMAX_CROSSENTROPY, PROFILE_FORWARD, start, classes, batch, 0,
+                   sizeof(float));
+    return loss;
+}
@@ -0,0 +1,211 @@
+#include "much/data_parallel.h"
+#include "much/crossentropy.h"
+#include "much/parallel.h"
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#define DP_ARENA_SIZE (4 << 20)
+
+static void add_grads(linear_layer_t** dst, linear_layer_t** src, uint64_t num_layers) {
+    for (uint64_t l = 0; l < num_layers; l++) {
+        tensor_f32_accumulate_grad(dst[l]->weight, src[l]->weight);
+        tensor_f32_accumulate_grad(dst[l]->bias, src[l]->bias);
+    }
+}
+
+static void run_worker(data_parallel_t* dp, uint64_t id, uint64_t step) {
+    dp_worker_t* worker = &dp->workers[id];
+    uint64_t batch = dp->images->meta.shape[1];
+    uint64_t begin = batch * id / dp->num_workers;
+    uint64_t end = batch * (id + 1) / dp->num_workers;
+
+    // The backward pass below overwrites stale gradients; a worker with an
+    // empty shard leaves them stale and the reduction skips it.
+    for (uint64_t l = 0; l < dp->num_layers; l++) {
+        tensor_zero_grad(worker->layers[l]->weight);
+        tensor_zero_grad(worker->layers[l]->bias);
+    }
+
+    worker->loss = 0.0f;
+    if (end > begin) {
+        arena_t* prev = tensor_set_arena(worker->arena);
+        // Each shard is a column view of the batch; nothing is copied.
+        tensor_f32_t* x = tensor_f32_narrow(dp->images, 1, begin, end - begin);
+        for (uint64_t l = 0; l < dp->num_layers; l++) {
+            activation_t activation = l + 1 < dp->num_layers ? dp->hidden_activation : ACTIVATION_NONE;
+            x = linear_layer_forward_act(worker->layers[l], x, activation);
+        }
+        tensor_f32_t* loss = softmax_crossentropy(x, dp->labels + begin);
+
+        // Weight the shard's mean loss by its share of the batch so the
+        // summed gradients are those of the batch mean.
+        tensor_f32_t* weight = new_tensor_f32((uint64_t[]){1}, 1, CBOOL_FALSE);
+        weight->data[0] = (float)(end - begin) / (float)batch;
+        tensor_f32_t* weighted = tensor_f32_mul(loss, weight);
+        backward(weighted);
+
+        worker->loss = loss->data[0] * (float)(end - begin);
+        tensor_set_arena(prev);
+        arena_reset(worker->arena);
+    }
+
+    // Tree reduction: at distance s, worker id (a multiple of 2s) folds in
+    // the subtree rooted at id + s once that worker has published it.
+    for (uint64_t s = 1; s < dp->num_workers; s *= 2) {
+        if (id % (2 * s) != 0) {
+            break;
+        }
+        uint64_t partner = id + s;
+        if (partner >= dp->num_workers) {
+            continue;
+        }
+        while (atomic_load_explicit(&dp->workers[partner].reduced_step, memory_order_acquire) != step) {
+            sched_yield();
+        }
+        add_grads(worker->layers, dp->workers[partner].layers, dp->num_layers);
+        worker->loss += dp->workers[partner].loss;
+    }
+    atomic_store_explicit(&worker->reduced_step, step, memory_order_release);
+}
+
+typedef struct {
+    data_parallel_t* dp;
+    uint64_t id;
+} dp_thread_arg_t;
+
+static void* worker_main(void* arg) {
+    dp_thread_arg_t* thread_arg = (dp_thread_arg_t*)arg;
+    data_parallel_t* dp = thread_arg->dp;
+    uint64_t id = thread_arg->id;
+    free(thread_arg);
+    // Replicas already fill the cores; ops inside them stay single-threaded.
+    parallel_mark_worker();
+
+    uint64_t seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&dp->lock);
+        while (dp->step == seen && dp->stop != CBOOL_TRUE) {
+            pthread_cond_wait(&dp->start, &dp->lock);
+        }
+        cbool_t stop = dp->stop;
+        seen = dp->step;
+        pthread_mutex_unlock(&dp->lock);
+        if (stop == CBOOL_TRUE) {
+            release_thread_scratch();
+            return NULL;
+        }
+        run_worker(dp, id, seen);
+    }
+}
+
+data_parallel_t* new_data_parallel(linear_layer_t** layers, uint64_t num_layers,
+                                   activation_t hidden_activation, uint64_t num_workers) {
+    if (num_layers == 0 || num_workers == 0) {
+        raise_error(ValueError, "data parallel trainer needs layers and workers");
+    }
+    data_parallel_t* dp = (data_parallel_t*)malloc(sizeof(data_parallel_t));
+    if (dp == NULL) {
+        raise_error(NullPointer, "malloc failed to allocate data_parallel_t");
+    }
+    dp->layers = layers;
+    dp->num_layers = num_layers;
+    dp->hidden_activation = hidden_activation;
+    dp->num_workers = num_workers;
+    dp->step = 0;
+    dp->stop = CBOOL_FALSE;
+    dp->images = NULL;
+    dp->labels = NULL;
+    pthread_mutex_init(&dp->lock, NULL);
+    pthread_cond_init(&dp->start, NULL);
+
+    dp->workers = (dp_worker_t*)calloc(num_workers, sizeof(dp_worker_t));
+    dp->threads = (pthread_t*)calloc(num_workers, sizeof(pthread_t));
+    if (dp->workers == NULL || dp->threads == NULL) {
+        raise_error(NullPointer, "malloc failed to allocate data parallel workers");
+    }
+
+    for (uint64_t i = 0; i < num_workers; i++) {
+        dp_worker_t* worker = &dp->workers[i];
+        worker->arena = new_arena(DP_ARENA_SIZE);
+        atomic_init(&worker->reduced_step, 0);
+        if (i == 0) {
+            worker->layers = layers;
+            continue;
+        }
+        worker->layers = (linear_layer_t**)malloc(sizeof(linear_layer_t*) * num_layers);
+        if (worker->layers == NULL) {
+            raise_error(NullPointer, "malloc failed to allocate worker layers");
+        }
+        for (uint64_t l = 0; l < num_layers; l++) {
+            linear_layer_t* replica = (linear_layer_t*)malloc(sizeof(linear_layer_t));
+            if (replica == NULL) {
+                raise_error(NullPointer, "malloc failed to allocate layer replica");
+            }
+            replica->weight = tensor_f32_share(layers[l]->weight, CBOOL_TRUE);
+            replica->bias = tensor_f32_share(layers[l]->bias, CBOOL_TRUE);
+            worker->layers[l] = replica;
+        }
+    }
+
+    for (uint64_t i = 1; i < num_workers; i++) {
+        dp_thread_arg_t* arg = (dp_thread_arg_t*)malloc(sizeof(dp_thread_arg_t));
+        if (arg == NULL) {
+            raise_error(NullPointer, "malloc failed to allocate worker argument");
+        }
+        arg->dp = dp;
+        arg->id = i;
+        if (pthread_create(&dp->threads[i], NULL, worker_main, arg) != 0) {
+            raise_error(RuntimeError, "failed to start data parallel worker");
+        }
+    }
+    return dp;
+}
+
+void free_data_parallel(data_parallel_t* dp) {
+    if (dp == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&dp->lock);
+    dp->stop = CBOOL_TRUE;
+    pthread_cond_broadcast(&dp->start);
+    pthread_mutex_unlock(&dp->lock);
+    for (uint64_t i = 1; i < dp->num_workers; i++) {
+        pthread_join(dp->threads[i], NULL);
+    }
+
+    for (uint64_t i = 0; i < dp->num_workers; i++) {
+        dp_worker_t* worker = &dp->workers[i];
+        free_arena(worker->arena);
+        if (i == 0) {
+            continue;
+        }
+        for (uint64_t l = 0; l < dp->num_layers; l++) {
+            free_linear_layer(worker->layers[l]);
+        }
+        free(worker->layers);
+    }
+    pthread_mutex_destroy(&dp->lock);
+    pthread_cond_destroy(&dp->start);
+    free(dp->workers);
+    free(dp->threads);
+    free(dp);
+}
+
+float data_parallel_step(data_parallel_t* dp, tensor_f32_t* images, const uint32_t* labels) {
+    if (images->meta.shape_length != 2) {
+        raise_error(ValueError, "images must be [features, batch]");
+    }
+
+    pthread_mutex_lock(&dp->lock);
+    dp->images = images;
+    dp->labels = labels;
+    uint64_t step = ++dp->step;
+    pthread_cond_broadcast(&dp->start);
+    pthread_mutex_unlock(&dp->lock);
+
+    // Worker 0 returns only after every other worker's gradients have been
+    // folded into the master layers.
+    run_worker(dp, 0, step);
+    return dp->workers[0].loss / (float)images->meta.shape[1];
+}
@@ -0,0 +1,189 @@
+#include "much/dataloader.h"
+#include "much/random.h"
+#include <stdlib.h>
+#include <time.h>
+
+#define DEFAULT_PREFETCH 4
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Fisher-Yates over the identity, drawn from the data stream of `epoch` so
+// every epoch's order can be reproduced independently.
+static void shuffle_order(dataloader_t* loader, uint64_t epoch) {
+    uint64_t n = loader->dataset->num_items;
+    for (uint64_t i = 0; i < n; i++) {
+        loader->order[i] = i;
+    }
+    if (loader->shuffle != CBOOL_TRUE) {
+        return;
+    }
+    rng_t rng = rng_init(loader->seed, RNG_DATA_STREAMS | epoch);
+    for (uint64_t i = n; i > 1; i--) {
+        uint64_t j = rng_below(&rng, i);
+        uint64_t tmp = loader->order[i - 1];
+        loader->order[i - 1] = loader->order[j];
+        loader->order[j] = tmp;
+    }
+}
+
+// Waits for the next slot in ring order to be free; returns NULL on stop.
+static mnist_batch_t* acquire_slot(dataloader_t* loader) {
+    pthread_mutex_lock(&loader->lock);
+    mnist_batch_t* slot = &loader->slots[loader->produced % loader->num_slots];
+    while (loader->stop != CBOOL_TRUE && loader->produced - loader->released >= loader->num_slots) {
+        pthread_cond_wait(&loader->changed, &loader->lock);
+    }
+    cbool_t stop = loader->stop;
+    pthread_mutex_unlock(&loader->lock);
+    return stop == CBOOL_TRUE ? NULL : slot;
+}
+
+static void publish_slot(dataloader_t* loader, mnist_batch_t* slot) {
+    pthread_mutex_lock(&loader->lock);
+    slot->ready = CBOOL_TRUE;
+    loader->produced++;
+    pthread_cond_broadcast(&loader->changed);
+    pthread_mutex_unlock(&loader->lock);
+}
+
+static void* producer_main(void* arg) {
+    dataloader_t* loader = (dataloader_t*)arg;
+    uint64_t n = loader->dataset->num_items;
+    uint64_t image_size = loader->dataset->image_size;
+
+    for (uint64_t epoch = loader->first_epoch;; epoch++) {
+        shuffle_order(loader, epoch);
+        for (uint64_t start = 0; start < n; start += loader->batch_size) {
+            mnist_batch_t* slot = acquire_slot(loader);
+            if (slot == NULL) {
+                return NULL;
+            }
+            uint64_t count = n - start < loader->batch_size ? n - start : loader->batch_size;
+            // The slot tensors are sized for a full batch; a short final
+            // batch just uses a prefix of them.
+            slot->images->meta.shape[1] = count;
+            slot->images->meta.strides[0] = count;
+            slot->images->meta.capacity = image_size * count;
+            mnist_gather_indices(loader->dataset, loader->order + start, count, slot->images,
+                                 slot->labels);
+            slot->count = count;
+            slot->epoch = epoch;
+            slot->end_of_epoch = CBOOL_FALSE;
+            publish_slot(loader, slot);
+        }
+
+        mnist_batch_t* slot = acquire_slot(loader);
+        if (slot == NULL) {
+            return NULL;
+        }
+        slot->count = 0;
+        slot->epoch = epoch;
+        slot->end_of_epoch = CBOOL_TRUE;
+        publish_slot(loader, slot);
+    }
+}
+
+dataloader_t* new_dataloader(mnist_dataset_t* dataset, uint64_t batch_size, uint64_t prefetch,
+                             cbool_t shuffle, uint64_t seed, uint64_t first_epoch) {
+    if (batch_size == 0) {
+        raise_error(ValueError, "batch size must be positive");
+    }
+    dataloader_t* loader = (dataloader_t*)malloc(sizeof(dataloader_t));
+    if (loader == NULL) {
+        raise_error(NullPointer, "malloc failed to allocate dataloader_t");
+    }
+    loader->dataset = dataset;
+    loader->batch_size = batch_size;
+    loader->shuffle = shuffle;
+    loader->seed = seed;
+    loader->first_epoch = first_epoch;
+    // One slot is held by the trainer, the rest are in flight.
+    loader->num_slots = (prefetch > 0 ? prefetch : DEFAULT_PREFETCH) + 1;
+    loader->produced = 0;
+    loader->consumed = 0;
+    loader->released = 0;
+    loader->stop = CBOOL_FALSE;
+    loader->stall_seconds = 0.0;
+    loader->stalls = 0;
+
+    loader->order = (uint64_t*)malloc(sizeof(uint64_t) * (dataset->num_items > 0 ? dataset->num_items : 1));
+    loader->slots = (mnist_batch_t*)calloc(loader->num_slots, sizeof(mnist_batch_t));
+    if (loader->order == NULL || loader->slots == NULL) {
+        raise_error(NullPointer, "malloc failed to allocate dataloader buffers");
+    }
+
+    // Slot tensors outlive any step, so keep them off the caller's arena.
+    arena_t* arena = tensor_set_arena(NULL);
+    for (uint64_t i = 0; i < loader->num_slots; i++) {
+        loader->slots[i].images =
+            new_tensor_f32((uint64_t[]){dataset->image_size, batch_size}, 2, CBOOL_FALSE);
+        loader->slots[i].labels = (uint32_t*)malloc(sizeof(uint32_t) * batch_size);
+        if (loader->slots[i].labels == NULL) {
+            raise_error(NullPointer, "malloc failed to allocate batch labels");
+        }
+    }
+    tensor_set_arena(arena);
+
+    pthread_mutex_init(&loader->lock, NULL);
+    pthread_cond_init(&loader->changed, NULL);
+    if (pthread_create(&loader->thread, NULL, producer_main, loader) != 0) {
+        raise_error(RuntimeError, "failed to start data loader thread");
+    }
+    return loader;
+}
+
+void free_dataloader(dataloader_t* loader) {
+    if (loader == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&loader->lock);
+    loader->stop = CBOOL_TRUE;
+    pthread_cond_broadcast(&loader->changed);
+    pthread_mutex_unlock(&loader->lock);
+    pthread_join(loader->thread, NULL);
+
+    for (uint64_t i = 0; i < loader->num_slots; i++) {
+        free_tensor_f32(loader->slots[i].images);
+        free(loader->slots[i].labels);
+    }
+    pthread_mutex_destroy(&loader->lock);
+    pthread_cond_destroy(&loader->changed);
+    free(loader->slots);
+    free(loader->order);
+    free(loader);
+}
+
+mnist_batch_t* dataloader_next(dataloader_t* loader) {
+    pthread_mutex_lock(&loader->lock);
+    if (loader->released < loader->consumed) {
+        // Hand the previous batch back to the producer.
+        loader->slots[loader->released % loader->num_slots].ready = CBOOL_FALSE;
+        loader->released++;
+        pthread_cond_broadcast(&loader->changed);
+    }
+
+    mnist_batch_t* slot = &loader->slots[loader->consumed % loader->num_slots];
+    if (slot->ready != CBOOL_TRUE) {
+        double start = now_seconds();
+        while (slot->ready != CBOOL_TRUE) {
+            pthread_cond_wait(&loader->changed, &loader->lock);
+        }
+        loader->stall_seconds += now_seconds() - start;
+        loader->stalls++;
+    }
+    loader->consumed++;
+    pthread_mutex_unlock(&loader->lock);
+
+    return slot->end_of_epoch == CBOOL_TRUE ? NULL : slot;
+}
+
+double dataloader_stall_seconds(dataloader_t* loader) {
+    pthread_mutex_lock(&loader->lock);
+    double ret = loader->stall_seconds;
+    pthread_mutex_unlock(&loader->lock);
+    return ret;
+}
@@ -0,0 +1,96 @@
+#include "much/idx.h"
+#include "much/util.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint64_t idx_dtype_size(uint8_t dtype) {
+    switch (dtype) {
+    case IDX_U8:
+    case IDX_I8:
+        return 1;
+    case IDX_I16:
+        return 2;
+    case IDX_I32:
+    case IDX_F32:
+        return 4;
+    case IDX_F64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+static uint64_t read_be32(const uint8_t* p) {
+    return ((uint64_t)p[0] << 24) | ((uint64_t)p[1] << 16) | ((uint64_t)p[2] << 8) | (uint64_t)p[3];
+}
+
+idx_file_t* idx_open(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        raise_error(RuntimeError, "Could not open IDX file");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 4) {
+        raise_error(RuntimeError, "Could not read IDX file size");
+    }
+    void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        raise_error(RuntimeError, "Could not mmap IDX file");
+    }
+
+    const uint8_t* header = (const uint8_t*)map;
+    uint64_t size = (uint64_t)st.st_size;
+    uint64_t elem_size = idx_dtype_size(header[2]);
+    uint64_t num_dims = header[3];
+    if (header[0] != 0 || header[1] != 0 || elem_size == 0) {
+        raise_error(RuntimeError, "Invalid magic number in IDX file");
+    }
+    if (num_dims == 0 || num_dims > IDX_MAX_DIMS || size < 4 + 4 * num_dims) {
+        raise_error(RuntimeError, "Invalid dimensions in IDX file");
+    }
+
+    idx_file_t* file = (idx_file_t*)malloc(sizeof(idx_file_t));
+    if (file == NULL) {
+        raise_error(NullPointer, "malloc failed to allocate idx_file_t");
+    }
+    file->map = map;
+    file->map_size = size;
+    file->dtype = (idx_dtype_t)header[2];
+    file->num_dims = num_dims;
+    file->item_size = elem_size;
+    for (uint64_t i = 0; i < num_dims; i++) {
+        file->dims[i] = read_be32(header + 4 + 4 * i);
+        if (i > 0) {
+            // A wrapped product could pass the size check below.
+            if (file->dims[i] != 0 && file->item_size > UINT64_MAX / file->dims[i]) {
+                raise_error(RuntimeError, "IDX item size overflows");
+            }
+            file->item_size *= file->dims[i];
+        }
+    }
+    file->data = header + 4 + 4 * num_dims;
+
+    uint64_t payload = size - (4 + 4 * num_dims);
+    if (file->dims[0] > 0 && payload / file->dims[0] < file->item_size) {
+        raise_error(RuntimeError, "IDX file is truncated");
+    }
+    return file;
+}
+
+void idx_close(idx_file_t* file) {
+    if (file != NULL) {
+        munmap(file->map, (size_t)file->map_size);
+        free(file);
+    }
+}
+
+const void* idx_item(idx_file_t* file, uint64_t index) {
+    if (index >= file->dims[0]) {
+        raise_error(ValueError, "IDX item index out of range");
+    }
+    return file->data + index * file->item_size;
+}
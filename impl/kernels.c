@@ -0,0 +1,127 @@
+#include "kernels_internal.h"
+#include <math.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+void scalar_bf16_to_f32(float *out, const uint16_t *in, uint64_t n) {
+  for (uint64_t i = 0; i < n; i++) {
+    out[i] = bf16_to_float(in[i]);
+  }
+}
+
+void scalar_f32_to_bf16(uint16_t *out, const float *in, uint64_t n) {
+  for (uint64_t i = 0; i < n; i++) {
+    out[i] = float_to_bf16(in[i]);
+  }
+}
+
+void scalar_f16_to_f32(float *out, const uint16_t *in, uint64_t n) {
+  for (uint64_t i = 0; i < n; i++) {
+    out[i] = f16_to_float(in[i]);
+  }
+}
+
+void scalar_f32_to_f16(uint16_t *out, const float *in, uint64_t n) {
+  for (uint64_t i = 0; i < n; i++) {
+    out[i] = float_to_f16(in[i]);
+  }
+}
+
+// The portable fallback is the same template with one-lane "vectors".
+#define VEC float
+#define VEC_WIDTH 1
+#define VLOAD(p) (*(p))
+#define VSTORE(p, v) (*(p) = (v))
+#define VSET1(x) (x)
+#define VZERO() 0.0f
+#define VADD(a, b) ((a) + (b))
+#define VSUB(a, b) ((a) - (b))
+#define VMUL(a, b) ((a) * (b))
+#define VDIV(a, b) ((a) / (b))
+#define VSQRT(v) sqrtf(v)
+#define VMAX(a, b) fmaxf(a, b)
+#define VMIN(a, b) fminf(a, b)
+#define VROUND(v) nearbyintf(v)
+#define VPOW2I(n) pow2i_float(n)
+#define VEXPONENT(v) float_exponent(v)
+#define VMANTISSA(v) float_mantissa(v)
+#define VSELECT_GT0(x, a, b) ((x) > 0 ? (a) : (b))
+#define VANY_EQ0(v) ((v) == 0.0f)
+#define VHSUM(v) (v)
+#define VLOAD_I32(p) ((float)*(p))
+#define VSTORE_I8(p, v) (*(p) = (int8_t)(v))
+
+#define KERNEL_PREFIX scalar
+#define KERNEL_LEVEL SIMD_SCALAR
+#define KERNEL_NAME "scalar"
+#include "kernels_template.h"
+
+simd_level_t detect_simd_level() {
+#ifdef MUCH_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return SIMD_AVX512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return SIMD_AVX2;
+  }
+  if (__builtin_cpu_supports("sse4.1")) {
+    return SIMD_SSE4;
+  }
+#endif
+  return SIMD_SCALAR;
+}
+
+const elementwise_kernels_t *get_kernels_for(simd_level_t level) {
+  if (level > detect_simd_level()) {
+    return NULL;
+  }
+  switch (level) {
+  case SIMD_SCALAR:
+    return &scalar_kernels;
+#ifdef MUCH_X86_KERNELS
+  case SIMD_SSE4:
+    return &sse4_kernels;
+  case SIMD_AVX2:
+    return &avx2_kernels;
+  case SIMD_AVX512:
+    return &avx512_kernels;
+#endif
+  default:
+    return NULL;
+  }
+}
+
+static simd_level_t requested_simd_level() {
+  const char *env = getenv("MUCH_SIMD");
+  if (env == NULL) {
+    return SIMD_AVX512;
+  }
+  if (strcmp(env, "scalar") == 0) {
+    return SIMD_SCALAR;
+  }
+  if (strcmp(env, "sse4") == 0) {
+    return SIMD_SSE4;
+  }
+  if (strcmp(env, "avx2") == 0) {
+    return SIMD_AVX2;
+  }
+  return SIMD_AVX512;
+}
+
+static _Atomic(const elementwise_kernels_t *) active_kernels = NULL;
+
+const elementwise_kernels_t *get_kernels() {
+  const elementwise_kernels_t *ret = atomic_load(&active_kernels);
+  if (ret == NULL) {
+    simd_level_t level = detect_simd_level();
+    simd_level_t cap = requested_simd_level();
+    if (cap < level) {
+      level = cap;
+    }
+    ret = get_kernels_for(level);
+    atomic_store(&active_kernels, ret);
+  }
+  return ret;
+}
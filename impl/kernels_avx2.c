@@ -0,0 +1,84 @@
+#include <immintrin.h>
+#include <stdint.h>
+
+#define VEC __m256
+#define VEC_WIDTH 8
+#define VLOAD(p) _mm256_loadu_ps(p)
+#define VSTORE(p, v) _mm256_storeu_ps(p, v)
+#define VSET1(x) _mm256_set1_ps(x)
+#define VZERO() _mm256_setzero_ps()
+#define VADD(a, b) _mm256_add_ps(a, b)
+#define VSUB(a, b) _mm256_sub_ps(a, b)
+#define VMUL(a, b) _mm256_mul_ps(a, b)
+#define VDIV(a, b) _mm256_div_ps(a, b)
+#define VSQRT(v) _mm256_sqrt_ps(v)
+#define VMAX(a, b) _mm256_max_ps(a, b)
+#define VMIN(a, b) _mm256_min_ps(a, b)
+#define VROUND(v)                                                              \
+  _mm256_round_ps(v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+#define VPOW2I(n)                                                              \
+  _mm256_castsi256_ps(_mm256_slli_epi32(                                       \
+      _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23))
+#define VEXPONENT(v)                                                           \
+  _mm256_cvtepi32_ps(_mm256_sub_epi32(                                         \
+      _mm256_srli_epi32(_mm256_castps_si256(v), 23), _mm256_set1_epi32(127)))
+#define VMANTISSA(v)                                                           \
+  _mm256_castsi256_ps(_mm256_or_si256(                                         \
+      _mm256_and_si256(_mm256_castps_si256(v), _mm256_set1_epi32(0x007FFFFF)), \
+      _mm256_set1_epi32(0x3F800000)))
+#define VSELECT_GT0(x, a, b)                                                   \
+  _mm256_blendv_ps(b, a, _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GT_OQ))
+#define VANY_EQ0(v)                                                            \
+  _mm256_movemask_ps(_mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_EQ_OQ))
+#define VHSUM(v) avx2_hsum(v)
+#define VLOAD_I32(p)                                                           \
+  _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(p)))
+#define VSTORE_I8(p, v) avx2_store_i8(p, v)
+
+static inline float avx2_hsum(__m256 v) {
+  __m128 lo = _mm256_castps256_ps128(v);
+  __m128 hi = _mm256_extractf128_ps(v, 1);
+  lo = _mm_add_ps(lo, hi);
+  __m128 shuf = _mm_movehdup_ps(lo);
+  __m128 sums = _mm_add_ps(lo, shuf);
+  shuf = _mm_movehl_ps(shuf, sums);
+  return _mm_cvtss_f32(_mm_add_ss(sums, shuf));
+}
+
+static inline void avx2_store_i8(int8_t *p, __m256 v) {
+  __m256i q = _mm256_cvtps_epi32(v);
+  __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(q),
+                                  _mm256_extracti128_si256(q, 1));
+  _mm_storel_epi64((__m128i *)p, _mm_packs_epi16(words, words));
+}
+
+// bf16 is the top half of a float; rounding adds 0x7FFF plus the lowest
+// kept bit, and NaNs are kept quiet instead.
+static inline __m128i avx2_round_bf16(__m256 v) {
+  __m256i bits = _mm256_castps_si256(v);
+  __m256i lsb =
+      _mm256_and_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(1));
+  __m256i rounded = _mm256_add_epi32(
+      bits, _mm256_add_epi32(lsb, _mm256_set1_epi32(0x7FFF)));
+  __m256i nan = _mm256_cmpgt_epi32(
+      _mm256_and_si256(bits, _mm256_set1_epi32(0x7FFFFFFF)),
+      _mm256_set1_epi32(0x7F800000));
+  __m256i quiet = _mm256_or_si256(bits, _mm256_set1_epi32(0x400000));
+  __m256i top = _mm256_srli_epi32(_mm256_blendv_epi8(rounded, quiet, nan), 16);
+  return _mm_packus_epi32(_mm256_castsi256_si128(top),
+                          _mm256_extracti128_si256(top, 1));
+}
+
+#define VLOAD_BF16(p)                                                          \
+  _mm256_castsi256_ps(_mm256_slli_epi32(                                       \
+      _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(p))), 16))
+#define VSTORE_BF16(p, v) _mm_storeu_si128((__m128i *)(p), avx2_round_bf16(v))
+#define VLOAD_F16(p) _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(p)))
+#define VSTORE_F16(p, v)                                                       \
+  _mm_storeu_si128((__m128i *)(p),                                             \
+                   _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT))
+
+#define KERNEL_PREFIX avx2
+#define KERNEL_LEVEL SIMD_AVX2
+#define KERNEL_NAME "avx2"
+#include "kernels_template.h"
@@ -0,0 +1,62 @@
+#include <immintrin.h>
+
+#define VEC __m512
+#define VEC_WIDTH 16
+#define VLOAD(p) _mm512_loadu_ps(p)
+#define VSTORE(p, v) _mm512_storeu_ps(p, v)
+#define VSET1(x) _mm512_set1_ps(x)
+#define VZERO() _mm512_setzero_ps()
+#define VADD(a, b) _mm512_add_ps(a, b)
+#define VSUB(a, b) _mm512_sub_ps(a, b)
+#define VMUL(a, b) _mm512_mul_ps(a, b)
+#define VDIV(a, b) _mm512_div_ps(a, b)
+#define VSQRT(v) _mm512_sqrt_ps(v)
+#define VMAX(a, b) _mm512_max_ps(a, b)
+#define VMIN(a, b) _mm512_min_ps(a, b)
+#define VROUND(v)                                                              \
+  _mm512_roundscale_ps(v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+#define VPOW2I(n)                                                              \
+  _mm512_castsi512_ps(_mm512_slli_epi32(                                       \
+      _mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127)), 23))
+#define VEXPONENT(v) _mm512_getexp_ps(v)
+#define VMANTISSA(v) _mm512_getmant_ps(v, _MM_MANT_NORM_1_2, _MM_MANT_SIGN_zero)
+#define VSELECT_GT0(x, a, b)                                                   \
+  _mm512_mask_blend_ps(                                                        \
+      _mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_GT_OQ), b, a)
+#define VANY_EQ0(v) _mm512_cmp_ps_mask(v, _mm512_setzero_ps(), _CMP_EQ_OQ)
+#define VHSUM(v) _mm512_reduce_add_ps(v)
+#define VLOAD_I32(p) _mm512_cvtepi32_ps(_mm512_loadu_si512(p))
+#define VSTORE_I8(p, v)                                                        \
+  _mm_storeu_si128((__m128i *)(p), _mm512_cvtsepi32_epi8(_mm512_cvtps_epi32(v)))
+
+// bf16 is the top half of a float; rounding adds 0x7FFF plus the lowest
+// kept bit, and NaNs are kept quiet instead.
+static inline __m256i avx512_round_bf16(__m512 v) {
+  __m512i bits = _mm512_castps_si512(v);
+  __m512i lsb =
+      _mm512_and_si512(_mm512_srli_epi32(bits, 16), _mm512_set1_epi32(1));
+  __m512i rounded = _mm512_add_epi32(
+      bits, _mm512_add_epi32(lsb, _mm512_set1_epi32(0x7FFF)));
+  __mmask16 nan = _mm512_cmpgt_epi32_mask(
+      _mm512_and_si512(bits, _mm512_set1_epi32(0x7FFFFFFF)),
+      _mm512_set1_epi32(0x7F800000));
+  __m512i quiet = _mm512_or_si512(bits, _mm512_set1_epi32(0x400000));
+  __m512i top =
+      _mm512_srli_epi32(_mm512_mask_blend_epi32(nan, rounded, quiet), 16);
+  return _mm512_cvtepi32_epi16(top);
+}
+
+#define VLOAD_BF16(p)                                                          \
+  _mm512_castsi512_ps(_mm512_slli_epi32(                                       \
+      _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)(p))), 16))
+#define VSTORE_BF16(p, v)                                                      \
+  _mm256_storeu_si256((__m256i *)(p), avx512_round_bf16(v))
+#define VLOAD_F16(p) _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(p)))
+#define VSTORE_F16(p, v)                                                       \
+  _mm256_storeu_si256((__m256i *)(p),                                          \
+                      _mm512_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT))
+
+#define KERNEL_PREFIX avx512
+#define KERNEL_LEVEL SIMD_AVX512
+#define KERNEL_NAME "avx512"
+#include "kernels_template.h"
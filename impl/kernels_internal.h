@@ -0,0 +1,197 @@
+#pragma once
+#include "much/kernels.h"
+
+// Shared between impl/kernels*.c; not part of the public API.
+
+#include <math.h>
+#include <string.h>
+
+void scalar_bf16_to_f32(float *out, const uint16_t *in, uint64_t n);
+void scalar_f32_to_bf16(uint16_t *out, const float *in, uint64_t n);
+void scalar_f16_to_f32(float *out, const uint16_t *in, uint64_t n);
+void scalar_f32_to_f16(uint16_t *out, const float *in, uint64_t n);
+
+// expf for the vector kernels (Cephes): x = n ln2 + r with |r| <= ln2 / 2,
+// exp(r) = 1 + r + r^2 P(r) with P of degree 5 (EXP_P0 to EXP_P5), scaled
+// by 2^n built from exponent bits. Inputs are clamped so that 2^n stays a
+// normal float. Every SIMD level runs these steps per lane; poly_expf is
+// the scalar version.
+#define EXP_HI 88.02f
+#define EXP_LO -87.33f
+#define EXP_LOG2E 1.44269504088896341f
+#define EXP_C1 0.693359375f
+#define EXP_C2 -2.12194440e-4f
+#define EXP_P0 1.9875691500e-4f
+#define EXP_P1 1.3981999507e-3f
+#define EXP_P2 8.3334519073e-3f
+#define EXP_P3 4.1665795894e-2f
+#define EXP_P4 1.6666665459e-1f
+#define EXP_P5 5.0000001201e-1f
+// The fast tier keeps the reduction but stops at 1 + r + r^2 (F0 + F1 r),
+// fitted for relative error.
+#define EXP_F0 0.50484375f
+#define EXP_F1 0.16950570f
+
+// Far below 0, 1 + exp(-x) rounds away bits that the tiny result keeps,
+// and the error of exp adds to that. From here down sigmoid is computed as
+// e / (1 + e) = e (1 - e / (1 + e)) with e = exp(x), where the factor
+// rounds below 1 and so at twice the precision.
+#define SIGMOID_TAIL -4.0f
+
+// logf (Cephes): x = m 2^e with m in [sqrt(1/2), sqrt(2)), then
+// log(1 + f) = f - f^2 / 2 + f^3 P(f) for f = m - 1, and e ln2 added in
+// two parts like EXP_C1/EXP_C2.
+#define LOG_SQRT2 1.41421356237309505f
+#define LOG_P0 7.0376836292e-2f
+#define LOG_P1 -1.1514610310e-1f
+#define LOG_P2 1.1676998740e-1f
+#define LOG_P3 -1.2420140846e-1f
+#define LOG_P4 1.4249322787e-1f
+#define LOG_P5 -1.6668057665e-1f
+#define LOG_P6 2.0000714765e-1f
+#define LOG_P7 -2.4999993993e-1f
+#define LOG_P8 3.3333331174e-1f
+
+// tanhf (Cephes): an odd polynomial below |x| = 0.625, 1 - 2 / (exp(2x) + 1)
+// above it.
+#define TANH_SMALL 0.625f
+#define TANH_P0 -5.70498872745e-3f
+#define TANH_P1 2.06390887954e-2f
+#define TANH_P2 -5.37397155531e-2f
+#define TANH_P3 1.33314422036e-1f
+#define TANH_P4 -3.33332819422e-1f
+
+// sinf/cosf (Cephes): x = n pi/2 + r with |r| <= pi/4, pi/2 split in
+// three so that n pi/2 is exact for |n| < 2^16, then one polynomial for
+// each of sin(r) and cos(r); n mod 4 picks and signs them.
+#define TRIG_2_PI 0.636619772367581343f
+#define TRIG_PIO2_1 1.5703125f
+#define TRIG_PIO2_2 4.837512969970703125e-4f
+#define TRIG_PIO2_3 7.54978995489188216e-8f
+#define SIN_P0 -1.9515295891e-4f
+#define SIN_P1 8.3321608736e-3f
+#define SIN_P2 -1.6666654611e-1f
+#define COS_P0 2.443315711809948e-5f
+#define COS_P1 -1.388731625493765e-3f
+#define COS_P2 4.166664568298827e-2f
+
+// 2^n for an integral float n in [-126, 127].
+static inline float pow2i_float(float n) {
+  uint32_t bits = (uint32_t)((int32_t)n + 127) << 23;
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+// The unbiased exponent and the significand in [1, 2) of a positive
+// normal float.
+static inline float float_exponent(float f) {
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  return (float)((int32_t)(bits >> 23) - 127);
+}
+
+static inline float float_mantissa(float f) {
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  bits = (bits & 0x007FFFFFu) | 0x3F800000u;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+static inline float poly_expf(float x) {
+  x = fminf(fmaxf(x, EXP_LO), EXP_HI);
+  float n = nearbyintf(x * EXP_LOG2E);
+  float r = x - n * EXP_C1 - n * EXP_C2;
+  float y = EXP_P0;
+  y = y * r + EXP_P1;
+  y = y * r + EXP_P2;
+  y = y * r + EXP_P3;
+  y = y * r + EXP_P4;
+  y = y * r + EXP_P5;
+  y = y * r * r + r + 1.0f;
+  return y * pow2i_float(n);
+}
+
+static inline float bf16_to_float(uint16_t h) {
+  uint32_t bits = (uint32_t)h << 16;
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+static inline uint16_t float_to_bf16(float f) {
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  if ((bits & 0x7FFFFFFFu) > 0x7F800000u) {
+    return (uint16_t)((bits >> 16) | 0x40); // keep NaNs quiet
+  }
+  bits += 0x7FFFu + ((bits >> 16) & 1);
+  return (uint16_t)(bits >> 16);
+}
+
+static inline float f16_to_float(uint16_t h) {
+  uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  uint32_t exp = (h >> 10) & 0x1F;
+  uint32_t mant = h & 0x3FF;
+  uint32_t bits;
+  if (exp == 0) {
+    // Zero or subnormal: mant * 2^-24
+    float f = (float)mant * 5.9604644775390625e-8f;
+    return sign != 0 ? -f : f;
+  }
+  if (exp == 31) {
+    // Infinity, or a NaN quieted the way F16C does it
+    bits = sign | 0x7F800000u | (mant << 13) | (mant != 0 ? 0x400000u : 0);
+  } else {
+    bits = sign | ((exp + 112) << 23) | (mant << 13);
+  }
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+static inline uint16_t float_to_f16(float f) {
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+  int32_t exp = (int32_t)((bits >> 23) & 0xFF);
+  uint32_t mant = bits & 0x7FFFFF;
+  if (exp == 255) {
+    return sign | 0x7C00 | (mant != 0 ? 0x200 | (mant >> 13) : 0);
+  }
+  int32_t e = exp - 127 + 15;
+  if (e >= 31) {
+    return sign | 0x7C00;
+  }
+  uint32_t half;
+  uint32_t rem;
+  uint32_t halfway;
+  if (e <= 0) {
+    if (e < -10) {
+      return sign;
+    }
+    // Subnormal: shift the implicit bit into the mantissa.
+    mant |= 0x800000;
+    uint32_t shift = (uint32_t)(14 - e);
+    half = mant >> shift;
+    rem = mant & ((1u << shift) - 1);
+    halfway = 1u << (shift - 1);
+  } else {
+    half = ((uint32_t)e << 10) | (mant >> 13);
+    rem = mant & 0x1FFF;
+    halfway = 0x1000;
+  }
+  // A carry out of the mantissa correctly bumps the exponent.
+  if (rem > halfway || (rem == halfway && (half & 1) != 0)) {
+    half++;
+  }
+  return sign | (uint16_t)half;
+}
+
+extern const elementwise_kernels_t scalar_kernels;
+#ifdef MUCH_X86_KERNELS
+extern const elementwise_kernels_t sse4_kernels;
+extern const elementwise_kernels_t avx2_kernels;
+extern const elementwise_kernels_t avx512_kernels;
+#endif
@@ -0,0 +1,72 @@
+#include <smmintrin.h>
+#include <stdint.h>
+#include <string.h>
+
+#define VEC __m128
+#define VEC_WIDTH 4
+#define VLOAD(p) _mm_loadu_ps(p)
+#define VSTORE(p, v) _mm_storeu_ps(p, v)
+#define VSET1(x) _mm_set1_ps(x)
+#define VZERO() _mm_setzero_ps()
+#define VADD(a, b) _mm_add_ps(a, b)
+#define VSUB(a, b) _mm_sub_ps(a, b)
+#define VMUL(a, b) _mm_mul_ps(a, b)
+#define VDIV(a, b) _mm_div_ps(a, b)
+#define VSQRT(v) _mm_sqrt_ps(v)
+#define VMAX(a, b) _mm_max_ps(a, b)
+#define VMIN(a, b) _mm_min_ps(a, b)
+#define VROUND(v) _mm_round_ps(v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+#define VPOW2I(n)                                                              \
+  _mm_castsi128_ps(_mm_slli_epi32(                                             \
+      _mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23))
+#define VEXPONENT(v)                                                           \
+  _mm_cvtepi32_ps(_mm_sub_epi32(                                               \
+      _mm_srli_epi32(_mm_castps_si128(v), 23), _mm_set1_epi32(127)))
+#define VMANTISSA(v)                                                           \
+  _mm_castsi128_ps(_mm_or_si128(                                               \
+      _mm_and_si128(_mm_castps_si128(v), _mm_set1_epi32(0x007FFFFF)),          \
+      _mm_set1_epi32(0x3F800000)))
+#define VSELECT_GT0(x, a, b)                                                   \
+  _mm_blendv_ps(b, a, _mm_cmpgt_ps(x, _mm_setzero_ps()))
+#define VANY_EQ0(v) _mm_movemask_ps(_mm_cmpeq_ps(v, _mm_setzero_ps()))
+#define VHSUM(v) sse4_hsum(v)
+#define VLOAD_I32(p) _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(p)))
+#define VSTORE_I8(p, v) sse4_store_i8(p, v)
+
+static inline float sse4_hsum(__m128 v) {
+  __m128 shuf = _mm_movehdup_ps(v);
+  __m128 sums = _mm_add_ps(v, shuf);
+  shuf = _mm_movehl_ps(shuf, sums);
+  return _mm_cvtss_f32(_mm_add_ss(sums, shuf));
+}
+
+static inline void sse4_store_i8(int8_t *p, __m128 v) {
+  __m128i q = _mm_cvtps_epi32(v);
+  q = _mm_packs_epi16(_mm_packs_epi32(q, q), q);
+  int32_t bytes = _mm_cvtsi128_si32(q);
+  memcpy(p, &bytes, sizeof(bytes));
+}
+
+// bf16 is the top half of a float; rounding adds 0x7FFF plus the lowest
+// kept bit, and NaNs are kept quiet instead.
+static inline __m128i sse4_round_bf16(__m128 v) {
+  __m128i bits = _mm_castps_si128(v);
+  __m128i lsb = _mm_and_si128(_mm_srli_epi32(bits, 16), _mm_set1_epi32(1));
+  __m128i rounded = _mm_add_epi32(bits, _mm_add_epi32(lsb, _mm_set1_epi32(0x7FFF)));
+  __m128i nan = _mm_cmpgt_epi32(_mm_and_si128(bits, _mm_set1_epi32(0x7FFFFFFF)),
+                                _mm_set1_epi32(0x7F800000));
+  __m128i quiet = _mm_or_si128(bits, _mm_set1_epi32(0x400000));
+  return _mm_srli_epi32(_mm_blendv_epi8(rounded, quiet, nan), 16);
+}
+
+#define VLOAD_BF16(p)                                                          \
+  _mm_castsi128_ps(_mm_slli_epi32(                                             \
+      _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)(p))), 16))
+#define VSTORE_BF16(p, v)                                                      \
+  _mm_storel_epi64((__m128i *)(p),                                             \
+                   _mm_packus_epi32(sse4_round_bf16(v), _mm_setzero_si128()))
+
+#define KERNEL_PREFIX sse4
+#define KERNEL_LEVEL SIMD_SSE4
+#define KERNEL_NAME "sse4"
+#include "kernels_template.h"
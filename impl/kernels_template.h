@@ -0,0 +1,600 @@
+// Elementwise kernel bodies shared by every SIMD level. The including file
+// defines the vector type and primitives below, then includes this file
+// once to get a `<KERNEL_PREFIX>_kernels` table.
+//
+//   VEC, VEC_WIDTH          vector type and lanes per vector
+//   VLOAD(p), VSTORE(p, v)  unaligned load/store
+//   VSET1(x), VZERO()       broadcast / zero
+//   VADD, VSUB, VMUL, VDIV  lane-wise arithmetic
+//   VSQRT(v)                lane-wise square root
+//   VMAX, VMIN              lane-wise maximum / minimum
+//   VROUND(v)               round to nearest, ties to even
+//   VPOW2I(n)               2^n for integral n in [-126, 127]
+//   VEXPONENT(v)            unbiased exponent of a positive normal float
+//   VMANTISSA(v)            its significand, in [1, 2)
+//   VSELECT_GT0(x, a, b)    x > 0 ? a : b per lane
+//   VANY_EQ0(v)             nonzero if any lane equals 0
+//   VHSUM(v)                horizontal sum
+//   VLOAD_I32(p)            VEC_WIDTH int32 values at p, as floats
+//   VSTORE_I8(p, v)         VEC_WIDTH integral floats in [-128, 127] to
+//                           int8 at p
+//   KERNEL_PREFIX, KERNEL_LEVEL, KERNEL_NAME
+//
+// Optional, for vectorized 16-bit storage conversions (the scalar ones are
+// used otherwise):
+//   VLOAD_BF16(p), VSTORE_BF16(p, v)  VEC_WIDTH bf16 values at p
+//   VLOAD_F16(p), VSTORE_F16(p, v)    VEC_WIDTH fp16 values at p
+
+#include "kernels_internal.h"
+#include <float.h>
+#include <math.h>
+
+#define KERNEL_CAT_(a, b) a##_##b
+#define KERNEL_CAT(a, b) KERNEL_CAT_(a, b)
+#define KERNEL_FN(name) KERNEL_CAT(KERNEL_PREFIX, name)
+
+static void KERNEL_FN(fill)(float *out, float value, uint64_t n) {
+  VEC v = VSET1(value);
+  uint64_t i = 0;
+  for (; i + VEC_WIDTH <= n; i += VEC_WIDTH) {
+    VSTORE(out + i, v);
+  }
+  for (; i < n; i++) {
+    out[i] = value;
+  }
+}
+
+#define KERNEL_BINARY(name, VOP, op)                                          \
+  static void KERNEL_FN(name)(float *out, const float *a, const float *b,    \
+                              uint64_t n) {                                   \
+    uint64_t i = 0;                                                           \
+    for (; i + VEC_WIDTH <= n; i += VEC_WIDTH) {                              \
+      VSTORE(out + i, VOP(VLOAD(a + i), VLOAD(b + i)));                       \
+    }                                                                         \
+    for (; i < n; i++) {                                                      \
+      out[i] = a[i] op b[i];                                                  \
+    }                                                                         \
+  }
+
+KERNEL_BINARY(add, VADD, +)
+KERNEL_BINARY(sub, VSUB, -)
+KERNEL_BINARY(mul, VMUL, *)
+KERNEL_BINARY(div, VDIV, /)
+
+static void KERNEL_FN(add_scalar)(float *out, const float *a, float value,
+                                  uint64_t n) {
+  VEC v = VSET1(value);
+  uint64_t i = 0;
+  for (; i + VEC_WIDTH <= n; i += VEC_WIDTH) {
+    VSTORE(out + i, VADD(VLOAD(a + i), v));
+  }
+  for (; i < n; i++) {
+    out[i] = a[i] + value;
+  }
+}
+
+static void KERNEL_FN(leaky_relu)(float *out, const float *a, float slope,
+                                  uint64_t n) {
+  VEC s = VSET1(slope);
+  uint64_t i = 0;
+  for (; i + VEC_WIDTH <= n; i += VEC_WIDTH) {
+    VEC x = VLOAD(a + i);
+    VSTORE(out + i, VSELECT_GT0(x, x, VMUL(x, s)));
+  }
+  for (; i < n; i++) {
+    out[i] = a[i] > 0 ? a[i] : a[i] * slope;
+  }
+}
+
+static float KERNEL_FN(sum)(const float *a, uint64_t n) {
+  VEC acc0 = VZERO();
+  VEC acc1 = VZERO();
+  uint64_t i = 0;
+  for (; i + 2 * VEC_WIDTH <= n; i += 2 * VEC_WIDTH) {
+    acc0 = VADD(acc0, VLOAD(a + i));
+    acc1 = VADD(acc1, VLOAD(a + i + VEC_WIDTH));
+  }
+  for (; i + VEC_WIDTH <= n; i += VEC_WIDTH) {
+    acc0 = VADD(acc0, VLOAD(a + i));
+  }
+  float ret = VHSUM(VADD(acc0, acc1));
+  for (; i < n; i++) {
+    ret += a[i];
+  }
+  return ret;
+}
+
+static cbool_t KERNEL_FN(has_zero)(const float *a, uint64_t n) {
+  uint64_t i = 0;
+  for (; i + VEC_WIDTH <= n; i += VEC_WIDTH) {
+    if (VANY_EQ0(VLOAD(a + i))) {
+      return CBOOL_TRUE;
+    }
+  }
+  for (; i < n; i++) {
+    if (a[i] == 0.0f) {
+      return CBOOL_TRUE;
+    }
+  }
+  return CBOOL_FALSE;
+}
+
+// Math kernels: VFN maps a vector of inputs to a vector of results. The
+// tail goes through one zero-padded vector, so every element of an array
+// gets the same rounding whatever its position.
+#define KERNEL_MATH_LOOP(VFN)                                                  \
+  uint64_t i = 0;                                                              \
+  for (; i + VEC_WIDTH <= n; i += VEC_WIDTH) {                                 \
+    VSTORE(out + i, VFN(VLOAD(a + i)));                                        \
+  }                                                                            \
+  if (i < n) {                                                                 \
+    float tail[VEC_WIDTH] = {0};                                               \
+    memcpy(tail, a + i, sizeof(float) * (n - i));                              \
+    VSTORE(tail, VFN(VLOAD(tail)));                                            \
+    memcpy(out + i, tail, sizeof(float) * (n - i));                            \
+  }
+
+// Clamps x and splits it into n ln2 + r; returns r.
+static inline VEC KERNEL_FN(vexp_reduce)(VEC x, VEC *n) {
+  x = VMIN(VMAX(x, VSET1(EXP_LO)), VSET1(EXP_HI));
+  *n = VROUND(VMUL(x, VSET1(EXP_LOG2E)));
+  return VSUB(VSUB(x, VMUL(*n, VSET1(EXP_C1))), VMUL(*n, VSET1(EXP_C2)));
+}
+
+// poly_expf per lane.
+static inline VEC KERNEL_FN(vexp)(VEC x) {
+  VEC n;
+  VEC r = KERNEL_FN(vexp_reduce)(x, &n);
+  VEC y = VSET1(EXP_P0);
+  y = VADD(VMUL(y, r), VSET1(EXP_P1));
+  y = VADD(VMUL(y, r), VSET1(EXP_P2));
+  y = VADD(VMUL(y, r), VSET1(EXP_P3));
+  y = VADD(VMUL(y, r), VSET1(EXP_P4));
+  y = VADD(VMUL(y, r), VSET1(EXP_P5));
+  y = VADD(VADD(VMUL(VMUL(y, r), r), r), VSET1(1.0f));
+  return VMUL(y, VPOW2I(n));
+}
+
+static inline VEC KERNEL_FN(vexp_fast)(VEC x) {
+  VEC n;
+  VEC r = KERNEL_FN(vexp_reduce)(x, &n);
+  VEC y = VADD(VMUL(VSET1(EXP_F1), r), VSET1(EXP_F0));
+  y = VADD(VADD(VMUL(VMUL(y, r), r), r), VSET1(1.0f));
+  return VMUL(y, VPOW2I(n));
+}
+
+static inline VEC KERNEL_FN(vlog)(VEC x) {
+  x = VMAX(x, VSET1(FLT_MIN));
+  VEC e = VEXPONENT(x);
+  VEC m = VMANTISSA(x);
+  VEC high = VSUB(m, VSET1(LOG_SQRT2));
+  m = VSELECT_GT0(high, VMUL(m, VSET1(0.5f)), m);
+  e = VSELECT_GT0(high, VADD(e, VSET1(1.0f)), e);
+  VEC f = VSUB(m, VSET1(1.0f));
+  VEC z = VMUL(f, f);
+  VEC y = VSET1(LOG_P0);
+  y = VADD(VMUL(y, f), VSET1(LOG_P1));
+  y = VADD(VMUL(y, f), VSET1(LOG_P2));
+  y = VADD(VMUL(y, f), VSET1(LOG_P3));
+  y = VADD(VMUL(y, f), VSET1(LOG_P4));
+  y = VADD(VMUL(y, f), VSET1(LOG_P5));
+  y = VADD(VMUL(y, f), VSET1(LOG_P6));
+  y = VADD(VMUL(y, f), VSET1(LOG_P7));
+  y = VADD(VMUL(y, f), VSET1(LOG_P8));
+  y = VMUL(VMUL(y, f), z);
+  y = VADD(y, VMUL(e, VSET1(EXP_C2)));
+  y = VSUB(y, VMUL(z, VSET1(0.5f)));
+  return VADD(VADD(f, y), VMUL(e, VSET1(EXP_C1)));
+}
+
+// 1 / (1 + exp(-x)), or e (1 - e / (1 + e)) with e = exp(x) below
+// SIGMOID_TAIL, from a single exp either way.
+static inline VEC KERNEL_FN(vsigmoid)(VEC x) {
+  VEC one = VSET1(1.0f);
+  VEC upper = VSUB(x, VSET1(SIGMOID_TAIL));
+  VEC e = KERNEL_FN(vexp)(VSELECT_GT0(upper, VSUB(VZERO(), x), x));
+  VEC s = VDIV(one, VADD(one, e));
+  return VSELECT_GT0(upper, s, VMUL(e, VSUB(one, VMUL(e, s))));
+}
+
+static inline VEC KERNEL_FN(vsigmoid_fast)(VEC x) {
+  VEC one = VSET1(1.0f);
+  return VDIV(one, VADD(one, KERNEL_FN(vexp_fast)(VSUB(VZERO(), x))));
+}
+
+static inline VEC KERNEL_FN(vtanh)(VEC x) {
+  VEC one = VSET1(1.0f);
+  VEC z = VMUL(x, x);
+  VEC p = VSET1(TANH_P0);
+  p = VADD(VMUL(p, z), VSET1(TANH_P1));
+  p = VADD(VMUL(p, z), VSET1(TANH_P2));
+  p = VADD(VMUL(p, z), VSET1(TANH_P3));
+  p = VADD(VMUL(p, z), VSET1(TANH_P4));
+  VEC small = VADD(x, VMUL(VMUL(x, z), p));
+  VEC e = KERNEL_FN(vexp)(VADD(x, x));
+  VEC large = VSUB(one, VDIV(VSET1(2.0f), VADD(e, one)));
+  VEC magnitude = VMAX(x, VSUB(VZERO(), x));
+  return VSELECT_GT0(VSUB(magnitude, VSET1(TANH_SMALL)), large, small);
+}
+
+// 2 sigmoid(2x) - 1: absolute rather than relative error near 0.
+static inline VEC KERNEL_FN(vtanh_fast)(VEC x) {
+  VEC one = VSET1(1.0f);
+  VEC e = KERNEL_FN(vexp_fast)(VADD(x, x));
+  return VSUB(one, VDIV(VSET1(2.0f), VADD(e, one)));
+}
+
+static inline void KERNEL_FN(vsincos)(VEC x, VEC *sin_x, VEC *cos_x) {
+  VEC one = VSET1(1.0f);
+  VEC zero = VZERO();
+  VEC n = VROUND(VMUL(x, VSET1(TRIG_2_PI)));
+  VEC r = VSUB(x, VMUL(n, VSET1(TRIG_PIO2_1)));
+  r = VSUB(r, VMUL(n, VSET1(TRIG_PIO2_2)));
+  r = VSUB(r, VMUL(n, VSET1(TRIG_PIO2_3)));
+  VEC z = VMUL(r, r);
+
+  VEC s = VSET1(SIN_P0);
+  s = VADD(VMUL(s, z), VSET1(SIN_P1));
+  s = VADD(VMUL(s, z), VSET1(SIN_P2));
+  s = VADD(VMUL(VMUL(s, z), r), r);
+  VEC c = VSET1(COS_P0);
+  c = VADD(VMUL(c, z), VSET1(COS_P1));
+  c = VADD(VMUL(c, z), VSET1(COS_P2));
+  c = VADD(VSUB(VMUL(VMUL(c, z), z), VMUL(z, VSET1(0.5f))), one);
+
+  // q = n mod 4, and whether it is odd, with float rounding only. Neither
+  // product lands on a tie.
+  VEC q = VSUB(n, VMUL(VSET1(4.0f),
+                       VROUND(VMUL(VSUB(n, VSET1(1.5f)), VSET1(0.25f)))));
+  VEC odd = VSUB(q, VMUL(VSET1(2.0f),
+                         VROUND(VMUL(VSUB(q, VSET1(0.5f)), VSET1(0.5f)))));
+  VEC swap = VSUB(odd, VSET1(0.5f));
+  VEC sin_r = VSELECT_GT0(swap, c, s);
+  VEC cos_r = VSELECT_GT0(swap, s, c);
+  // sin is negated in quadrants 2 and 3, cos in 1 and 2.
+  VEC centered = VSUB(q, VSET1(1.5f));
+  VEC distance = VMAX(centered, VSUB(zero, centered));
+  *sin_x = VSELECT_GT0(centered, VSUB(zero, sin_r), sin_r);
+  *cos_x = VSELECT_GT0(VSUB(one, distance), VSUB(zero, cos_r), cos_r);
+}
+
+static void KERNEL_FN(exp)(float *out, const float *a, uint64_t n) {
+  KERNEL_MATH_LOOP(KERNEL_FN(vexp))
+}
+
+static void KERNEL_FN(exp_fast)(float *out, const float *a, uint64_t n) {
+  KERNEL_MATH_LOOP(KERNEL_FN(vexp_fast))
+}
+
+static void KERNEL_FN(log)(float *out, const float *a, uint64_t n) {
+  KERNEL_MATH_LOOP(KERNEL_FN(vlog))
+}
+
+static void KERNEL_FN(sigmoid)(float *out, const float *a, uint64_t n) {
+  KERNEL_MATH_LOOP(KERNEL_FN(vsigmoid))
+}
+
+static void KERNEL_FN(sigmoid_fast)(float *out, const float *a, uint64_t n) {
+  KERNEL_MATH_LOOP(KERNEL_FN(vsigmoid_fast))
+}
+
+static void KERNEL_FN(tanh)(float *out, const float *a, uint64_t n) {
+  KERNEL_MATH_LOOP(KERNEL_FN(vtanh))
+}
+
+static void KERNEL_FN(tanh_fast)(float *out, const float *a, uint64_t n) {
+  KERNEL_MATH_LOOP(KERNEL_FN(vtanh_fast))
+}
+
+static void KERNEL_FN(sincos)(float *sin_out, float *cos_out, const float *a,
+                              uint64_t n) {
+  VEC s, c;
+  uint64_t i = 0;
+  for (; i + VEC_WIDTH <= n; i += VEC_WIDTH) {
+    KERNEL_FN(vsincos)(VLOAD(a + i), &s, &c);
+    VSTORE(sin_out + i, s);
+    VSTORE(cos_out + i, c);
+  }
+  if (i < n) {
+    float tail[VEC_WIDTH] = {0};
+    memcpy(tail, a + i, sizeof(float) * (n - i));
+    KERNEL_FN(vsincos)(VLOAD(tail), &s, &c);
+    VSTORE(tail, s);
+    memcpy(sin_out + i, tail, sizeof(float) * (n - i));
+    VSTORE(tail, c);
+    memcpy(cos_out + i, tail, sizeof(float) * (n - i));
+  }
+}
+
+// Lane j holds softmax column j: a new row `x` raises the running maximum
+// and rescales the running sum, with a single exp per element:
+// x > m ? s * exp(m - x) + 1 : s + exp(x - m).
+static void KERNEL_FN(softmax_update)(float *max, float *sum, const float *x,
+                                      uint64_t n) {
+  VEC one = VSET1(1.0f);
+  VEC zero = VZERO();
+  uint64_t i = 0;
+  for (; i + VEC_WIDTH <= n; i += VEC_WIDTH) {
+    VEC xi = VLOAD(x + i);
+    VEC m = VLOAD(max + i);
+    VEC s = VLOAD(sum + i);
+    VEC d = VSUB(xi, m);
+    VEC e = KERNEL_FN(vexp)(VMIN(d, VSUB(zero, d)));
+    VSTORE(sum + i, VSELECT_GT0(d, VADD(VMUL(s, e), one), VADD(s, e)));
+    VSTORE(max + i, VMAX(m, xi));
+  }
+  for (; i < n; i++) {
+    float d = x[i] - max[i];
+    float e = poly_expf(d > 0 ? -d : d);
+    sum[i] = d > 0 ? sum[i] * e + 1.0f : sum[i] + e;
+    max[i] = d > 0 ? x[i] : max[i];
+  }
+}
+
+static void KERNEL_FN(softmax_scale)(float *out, const float *x,
+                                     const float *max, const float *scale,
+                                     uint64_t n) {
+  uint64_t i = 0;
+  for (; i + VEC_WIDTH <= n; i += VEC_WIDTH) {
+    VEC e = KERNEL_FN(vexp)(VSUB(VLOAD(x + i), VLOAD(max + i)));
+    VSTORE(out + i, VMUL(e, VLOAD(scale + i)));
+  }
+  for (; i < n; i++) {
+    out[i] = poly_expf(x[i] - max[i]) * scale[i];
+  }
+}
+
+static void KERNEL_FN(abs_max)(float *max, const float *a, uint64_t n) {
+  VEC zero = VZERO();
+  uint64_t i = 0;
+  for (; i + VEC_WIDTH <= n; i += VEC_WIDTH) {
+    VEC x = VLOAD(a + i);
+    VSTORE(max + i, VMAX(VLOAD(max + i), VMAX(x, VSUB(zero, x))));
+  }
+  for (; i < n; i++) {
+    max[i] = fmaxf(max[i], fabsf(a[i]));
+  }
+}
+
+static void KERNEL_FN(quantize_i8)(int8_t *out, const float *a,
+                                   const float *inv_scale, uint64_t n) {
+  VEC hi = VSET1(127.0f);
+  VEC lo = VSET1(-127.0f);
+  uint64_t i = 0;
+  for (; i + VEC_WIDTH <= n; i += VEC_WIDTH) {
+    VEC q = VROUND(VMUL(VLOAD(a + i), VLOAD(inv_scale + i)));
+    VSTORE_I8(out + i, VMIN(VMAX(q, lo), hi));
+  }
+  for (; i < n; i++) {
+    out[i] = (int8_t)fminf(fmaxf(nearbyintf(a[i] * inv_scale[i]), -127.0f),
+                           127.0f);
+  }
+}
+
+static void KERNEL_FN(dequantize_i32)(float *out, const int32_t *acc,
+                                      float scale, const float *col_scale,
+                                      float bias, uint64_t n) {
+  VEC s = VSET1(scale);
+  VEC b = VSET1(bias);
+  uint64_t i = 0;
+  for (; i + VEC_WIDTH <= n; i += VEC_WIDTH) {
+    VEC x = VMUL(VMUL(VLOAD_I32(acc + i), s), VLOAD(col_scale + i));
+    VSTORE(out + i, VADD(x, b));
+  }
+  for (; i < n; i++) {
+    out[i] = (float)acc[i] * scale * col_scale[i] + bias;
+  }
+}
+
+// Gradient kernels: `expr` is the contribution for lane/element i, written
+// once for vectors (VEXPR) and once for the scalar tail (SEXPR).
+#define KERNEL_GRAD_LOOP(VEXPR, SEXPR)                                        \
+  uint64_t i = 0;                                                             \
+  if (accumulate == CBOOL_TRUE) {                                             \
+    for (; i + VEC_WIDTH <= n; i += VEC_WIDTH) {                              \
+      VSTORE(dst + i, VADD(VLOAD(dst + i), VEXPR));                           \
+    }                                                                         \
+    for (; i < n; i++) {                                                      \
+      dst[i] += SEXPR;                                                        \
+    }                                                                         \
+  } else {                                                                    \
+    for (; i + VEC_WIDTH <= n; i += VEC_WIDTH) {                              \
+      VSTORE(dst + i, VEXPR);                                                 \
+    }                                                                         \
+    for (; i < n; i++) {                                                      \
+      dst[i] = SEXPR;                                                         \
+    }                                                                         \
+  }
+
+static void KERNEL_FN(scale_grad)(float *dst, const float *g, float alpha,
+                                  uint64_t n, cbool_t accumulate) {
+  VEC va = VSET1(alpha);
+  KERNEL_GRAD_LOOP(VMUL(VLOAD(g + i), va), alpha * g[i])
+}
+
+static void KERNEL_FN(mul_grad)(float *dst, const float *g, const float *b,
+                                uint64_t n, cbool_t accumulate) {
+  KERNEL_GRAD_LOOP(VMUL(VLOAD(g + i), VLOAD(b + i)), g[i] * b[i])
+}
+
+static void KERNEL_FN(div_grad)(float *dst, const float *g, const float *b,
+                                uint64_t n, cbool_t accumulate) {
+  KERNEL_GRAD_LOOP(VDIV(VLOAD(g + i), VLOAD(b + i)), g[i] / b[i])
+}
+
+static void KERNEL_FN(div_rhs_grad)(float *dst, const float *g,
+                                    const float *a, const float *b,
+                                    uint64_t n, cbool_t accumulate) {
+  VEC zero = VZERO();
+  KERNEL_GRAD_LOOP(
+      VSUB(zero, VDIV(VMUL(VLOAD(g + i), VLOAD(a + i)),
+                      VMUL(VLOAD(b + i), VLOAD(b + i)))),
+      -(g[i] * a[i] / (b[i] * b[i])))
+}
+
+static void KERNEL_FN(leaky_relu_grad)(float *dst, const float *g,
+                                       const float *y, float slope,
+                                       uint64_t n, cbool_t accumulate) {
+  VEC s = VSET1(slope);
+  KERNEL_GRAD_LOOP(
+      VSELECT_GT0(VLOAD(y + i), VLOAD(g + i), VMUL(VLOAD(g + i), s)),
+      y[i] > 0 ? g[i] : g[i] * slope)
+}
+
+static void KERNEL_FN(sigmoid_grad)(float *dst, const float *g,
+                                    const float *s, uint64_t n,
+                                    cbool_t accumulate) {
+  VEC one = VSET1(1.0f);
+  KERNEL_GRAD_LOOP(
+      VMUL(VMUL(VLOAD(g + i), VLOAD(s + i)), VSUB(one, VLOAD(s + i))),
+      g[i] * s[i] * (1 - s[i]))
+}
+
+static void KERNEL_FN(tanh_grad)(float *dst, const float *g, const float *t,
+                                 uint64_t n, cbool_t accumulate) {
+  VEC one = VSET1(1.0f);
+  KERNEL_GRAD_LOOP(
+      VMUL(VLOAD(g + i), VSUB(one, VMUL(VLOAD(t + i), VLOAD(t + i)))),
+      g[i] * (1 - t[i] * t[i]))
+}
+
+static void KERNEL_FN(adam)(float *param, const float *grad, float *m,
+                            float *v, uint64_t n, const adam_step_t *step) {
+  VEC b1 = VSET1(step->beta1);
+  VEC b2 = VSET1(step->beta2);
+  VEC one_b1 = VSET1(1.0f - step->beta1);
+  VEC one_b2 = VSET1(1.0f - step->beta2);
+  VEC step_size = VSET1(step->step_size);
+  VEC inv_sqrt_bias2 = VSET1(step->inv_sqrt_bias2);
+  VEC eps = VSET1(step->epsilon);
+  VEC decay = VSET1(step->decay);
+  uint64_t i = 0;
+  for (; i + VEC_WIDTH <= n; i += VEC_WIDTH) {
+    VEC g = VLOAD(grad + i);
+    VEC mi = VADD(VMUL(b1, VLOAD(m + i)), VMUL(one_b1, g));
+    VEC vi = VADD(VMUL(b2, VLOAD(v + i)), VMUL(one_b2, VMUL(g, g)));
+    VEC denom = VADD(VMUL(VSQRT(vi), inv_sqrt_bias2), eps);
+    VEC p = VMUL(VLOAD(param + i), decay);
+    VSTORE(m + i, mi);
+    VSTORE(v + i, vi);
+    VSTORE(param + i, VSUB(p, VDIV(VMUL(step_size, mi), denom)));
+  }
+  for (; i < n; i++) {
+    float g = grad[i];
+    m[i] = step->beta1 * m[i] + (1.0f - step->beta1) * g;
+    v[i] = step->beta2 * v[i] + (1.0f - step->beta2) * (g * g);
+    float denom = sqrtf(v[i]) * step->inv_sqrt_bias2 + step->epsilon;
+    param[i] = param[i] * step->decay - step->step_size * m[i] / denom;
+  }
+}
+
+static void KERNEL_FN(sgd_momentum)(float *param, const float *grad,
+                                    float *vel, uint64_t n, float lr,
+                                    float momentum) {
+  VEC mu = VSET1(momentum);
+  VEC neg_lr = VSET1(-lr);
+  uint64_t i = 0;
+  for (; i + VEC_WIDTH <= n; i += VEC_WIDTH) {
+    VEC vi = VADD(VMUL(mu, VLOAD(vel + i)), VLOAD(grad + i));
+    VSTORE(vel + i, vi);
+    VSTORE(param + i, VADD(VLOAD(param + i), VMUL(neg_lr, vi)));
+  }
+  for (; i < n; i++) {
+    vel[i] = momentum * vel[i] + grad[i];
+    param[i] -= lr * vel[i];
+  }
+}
+
+#ifdef VLOAD_BF16
+static void KERNEL_FN(bf16_to_f32)(float *out, const uint16_t *in, uint64_t n) {
+  uint64_t i = 0;
+  for (; i + VEC_WIDTH <= n; i += VEC_WIDTH) {
+    VSTORE(out + i, VLOAD_BF16(in + i));
+  }
+  for (; i < n; i++) {
+    out[i] = bf16_to_float(in[i]);
+  }
+}
+
+static void KERNEL_FN(f32_to_bf16)(uint16_t *out, const float *in, uint64_t n) {
+  uint64_t i = 0;
+  for (; i + VEC_WIDTH <= n; i += VEC_WIDTH) {
+    VSTORE_BF16(out + i, VLOAD(in + i));
+  }
+  for (; i < n; i++) {
+    out[i] = float_to_bf16(in[i]);
+  }
+}
+#define KERNEL_BF16_TO_F32 KERNEL_FN(bf16_to_f32)
+#define KERNEL_F32_TO_BF16 KERNEL_FN(f32_to_bf16)
+#else
+#define KERNEL_BF16_TO_F32 scalar_bf16_to_f32
+#define KERNEL_F32_TO_BF16 scalar_f32_to_bf16
+#endif
+
+#ifdef VLOAD_F16
+static void KERNEL_FN(f16_to_f32)(float *out, const uint16_t *in, uint64_t n) {
+  uint64_t i = 0;
+  for (; i + VEC_WIDTH <= n; i += VEC_WIDTH) {
+    VSTORE(out + i, VLOAD_F16(in + i));
+  }
+  for (; i < n; i++) {
+    out[i] = f16_to_float(in[i]);
+  }
+}
+
+static void KERNEL_FN(f32_to_f16)(uint16_t *out, const float *in, uint64_t n) {
+  uint64_t i = 0;
+  for (; i + VEC_WIDTH <= n; i += VEC_WIDTH) {
+    VSTORE_F16(out + i, VLOAD(in + i));
+  }
+  for (; i < n; i++) {
+    out[i] = float_to_f16(in[i]);
+  }
+}
+#define KERNEL_F16_TO_F32 KERNEL_FN(f16_to_f32)
+#define KERNEL_F32_TO_F16 KERNEL_FN(f32_to_f16)
+#else
+#define KERNEL_F16_TO_F32 scalar_f16_to_f32
+#define KERNEL_F32_TO_F16 scalar_f32_to_f16
+#endif
+
+const elementwise_kernels_t KERNEL_FN(kernels) = {
+    .level = KERNEL_LEVEL,
+    .name = KERNEL_NAME,
+    .fill = KERNEL_FN(fill),
+    .add = KERNEL_FN(add),
+    .sub = KERNEL_FN(sub),
+    .mul = KERNEL_FN(mul),
+    .div = KERNEL_FN(div),
+    .add_scalar = KERNEL_FN(add_scalar),
+    .leaky_relu = KERNEL_FN(leaky_relu),
+    .sigmoid = KERNEL_FN(sigmoid),
+    .sum = KERNEL_FN(sum),
+    .has_zero = KERNEL_FN(has_zero),
+    .exp = KERNEL_FN(exp),
+    .log = KERNEL_FN(log),
+    .tanh = KERNEL_FN(tanh),
+    .sincos = KERNEL_FN(sincos),
+    .exp_fast = KERNEL_FN(exp_fast),
+    .sigmoid_fast = KERNEL_FN(sigmoid_fast),
+    .tanh_fast = KERNEL_FN(tanh_fast),
+    .softmax_update = KERNEL_FN(softmax_update),
+    .softmax_scale = KERNEL_FN(softmax_scale),
+    .abs_max = KERNEL_FN(abs_max),
+    .quantize_i8 = KERNEL_FN(quantize_i8),
+    .dequantize_i32 = KERNEL_FN(dequantize_i32),
+    .scale_grad = KERNEL_FN(scale_grad),
+    .mul_grad = KERNEL_FN(mul_grad),
+    .div_grad = KERNEL_FN(div_grad),
+    .div_rhs_grad = KERNEL_FN(div_rhs_grad),
+    .leaky_relu_grad = KERNEL_FN(leaky_relu_grad),
+    .sigmoid_grad = KERNEL_FN(sigmoid_grad),
+    .tanh_grad = KERNEL_FN(tanh_grad),
+    .adam = KERNEL_FN(adam),
+    .sgd_momentum = KERNEL_FN(sgd_momentum),
+    .bf16_to_f32 = KERNEL_BF16_TO_F32,
+    .f32_to_bf16 = KERNEL_F32_TO_BF16,
+    .f16_to_f32 = KERNEL_F16_TO_F32,
+    .f32_to_f16 = KERNEL_F32_TO_F16,
+};
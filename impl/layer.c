@@ -1,19 +1,44 @@
 #include "much/layer.h"
+#include "much/conv.h"
+#include <math.h>
 
 linear_layer_t* new_linear_layer(uint64_t input_features, uint64_t output_features, cbool_t require_grad) {
+    return new_linear_layer_dtype(input_features, output_features, require_grad, DTYPE_F32);
+}
+
+linear_layer_t* new_linear_layer_dtype(uint64_t input_features, uint64_t output_features,
+                                       cbool_t require_grad, dtype_t dtype) {
     linear_layer_t* layer = (linear_layer_t*)malloc(sizeof(linear_layer_t));
     uint64_t weight_shape[] = {output_features, input_features};
-    layer->weight = new_tensor_f32(weight_shape, 2, require_grad);
+    layer->weight = new_tensor_dtype(weight_shape, 2, dtype, require_grad);
     uint64_t bias_shape[] = {output_features};
-    layer->bias = new_tensor_f32(bias_shape, 1, require_grad);
-
-    // Initialize weights and biases
-    tensor_f32_randn(layer->weight, 0.0f, 1.0f);
-    tensor_f32_fill(layer->bias, 0.0f);
+    layer->bias = new_tensor_dtype(bias_shape, 1, dtype, require_grad);
 
+    linear_layer_init(layer, INIT_HE, NULL);
     return layer;
 }
 
+void linear_layer_init(linear_layer_t* layer, init_t init, rng_t* rng) {
+    // Weights per output and per input; a convolution's taps count towards
+    // both.
+    float weights = (float)layer->weight->meta.capacity;
+    float fan_in = weights / (float)layer->weight->meta.shape[0];
+    float fan_out = weights / (float)layer->weight->meta.shape[1];
+    switch (init) {
+    case INIT_HE:
+        tensor_f32_randn(layer->weight, rng, 0.0f, sqrtf(2.0f / fan_in));
+        break;
+    case INIT_XAVIER: {
+        float limit = sqrtf(6.0f / (fan_in + fan_out));
+        tensor_f32_rand(layer->weight, rng, -limit, limit);
+        break;
+    }
+    default:
+        raise_error(ValueError, "unknown initializer");
+    }
+    tensor_f32_fill(layer->bias, 0.0f);
+}
+
 void free_linear_layer(linear_layer_t* layer) {
     if (layer != NULL) {
         free_tensor_f32(layer->weight);
@@ -23,7 +48,39 @@ void free_linear_layer(linear_layer_t* layer) {
 }
 
 tensor_f32_t* linear_layer_forward(linear_layer_t* layer, tensor_f32_t* src) {
-    tensor_f32_t* matmul_out = tensor_f32_matmul(layer->weight, src);
-    tensor_f32_t* add_out = tensor_f32_add(matmul_out, layer->bias);
-    return add_out;
+    return linear_layer_forward_act(layer, src, ACTIVATION_NONE);
+}
+
+tensor_f32_t* linear_layer_forward_act(linear_layer_t* layer, tensor_f32_t* src, activation_t activation) {
+    return tensor_f32_linear(src, layer->weight, layer->bias, activation);
+}
+
+conv2d_layer_t* new_conv2d_layer(uint64_t in_channels, uint64_t out_channels, uint64_t kernel,
+                                 uint64_t stride, uint64_t padding, cbool_t require_grad) {
+    conv2d_layer_t* layer = (conv2d_layer_t*)malloc(sizeof(conv2d_layer_t));
+    if (layer == NULL) {
+        raise_error(NullPointer, "malloc failed to allocate conv2d_layer_t");
+    }
+    uint64_t weight_shape[] = {out_channels, in_channels, kernel, kernel};
+    layer->params.weight = new_tensor_f32(weight_shape, 4, require_grad);
+    uint64_t bias_shape[] = {out_channels};
+    layer->params.bias = new_tensor_f32(bias_shape, 1, require_grad);
+    layer->stride = stride;
+    layer->padding = padding;
+
+    linear_layer_init(&layer->params, INIT_HE, NULL);
+    return layer;
+}
+
+void free_conv2d_layer(conv2d_layer_t* layer) {
+    if (layer != NULL) {
+        free_tensor_f32(layer->params.weight);
+        free_tensor_f32(layer->params.bias);
+        free(layer);
+    }
+}
+
+tensor_f32_t* conv2d_layer_forward_act(conv2d_layer_t* layer, tensor_f32_t* src, activation_t activation) {
+    return tensor_f32_conv2d(src, layer->params.weight, layer->params.bias, layer->stride,
+                             layer->padding, activation);
 }
@@ -1,95 +1,114 @@
 #include "much/mnist.h"
-#include <stdio.h>
 #include <stdlib.h>
 
-int32_t bswap_32(int32_t val) {
-    return ((val & 0xFF) << 24) |
-           ((val & 0xFF00) << 8) |
-           ((val >> 8) & 0xFF00) |
-           ((val >> 24) & 0xFF);
-}
+// Samples transposed together by the gather kernel. Their source rows stay
+// in L1 while each output row receives GATHER_TILE contiguous floats.
+#define GATHER_TILE 16
 
 mnist_dataset_t* load_mnist_dataset(const char* image_path, const char* label_path) {
-    FILE* image_file = fopen(image_path, "rb");
-    if (!image_file) {
-        raise_error(RuntimeError, "Could not open image file");
-    }
-
-    FILE* label_file = fopen(label_path, "rb");
-    if (!label_file) {
-        raise_error(RuntimeError, "Could not open label file");
-    }
+    idx_file_t* image_file = idx_open(image_path);
+    idx_file_t* label_file = idx_open(label_path);
 
-    int32_t magic, num_images, num_labels, rows, cols;
-
-    fread(&magic, sizeof(int32_t), 1, image_file);
-    magic = bswap_32(magic);
-    if (magic != 2051) {
+    if (image_file->dtype != IDX_U8 || image_file->num_dims != 3) {
         raise_error(RuntimeError, "Invalid magic number in image file");
     }
-    
-    fread(&num_images, sizeof(int32_t), 1, image_file);
-    num_images = bswap_32(num_images);
-
-    fread(&rows, sizeof(int32_t), 1, image_file);
-    rows = bswap_32(rows);
-
-    fread(&cols, sizeof(int32_t), 1, image_file);
-    cols = bswap_32(cols);
-
-    fread(&magic, sizeof(int32_t), 1, label_file);
-    magic = bswap_32(magic);
-    if (magic != 2049) {
+    if (label_file->dtype != IDX_U8 || label_file->num_dims != 1) {
         raise_error(RuntimeError, "Invalid magic number in label file");
     }
-
-    fread(&num_labels, sizeof(int32_t), 1, label_file);
-    num_labels = bswap_32(num_labels);
-    
-    if (num_images != num_labels) {
+    if (image_file->dims[0] != label_file->dims[0]) {
         raise_error(ValueError, "Number of images and labels do not match");
     }
 
     mnist_dataset_t* dataset = (mnist_dataset_t*)malloc(sizeof(mnist_dataset_t));
-    dataset->num_items = num_images;
-    dataset->images = (tensor_f32_t**)malloc(sizeof(tensor_f32_t*) * num_images);
-    dataset->labels = (tensor_f32_t**)malloc(sizeof(tensor_f32_t*) * num_images);
+    if (dataset == NULL) {
+        raise_error(NullPointer, "malloc failed to allocate mnist_dataset_t");
+    }
+    dataset->image_file = image_file;
+    dataset->label_file = label_file;
+    dataset->pixels = image_file->data;
+    dataset->labels = label_file->data;
+    dataset->num_items = image_file->dims[0];
+    dataset->rows = image_file->dims[1];
+    dataset->cols = image_file->dims[2];
+    dataset->image_size = image_file->item_size;
+
+    for (uint64_t i = 0; i < dataset->num_items; i++) {
+        if (dataset->labels[i] >= MNIST_NUM_CLASSES) {
+            raise_error(ValueError, "label out of range in label file");
+        }
+    }
+    return dataset;
+}
 
-    uint64_t image_shape[] = {rows * cols, 1};
-    uint64_t label_shape[] = {10, 1};
+void free_mnist_dataset(mnist_dataset_t* dataset) {
+    if (dataset != NULL) {
+        idx_close(dataset->image_file);
+        idx_close(dataset->label_file);
+        free(dataset);
+    }
+}
 
-    for (int i = 0; i < num_images; i++) {
-        dataset->images[i] = new_tensor_f32(image_shape, 2, CBOOL_FALSE);
-        dataset->labels[i] = new_tensor_f32(label_shape, 2, CBOOL_FALSE);
+static void check_batch_tensors(mnist_dataset_t* dataset, uint64_t count,
+                                tensor_f32_t* images) {
+    if (images != NULL && images->meta.capacity != dataset->image_size * count) {
+        raise_error(ValueError, "batch tensors do not match the requested batch size");
+    }
+}
 
-        uint8_t* image_data = (uint8_t*)malloc(rows * cols);
-        fread(image_data, 1, rows * cols, image_file);
-        for (int j = 0; j < rows * cols; j++) {
-            dataset->images[i]->data[j] = (float)image_data[j] / 255.0f;
+// `index(ctx, b)` names the dataset row of batch column b.
+static void gather(mnist_dataset_t* dataset, uint64_t count,
+                   uint64_t (*index)(const void*, uint64_t), const void* ctx,
+                   tensor_f32_t* images, uint32_t* labels) {
+    const float scale = 1.0f / 255.0f;
+    uint64_t pixels = dataset->image_size;
+
+    if (images != NULL) {
+        for (uint64_t b0 = 0; b0 < count; b0 += GATHER_TILE) {
+            uint64_t tile = count - b0 < GATHER_TILE ? count - b0 : GATHER_TILE;
+            const uint8_t* src[GATHER_TILE];
+            for (uint64_t b = 0; b < tile; b++) {
+                src[b] = (const uint8_t*)idx_item(dataset->image_file, index(ctx, b0 + b));
+            }
+            for (uint64_t j = 0; j < pixels; j++) {
+                float* dst = images->data + j * count + b0;
+                for (uint64_t b = 0; b < tile; b++) {
+                    dst[b] = (float)src[b][j] * scale;
+                }
+            }
         }
-        free(image_data);
+    }
 
-        uint8_t label_data;
-        fread(&label_data, 1, 1, label_file);
-        for (int j = 0; j < 10; j++) {
-            dataset->labels[i]->data[j] = (j == label_data) ? 1.0f : 0.0f;
+    if (labels != NULL) {
+        for (uint64_t b = 0; b < count; b++) {
+            labels[b] = *(const uint8_t*)idx_item(dataset->label_file, index(ctx, b));
         }
     }
+}
 
-    fclose(image_file);
-    fclose(label_file);
+static uint64_t range_index(const void* ctx, uint64_t b) {
+    return *(const uint64_t*)ctx + b;
+}
 
-    return dataset;
+static uint64_t list_index(const void* ctx, uint64_t b) {
+    return ((const uint64_t*)ctx)[b];
 }
 
-void free_mnist_dataset(mnist_dataset_t* dataset) {
-    if (dataset != NULL) {
-        for (uint64_t i = 0; i < dataset->num_items; i++) {
-            free_tensor_f32(dataset->images[i]);
-            free_tensor_f32(dataset->labels[i]);
+void mnist_gather_batch(mnist_dataset_t* dataset, uint64_t start, uint64_t count,
+                        tensor_f32_t* images, uint32_t* labels) {
+    if (start + count > dataset->num_items) {
+        raise_error(ValueError, "batch exceeds dataset size");
+    }
+    check_batch_tensors(dataset, count, images);
+    gather(dataset, count, range_index, &start, images, labels);
+}
+
+void mnist_gather_indices(mnist_dataset_t* dataset, const uint64_t* indices, uint64_t count,
+                          tensor_f32_t* images, uint32_t* labels) {
+    for (uint64_t b = 0; b < count; b++) {
+        if (indices[b] >= dataset->num_items) {
+            raise_error(ValueError, "sample index exceeds dataset size");
         }
-        free(dataset->images);
-        free(dataset->labels);
-        free(dataset);
     }
+    check_batch_tensors(dataset, count, images);
+    gather(dataset, count, list_index, indices, images, labels);
 }
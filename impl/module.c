@@ -0,0 +1,295 @@
+#include "much/module.h"
+#include "much/kernels.h"
+#include "much/parallel.h"
+#include "much/sgemm.h"
+#include <stdlib.h>
+
+static float activation_slope(activation_t activation) {
+    return activation == ACTIVATION_RELU ? 0.0f : 0.01f;
+}
+
+// Float operations per element of the sigmoid kernels, for parallel_grain.
+#define SIGMOID_COST 16
+
+// An activation pass over contiguous floats, split across the thread pool
+// when large.
+typedef struct {
+    activation_t activation;
+    float* dst;
+    const float* x;
+    const float* dy;
+    const float* y;
+} activation_pass_t;
+
+static uint64_t activation_grain(activation_t activation) {
+    return parallel_grain(activation == ACTIVATION_SIGMOID ? SIGMOID_COST : 1);
+}
+
+static void activate_range(void* ctx, uint64_t begin, uint64_t end) {
+    activation_pass_t* p = (activation_pass_t*)ctx;
+    const elementwise_kernels_t* k = get_kernels();
+    if (p->activation == ACTIVATION_SIGMOID) {
+        k->sigmoid(p->dst + begin, p->x + begin, end - begin);
+    } else {
+        k->leaky_relu(p->dst + begin, p->x + begin, activation_slope(p->activation), end - begin);
+    }
+}
+
+static void activation_grad_range(void* ctx, uint64_t begin, uint64_t end) {
+    activation_pass_t* p = (activation_pass_t*)ctx;
+    const elementwise_kernels_t* k = get_kernels();
+    if (p->activation == ACTIVATION_SIGMOID) {
+        k->sigmoid_grad(p->dst + begin, p->dy + begin, p->y + begin, end - begin, CBOOL_FALSE);
+    } else {
+        k->leaky_relu_grad(p->dst + begin, p->dy + begin, p->y + begin,
+                           activation_slope(p->activation), end - begin, CBOOL_FALSE);
+    }
+}
+
+// y = activation(x); y may be x.
+static void apply_activation(activation_t activation, float* y, const float* x, uint64_t n) {
+    switch (activation) {
+    case ACTIVATION_NONE:
+        break;
+    case ACTIVATION_RELU:
+    case ACTIVATION_LEAKY_RELU:
+    case ACTIVATION_SIGMOID: {
+        activation_pass_t pass = {activation, y, x, NULL, NULL};
+        parallel_for(0, n, activation_grain(activation), activate_range, &pass);
+        break;
+    }
+    default:
+        raise_error(ValueError, "unknown activation");
+    }
+}
+
+// dst = dy * activation'(y), recovered from the activation's output.
+static void activation_grad(activation_t activation, float* dst, const float* dy, const float* y,
+                            uint64_t n) {
+    activation_pass_t pass = {activation, dst, NULL, dy, y};
+    parallel_for(0, n, activation_grain(activation), activation_grad_range, &pass);
+}
+
+// bias->grad[r] (+)= the sum of row r of dy.
+typedef struct {
+    float* grad;
+    const float* dy;
+    uint64_t batch;
+    cbool_t accumulate;
+} bias_grad_t;
+
+static void bias_grad_range(void* ctx, uint64_t begin, uint64_t end) {
+    bias_grad_t* p = (bias_grad_t*)ctx;
+    const elementwise_kernels_t* k = get_kernels();
+    for (uint64_t r = begin; r < end; r++) {
+        float sum = k->sum(p->dy + r * p->batch, p->batch);
+        p->grad[r] = p->accumulate == CBOOL_TRUE ? p->grad[r] + sum : sum;
+    }
+}
+
+static module_t* new_module(const module_ops_t* ops, void* state) {
+    module_t* module = (module_t*)malloc(sizeof(module_t));
+    if (module == NULL) {
+        raise_error(NullPointer, "malloc failed to allocate module_t");
+    }
+    module->ops = ops;
+    module->state = state;
+    return module;
+}
+
+void free_module(module_t* module) {
+    if (module != NULL) {
+        module->ops->free(module);
+        free(module);
+    }
+}
+
+// Linear
+
+typedef struct {
+    linear_layer_t* layer;
+    activation_t activation;
+} linear_module_t;
+
+static uint64_t linear_out_features(module_t* self, uint64_t in_features) {
+    linear_layer_t* layer = ((linear_module_t*)self->state)->layer;
+    if (layer->weight->meta.shape[1] != in_features) {
+        raise_error(ValueError, "linear module input features do not match its weight");
+    }
+    return layer->weight->meta.shape[0];
+}
+
+static tensor_f32_t* linear_module_forward(module_t* self, tensor_f32_t* x) {
+    linear_module_t* state = (linear_module_t*)self->state;
+    return linear_layer_forward_act(state->layer, x, state->activation);
+}
+
+// The same steps as tensor_f32_linear, so both give identical results:
+// preload the bias, let sgemm accumulate onto it, then activate in place.
+static void linear_forward_into(module_t* self, const float* x, float* y, uint64_t in_features,
+                                uint64_t batch) {
+    linear_module_t* state = (linear_module_t*)self->state;
+    tensor_f32_t* w = state->layer->weight;
+    uint64_t out_features = w->meta.shape[0];
+    const elementwise_kernels_t* k = get_kernels();
+    for (uint64_t r = 0; r < out_features; r++) {
+        k->fill(y + r * batch, state->layer->bias->data[r], batch);
+    }
+    sgemm(SGEMM_NO_TRANS, SGEMM_NO_TRANS, out_features, batch, in_features, 1.0f, w->data,
+          in_features, x, batch, 1.0f, y, batch);
+    apply_activation(state->activation, y, y, out_features * batch);
+}
+
+static void linear_backward_into(module_t* self, const float* x, const float* y, float* dy,
+                                 float* dx, uint64_t in_features, uint64_t batch) {
+    linear_module_t* state = (linear_module_t*)self->state;
+    tensor_f32_t* w = state->layer->weight;
+    tensor_f32_t* bias = state->layer->bias;
+    uint64_t out_features = w->meta.shape[0];
+
+    // dz overwrites dy.
+    if (state->activation != ACTIVATION_NONE) {
+        activation_grad(state->activation, dy, dy, y, out_features * batch);
+    }
+    if (w->meta.require_grad == CBOOL_TRUE) {
+        // w->grad (+)= dz * x^T
+        float beta = tensor_grad_prepare(w) == CBOOL_TRUE ? 1.0f : 0.0f;
+        sgemm(SGEMM_NO_TRANS, SGEMM_TRANS, out_features, in_features, batch, 1.0f, dy, batch, x,
+              batch, beta, w->grad, in_features);
+    }
+    if (bias->meta.require_grad == CBOOL_TRUE) {
+        cbool_t accumulate = tensor_grad_prepare(bias);
+        bias_grad_t sums = {bias->grad, dy, batch, accumulate};
+        parallel_for(0, out_features, parallel_grain(batch), bias_grad_range, &sums);
+    }
+    if (dx != NULL) {
+        // dx = w^T * dz
+        sgemm(SGEMM_TRANS, SGEMM_NO_TRANS, in_features, batch, out_features, 1.0f, w->data,
+              in_features, dy, batch, 0.0f, dx, batch);
+    }
+}
+
+static uint64_t linear_parameters(module_t* self, tensor_f32_t** params, uint64_t max) {
+    linear_layer_t* layer = ((linear_module_t*)self->state)->layer;
+    if (max > 0) {
+        params[0] = layer->weight;
+    }
+    if (max > 1) {
+        params[1] = layer->bias;
+    }
+    return 2;
+}
+
+static void free_state(module_t* self) { free(self->state); }
+
+static const module_ops_t linear_module_ops = {
+    .out_features = linear_out_features,
+    .forward = linear_module_forward,
+    .forward_into = linear_forward_into,
+    .backward_into = linear_backward_into,
+    .parameters = linear_parameters,
+    .free = free_state,
+    .backward_reads_x = CBOOL_TRUE,
+    .backward_reads_y = CBOOL_TRUE,
+    .in_place = CBOOL_FALSE,
+    .op = OP_LINEAR,
+};
+
+// Without an activation the output is not needed for backward.
+static const module_ops_t linear_module_ops_none = {
+    .out_features = linear_out_features,
+    .forward = linear_module_forward,
+    .forward_into = linear_forward_into,
+    .backward_into = linear_backward_into,
+    .parameters = linear_parameters,
+    .free = free_state,
+    .backward_reads_x = CBOOL_TRUE,
+    .backward_reads_y = CBOOL_FALSE,
+    .in_place = CBOOL_FALSE,
+    .op = OP_LINEAR,
+};
+
+module_t* new_linear_module(linear_layer_t* layer, activation_t activation) {
+    if (layer->weight->meta.dtype != DTYPE_F32 || layer->bias->meta.dtype != DTYPE_F32 ||
+        tensor_is_contiguous(layer->weight) != CBOOL_TRUE ||
+        tensor_is_contiguous(layer->bias) != CBOOL_TRUE) {
+        raise_error(ValueError, "linear modules need contiguous float parameters");
+    }
+    linear_module_t* state = (linear_module_t*)malloc(sizeof(linear_module_t));
+    if (state == NULL) {
+        raise_error(NullPointer, "malloc failed to allocate linear module");
+    }
+    state->layer = layer;
+    state->activation = activation;
+    return new_module(activation == ACTIVATION_NONE ? &linear_module_ops_none : &linear_module_ops,
+                      state);
+}
+
+// Activation
+
+static uint64_t activation_out_features(module_t* self, uint64_t in_features) {
+    (void)self;
+    return in_features;
+}
+
+static tensor_f32_t* activation_module_forward(module_t* self, tensor_f32_t* x) {
+    activation_t activation = (activation_t)(uintptr_t)self->state;
+    return activation == ACTIVATION_SIGMOID ? tensor_f32_sigmoid(x) : tensor_f32_relu(x);
+}
+
+static void activation_forward_into(module_t* self, const float* x, float* y,
+                                    uint64_t in_features, uint64_t batch) {
+    apply_activation((activation_t)(uintptr_t)self->state, y, x, in_features * batch);
+}
+
+static void activation_backward_into(module_t* self, const float* x, const float* y, float* dy,
+                                     float* dx, uint64_t in_features, uint64_t batch) {
+    (void)x;
+    if (dx != NULL) {
+        activation_grad((activation_t)(uintptr_t)self->state, dx, dy, y, in_features * batch);
+    }
+}
+
+static uint64_t no_parameters(module_t* self, tensor_f32_t** params, uint64_t max) {
+    (void)self;
+    (void)params;
+    (void)max;
+    return 0;
+}
+
+static void free_nothing(module_t* self) { (void)self; }
+
+static const module_ops_t relu_module_ops = {
+    .out_features = activation_out_features,
+    .forward = activation_module_forward,
+    .forward_into = activation_forward_into,
+    .backward_into = activation_backward_into,
+    .parameters = no_parameters,
+    .free = free_nothing,
+    .backward_reads_x = CBOOL_FALSE,
+    .backward_reads_y = CBOOL_TRUE,
+    .in_place = CBOOL_TRUE,
+    .op = OP_RELU,
+};
+
+// The same functions, profiled under their own op.
+static const module_ops_t sigmoid_module_ops = {
+    .out_features = activation_out_features,
+    .forward = activation_module_forward,
+    .forward_into = activation_forward_into,
+    .backward_into = activation_backward_into,
+    .parameters = no_parameters,
+    .free = free_nothing,
+    .backward_reads_x = CBOOL_FALSE,
+    .backward_reads_y = CBOOL_TRUE,
+    .in_place = CBOOL_TRUE,
+    .op = OP_SIGMOID,
+};
+
+module_t* new_activation_module(activation_t activation) {
+    if (activation != ACTIVATION_LEAKY_RELU && activation != ACTIVATION_SIGMOID) {
+        raise_error(ValueError, "standalone activations are leaky ReLU or sigmoid");
+    }
+    return new_module(activation == ACTIVATION_SIGMOID ? &sigmoid_module_ops : &relu_module_ops,
+                      (void*)(uintptr_t)activation);
+}
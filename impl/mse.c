@@ -1,18 +1,56 @@
 #include "much/mse.h"
+#include "much/parallel.h"
 #include <math.h>
 
+// Squared differences are summed in blocks of this many elements, then the
+// block sums in order, so the loss is the same at any thread count.
+#define MSE_BLOCK 4096
+// Float operations per element of each pass, for parallel_grain.
+#define MSE_COST 3
+
+typedef struct {
+    tensor_f32_t* a;
+    tensor_f32_t* b;
+    float* dst;
+    float scale;
+    cbool_t accumulate;
+} mse_pass_t;
+
+static void mse_grad_range(void* ctx, uint64_t begin, uint64_t end) {
+    mse_pass_t* p = (mse_pass_t*)ctx;
+    for (uint64_t i = begin; i < end; i++) {
+        float g = p->scale * (p->a->data[i] - p->b->data[i]);
+        p->dst[i] = p->accumulate == CBOOL_TRUE ? p->dst[i] + g : g;
+    }
+}
+
+static void mse_block_range(void* ctx, uint64_t begin, uint64_t end) {
+    mse_pass_t* p = (mse_pass_t*)ctx;
+    uint64_t n = p->a->meta.capacity;
+    for (uint64_t block = begin; block < end; block++) {
+        uint64_t last = (block + 1) * MSE_BLOCK < n ? (block + 1) * MSE_BLOCK : n;
+        float sum = 0.0f;
+        for (uint64_t i = block * MSE_BLOCK; i < last; i++) {
+            float d = p->a->data[i] - p->b->data[i];
+            sum += d * d;
+        }
+        p->dst[block] = sum;
+    }
+}
+
 void mse_backward(tensor_f32_t *self) {
     tensor_f32_t *a = self->prev[0];
     tensor_f32_t *b = self->prev[1];
+    float scale = self->grad[0] * 2.0f / a->meta.capacity;
     if (a->meta.require_grad == CBOOL_TRUE) {
-        for (uint64_t i = 0; i < a->meta.capacity; i++) {
-            a->grad[i] += self->grad[i] * 2.0f * (a->data[i] - b->data[i]) / a->meta.capacity;
-        }
+        cbool_t accumulate = tensor_grad_prepare(a);
+        mse_pass_t pass = {a, b, a->grad, scale, accumulate};
+        parallel_for(0, a->meta.capacity, parallel_grain(MSE_COST), mse_grad_range, &pass);
     }
     if (b->meta.require_grad == CBOOL_TRUE) {
-        for (uint64_t i = 0; i < b->meta.capacity; i++) {
-            b->grad[i] += self->grad[i] * -2.0f * (a->data[i] - b->data[i]) / a->meta.capacity;
-        }
+        cbool_t accumulate = tensor_grad_prepare(b);
+        mse_pass_t pass = {a, b, b->grad, -scale, accumulate};
+        parallel_for(0, b->meta.capacity, parallel_grain(MSE_COST), mse_grad_range, &pass);
     }
 }
 
@@ -20,22 +58,48 @@ tensor_f32_t* mse_forward(tensor_f32_t* a, tensor_f32_t* b) {
     if (a->meta.capacity != b->meta.capacity) {
         raise_error(ValueError, "tensor shapes are not compatible for mse");
     }
-    cbool_t require_grad = a->meta.require_grad == CBOOL_TRUE || b->meta.require_grad == CBOOL_TRUE;
+    // Reduced-precision and strided inputs are copied through cast nodes.
+    tensor_f32_t* a_in = a;
+    tensor_f32_t* b_in = b;
+    if (a->meta.dtype != DTYPE_F32 || tensor_is_contiguous(a) != CBOOL_TRUE) {
+        a = tensor_f32_cast(a, DTYPE_F32);
+    }
+    if (b->meta.dtype != DTYPE_F32 || tensor_is_contiguous(b) != CBOOL_TRUE) {
+        b = tensor_f32_cast(b, DTYPE_F32);
+    }
+    uint64_t start = profile_begin();
+    cbool_t require_grad = tensor_grad_enabled() == CBOOL_TRUE &&
+                           (a->meta.require_grad == CBOOL_TRUE || b->meta.require_grad == CBOOL_TRUE);
     uint64_t ret_shape[] = {1};
     tensor_f32_t* ret = new_tensor_f32(ret_shape, 1, require_grad);
 
+    uint64_t blocks = (a->meta.capacity + MSE_BLOCK - 1) / MSE_BLOCK;
+    float block_sum;
+    float* sums = blocks > 1 ? (float*)malloc(sizeof(float) * blocks) : &block_sum;
+    if (sums == NULL) {
+        raise_error(NullPointer, "malloc failed to allocate mse block sums");
+    }
+    mse_pass_t pass = {a, b, sums, 0.0f, CBOOL_FALSE};
+    parallel_for(0, blocks, parallel_grain(MSE_COST * MSE_BLOCK), mse_block_range, &pass);
     float sum = 0.0f;
-    for (uint64_t i = 0; i < a->meta.capacity; i++) {
-        sum += powf(a->data[i] - b->data[i], 2);
+    for (uint64_t block = 0; block < blocks; block++) {
+        sum += sums[block];
+    }
+    if (sums != &block_sum) {
+        free(sums);
     }
     ret->data[0] = sum / a->meta.capacity;
+    profile_record(OP_MSE, PROFILE_FORWARD, start, a->meta.capacity, 1, 0, sizeof(float));
 
     if (require_grad) {
-        ret->backward_fn = mse_backward;
-        ret->num_prev = 2;
-        ret->prev = (tensor_f32_t**)malloc(sizeof(tensor_f32_t*) * ret->num_prev);
-        ret->prev[0] = a;
-        ret->prev[1] = b;
+        tensor_f32_set_backward(ret, OP_MSE, mse_backward, (tensor_f32_t*[]){a, b}, 2);
+    }
+    // The graph holds its own references to the copies.
+    if (a != a_in) {
+        free_tensor_f32(a);
+    }
+    if (b != b_in) {
+        free_tensor_f32(b);
     }
     return ret;
 }
@@ -1,45 +1,181 @@
 #include "much/optimizer.h"
+#include "much/kernels.h"
+#include "much/parallel.h"
 #include <stdlib.h>
 #include <math.h>
 
-adam_optimizer_t* new_adam_optimizer(uint64_t num_params) {
-    adam_optimizer_t* optimizer = (adam_optimizer_t*)malloc(sizeof(adam_optimizer_t));
+// Parameters per parallel_for chunk; tensors smaller than this are updated
+// on the calling thread.
+#define OPTIMIZER_GRAIN 16384
+// Gradients of reduced-precision parameters are widened this many at a time.
+#define OPTIMIZER_CONVERT_CHUNK 512
+
+static optimizer_t* new_optimizer(optimizer_type_t type, uint64_t num_params) {
+    optimizer_t* optimizer = (optimizer_t*)malloc(sizeof(optimizer_t));
+    if (optimizer == NULL) {
+        raise_error(NullPointer, "malloc failed to allocate optimizer_t");
+    }
+    optimizer->type = type;
     optimizer->beta1 = 0.9f;
     optimizer->beta2 = 0.999f;
     optimizer->epsilon = 1e-8f;
+    optimizer->momentum = 0.0f;
+    optimizer->weight_decay = 0.0f;
+    optimizer->num_params = num_params;
     optimizer->t = 0;
+    optimizer->m = NULL;
+    optimizer->v = NULL;
+    optimizer->master = NULL;
+    return optimizer;
+}
+
+optimizer_t* new_adam_optimizer(uint64_t num_params) {
+    optimizer_t* optimizer = new_optimizer(OPTIMIZER_ADAM, num_params);
     optimizer->m = (float*)calloc(num_params, sizeof(float));
     optimizer->v = (float*)calloc(num_params, sizeof(float));
     return optimizer;
 }
 
-void free_adam_optimizer(adam_optimizer_t* optimizer) {
+optimizer_t* new_adamw_optimizer(uint64_t num_params, float weight_decay) {
+    optimizer_t* optimizer = new_adam_optimizer(num_params);
+    optimizer->type = OPTIMIZER_ADAMW;
+    optimizer->weight_decay = weight_decay;
+    return optimizer;
+}
+
+optimizer_t* new_sgd_optimizer(uint64_t num_params, float momentum) {
+    optimizer_t* optimizer = new_optimizer(OPTIMIZER_SGD, num_params);
+    optimizer->momentum = momentum;
+    if (momentum != 0.0f) {
+        optimizer->m = (float*)calloc(num_params, sizeof(float));
+    }
+    return optimizer;
+}
+
+void free_optimizer(optimizer_t* optimizer) {
     if (optimizer != NULL) {
         free(optimizer->m);
         free(optimizer->v);
+        free(optimizer->master);
         free(optimizer);
     }
 }
 
-void adam_update(adam_optimizer_t* optimizer, linear_layer_t* layer, float learning_rate) {
-    optimizer->t++;
-    uint64_t param_index = 0;
+typedef struct {
+    const optimizer_t* optimizer;
+    const adam_step_t* step;
+    const elementwise_kernels_t* kernels;
+    float* param;  // the layer's data, or its master copy
+    const float* grad;
+    float* m;
+    float* v;
+    float learning_rate;
+    // Storage of a bf16/fp16 parameter, refreshed from `param` after each
+    // chunk; DTYPE_F32 when `param` is the layer's data.
+    dtype_t dtype;
+    uint16_t* storage;
+} optimizer_task_t;
 
-    for (uint64_t i = 0; i < layer->weight->meta.capacity; i++) {
-        optimizer->m[param_index] = optimizer->beta1 * optimizer->m[param_index] + (1 - optimizer->beta1) * layer->weight->grad[i];
-        optimizer->v[param_index] = optimizer->beta2 * optimizer->v[param_index] + (1 - optimizer->beta2) * powf(layer->weight->grad[i], 2);
-        float m_hat = optimizer->m[param_index] / (1 - powf(optimizer->beta1, optimizer->t));
-        float v_hat = optimizer->v[param_index] / (1 - powf(optimizer->beta2, optimizer->t));
-        layer->weight->data[i] -= learning_rate * m_hat / (sqrtf(v_hat) + optimizer->epsilon);
-        param_index++;
+static void apply_update(optimizer_task_t* task, float* param, const float* grad, uint64_t begin,
+                         uint64_t n) {
+    const elementwise_kernels_t* k = task->kernels;
+    switch (task->optimizer->type) {
+    case OPTIMIZER_ADAM:
+    case OPTIMIZER_ADAMW:
+        k->adam(param, grad, task->m + begin, task->v + begin, n, task->step);
+        break;
+    case OPTIMIZER_SGD:
+        if (task->m != NULL) {
+            k->sgd_momentum(param, grad, task->m + begin, n, task->learning_rate,
+                            task->optimizer->momentum);
+        } else {
+            k->scale_grad(param, grad, -task->learning_rate, n, CBOOL_TRUE);
+        }
+        break;
     }
+}
 
-    for (uint64_t i = 0; i < layer->bias->meta.capacity; i++) {
-        optimizer->m[param_index] = optimizer->beta1 * optimizer->m[param_index] + (1 - optimizer->beta1) * layer->bias->grad[i];
-        optimizer->v[param_index] = optimizer->beta2 * optimizer->v[param_index] + (1 - optimizer->beta2) * powf(layer->bias->grad[i], 2);
-        float m_hat = optimizer->m[param_index] / (1 - powf(optimizer->beta1, optimizer->t));
-        float v_hat = optimizer->v[param_index] / (1 - powf(optimizer->beta2, optimizer->t));
-        layer->bias->data[i] -= learning_rate * m_hat / (sqrtf(v_hat) + optimizer->epsilon);
-        param_index++;
+static void update_range(void* ctx, uint64_t begin, uint64_t end) {
+    optimizer_task_t* task = (optimizer_task_t*)ctx;
+    if (task->dtype == DTYPE_F32) {
+        apply_update(task, task->param + begin, task->grad + begin, begin, end - begin);
+        return;
     }
+    const uint16_t* grad16 = (const uint16_t*)task->grad;
+    float grad[OPTIMIZER_CONVERT_CHUNK];
+    for (uint64_t i = begin; i < end; i += OPTIMIZER_CONVERT_CHUNK) {
+        uint64_t n = end - i < OPTIMIZER_CONVERT_CHUNK ? end - i : OPTIMIZER_CONVERT_CHUNK;
+        dtype_to_f32(grad, grad16 + i, task->dtype, n);
+        apply_update(task, task->param + i, grad, i, n);
+        dtype_from_f32(task->storage + i, task->param + i, task->dtype, n);
+    }
+}
+
+static void update_tensor(optimizer_task_t* task, tensor_f32_t* param, uint64_t offset) {
+    task->dtype = param->meta.dtype;
+    if (task->dtype == DTYPE_F32) {
+        task->param = param->data;
+        task->storage = NULL;
+    } else {
+        task->param = task->optimizer->master + offset;
+        task->storage = param->data16;
+    }
+    task->grad = (const float*)tensor_grad(param);
+    task->m = task->optimizer->m != NULL ? task->optimizer->m + offset : NULL;
+    task->v = task->optimizer->v != NULL ? task->optimizer->v + offset : NULL;
+    parallel_for(0, param->meta.capacity, OPTIMIZER_GRAIN, update_range, task);
+}
+
+// Makes the float master copy the first time a reduced-precision layer is
+// updated.
+static void init_master(optimizer_t* optimizer, linear_layer_t* layer) {
+    if (optimizer->master != NULL ||
+        (layer->weight->meta.dtype == DTYPE_F32 && layer->bias->meta.dtype == DTYPE_F32)) {
+        return;
+    }
+    optimizer->master = (float*)malloc(optimizer->num_params * sizeof(float));
+    if (optimizer->master == NULL) {
+        raise_error(NullPointer, "malloc failed to allocate master weights");
+    }
+    uint64_t weight_size = layer->weight->meta.capacity;
+    dtype_to_f32(optimizer->master, layer->weight->data, layer->weight->meta.dtype, weight_size);
+    dtype_to_f32(optimizer->master + weight_size, layer->bias->data, layer->bias->meta.dtype,
+                 layer->bias->meta.capacity);
+}
+
+void optimizer_update(optimizer_t* optimizer, linear_layer_t* layer, float learning_rate) {
+    if (layer->weight->meta.capacity + layer->bias->meta.capacity != optimizer->num_params) {
+        raise_error(ValueError, "optimizer size does not match layer parameters");
+    }
+    if (tensor_is_contiguous(layer->weight) != CBOOL_TRUE ||
+        tensor_is_contiguous(layer->bias) != CBOOL_TRUE) {
+        raise_error(ValueError, "optimizer parameters must be contiguous");
+    }
+    uint64_t start = profile_begin();
+    optimizer->t++;
+    init_master(optimizer, layer);
+
+    // The bias corrections are the same for every parameter in a step.
+    adam_step_t step;
+    step.beta1 = optimizer->beta1;
+    step.beta2 = optimizer->beta2;
+    step.step_size = learning_rate / (1.0f - powf(optimizer->beta1, optimizer->t));
+    step.inv_sqrt_bias2 = 1.0f / sqrtf(1.0f - powf(optimizer->beta2, optimizer->t));
+    step.epsilon = optimizer->epsilon;
+    step.decay = 1.0f - learning_rate * optimizer->weight_decay;
+
+    optimizer_task_t task;
+    task.optimizer = optimizer;
+    task.step = &step;
+    task.kernels = get_kernels();
+    task.learning_rate = learning_rate;
+
+    update_tensor(&task, layer->weight, 0);
+    update_tensor(&task, layer->bias, layer->weight->meta.capacity);
+
+    // The gradients are spent; the next backward overwrites them.
+    tensor_zero_grad(layer->weight);
+    tensor_zero_grad(layer->bias);
+    profile_record(OP_OPTIMIZER, PROFILE_UPDATE, start, optimizer->num_params, 1, 0,
+                   sizeof(float));
 }
@@ -0,0 +1,344 @@
+#define _GNU_SOURCE
+#include "much/parallel.h"
+#include "much/util.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Float operations a chunk should amount to before it is worth waking a
+// thread for: a few microseconds of work.
+#define PARALLEL_CHUNK_WORK (1u << 17)
+// Polls of the job counter an idle worker makes before it sleeps, so
+// back-to-back loops do not pay for a wake-up each.
+#define PARALLEL_SPIN 4096
+#define CACHE_LINE 64
+
+// One thread's share of the current range. The owner takes chunks off the
+// front and thieves take the back half, both under the slot's spinlock,
+// which is only contended while stealing.
+typedef struct {
+  _Alignas(CACHE_LINE) atomic_flag lock;
+  uint64_t begin;
+  uint64_t end;
+} range_slot_t;
+
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_cond_t done;
+  pthread_t *threads;
+  // Slot 0 is the caller's, slot i worker i's.
+  range_slot_t *slots;
+  uint64_t num_workers;
+  // Bumped once per job, and once more to shut down.
+  _Atomic uint64_t generation;
+  cbool_t shutdown;
+
+  // The job being run; only valid while `active` is nonzero.
+  parallel_range_fn fn;
+  void *ctx;
+  uint64_t chunk;
+  uint64_t grain;
+  _Atomic uint64_t active;
+} thread_pool_t;
+
+static thread_pool_t pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+// Serialises submissions; a caller that cannot take it runs inline.
+static pthread_mutex_t submit_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic uint64_t requested_threads = 0;
+static cbool_t pool_started = CBOOL_FALSE;
+static _Thread_local cbool_t in_parallel = CBOOL_FALSE;
+
+static void lock_slot(range_slot_t *slot) {
+  while (atomic_flag_test_and_set_explicit(&slot->lock,
+                                           memory_order_acquire)) {
+  }
+}
+
+static void unlock_slot(range_slot_t *slot) {
+  atomic_flag_clear_explicit(&slot->lock, memory_order_release);
+}
+
+static cbool_t take_chunk(range_slot_t *slot, uint64_t *begin,
+                          uint64_t *end) {
+  cbool_t found = CBOOL_FALSE;
+  lock_slot(slot);
+  if (slot->begin < slot->end) {
+    *begin = slot->begin;
+    *end = slot->end - slot->begin > pool.chunk ? slot->begin + pool.chunk
+                                                : slot->end;
+    slot->begin = *end;
+    found = CBOOL_TRUE;
+  }
+  unlock_slot(slot);
+  return found;
+}
+
+// Moves the back half of another thread's share into slot `self`, or all
+// of it when halving would leave pieces under the grain.
+static cbool_t steal(uint64_t self) {
+  uint64_t threads = pool.num_workers + 1;
+  for (uint64_t i = 1; i < threads; i++) {
+    range_slot_t *victim = &pool.slots[(self + i) % threads];
+    lock_slot(victim);
+    if (victim->begin >= victim->end) {
+      unlock_slot(victim);
+      continue;
+    }
+    uint64_t left = victim->end - victim->begin;
+    uint64_t take = left >= 2 * pool.grain ? left / 2 : left;
+    uint64_t end = victim->end;
+    victim->end -= take;
+    unlock_slot(victim);
+
+    range_slot_t *own = &pool.slots[self];
+    lock_slot(own);
+    own->begin = end - take;
+    own->end = end;
+    unlock_slot(own);
+    return CBOOL_TRUE;
+  }
+  return CBOOL_FALSE;
+}
+
+static void run_slots(uint64_t self) {
+  uint64_t begin;
+  uint64_t end;
+  do {
+    while (take_chunk(&pool.slots[self], &begin, &end) == CBOOL_TRUE) {
+      pool.fn(pool.ctx, begin, end);
+    }
+  } while (steal(self) == CBOOL_TRUE);
+}
+
+static void *worker_main(void *arg) {
+  uint64_t self = (uint64_t)(uintptr_t)arg;
+  in_parallel = CBOOL_TRUE;
+  uint64_t seen = 0;
+  for (;;) {
+    for (int i = 0; i < PARALLEL_SPIN &&
+                    atomic_load_explicit(&pool.generation,
+                                         memory_order_acquire) == seen;
+         i++) {
+    }
+    if (atomic_load_explicit(&pool.generation, memory_order_acquire) ==
+        seen) {
+      pthread_mutex_lock(&pool.lock);
+      while (atomic_load(&pool.generation) == seen) {
+        pthread_cond_wait(&pool.wake, &pool.lock);
+      }
+      pthread_mutex_unlock(&pool.lock);
+    }
+    seen = atomic_load_explicit(&pool.generation, memory_order_acquire);
+    if (pool.shutdown == CBOOL_TRUE) {
+      release_thread_scratch();
+      return NULL;
+    }
+
+    run_slots(self);
+
+    if (atomic_fetch_sub(&pool.active, 1) == 1) {
+      pthread_mutex_lock(&pool.lock);
+      pthread_cond_signal(&pool.done);
+      pthread_mutex_unlock(&pool.lock);
+    }
+  }
+}
+
+static uint64_t default_num_threads() {
+  const char *env = getenv("MUCH_NUM_THREADS");
+  if (env != NULL && atoi(env) > 0) {
+    return (uint64_t)atoi(env);
+  }
+#ifdef __linux__
+  cpu_set_t cpus;
+  if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0 && CPU_COUNT(&cpus) > 0) {
+    return (uint64_t)CPU_COUNT(&cpus);
+  }
+#endif
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  return cores > 0 ? (uint64_t)cores : 1;
+}
+
+// Pins worker i to the i-th core after the first one this process may
+// use, wrapping around when there are more threads. The thread that
+// happens to start the pool may not be the one that keeps submitting to
+// it, so it is left where it is; the first core stays free for it.
+static void pin_workers() {
+#ifdef __linux__
+  const char *env = getenv("MUCH_PIN_THREADS");
+  if (env == NULL || atoi(env) <= 0) {
+    return;
+  }
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    return;
+  }
+  int cores[CPU_SETSIZE];
+  int num_cores = 0;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &allowed)) {
+      cores[num_cores++] = cpu;
+    }
+  }
+  for (uint64_t i = 1; i <= pool.num_workers && num_cores > 0; i++) {
+    cpu_set_t one;
+    CPU_ZERO(&one);
+    CPU_SET(cores[i % num_cores], &one);
+    pthread_setaffinity_np(pool.threads[i - 1], sizeof(one), &one);
+  }
+#endif
+}
+
+static void start_pool() {
+  if (requested_threads == 0) {
+    requested_threads = default_num_threads();
+  }
+  pool.num_workers = requested_threads - 1;
+  pool.shutdown = CBOOL_FALSE;
+  // Workers start out having seen generation 0.
+  atomic_store(&pool.generation, 0);
+  pool.threads = NULL;
+  pool.slots = (range_slot_t *)aligned_alloc(
+      CACHE_LINE, sizeof(range_slot_t) * (pool.num_workers + 1));
+  if (pool.slots == NULL) {
+    raise_error(NullPointer, "malloc failed to allocate thread pool");
+  }
+  for (uint64_t i = 0; i <= pool.num_workers; i++) {
+    atomic_flag_clear(&pool.slots[i].lock);
+    pool.slots[i].begin = 0;
+    pool.slots[i].end = 0;
+  }
+  if (pool.num_workers > 0) {
+    pool.threads = (pthread_t *)malloc(sizeof(pthread_t) * pool.num_workers);
+    if (pool.threads == NULL) {
+      raise_error(NullPointer, "malloc failed to allocate thread pool");
+    }
+    for (uint64_t i = 0; i < pool.num_workers; i++) {
+      if (pthread_create(&pool.threads[i], NULL, worker_main,
+                         (void *)(uintptr_t)(i + 1)) != 0) {
+        raise_error(RuntimeError, "failed to start thread pool worker");
+      }
+    }
+    pin_workers();
+  }
+  pool_started = CBOOL_TRUE;
+}
+
+static void stop_pool() {
+  pthread_mutex_lock(&pool.lock);
+  pool.shutdown = CBOOL_TRUE;
+  atomic_fetch_add(&pool.generation, 1);
+  pthread_cond_broadcast(&pool.wake);
+  pthread_mutex_unlock(&pool.lock);
+  for (uint64_t i = 0; i < pool.num_workers; i++) {
+    pthread_join(pool.threads[i], NULL);
+  }
+  free(pool.threads);
+  free(pool.slots);
+  pool.threads = NULL;
+  pool.slots = NULL;
+  pool.num_workers = 0;
+  pool_started = CBOOL_FALSE;
+}
+
+uint64_t parallel_get_num_threads() {
+  uint64_t ret = atomic_load(&requested_threads);
+  return ret > 0 ? ret : default_num_threads();
+}
+
+void parallel_set_num_threads(uint64_t num_threads) {
+  pthread_mutex_lock(&submit_lock);
+  if (pool_started == CBOOL_TRUE) {
+    stop_pool();
+  }
+  requested_threads = num_threads > 0 ? num_threads : 1;
+  pthread_mutex_unlock(&submit_lock);
+}
+
+uint64_t parallel_grain(uint64_t cost) {
+  uint64_t grain = PARALLEL_CHUNK_WORK / (cost > 0 ? cost : 1);
+  return grain > 0 ? grain : 1;
+}
+
+void parallel_mark_worker() { in_parallel = CBOOL_TRUE; }
+
+cbool_t parallel_is_worker() { return in_parallel; }
+
+uint64_t parallel_blas_threads() {
+  return in_parallel == CBOOL_TRUE ? 1 : parallel_get_num_threads();
+}
+
+// Where share i of n items split `parts` ways starts; shares past the last
+// are empty.
+static uint64_t share_start(uint64_t n, uint64_t parts, uint64_t i) {
+  if (i >= parts) {
+    return n;
+  }
+  uint64_t extra = n % parts;
+  return n / parts * i + (i < extra ? i : extra);
+}
+
+void parallel_for(uint64_t begin, uint64_t end, uint64_t grain,
+                  parallel_range_fn fn, void *ctx) {
+  if (begin >= end) {
+    return;
+  }
+  if (grain == 0) {
+    grain = parallel_grain(1);
+  }
+  uint64_t n = end - begin;
+  if (n <= grain || in_parallel == CBOOL_TRUE ||
+      pthread_mutex_trylock(&submit_lock) != 0) {
+    fn(ctx, begin, end);
+    return;
+  }
+  if (pool_started != CBOOL_TRUE) {
+    start_pool();
+  }
+  // Only as many threads start with a share as the range has grains for;
+  // the rest join in by stealing.
+  uint64_t threads = pool.num_workers + 1;
+  uint64_t sharing = n / grain < threads ? n / grain : threads;
+  if (sharing <= 1) {
+    pthread_mutex_unlock(&submit_lock);
+    fn(ctx, begin, end);
+    return;
+  }
+
+  // A few chunks per share, so the owner leaves something to steal without
+  // making chunks smaller than the grain.
+  uint64_t chunk = n / (sharing * 4);
+  pool.chunk = chunk > grain ? chunk : grain;
+  pool.grain = grain;
+  pool.fn = fn;
+  pool.ctx = ctx;
+  for (uint64_t i = 0; i < threads; i++) {
+    pool.slots[i].begin = begin + share_start(n, sharing, i);
+    pool.slots[i].end = begin + share_start(n, sharing, i + 1);
+  }
+  atomic_store(&pool.active, pool.num_workers);
+  atomic_fetch_add_explicit(&pool.generation, 1, memory_order_release);
+  pthread_mutex_lock(&pool.lock);
+  pthread_cond_broadcast(&pool.wake);
+  pthread_mutex_unlock(&pool.lock);
+
+  in_parallel = CBOOL_TRUE;
+  run_slots(0);
+  in_parallel = CBOOL_FALSE;
+
+  for (int i = 0; i < PARALLEL_SPIN && atomic_load(&pool.active) > 0; i++) {
+  }
+  pthread_mutex_lock(&pool.lock);
+  while (atomic_load(&pool.active) > 0) {
+    pthread_cond_wait(&pool.done, &pool.lock);
+  }
+  pthread_mutex_unlock(&pool.lock);
+  pthread_mutex_unlock(&submit_lock);
+}
@@ -0,0 +1,260 @@
+#include "much/profile.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Rough per-element costs. `streams` counts the arrays of the result's size
+// an op reads or writes; gemm-shaped ops are costed from their dimensions.
+typedef struct {
+  const char *name;
+  uint64_t flops[PROFILE_PHASE_COUNT];
+  uint64_t streams[PROFILE_PHASE_COUNT];
+  cbool_t gemm;
+} op_cost_t;
+
+static const op_cost_t op_costs[OP_KIND_COUNT] = {
+    [OP_NONE] = {"none", {0, 0, 0}, {0, 0, 0}, CBOOL_FALSE},
+    [OP_ADD] = {"add", {1, 1, 0}, {3, 3, 0}, CBOOL_FALSE},
+    [OP_SUB] = {"sub", {1, 1, 0}, {3, 3, 0}, CBOOL_FALSE},
+    [OP_MUL] = {"mul", {1, 2, 0}, {3, 5, 0}, CBOOL_FALSE},
+    [OP_DIV] = {"div", {1, 3, 0}, {3, 5, 0}, CBOOL_FALSE},
+    [OP_MATMUL] = {"matmul", {0, 0, 0}, {0, 0, 0}, CBOOL_TRUE},
+    [OP_SIGMOID] = {"sigmoid", {4, 3, 0}, {2, 3, 0}, CBOOL_FALSE},
+    [OP_TANH] = {"tanh", {4, 3, 0}, {2, 3, 0}, CBOOL_FALSE},
+    [OP_RELU] = {"relu", {1, 1, 0}, {2, 3, 0}, CBOOL_FALSE},
+    [OP_CAST] = {"cast", {0, 0, 0}, {2, 2, 0}, CBOOL_FALSE},
+    [OP_VIEW] = {"view", {0, 0, 0}, {0, 0, 0}, CBOOL_FALSE},
+    [OP_LINEAR] = {"linear", {0, 0, 0}, {0, 0, 0}, CBOOL_TRUE},
+    [OP_CONV2D] = {"conv2d", {0, 0, 0}, {0, 0, 0}, CBOOL_TRUE},
+    // Pools as used with 2x2 windows: four inputs per output.
+    [OP_MAX_POOL] = {"max_pool", {4, 4, 0}, {5, 9, 0}, CBOOL_FALSE},
+    [OP_AVG_POOL] = {"avg_pool", {4, 4, 0}, {5, 5, 0}, CBOOL_FALSE},
+    [OP_CROSSENTROPY] = {"crossentropy", {5, 2, 0}, {2, 3, 0}, CBOOL_FALSE},
+    [OP_SOFTMAX_CROSSENTROPY] = {"softmax_crossentropy",
+                                 {5, 1, 0},
+                                 {2, 2, 0},
+                                 CBOOL_FALSE},
+    [OP_MSE] = {"mse", {3, 3, 0}, {2, 4, 0}, CBOOL_FALSE},
+    // Adam: parameter, gradient and both moments read, three written.
+    [OP_OPTIMIZER] = {"optimizer", {0, 0, 10}, {0, 0, 7}, CBOOL_FALSE},
+};
+
+static const char *phase_names[PROFILE_PHASE_COUNT] = {"forward", "backward",
+                                                       "update"};
+
+const char *op_kind_name(op_kind_t op) {
+  return op < OP_KIND_COUNT ? op_costs[op].name : "unknown";
+}
+
+const char *profile_phase_name(profile_phase_t phase) {
+  return phase < PROFILE_PHASE_COUNT ? phase_names[phase] : "unknown";
+}
+
+typedef struct {
+  _Atomic uint64_t calls;
+  _Atomic uint64_t ns;
+  _Atomic uint64_t flops;
+  _Atomic uint64_t bytes;
+} profile_stat_t;
+
+// One op call, or a step when `op` is OP_NONE.
+typedef struct {
+  uint64_t start;
+  uint64_t duration;
+  uint64_t flops;
+  uint64_t bytes;
+  uint32_t thread;
+  uint8_t op;
+  uint8_t phase;
+} profile_event_t;
+
+atomic_bool profile_enabled = false;
+
+static profile_stat_t stats[OP_KIND_COUNT][PROFILE_PHASE_COUNT];
+static profile_event_t *events = NULL;
+static uint64_t max_events = 0;
+static _Atomic uint64_t num_events = 0;
+static uint64_t origin = 0;
+static uint64_t last_step = 0;
+static uint64_t num_steps = 0;
+static uint64_t step_ns = 0;
+
+static _Atomic uint32_t next_thread = 0;
+static _Thread_local uint32_t thread_number = 0;
+
+uint64_t profile_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  // Never 0, which profile_record reads as "not profiling".
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec + 1;
+}
+
+static void add_event(op_kind_t op, profile_phase_t phase, uint64_t start,
+                      uint64_t end, uint64_t flops, uint64_t bytes) {
+  if (max_events == 0) {
+    return;
+  }
+  uint64_t slot = atomic_fetch_add_explicit(&num_events, 1,
+                                            memory_order_relaxed);
+  if (slot >= max_events) {
+    return;
+  }
+  if (thread_number == 0) {
+    thread_number = atomic_fetch_add(&next_thread, 1) + 1;
+  }
+  events[slot] = (profile_event_t){start, end - start, flops, bytes,
+                                   thread_number, (uint8_t)op, (uint8_t)phase};
+}
+
+void profile_clear() {
+  atomic_store(&profile_enabled, false);
+  free(events);
+  events = NULL;
+  max_events = 0;
+  atomic_store(&num_events, 0);
+  for (int op = 0; op < OP_KIND_COUNT; op++) {
+    for (int phase = 0; phase < PROFILE_PHASE_COUNT; phase++) {
+      profile_stat_t *s = &stats[op][phase];
+      atomic_store(&s->calls, 0);
+      atomic_store(&s->ns, 0);
+      atomic_store(&s->flops, 0);
+      atomic_store(&s->bytes, 0);
+    }
+  }
+  num_steps = 0;
+  step_ns = 0;
+}
+
+void profile_start(uint64_t trace_events) {
+  profile_clear();
+  if (trace_events > 0) {
+    events = (profile_event_t *)malloc(sizeof(profile_event_t) * trace_events);
+    if (events == NULL) {
+      raise_error(NullPointer, "malloc failed to allocate profile trace");
+    }
+    max_events = trace_events;
+  }
+  origin = profile_now_ns();
+  last_step = origin;
+  atomic_store(&profile_enabled, true);
+}
+
+void profile_stop() { atomic_store(&profile_enabled, false); }
+
+void profile_step() {
+  if (!atomic_load_explicit(&profile_enabled, memory_order_relaxed)) {
+    return;
+  }
+  uint64_t now = profile_now_ns();
+  add_event(OP_NONE, PROFILE_FORWARD, last_step, now, 0, 0);
+  step_ns += now - last_step;
+  num_steps++;
+  last_step = now;
+}
+
+void profile_record(op_kind_t op, profile_phase_t phase, uint64_t start,
+                    uint64_t rows, uint64_t cols, uint64_t inner,
+                    size_t element_bytes) {
+  if (start == 0) {
+    return;
+  }
+  uint64_t end = profile_now_ns();
+  const op_cost_t *cost = &op_costs[op];
+  uint64_t flops;
+  uint64_t bytes;
+  if (cost->gemm == CBOOL_TRUE) {
+    // Backward computes the gradients of both operands.
+    uint64_t passes = phase == PROFILE_BACKWARD ? 2 : 1;
+    flops = passes * 2 * rows * cols * inner;
+    bytes = passes * (rows * inner + inner * cols + rows * cols) *
+            element_bytes;
+  } else {
+    flops = cost->flops[phase] * rows * cols;
+    bytes = cost->streams[phase] * rows * cols * element_bytes;
+  }
+  profile_stat_t *s = &stats[op][phase];
+  atomic_fetch_add_explicit(&s->calls, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&s->ns, end - start, memory_order_relaxed);
+  atomic_fetch_add_explicit(&s->flops, flops, memory_order_relaxed);
+  atomic_fetch_add_explicit(&s->bytes, bytes, memory_order_relaxed);
+  add_event(op, phase, start, end, flops, bytes);
+}
+
+typedef struct {
+  op_kind_t op;
+  profile_phase_t phase;
+  uint64_t ns;
+} profile_row_t;
+
+static int compare_rows(const void *a, const void *b) {
+  uint64_t x = ((const profile_row_t *)a)->ns;
+  uint64_t y = ((const profile_row_t *)b)->ns;
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+void profile_report(FILE *out) {
+  profile_row_t rows[OP_KIND_COUNT * PROFILE_PHASE_COUNT];
+  uint64_t num_rows = 0;
+  for (int op = 0; op < OP_KIND_COUNT; op++) {
+    for (int phase = 0; phase < PROFILE_PHASE_COUNT; phase++) {
+      if (atomic_load(&stats[op][phase].calls) > 0) {
+        rows[num_rows++] = (profile_row_t){(op_kind_t)op,
+                                           (profile_phase_t)phase,
+                                           atomic_load(&stats[op][phase].ns)};
+      }
+    }
+  }
+  qsort(rows, num_rows, sizeof(profile_row_t), compare_rows);
+
+  uint64_t steps = num_steps > 0 ? num_steps : 1;
+  fprintf(out, "Profile: %llu steps, %.3f ms per step\n",
+          (unsigned long long)num_steps, step_ns * 1e-6 / steps);
+  fprintf(out, "%-22s %-9s %10s %10s %7s %9s %8s\n", "op", "phase", "calls",
+          "ms/step", "step%", "GFLOP/s", "GB/s");
+  for (uint64_t i = 0; i < num_rows; i++) {
+    profile_stat_t *s = &stats[rows[i].op][rows[i].phase];
+    double seconds = rows[i].ns * 1e-9;
+    fprintf(out, "%-22s %-9s %10llu %10.3f %6.1f%% %9.2f %8.2f\n",
+            op_kind_name(rows[i].op), profile_phase_name(rows[i].phase),
+            (unsigned long long)atomic_load(&s->calls),
+            rows[i].ns * 1e-6 / steps,
+            step_ns > 0 ? 100.0 * rows[i].ns / step_ns : 0.0,
+            atomic_load(&s->flops) * 1e-9 / seconds,
+            atomic_load(&s->bytes) * 1e-9 / seconds);
+  }
+  uint64_t recorded = atomic_load(&num_events);
+  if (recorded > max_events && max_events > 0) {
+    fprintf(out, "Trace kept %llu of %llu events\n",
+            (unsigned long long)max_events, (unsigned long long)recorded);
+  }
+}
+
+cbool_t profile_write_trace(const char *path) {
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    return CBOOL_FALSE;
+  }
+  uint64_t n = atomic_load(&num_events);
+  if (n > max_events) {
+    n = max_events;
+  }
+  // Complete ("X") events in microseconds since profile_start.
+  fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+  for (uint64_t i = 0; i < n; i++) {
+    const profile_event_t *e = &events[i];
+    cbool_t step = e->op == OP_NONE ? CBOOL_TRUE : CBOOL_FALSE;
+    fprintf(f,
+            "%s\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", "
+            "\"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %u",
+            i > 0 ? "," : "", step ? "step" : op_kind_name(e->op),
+            step ? "step" : profile_phase_name(e->phase),
+            (e->start - origin) * 1e-3, e->duration * 1e-3, e->thread);
+    if (step != CBOOL_TRUE) {
+      fprintf(f, ", \"args\": {\"flops\": %llu, \"bytes\": %llu}",
+              (unsigned long long)e->flops, (unsigned long long)e->bytes);
+    }
+    fprintf(f, "}");
+  }
+  fprintf(f, "\n]}\n");
+  return fclose(f) == 0 ? CBOOL_TRUE : CBOOL_FALSE;
+}
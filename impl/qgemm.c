@@ -0,0 +1,62 @@
+#include "qgemm_internal.h"
+#include "much/kernels.h"
+#include <stdatomic.h>
+
+void qgemm_scalar(int32_t *out, const int8_t *w, const int32_t *w_row_sums,
+                  const int8_t *x, uint64_t row_begin, uint64_t row_end,
+                  uint64_t N, uint64_t K) {
+  (void)w_row_sums;
+  for (uint64_t m = row_begin; m < row_end; m++) {
+    const int8_t *wr = w + m * K;
+    for (uint64_t n = 0; n < N; n++) {
+      const int8_t *xr = x + n * K;
+      int32_t acc = 0;
+      for (uint64_t k = 0; k < K; k++) {
+        acc += (int32_t)wr[k] * (int32_t)xr[k];
+      }
+      out[m * N + n] = acc;
+    }
+  }
+}
+
+typedef struct {
+  qgemm_fn fn;
+  const char *name;
+} qgemm_choice_t;
+
+static qgemm_choice_t choose_qgemm() {
+  // get_kernels() already applies the MUCH_SIMD cap.
+  simd_level_t level = get_kernels()->level;
+#ifdef MUCH_X86_KERNELS
+  __builtin_cpu_init();
+  if (level >= SIMD_AVX512 && __builtin_cpu_supports("avx512bw") &&
+      __builtin_cpu_supports("avx512vnni")) {
+    return (qgemm_choice_t){qgemm_avx512_vnni, "avx512-vnni"};
+  }
+  if (level >= SIMD_AVX2) {
+    return (qgemm_choice_t){qgemm_avx2, "avx2"};
+  }
+#else
+  (void)level;
+#endif
+  return (qgemm_choice_t){qgemm_scalar, "scalar"};
+}
+
+static _Atomic(qgemm_fn) active_qgemm = NULL;
+static _Atomic(const char *) active_qgemm_name = NULL;
+
+qgemm_fn get_qgemm() {
+  qgemm_fn ret = atomic_load(&active_qgemm);
+  if (ret == NULL) {
+    qgemm_choice_t choice = choose_qgemm();
+    atomic_store(&active_qgemm_name, choice.name);
+    atomic_store(&active_qgemm, choice.fn);
+    ret = choice.fn;
+  }
+  return ret;
+}
+
+const char *get_qgemm_name() {
+  get_qgemm();
+  return atomic_load(&active_qgemm_name);
+}
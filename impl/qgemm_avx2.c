@@ -0,0 +1,58 @@
+#include "qgemm_internal.h"
+#include <immintrin.h>
+
+static inline int32_t hsum_epi32(__m256i v) {
+  __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v),
+                              _mm256_extracti128_si256(v, 1));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(sum);
+}
+
+// maddubs multiplies unsigned by signed bytes, so the weight's sign is moved
+// onto the activation. Both operands stay within [-127, 127], so the pairwise
+// int16 sums cannot saturate.
+static inline __m256i dot_step(__m256i acc, __m256i abs_w, __m256i w,
+                               const int8_t *x, __m256i ones) {
+  __m256i xv = _mm256_loadu_si256((const __m256i *)x);
+  __m256i prod = _mm256_maddubs_epi16(abs_w, _mm256_sign_epi8(xv, w));
+  return _mm256_add_epi32(acc, _mm256_madd_epi16(prod, ones));
+}
+
+void qgemm_avx2(int32_t *out, const int8_t *w, const int32_t *w_row_sums,
+                const int8_t *x, uint64_t row_begin, uint64_t row_end,
+                uint64_t N, uint64_t K) {
+  (void)w_row_sums;
+  const __m256i ones = _mm256_set1_epi16(1);
+  for (uint64_t m = row_begin; m < row_end; m++) {
+    const int8_t *wr = w + m * K;
+    uint64_t n = 0;
+    for (; n + 4 <= N; n += 4) {
+      const int8_t *x0 = x + n * K;
+      __m256i acc0 = _mm256_setzero_si256();
+      __m256i acc1 = _mm256_setzero_si256();
+      __m256i acc2 = _mm256_setzero_si256();
+      __m256i acc3 = _mm256_setzero_si256();
+      for (uint64_t k = 0; k < K; k += 32) {
+        __m256i wv = _mm256_loadu_si256((const __m256i *)(wr + k));
+        __m256i abs_w = _mm256_abs_epi8(wv);
+        acc0 = dot_step(acc0, abs_w, wv, x0 + k, ones);
+        acc1 = dot_step(acc1, abs_w, wv, x0 + K + k, ones);
+        acc2 = dot_step(acc2, abs_w, wv, x0 + 2 * K + k, ones);
+        acc3 = dot_step(acc3, abs_w, wv, x0 + 3 * K + k, ones);
+      }
+      out[m * N + n] = hsum_epi32(acc0);
+      out[m * N + n + 1] = hsum_epi32(acc1);
+      out[m * N + n + 2] = hsum_epi32(acc2);
+      out[m * N + n + 3] = hsum_epi32(acc3);
+    }
+    for (; n < N; n++) {
+      __m256i acc = _mm256_setzero_si256();
+      for (uint64_t k = 0; k < K; k += 32) {
+        __m256i wv = _mm256_loadu_si256((const __m256i *)(wr + k));
+        acc = dot_step(acc, _mm256_abs_epi8(wv), wv, x + n * K + k, ones);
+      }
+      out[m * N + n] = hsum_epi32(acc);
+    }
+  }
+}
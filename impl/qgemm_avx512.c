@@ -0,0 +1,128 @@
+#include "qgemm_internal.h"
+#include <immintrin.h>
+
+// vpdpbusd multiplies unsigned by signed bytes. Flipping the sign bit of an
+// activation gives x + 128 as unsigned, so each dot product comes out as
+// w . x + 128 * sum(w) and the row sum is subtracted afterwards.
+static inline __m512i load_biased(const int8_t *x, __m512i bias) {
+  return _mm512_xor_si512(_mm512_loadu_si512(x), bias);
+}
+
+// The totals of four accumulators, in lanes 0 to 3.
+static inline __m128i reduce4(__m512i a0, __m512i a1, __m512i a2,
+                              __m512i a3) {
+  __m256i s0 = _mm256_add_epi32(_mm512_castsi512_si256(a0),
+                                _mm512_extracti64x4_epi64(a0, 1));
+  __m256i s1 = _mm256_add_epi32(_mm512_castsi512_si256(a1),
+                                _mm512_extracti64x4_epi64(a1, 1));
+  __m256i s2 = _mm256_add_epi32(_mm512_castsi512_si256(a2),
+                                _mm512_extracti64x4_epi64(a2, 1));
+  __m256i s3 = _mm256_add_epi32(_mm512_castsi512_si256(a3),
+                                _mm512_extracti64x4_epi64(a3, 1));
+  __m256i s = _mm256_hadd_epi32(_mm256_hadd_epi32(s0, s1),
+                                _mm256_hadd_epi32(s2, s3));
+  return _mm_add_epi32(_mm256_castsi256_si128(s),
+                       _mm256_extracti128_si256(s, 1));
+}
+
+// Rows m and m + 1 against columns n to n + 3: eight independent
+// accumulators keep vpdpbusd busy, and each activation load serves both
+// rows.
+static inline void block_2x4(int32_t *out, const int8_t *w0,
+                             const int8_t *x0, uint64_t N, uint64_t K,
+                             __m128i correction0, __m128i correction1,
+                             __m512i bias) {
+  const int8_t *w1 = w0 + K;
+  __m512i acc00 = _mm512_setzero_si512();
+  __m512i acc01 = _mm512_setzero_si512();
+  __m512i acc02 = _mm512_setzero_si512();
+  __m512i acc03 = _mm512_setzero_si512();
+  __m512i acc10 = _mm512_setzero_si512();
+  __m512i acc11 = _mm512_setzero_si512();
+  __m512i acc12 = _mm512_setzero_si512();
+  __m512i acc13 = _mm512_setzero_si512();
+  for (uint64_t k = 0; k < K; k += 64) {
+    __m512i wv0 = _mm512_loadu_si512(w0 + k);
+    __m512i wv1 = _mm512_loadu_si512(w1 + k);
+    __m512i xv = load_biased(x0 + k, bias);
+    acc00 = _mm512_dpbusd_epi32(acc00, xv, wv0);
+    acc10 = _mm512_dpbusd_epi32(acc10, xv, wv1);
+    xv = load_biased(x0 + K + k, bias);
+    acc01 = _mm512_dpbusd_epi32(acc01, xv, wv0);
+    acc11 = _mm512_dpbusd_epi32(acc11, xv, wv1);
+    xv = load_biased(x0 + 2 * K + k, bias);
+    acc02 = _mm512_dpbusd_epi32(acc02, xv, wv0);
+    acc12 = _mm512_dpbusd_epi32(acc12, xv, wv1);
+    xv = load_biased(x0 + 3 * K + k, bias);
+    acc03 = _mm512_dpbusd_epi32(acc03, xv, wv0);
+    acc13 = _mm512_dpbusd_epi32(acc13, xv, wv1);
+  }
+  _mm_storeu_si128((__m128i *)out,
+                   _mm_sub_epi32(reduce4(acc00, acc01, acc02, acc03),
+                                 correction0));
+  _mm_storeu_si128((__m128i *)(out + N),
+                   _mm_sub_epi32(reduce4(acc10, acc11, acc12, acc13),
+                                 correction1));
+}
+
+// One row against columns n to n + 3.
+static inline void block_1x4(int32_t *out, const int8_t *w0,
+                             const int8_t *x0, uint64_t K,
+                             __m128i correction, __m512i bias) {
+  __m512i acc0 = _mm512_setzero_si512();
+  __m512i acc1 = _mm512_setzero_si512();
+  __m512i acc2 = _mm512_setzero_si512();
+  __m512i acc3 = _mm512_setzero_si512();
+  for (uint64_t k = 0; k < K; k += 64) {
+    __m512i wv = _mm512_loadu_si512(w0 + k);
+    acc0 = _mm512_dpbusd_epi32(acc0, load_biased(x0 + k, bias), wv);
+    acc1 = _mm512_dpbusd_epi32(acc1, load_biased(x0 + K + k, bias), wv);
+    acc2 = _mm512_dpbusd_epi32(acc2, load_biased(x0 + 2 * K + k, bias), wv);
+    acc3 = _mm512_dpbusd_epi32(acc3, load_biased(x0 + 3 * K + k, bias), wv);
+  }
+  _mm_storeu_si128((__m128i *)out,
+                   _mm_sub_epi32(reduce4(acc0, acc1, acc2, acc3), correction));
+}
+
+static inline int32_t dot_1x1(const int8_t *w0, const int8_t *x0, uint64_t K,
+                              __m512i bias) {
+  __m512i acc = _mm512_setzero_si512();
+  for (uint64_t k = 0; k < K; k += 64) {
+    acc = _mm512_dpbusd_epi32(acc, load_biased(x0 + k, bias),
+                              _mm512_loadu_si512(w0 + k));
+  }
+  return _mm512_reduce_add_epi32(acc);
+}
+
+void qgemm_avx512_vnni(int32_t *out, const int8_t *w, const int32_t *w_row_sums,
+                       const int8_t *x, uint64_t row_begin, uint64_t row_end,
+                       uint64_t N, uint64_t K) {
+  const __m512i bias = _mm512_set1_epi8((char)0x80);
+  uint64_t m = row_begin;
+  for (; m + 2 <= row_end; m += 2) {
+    __m128i correction0 = _mm_set1_epi32(128 * w_row_sums[m]);
+    __m128i correction1 = _mm_set1_epi32(128 * w_row_sums[m + 1]);
+    uint64_t n = 0;
+    for (; n + 4 <= N; n += 4) {
+      block_2x4(out + m * N + n, w + m * K, x + n * K, N, K, correction0,
+                correction1, bias);
+    }
+    for (; n < N; n++) {
+      out[m * N + n] = dot_1x1(w + m * K, x + n * K, K, bias) -
+                       128 * w_row_sums[m];
+      out[(m + 1) * N + n] = dot_1x1(w + (m + 1) * K, x + n * K, K, bias) -
+                             128 * w_row_sums[m + 1];
+    }
+  }
+  if (m < row_end) {
+    __m128i correction = _mm_set1_epi32(128 * w_row_sums[m]);
+    uint64_t n = 0;
+    for (; n + 4 <= N; n += 4) {
+      block_1x4(out + m * N + n, w + m * K, x + n * K, K, correction, bias);
+    }
+    for (; n < N; n++) {
+      out[m * N + n] = dot_1x1(w + m * K, x + n * K, K, bias) -
+                       128 * w_row_sums[m];
+    }
+  }
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <stdint.h>
+
+// out[m, n] = sum_k w[m, k] * x[n, k] over int8 rows padded with zeros to a
+// multiple of QGEMM_K_ALIGN. Only rows [row_begin, row_end) of `out` are
+// written. `w_row_sums` holds sum_k w[m, k], which kernels that bias the
+// activations to unsigned need to undo the bias.
+#define QGEMM_K_ALIGN 64
+
+typedef void (*qgemm_fn)(int32_t *out, const int8_t *w, const int32_t *w_row_sums,
+                         const int8_t *x, uint64_t row_begin, uint64_t row_end,
+                         uint64_t N, uint64_t K);
+
+void qgemm_scalar(int32_t *out, const int8_t *w, const int32_t *w_row_sums,
+                  const int8_t *x, uint64_t row_begin, uint64_t row_end,
+                  uint64_t N, uint64_t K);
+void qgemm_avx2(int32_t *out, const int8_t *w, const int32_t *w_row_sums,
+                const int8_t *x, uint64_t row_begin, uint64_t row_end,
+                uint64_t N, uint64_t K);
+void qgemm_avx512_vnni(int32_t *out, const int8_t *w, const int32_t *w_row_sums,
+                       const int8_t *x, uint64_t row_begin, uint64_t row_end,
+                       uint64_t N, uint64_t K);
+
+// The fastest kernel this CPU supports, within the MUCH_SIMD cap.
+qgemm_fn get_qgemm();
+const char *get_qgemm_name();
@@ -0,0 +1,268 @@
+#include "much/quantize.h"
+#include "much/kernels.h"
+#include "much/parallel.h"
+#include "qgemm_internal.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define QUANT_MAX 127.0f
+// Output rows per parallel_for chunk.
+#define QGEMM_GRAIN 16
+#define OBSERVE_CHUNK 512
+
+// Per-thread scratch for the quantized input, its scales and the int32
+// accumulators, grown on demand.
+static _Thread_local void* quant_scratch = NULL;
+static _Thread_local uint64_t quant_scratch_capacity = 0;
+
+static void release_quant_scratch() {
+    free(quant_scratch);
+    quant_scratch = NULL;
+    quant_scratch_capacity = 0;
+}
+
+static void* reserve_quant_scratch(uint64_t size) {
+    if (size > quant_scratch_capacity) {
+        register_thread_scratch(release_quant_scratch);
+        free(quant_scratch);
+        quant_scratch = aligned_alloc(64, (size + 63) & ~(uint64_t)63);
+        if (quant_scratch == NULL) {
+            raise_error(NullPointer, "malloc failed to allocate quantization scratch");
+        }
+        quant_scratch_capacity = size;
+    }
+    return quant_scratch;
+}
+
+static int8_t quantize_value(float x, float inv_scale) {
+    float q = nearbyintf(x * inv_scale);
+    if (q > QUANT_MAX) {
+        q = QUANT_MAX;
+    } else if (q < -QUANT_MAX) {
+        q = -QUANT_MAX;
+    }
+    return (int8_t)q;
+}
+
+quantized_linear_layer_t* new_quantized_linear_layer(linear_layer_t* layer) {
+    uint64_t out_features = layer->weight->meta.shape[0];
+    uint64_t in_features = layer->weight->meta.shape[1];
+    uint64_t padded_in = (in_features + QGEMM_K_ALIGN - 1) / QGEMM_K_ALIGN * QGEMM_K_ALIGN;
+
+    quantized_linear_layer_t* ret = (quantized_linear_layer_t*)malloc(sizeof(quantized_linear_layer_t));
+    if (ret == NULL) {
+        raise_error(NullPointer, "malloc failed to allocate quantized_linear_layer_t");
+    }
+    ret->in_features = in_features;
+    ret->out_features = out_features;
+    ret->padded_in = padded_in;
+    ret->weight = (int8_t*)aligned_alloc(64, out_features * padded_in);
+    ret->weight_scale = (float*)malloc(out_features * sizeof(float));
+    ret->weight_row_sum = (int32_t*)malloc(out_features * sizeof(int32_t));
+    ret->bias = (float*)malloc(out_features * sizeof(float));
+    if (ret->weight == NULL || ret->weight_scale == NULL || ret->weight_row_sum == NULL || ret->bias == NULL) {
+        raise_error(NullPointer, "malloc failed to allocate quantized weights");
+    }
+    ret->input_max = 0.0f;
+    ret->input_scale = 0.0f;
+
+    // Reduced-precision weights are widened one row at a time.
+    dtype_t dtype = layer->weight->meta.dtype;
+    size_t elem = dtype_size(dtype);
+    float* widened = (float*)malloc(in_features * sizeof(float));
+    if (widened == NULL) {
+        raise_error(NullPointer, "malloc failed to allocate quantization row");
+    }
+
+    memset(ret->weight, 0, out_features * padded_in);
+    for (uint64_t o = 0; o < out_features; o++) {
+        const float* row = widened;
+        dtype_to_f32(widened, (const uint8_t*)layer->weight->data + o * in_features * elem, dtype,
+                     in_features);
+        float max_abs = 0.0f;
+        for (uint64_t i = 0; i < in_features; i++) {
+            max_abs = fmaxf(max_abs, fabsf(row[i]));
+        }
+        float scale = max_abs > 0.0f ? max_abs / QUANT_MAX : 1.0f;
+        int32_t row_sum = 0;
+        for (uint64_t i = 0; i < in_features; i++) {
+            int8_t q = quantize_value(row[i], 1.0f / scale);
+            ret->weight[o * padded_in + i] = q;
+            row_sum += q;
+        }
+        ret->weight_scale[o] = scale;
+        ret->weight_row_sum[o] = row_sum;
+    }
+    free(widened);
+    dtype_to_f32(ret->bias, layer->bias->data, layer->bias->meta.dtype, out_features);
+    return ret;
+}
+
+void free_quantized_linear_layer(quantized_linear_layer_t* layer) {
+    if (layer != NULL) {
+        free(layer->weight);
+        free(layer->weight_scale);
+        free(layer->weight_row_sum);
+        free(layer->bias);
+        free(layer);
+    }
+}
+
+void quantized_linear_observe(quantized_linear_layer_t* layer, tensor_f32_t* x) {
+    if (tensor_is_contiguous(x) != CBOOL_TRUE) {
+        raise_error(ValueError, "quantized linear observes contiguous activations");
+    }
+    // Activations of a reduced-precision model are widened in chunks.
+    float chunk[OBSERVE_CHUNK];
+    size_t elem = dtype_size(x->meta.dtype);
+    for (uint64_t i = 0; i < x->meta.capacity; i += OBSERVE_CHUNK) {
+        uint64_t n = x->meta.capacity - i < OBSERVE_CHUNK ? x->meta.capacity - i : OBSERVE_CHUNK;
+        dtype_to_f32(chunk, (const uint8_t*)x->data + i * elem, x->meta.dtype, n);
+        for (uint64_t j = 0; j < n; j++) {
+            layer->input_max = fmaxf(layer->input_max, fabsf(chunk[j]));
+        }
+    }
+}
+
+void quantized_linear_calibrate(quantized_linear_layer_t* layer) {
+    layer->input_scale = layer->input_max > 0.0f ? layer->input_max / QUANT_MAX : 1.0f;
+}
+
+typedef struct {
+    quantized_linear_layer_t* layer;
+    qgemm_fn gemm;
+    int32_t* acc;
+    const int8_t* xq;
+    uint64_t batch;
+} qgemm_ctx_t;
+
+static void qgemm_range(void* ctx, uint64_t begin, uint64_t end) {
+    qgemm_ctx_t* c = (qgemm_ctx_t*)ctx;
+    c->gemm(c->acc, c->layer->weight, c->layer->weight_row_sum, c->xq, begin, end, c->batch,
+            c->layer->padded_in);
+}
+
+// Columns quantized per tile: QGEMM_K_ALIGN rows of this many int8 values
+// stay in L1 while they are transposed into the GEMM's layout.
+#define QUANT_TILE_COLS 256
+
+// Row i of x from column b on, `cols` floats long; strided columns are
+// gathered into `buffer` first.
+static const float* column_run(tensor_f32_t* x, uint64_t i, uint64_t b, uint64_t cols,
+                               float* buffer) {
+    const float* row = x->data + i * x->meta.strides[0];
+    uint64_t col_stride = x->meta.strides[1];
+    if (col_stride == 1) {
+        return row + b;
+    }
+    for (uint64_t j = 0; j < cols; j++) {
+        buffer[j] = row[(b + j) * col_stride];
+    }
+    return buffer;
+}
+
+tensor_f32_t* quantized_linear_forward(quantized_linear_layer_t* layer, tensor_f32_t* x,
+                                       activation_t activation) {
+    if (x->meta.shape_length != 2 || x->meta.shape[0] != layer->in_features) {
+        raise_error(ValueError, "tensor shapes are not compatible for quantized linear");
+    }
+    if (x->meta.dtype != DTYPE_F32) {
+        raise_error(ValueError, "quantized linear expects float inputs");
+    }
+    const elementwise_kernels_t* k = get_kernels();
+    uint64_t in = layer->in_features;
+    uint64_t out = layer->out_features;
+    uint64_t padded = layer->padded_in;
+    uint64_t batch = x->meta.shape[1];
+
+    // Scratch layout: int32 accumulators, column scales and their inverses,
+    // then the inputs transposed to [batch, padded_in] so every dot product
+    // reads two contiguous int8 rows.
+    uint64_t scales_size = (batch * sizeof(float) + 63) & ~(uint64_t)63;
+    uint64_t scale_offset = (out * batch * sizeof(int32_t) + 63) & ~(uint64_t)63;
+    uint64_t xq_offset = scale_offset + 2 * scales_size;
+    uint8_t* scratch = (uint8_t*)reserve_quant_scratch(xq_offset + batch * padded);
+    int32_t* acc = (int32_t*)scratch;
+    float* x_scale = (float*)(scratch + scale_offset);
+    float* x_inv_scale = (float*)(scratch + scale_offset + scales_size);
+    int8_t* xq = (int8_t*)(scratch + xq_offset);
+    // Strided views (e.g. a slice of a larger batch) are read in place, a
+    // tile row at a time.
+    float run[QUANT_TILE_COLS];
+
+    if (layer->input_scale > 0.0f) {
+        k->fill(x_scale, layer->input_scale, batch);
+    } else {
+        k->fill(x_scale, 0.0f, batch);
+        for (uint64_t b = 0; b < batch; b += QUANT_TILE_COLS) {
+            uint64_t cols = batch - b < QUANT_TILE_COLS ? batch - b : QUANT_TILE_COLS;
+            for (uint64_t i = 0; i < in; i++) {
+                k->abs_max(x_scale + b, column_run(x, i, b, cols, run), cols);
+            }
+        }
+        for (uint64_t b = 0; b < batch; b++) {
+            x_scale[b] = x_scale[b] > 0.0f ? x_scale[b] / QUANT_MAX : 1.0f;
+        }
+    }
+    for (uint64_t b = 0; b < batch; b++) {
+        x_inv_scale[b] = 1.0f / x_scale[b];
+    }
+
+    // Rows are quantized QGEMM_K_ALIGN at a time into a row-major tile,
+    // which is then written out one column (one xq row segment) at a time.
+    int8_t tile[QGEMM_K_ALIGN * QUANT_TILE_COLS];
+    for (uint64_t b = 0; b < batch; b += QUANT_TILE_COLS) {
+        uint64_t cols = batch - b < QUANT_TILE_COLS ? batch - b : QUANT_TILE_COLS;
+        for (uint64_t i = 0; i < padded; i += QGEMM_K_ALIGN) {
+            for (uint64_t r = 0; r < QGEMM_K_ALIGN; r++) {
+                if (i + r < in) {
+                    k->quantize_i8(tile + r * cols, column_run(x, i + r, b, cols, run),
+                                   x_inv_scale + b, cols);
+                } else {
+                    memset(tile + r * cols, 0, cols);
+                }
+            }
+            for (uint64_t c = 0; c < cols; c++) {
+                int8_t* dst = xq + (b + c) * padded + i;
+                for (uint64_t r = 0; r < QGEMM_K_ALIGN; r++) {
+                    dst[r] = tile[r * cols + c];
+                }
+            }
+        }
+    }
+
+    qgemm_ctx_t ctx = {layer, get_qgemm(), acc, xq, batch};
+    parallel_for(0, out, QGEMM_GRAIN, qgemm_range, &ctx);
+
+    // Rescaling and the activation run a row at a time, while it is in L1.
+    tensor_f32_t* ret = new_tensor_f32((uint64_t[]){out, batch}, 2, CBOOL_FALSE);
+    for (uint64_t o = 0; o < out; o++) {
+        float* dst = ret->data + o * batch;
+        k->dequantize_i32(dst, acc + o * batch, layer->weight_scale[o], x_scale,
+                          layer->bias[o], batch);
+        switch (activation) {
+        case ACTIVATION_NONE:
+            break;
+        case ACTIVATION_RELU:
+            k->leaky_relu(dst, dst, 0.0f, batch);
+            break;
+        case ACTIVATION_LEAKY_RELU:
+            k->leaky_relu(dst, dst, 0.01f, batch);
+            break;
+        case ACTIVATION_SIGMOID:
+            k->sigmoid(dst, dst, batch);
+            break;
+        default:
+            raise_error(ValueError, "unknown activation");
+        }
+    }
+    return ret;
+}
+
+uint64_t quantized_linear_weight_bytes(quantized_linear_layer_t* layer) {
+    return layer->out_features * layer->padded_in * sizeof(int8_t) +
+           layer->out_features * (sizeof(float) + sizeof(int32_t) + sizeof(float));
+}
+
+const char* quantized_gemm_name() { return get_qgemm_name(); }
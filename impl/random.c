@@ -0,0 +1,183 @@
+#include "much/random.h"
+#include "much/kernels.h"
+#include "much/parallel.h"
+#include <math.h>
+#include <stdatomic.h>
+#include <string.h>
+
+// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2,
+// 3"). The 128-bit counter is (block, stream) and the key is the seed.
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+// Blocks of four values generated per batch of transcendental calls.
+#define RNG_BATCH_BLOCKS 128
+#define RNG_BATCH (RNG_BATCH_BLOCKS * 4)
+// Values per parallel_for chunk.
+#define RNG_GRAIN (1u << 16)
+
+static void philox(uint32_t out[4], uint64_t block, uint64_t stream,
+                   uint64_t seed) {
+  uint32_t c0 = (uint32_t)block, c1 = (uint32_t)(block >> 32);
+  uint32_t c2 = (uint32_t)stream, c3 = (uint32_t)(stream >> 32);
+  uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed >> 32);
+  for (int r = 0; r < PHILOX_ROUNDS; r++) {
+    uint64_t p0 = (uint64_t)PHILOX_M0 * c0;
+    uint64_t p1 = (uint64_t)PHILOX_M1 * c2;
+    uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+    uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+    c1 = (uint32_t)p1;
+    c3 = (uint32_t)p0;
+    c0 = n0;
+    c2 = n2;
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+  out[0] = c0;
+  out[1] = c1;
+  out[2] = c2;
+  out[3] = c3;
+}
+
+// The top 24 bits, centred in their interval: never 0 or 1.
+static inline float unit_float(uint32_t x) {
+  return ((float)(x >> 8) + 0.5f) * (1.0f / 16777216.0f);
+}
+
+rng_t rng_init(uint64_t seed, uint64_t stream) {
+  return (rng_t){seed, stream, 0};
+}
+
+static _Atomic uint64_t global_seed = 0;
+static _Atomic uint64_t global_stream = 0;
+
+void rng_set_seed(uint64_t seed) {
+  atomic_store(&global_seed, seed);
+  atomic_store(&global_stream, 0);
+}
+
+rng_t rng_next_stream() {
+  return rng_init(atomic_load(&global_seed),
+                  atomic_fetch_add(&global_stream, 1));
+}
+
+uint64_t rng_next(rng_t *rng) {
+  // Two values from one block.
+  uint64_t k = (rng->offset + 1) & ~1ull;
+  uint32_t words[4];
+  philox(words, k / 4, rng->stream, rng->seed);
+  rng->offset = k + 2;
+  return (uint64_t)words[k % 4] << 32 | words[k % 4 + 1];
+}
+
+uint64_t rng_below(rng_t *rng, uint64_t bound) {
+  return rng_next(rng) % bound;
+}
+
+typedef struct {
+  const rng_t *rng;
+  float *out;
+  uint64_t first;
+  float a;
+  float b;
+} rng_fill_t;
+
+// Unit floats for the whole blocks covering values [begin, end); returns
+// the index of value `begin` in `u`.
+static uint64_t fill_unit(const rng_t *rng, float *u, uint64_t begin,
+                          uint64_t end) {
+  uint32_t words[4];
+  uint64_t first_block = begin / 4;
+  uint64_t last_block = (end + 3) / 4;
+  for (uint64_t b = first_block; b < last_block; b++) {
+    philox(words, b, rng->stream, rng->seed);
+    for (int j = 0; j < 4; j++) {
+      u[(b - first_block) * 4 + j] = unit_float(words[j]);
+    }
+  }
+  return begin % 4;
+}
+
+// Where a batch of at most RNG_BATCH_BLOCKS whole blocks from `start` ends.
+static uint64_t batch_end(const rng_fill_t *fill, uint64_t start,
+                          uint64_t end) {
+  uint64_t stop = ((fill->first + start) / 4 + RNG_BATCH_BLOCKS) * 4 -
+                  fill->first;
+  return stop < end ? stop : end;
+}
+
+static void uniform_range(void *ctx, uint64_t begin, uint64_t end) {
+  rng_fill_t *fill = (rng_fill_t *)ctx;
+  float u[RNG_BATCH];
+  for (uint64_t start = begin; start < end;) {
+    uint64_t stop = batch_end(fill, start, end);
+    uint64_t skip = fill_unit(fill->rng, u, fill->first + start,
+                              fill->first + stop);
+    // lo + u * (hi - lo)
+    for (uint64_t i = 0; i < stop - start; i++) {
+      fill->out[start + i] = fill->a + u[skip + i] * fill->b;
+    }
+    start = stop;
+  }
+}
+
+// Box-Muller: values 2p and 2p + 1 are r cos(theta) and r sin(theta) for
+// r = sqrt(-2 log u) and theta = 2 pi v, where u and v are values 2p and
+// 2p + 1 of the uniform stream.
+static void normal_range(void *ctx, uint64_t begin, uint64_t end) {
+  rng_fill_t *fill = (rng_fill_t *)ctx;
+  float u[RNG_BATCH];
+  float radius[RNG_BATCH / 2];
+  float angle[RNG_BATCH / 2];
+  float sin_angle[RNG_BATCH / 2];
+  float cos_angle[RNG_BATCH / 2];
+  const elementwise_kernels_t *k = get_kernels();
+  for (uint64_t start = begin; start < end;) {
+    uint64_t stop = batch_end(fill, start, end);
+    uint64_t skip = fill_unit(fill->rng, u, fill->first + start,
+                              fill->first + stop);
+    uint64_t words = skip + (stop - start);
+    uint64_t pairs = (words + 1) / 2;
+    for (uint64_t p = 0; p < pairs; p++) {
+      radius[p] = u[2 * p];
+      angle[p] = 2.0f * (float)M_PI * u[2 * p + 1];
+    }
+    k->log(radius, radius, pairs);
+    k->sincos(sin_angle, cos_angle, angle, pairs);
+    for (uint64_t p = 0; p < pairs; p++) {
+      float r = sqrtf(-2.0f * radius[p]) * fill->b;
+      u[2 * p] = r * cos_angle[p] + fill->a;
+      u[2 * p + 1] = r * sin_angle[p] + fill->a;
+    }
+    memcpy(fill->out + start, u + skip, sizeof(float) * (stop - start));
+    start = stop;
+  }
+}
+
+void rng_uniform_at(const rng_t *rng, float *out, uint64_t first, uint64_t n,
+                    float lo, float hi) {
+  rng_fill_t fill = {rng, out, first, lo, hi - lo};
+  parallel_for(0, n, RNG_GRAIN, uniform_range, &fill);
+}
+
+void rng_normal_at(const rng_t *rng, float *out, uint64_t first, uint64_t n,
+                   float mean, float std) {
+  rng_fill_t fill = {rng, out, first, mean, std};
+  parallel_for(0, n, RNG_GRAIN, normal_range, &fill);
+}
+
+void rng_uniform(rng_t *rng, float *out, uint64_t n, float lo, float hi) {
+  rng_uniform_at(rng, out, rng->offset, n, lo, hi);
+  rng->offset += n;
+}
+
+void rng_normal(rng_t *rng, float *out, uint64_t n, float mean, float std) {
+  // Starting on a pair keeps every normal a whole Box-Muller pair apart
+  // from other draws.
+  rng->offset = (rng->offset + 1) & ~1ull;
+  rng_normal_at(rng, out, rng->offset, n, mean, std);
+  rng->offset += n;
+}
@@ -1,38 +1,48 @@
 #include "much/sequence.h"
 #include <stdlib.h>
 
+// Workspace buffers start on cache-line boundaries.
+#define PLAN_ALIGNMENT 64
+#define PLAN_ALIGN_FLOATS (PLAN_ALIGNMENT / sizeof(float))
+
 sequence_t* new_sequence() {
     sequence_t* seq = (sequence_t*)malloc(sizeof(sequence_t));
-    seq->layers = NULL;
-    seq->num_layers = 0;
+    if (seq == NULL) {
+        raise_error(NullPointer, "malloc failed to allocate sequence_t");
+    }
+    seq->modules = NULL;
+    seq->num_modules = 0;
     return seq;
 }
 
 void free_sequence(sequence_t* seq) {
     if (seq != NULL) {
-        // Freeing the layers themselves should be handled outside
-        if (seq->layers != NULL) {
-            free(seq->layers);
+        for (uint64_t i = 0; i < seq->num_modules; i++) {
+            free_module(seq->modules[i]);
         }
+        free(seq->modules);
         free(seq);
     }
 }
 
-void sequence_add_layer(sequence_t* seq, void* layer) {
-    seq->num_layers++;
-    seq->layers = realloc(seq->layers, sizeof(void*) * seq->num_layers);
-    seq->layers[seq->num_layers - 1] = layer;
+void sequence_add(sequence_t* seq, module_t* module) {
+    module_t** modules = (module_t**)realloc(seq->modules, sizeof(module_t*) * (seq->num_modules + 1));
+    if (modules == NULL) {
+        raise_error(NullPointer, "realloc failed to grow sequence");
+    }
+    seq->modules = modules;
+    seq->modules[seq->num_modules++] = module;
 }
 
-// This is a simplified forward pass that assumes all layers are linear
 tensor_f32_t* sequence_forward(sequence_t* seq, tensor_f32_t* src) {
     tensor_f32_t* current_input = src;
-    tensor_f32_t* current_output = NULL;
+    tensor_f32_t* current_output = src;
 
-    for (uint64_t i = 0; i < seq->num_layers; i++) {
-        linear_layer_t* layer = (linear_layer_t*)seq->layers[i];
-        current_output = linear_layer_forward(layer, current_input);
+    for (uint64_t i = 0; i < seq->num_modules; i++) {
+        module_t* module = seq->modules[i];
+        current_output = module->ops->forward(module, current_input);
 
+        // The output keeps its input alive for backward().
         if (current_input != src) {
             free_tensor_f32(current_input);
         }
@@ -40,3 +50,185 @@ tensor_f32_t* sequence_forward(sequence_t* seq, tensor_f32_t* src) {
     }
     return current_output;
 }
+
+uint64_t sequence_parameters(sequence_t* seq, tensor_f32_t** params, uint64_t max) {
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < seq->num_modules; i++) {
+        module_t* module = seq->modules[i];
+        uint64_t room = count < max ? max - count : 0;
+        count += module->ops->parameters(module, params + (count < max ? count : max), room);
+    }
+    return count;
+}
+
+static uint64_t align_floats(uint64_t n) {
+    return (n + PLAN_ALIGN_FLOATS - 1) / PLAN_ALIGN_FLOATS * PLAN_ALIGN_FLOATS;
+}
+
+// Whether activation `a` (module a - 1's output) must survive until
+// backward. The final output always does: the caller reads it.
+static cbool_t plan_keeps(sequence_t* seq, uint64_t a, cbool_t training) {
+    if (a == seq->num_modules) {
+        return CBOOL_TRUE;
+    }
+    if (training != CBOOL_TRUE) {
+        return CBOOL_FALSE;
+    }
+    return seq->modules[a]->ops->backward_reads_x == CBOOL_TRUE ||
+                   seq->modules[a - 1]->ops->backward_reads_y == CBOOL_TRUE
+               ? CBOOL_TRUE
+               : CBOOL_FALSE;
+}
+
+sequence_plan_t* sequence_compile(sequence_t* seq, uint64_t in_features, uint64_t batch,
+                                  cbool_t training) {
+    uint64_t n = seq->num_modules;
+    if (n == 0 || batch == 0) {
+        raise_error(ValueError, "a plan needs modules and a batch");
+    }
+    sequence_plan_t* plan = (sequence_plan_t*)malloc(sizeof(sequence_plan_t));
+    if (plan == NULL) {
+        raise_error(NullPointer, "malloc failed to allocate sequence_plan_t");
+    }
+    plan->seq = seq;
+    plan->batch = batch;
+    plan->training = training;
+    plan->current_batch = 0;
+    plan->features = (uint64_t*)malloc(sizeof(uint64_t) * (n + 1));
+    plan->activations = (const float**)calloc(n + 1, sizeof(float*));
+    uint64_t* slot_of = (uint64_t*)malloc(sizeof(uint64_t) * (n + 1));
+    uint64_t* slot_size = (uint64_t*)calloc(n, sizeof(uint64_t));
+    cbool_t* slot_busy = (cbool_t*)calloc(n, sizeof(cbool_t));
+    if (plan->features == NULL || plan->activations == NULL || slot_of == NULL ||
+        slot_size == NULL || slot_busy == NULL) {
+        raise_error(NullPointer, "malloc failed to allocate sequence plan");
+    }
+
+    // Shape inference, and a slot for each module's output. A slot is free
+    // again once the activation in it has been read for the last time, and
+    // an in-place module writes over its input when nothing else needs it.
+    plan->features[0] = in_features;
+    uint64_t num_slots = 0;
+    uint64_t max_features = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        module_t* module = seq->modules[i];
+        plan->features[i + 1] = module->ops->out_features(module, plan->features[i]);
+        if (plan->features[i + 1] > max_features) {
+            max_features = plan->features[i + 1];
+        }
+        uint64_t size = align_floats(plan->features[i + 1] * batch);
+
+        cbool_t input_dies = i > 0 && plan_keeps(seq, i, training) != CBOOL_TRUE;
+        uint64_t slot;
+        if (input_dies && module->ops->in_place == CBOOL_TRUE) {
+            slot = slot_of[i];
+        } else {
+            for (slot = 0; slot < num_slots && slot_busy[slot] == CBOOL_TRUE; slot++) {
+            }
+            if (slot == num_slots) {
+                num_slots++;
+            }
+            slot_busy[slot] = CBOOL_TRUE;
+            if (input_dies) {
+                slot_busy[slot_of[i]] = CBOOL_FALSE;
+            }
+        }
+        slot_of[i + 1] = slot;
+        if (size > slot_size[slot]) {
+            slot_size[slot] = size;
+        }
+    }
+
+    // One allocation: the activation slots, then two gradient buffers.
+    uint64_t grad_size = training == CBOOL_TRUE ? align_floats(max_features * batch) : 0;
+    uint64_t total = 2 * grad_size;
+    for (uint64_t s = 0; s < num_slots; s++) {
+        total += slot_size[s];
+    }
+    plan->workspace_bytes = total * sizeof(float);
+    plan->workspace = (float*)aligned_alloc(PLAN_ALIGNMENT, plan->workspace_bytes);
+    if (plan->workspace == NULL) {
+        raise_error(NullPointer, "aligned_alloc failed to allocate plan workspace");
+    }
+    uint64_t offset = 0;
+    for (uint64_t s = 0; s < num_slots; s++) {
+        for (uint64_t a = 1; a <= n; a++) {
+            if (slot_of[a] == s) {
+                plan->activations[a] = plan->workspace + offset;
+            }
+        }
+        offset += slot_size[s];
+    }
+    plan->grads[0] = training == CBOOL_TRUE ? plan->workspace + offset : NULL;
+    plan->grads[1] = training == CBOOL_TRUE ? plan->workspace + offset + grad_size : NULL;
+    // Module i's output gradient is in grads[(n - 1 - i) % 2].
+    plan->output_grad = plan->grads[0];
+
+    uint64_t output_shape[] = {plan->features[n], batch};
+    plan->output = tensor_f32_wrap((float*)plan->activations[n], output_shape, 2, CBOOL_FALSE);
+
+    free(slot_of);
+    free(slot_size);
+    free(slot_busy);
+    return plan;
+}
+
+void free_sequence_plan(sequence_plan_t* plan) {
+    if (plan != NULL) {
+        free_tensor_f32(plan->output);
+        free(plan->workspace);
+        free(plan->activations);
+        free(plan->features);
+        free(plan);
+    }
+}
+
+static void profile_module(sequence_plan_t* plan, uint64_t i, profile_phase_t phase,
+                           uint64_t start) {
+    op_kind_t op = plan->seq->modules[i]->ops->op;
+    profile_record(op, phase, start, plan->features[i + 1], plan->current_batch,
+                   op == OP_LINEAR ? plan->features[i] : 0, sizeof(float));
+}
+
+tensor_f32_t* sequence_plan_forward(sequence_plan_t* plan, tensor_f32_t* x) {
+    if (x->meta.dtype != DTYPE_F32 || x->meta.shape_length != 2 ||
+        x->meta.shape[0] != plan->features[0] || x->meta.shape[1] > plan->batch ||
+        tensor_is_contiguous(x) != CBOOL_TRUE) {
+        raise_error(ValueError, "plan input must be a contiguous float [in_features, <= batch]");
+    }
+    uint64_t batch = x->meta.shape[1];
+    sequence_t* seq = plan->seq;
+    plan->activations[0] = x->data;
+    plan->current_batch = batch;
+    for (uint64_t i = 0; i < seq->num_modules; i++) {
+        module_t* module = seq->modules[i];
+        uint64_t start = profile_begin();
+        module->ops->forward_into(module, plan->activations[i], (float*)plan->activations[i + 1],
+                                  plan->features[i], batch);
+        profile_module(plan, i, PROFILE_FORWARD, start);
+    }
+
+    // A short batch uses the front of each buffer, densely.
+    tensor_f32_t* output = plan->output;
+    output->meta.shape[1] = batch;
+    output->meta.strides[0] = batch;
+    output->meta.capacity = plan->features[seq->num_modules] * batch;
+    return output;
+}
+
+void sequence_plan_backward(sequence_plan_t* plan) {
+    if (plan->training != CBOOL_TRUE || plan->current_batch == 0) {
+        raise_error(RuntimeError, "sequence_plan_backward needs a training plan after a forward");
+    }
+    sequence_t* seq = plan->seq;
+    uint64_t n = seq->num_modules;
+    for (uint64_t i = n; i-- > 0;) {
+        module_t* module = seq->modules[i];
+        float* dy = plan->grads[(n - 1 - i) % 2];
+        float* dx = i > 0 ? plan->grads[(n - i) % 2] : NULL;
+        uint64_t start = profile_begin();
+        module->ops->backward_into(module, plan->activations[i], plan->activations[i + 1], dy, dx,
+                                   plan->features[i], plan->current_batch);
+        profile_module(plan, i, PROFILE_BACKWARD, start);
+    }
+}
@@ -0,0 +1,374 @@
+#include "much/sgemm.h"
+#include "much/kernels.h"
+#include "much/parallel.h"
+#include "sgemm_internal.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef MUCH_BLAS
+#ifdef __APPLE__
+#include <Accelerate/Accelerate.h>
+#else
+#include <cblas.h>
+#endif
+#endif
+
+// Cache blocking (Goto/BLIS): a KC x NC panel of B is packed once and
+// stays in L3, an MC x KC block of A is packed per thread for L2, and the
+// microkernel streams KC-long slivers of both through L1. MC and NC are
+// rounded down to whole tiles.
+#define SGEMM_MC 96
+#define SGEMM_KC 256
+#define SGEMM_NC 4096
+#define SGEMM_ALIGNMENT 64
+// Products of at least this many multiply-adds split their row blocks
+// across the thread pool.
+#define SGEMM_PARALLEL_WORK (1u << 20)
+// Products below this many multiply-adds (about 512^3), or with a side
+// below SGEMM_BLAS_MIN_SIDE, stay built in under SGEMM_AUTO. On one core
+// the built-in kernels kept up with OpenBLAS at every size measured; what
+// is left to BLAS is work large enough for its threading to pay off.
+#define SGEMM_BLAS_MIN_WORK (1u << 27)
+#define SGEMM_BLAS_MIN_SIDE 32
+
+void sgemm_kernel_scalar(uint64_t kc, const float *a, const float *b, float *c,
+                         uint64_t ldc) {
+  float acc[SGEMM_SCALAR_MR][SGEMM_SCALAR_NR] = {{0.0f}};
+  for (uint64_t p = 0; p < kc; p++) {
+    for (int i = 0; i < SGEMM_SCALAR_MR; i++) {
+      for (int j = 0; j < SGEMM_SCALAR_NR; j++) {
+        acc[i][j] += a[i] * b[j];
+      }
+    }
+    a += SGEMM_SCALAR_MR;
+    b += SGEMM_SCALAR_NR;
+  }
+  for (int i = 0; i < SGEMM_SCALAR_MR; i++) {
+    for (int j = 0; j < SGEMM_SCALAR_NR; j++) {
+      c[i * ldc + j] += acc[i][j];
+    }
+  }
+}
+
+static const sgemm_kernel_t scalar_kernel = {
+    sgemm_kernel_scalar, SGEMM_SCALAR_MR, SGEMM_SCALAR_NR, "scalar"};
+#ifdef MUCH_X86_KERNELS
+static const sgemm_kernel_t avx2_kernel = {sgemm_kernel_avx2, SGEMM_AVX2_MR,
+                                           SGEMM_AVX2_NR, "avx2"};
+static const sgemm_kernel_t avx512_kernel = {
+    sgemm_kernel_avx512, SGEMM_AVX512_MR, SGEMM_AVX512_NR, "avx512"};
+#endif
+
+static _Atomic(const sgemm_kernel_t *) active_kernel = NULL;
+
+const sgemm_kernel_t *get_sgemm_kernel() {
+  const sgemm_kernel_t *ret = atomic_load(&active_kernel);
+  if (ret == NULL) {
+    // get_kernels() already applies the MUCH_SIMD cap; the AVX2 kernel
+    // also needs FMA.
+    simd_level_t level = get_kernels()->level;
+    ret = &scalar_kernel;
+#ifdef MUCH_X86_KERNELS
+    __builtin_cpu_init();
+    if (level >= SIMD_AVX512) {
+      ret = &avx512_kernel;
+    } else if (level >= SIMD_AVX2 && __builtin_cpu_supports("fma")) {
+      ret = &avx2_kernel;
+    }
+#else
+    (void)level;
+#endif
+    atomic_store(&active_kernel, ret);
+  }
+  return ret;
+}
+
+const char *sgemm_kernel_name() { return get_sgemm_kernel()->name; }
+
+// Packing buffers, kept per thread and grown on demand; freed by
+// sgemm_release_thread_buffers.
+static _Thread_local float *pack_a = NULL;
+static _Thread_local uint64_t pack_a_capacity = 0;
+static _Thread_local float *pack_b = NULL;
+static _Thread_local uint64_t pack_b_capacity = 0;
+
+void sgemm_release_thread_buffers() {
+  free(pack_a);
+  pack_a = NULL;
+  pack_a_capacity = 0;
+  free(pack_b);
+  pack_b = NULL;
+  pack_b_capacity = 0;
+}
+
+static float *reserve_pack(float **buffer, uint64_t *capacity, uint64_t size) {
+  if (size > *capacity) {
+    register_thread_scratch(sgemm_release_thread_buffers);
+    free(*buffer);
+    size_t bytes = (sizeof(float) * size + SGEMM_ALIGNMENT - 1) /
+                   SGEMM_ALIGNMENT * SGEMM_ALIGNMENT;
+    *buffer = (float *)aligned_alloc(SGEMM_ALIGNMENT, bytes);
+    if (*buffer == NULL) {
+      raise_error(NullPointer, "aligned_alloc failed to allocate sgemm panel");
+    }
+    *capacity = size;
+  }
+  return *buffer;
+}
+
+// Rows [i0, i0 + mc) and columns [p0, p0 + kc) of op(a), times alpha, as
+// mr-row slivers; rows past `mc` are zero.
+static void pack_a_block(float *dst, sgemm_trans_t trans, const float *a,
+                         uint64_t lda, uint64_t i0, uint64_t mc, uint64_t p0,
+                         uint64_t kc, float alpha, uint64_t mr) {
+  for (uint64_t ir = 0; ir < mc; ir += mr) {
+    uint64_t rows = mc - ir < mr ? mc - ir : mr;
+    if (trans == SGEMM_NO_TRANS) {
+      for (uint64_t r = 0; r < rows; r++) {
+        const float *src = a + (i0 + ir + r) * lda + p0;
+        for (uint64_t p = 0; p < kc; p++) {
+          dst[p * mr + r] = alpha * src[p];
+        }
+      }
+    } else {
+      for (uint64_t p = 0; p < kc; p++) {
+        const float *src = a + (p0 + p) * lda + i0 + ir;
+        for (uint64_t r = 0; r < rows; r++) {
+          dst[p * mr + r] = alpha * src[r];
+        }
+      }
+    }
+    for (uint64_t r = rows; r < mr; r++) {
+      for (uint64_t p = 0; p < kc; p++) {
+        dst[p * mr + r] = 0.0f;
+      }
+    }
+    dst += mr * kc;
+  }
+}
+
+// Rows [p0, p0 + kc) and columns [j0, j0 + nc) of op(b) as nr-column
+// slivers; columns past `nc` are zero.
+static void pack_b_panel(float *dst, sgemm_trans_t trans, const float *b,
+                         uint64_t ldb, uint64_t p0, uint64_t kc, uint64_t j0,
+                         uint64_t nc, uint64_t nr) {
+  for (uint64_t jr = 0; jr < nc; jr += nr) {
+    uint64_t cols = nc - jr < nr ? nc - jr : nr;
+    if (trans == SGEMM_NO_TRANS) {
+      for (uint64_t p = 0; p < kc; p++) {
+        const float *src = b + (p0 + p) * ldb + j0 + jr;
+        float *row = dst + p * nr;
+        memcpy(row, src, sizeof(float) * cols);
+        for (uint64_t j = cols; j < nr; j++) {
+          row[j] = 0.0f;
+        }
+      }
+    } else {
+      for (uint64_t j = 0; j < cols; j++) {
+        const float *src = b + (j0 + jr + j) * ldb + p0;
+        for (uint64_t p = 0; p < kc; p++) {
+          dst[p * nr + j] = src[p];
+        }
+      }
+      for (uint64_t j = cols; j < nr; j++) {
+        for (uint64_t p = 0; p < kc; p++) {
+          dst[p * nr + j] = 0.0f;
+        }
+      }
+    }
+    dst += nr * kc;
+  }
+}
+
+typedef struct {
+  const sgemm_kernel_t *kernel;
+  sgemm_trans_t trans_a;
+  const float *a;
+  uint64_t lda;
+  float alpha;
+  const float *packed_b;
+  float *c;
+  uint64_t ldc;
+  uint64_t m;
+  uint64_t mc;
+  uint64_t p0;
+  uint64_t kc;
+  uint64_t j0;
+  uint64_t nc;
+} sgemm_panel_t;
+
+// Row blocks [begin, end) of one packed B panel.
+static void multiply_blocks(void *ctx, uint64_t begin, uint64_t end) {
+  const sgemm_panel_t *panel = (const sgemm_panel_t *)ctx;
+  const sgemm_kernel_t *kernel = panel->kernel;
+  uint64_t mr = kernel->mr;
+  uint64_t nr = kernel->nr;
+  float *a = reserve_pack(&pack_a, &pack_a_capacity, panel->mc * panel->kc);
+  float edge[SGEMM_MAX_TILE];
+  for (uint64_t block = begin; block < end; block++) {
+    uint64_t i0 = block * panel->mc;
+    uint64_t mc = panel->m - i0 < panel->mc ? panel->m - i0 : panel->mc;
+    pack_a_block(a, panel->trans_a, panel->a, panel->lda, i0, mc, panel->p0,
+                 panel->kc, panel->alpha, mr);
+    for (uint64_t jr = 0; jr < panel->nc; jr += nr) {
+      uint64_t cols = panel->nc - jr < nr ? panel->nc - jr : nr;
+      const float *b = panel->packed_b + jr * panel->kc;
+      for (uint64_t ir = 0; ir < mc; ir += mr) {
+        uint64_t rows = mc - ir < mr ? mc - ir : mr;
+        float *c = panel->c + (i0 + ir) * panel->ldc + panel->j0 + jr;
+        if (rows == mr && cols == nr) {
+          kernel->fn(panel->kc, a + ir * panel->kc, b, c, panel->ldc);
+          continue;
+        }
+        // An edge tile goes through scratch and only its valid part is
+        // added to c.
+        memset(edge, 0, sizeof(float) * mr * nr);
+        kernel->fn(panel->kc, a + ir * panel->kc, b, edge, nr);
+        for (uint64_t i = 0; i < rows; i++) {
+          for (uint64_t j = 0; j < cols; j++) {
+            c[i * panel->ldc + j] += edge[i * nr + j];
+          }
+        }
+      }
+    }
+  }
+}
+
+// c = beta * c, without reading c when beta is 0.
+static void scale_c(float *c, uint64_t ldc, uint64_t m, uint64_t n,
+                    float beta) {
+  if (beta == 1.0f) {
+    return;
+  }
+  const elementwise_kernels_t *k = get_kernels();
+  for (uint64_t i = 0; i < m; i++) {
+    if (beta == 0.0f) {
+      k->fill(c + i * ldc, 0.0f, n);
+    } else {
+      k->scale_grad(c + i * ldc, c + i * ldc, beta, n, CBOOL_FALSE);
+    }
+  }
+}
+
+static void sgemm_builtin(sgemm_trans_t trans_a, sgemm_trans_t trans_b,
+                          uint64_t m, uint64_t n, uint64_t k, float alpha,
+                          const float *a, uint64_t lda, const float *b,
+                          uint64_t ldb, float beta, float *c, uint64_t ldc) {
+  scale_c(c, ldc, m, n, beta);
+  if (k == 0 || alpha == 0.0f) {
+    return;
+  }
+  const sgemm_kernel_t *kernel = get_sgemm_kernel();
+  uint64_t mc_max = SGEMM_MC / kernel->mr * kernel->mr;
+  uint64_t nc_max = SGEMM_NC / kernel->nr * kernel->nr;
+  uint64_t blocks = (m + mc_max - 1) / mc_max;
+  cbool_t parallel = m * n * k >= SGEMM_PARALLEL_WORK && blocks > 1
+                         ? CBOOL_TRUE
+                         : CBOOL_FALSE;
+  for (uint64_t j0 = 0; j0 < n; j0 += nc_max) {
+    uint64_t nc = n - j0 < nc_max ? n - j0 : nc_max;
+    uint64_t nc_padded = (nc + kernel->nr - 1) / kernel->nr * kernel->nr;
+    for (uint64_t p0 = 0; p0 < k; p0 += SGEMM_KC) {
+      uint64_t kc = k - p0 < SGEMM_KC ? k - p0 : SGEMM_KC;
+      float *packed_b =
+          reserve_pack(&pack_b, &pack_b_capacity, nc_padded * kc);
+      pack_b_panel(packed_b, trans_b, b, ldb, p0, kc, j0, nc, kernel->nr);
+      sgemm_panel_t panel = {kernel, trans_a, a,  lda, alpha, packed_b, c,
+                             ldc,    m,       mc_max, p0,  kc,    j0,  nc};
+      if (parallel == CBOOL_TRUE) {
+        parallel_for(0, blocks, 1, multiply_blocks, &panel);
+      } else {
+        multiply_blocks(&panel, 0, blocks);
+      }
+    }
+  }
+}
+
+static _Atomic sgemm_backend_t requested_backend = SGEMM_AUTO;
+static _Atomic cbool_t backend_read = CBOOL_FALSE;
+
+static sgemm_backend_t env_backend() {
+  const char *env = getenv("MUCH_SGEMM");
+  if (env != NULL && strcmp(env, "builtin") == 0) {
+    return SGEMM_BUILTIN;
+  }
+  if (env != NULL && strcmp(env, "blas") == 0) {
+    return SGEMM_BLAS;
+  }
+  return SGEMM_AUTO;
+}
+
+void sgemm_set_backend(sgemm_backend_t backend) {
+  atomic_store(&requested_backend, backend);
+  atomic_store(&backend_read, CBOOL_TRUE);
+}
+
+sgemm_backend_t sgemm_get_backend() {
+  if (atomic_load(&backend_read) != CBOOL_TRUE) {
+    sgemm_set_backend(env_backend());
+  }
+  return atomic_load(&requested_backend);
+}
+
+cbool_t sgemm_has_blas() {
+#ifdef MUCH_BLAS
+  return CBOOL_TRUE;
+#else
+  return CBOOL_FALSE;
+#endif
+}
+
+#ifdef MUCH_BLAS
+#ifndef __APPLE__
+// Weak, so that a BLAS without it still links; the call is then skipped.
+extern void openblas_set_num_threads(int num_threads) __attribute__((weak));
+#endif
+
+// Gives OpenBLAS the threads parallel_blas_threads allows before each call,
+// so its threads and the pool's never run at once on the same cores. The
+// setting is global, so it is only changed when it differs.
+static void set_blas_threads() {
+#ifndef __APPLE__
+  static _Atomic int current = 0;
+  int threads = (int)parallel_blas_threads();
+  if (openblas_set_num_threads != NULL &&
+      atomic_exchange(&current, threads) != threads) {
+    openblas_set_num_threads(threads);
+  }
+#endif
+}
+
+static cbool_t use_blas(uint64_t m, uint64_t n, uint64_t k) {
+  switch (sgemm_get_backend()) {
+  case SGEMM_BUILTIN:
+    return CBOOL_FALSE;
+  case SGEMM_BLAS:
+    return CBOOL_TRUE;
+  default:
+    return m * n * k >= SGEMM_BLAS_MIN_WORK && m >= SGEMM_BLAS_MIN_SIDE &&
+                   n >= SGEMM_BLAS_MIN_SIDE
+               ? CBOOL_TRUE
+               : CBOOL_FALSE;
+  }
+}
+#endif
+
+void sgemm(sgemm_trans_t trans_a, sgemm_trans_t trans_b, uint64_t m,
+           uint64_t n, uint64_t k, float alpha, const float *a, uint64_t lda,
+           const float *b, uint64_t ldb, float beta, float *c, uint64_t ldc) {
+  if (m == 0 || n == 0) {
+    return;
+  }
+#ifdef MUCH_BLAS
+  if (use_blas(m, n, k) == CBOOL_TRUE) {
+    set_blas_threads();
+    cblas_sgemm(CblasRowMajor,
+                trans_a == SGEMM_TRANS ? CblasTrans : CblasNoTrans,
+                trans_b == SGEMM_TRANS ? CblasTrans : CblasNoTrans, m, n, k,
+                alpha, a, lda, b, ldb, beta, c, ldc);
+    return;
+  }
+#endif
+  sgemm_builtin(trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, beta, c,
+                ldc);
+}
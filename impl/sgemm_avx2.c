@@ -0,0 +1,29 @@
+#include "sgemm_internal.h"
+#include <immintrin.h>
+
+// 6 x 16: twelve accumulators, two B vectors and a broadcast of A.
+void sgemm_kernel_avx2(uint64_t kc, const float *a, const float *b, float *c,
+                       uint64_t ldc) {
+  __m256 acc[SGEMM_AVX2_MR][2];
+  for (int i = 0; i < SGEMM_AVX2_MR; i++) {
+    acc[i][0] = _mm256_setzero_ps();
+    acc[i][1] = _mm256_setzero_ps();
+  }
+  for (uint64_t p = 0; p < kc; p++) {
+    __m256 b0 = _mm256_loadu_ps(b);
+    __m256 b1 = _mm256_loadu_ps(b + 8);
+    for (int i = 0; i < SGEMM_AVX2_MR; i++) {
+      __m256 ai = _mm256_broadcast_ss(a + i);
+      acc[i][0] = _mm256_fmadd_ps(ai, b0, acc[i][0]);
+      acc[i][1] = _mm256_fmadd_ps(ai, b1, acc[i][1]);
+    }
+    a += SGEMM_AVX2_MR;
+    b += SGEMM_AVX2_NR;
+  }
+  for (int i = 0; i < SGEMM_AVX2_MR; i++) {
+    float *row = c + i * ldc;
+    _mm256_storeu_ps(row, _mm256_add_ps(_mm256_loadu_ps(row), acc[i][0]));
+    _mm256_storeu_ps(row + 8,
+                     _mm256_add_ps(_mm256_loadu_ps(row + 8), acc[i][1]));
+  }
+}
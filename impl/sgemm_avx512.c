@@ -0,0 +1,29 @@
+#include "sgemm_internal.h"
+#include <immintrin.h>
+
+// 8 x 32: sixteen accumulators, two B vectors and a broadcast of A.
+void sgemm_kernel_avx512(uint64_t kc, const float *a, const float *b, float *c,
+                         uint64_t ldc) {
+  __m512 acc[SGEMM_AVX512_MR][2];
+  for (int i = 0; i < SGEMM_AVX512_MR; i++) {
+    acc[i][0] = _mm512_setzero_ps();
+    acc[i][1] = _mm512_setzero_ps();
+  }
+  for (uint64_t p = 0; p < kc; p++) {
+    __m512 b0 = _mm512_loadu_ps(b);
+    __m512 b1 = _mm512_loadu_ps(b + 16);
+    for (int i = 0; i < SGEMM_AVX512_MR; i++) {
+      __m512 ai = _mm512_set1_ps(a[i]);
+      acc[i][0] = _mm512_fmadd_ps(ai, b0, acc[i][0]);
+      acc[i][1] = _mm512_fmadd_ps(ai, b1, acc[i][1]);
+    }
+    a += SGEMM_AVX512_MR;
+    b += SGEMM_AVX512_NR;
+  }
+  for (int i = 0; i < SGEMM_AVX512_MR; i++) {
+    float *row = c + i * ldc;
+    _mm512_storeu_ps(row, _mm512_add_ps(_mm512_loadu_ps(row), acc[i][0]));
+    _mm512_storeu_ps(row + 16,
+                     _mm512_add_ps(_mm512_loadu_ps(row + 16), acc[i][1]));
+  }
+}
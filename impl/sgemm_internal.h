@@ -0,0 +1,37 @@
+#pragma once
+#include <stdint.h>
+
+// c[0:mr, 0:nr] += a * b for one register tile, where `a` is an mr-row
+// sliver packed column by column (kc columns of mr values) and `b` an
+// nr-column sliver packed row by row (kc rows of nr values). The tile is
+// always whole: the driver pads slivers with zeros and gives edge tiles a
+// scratch `c`.
+typedef void (*sgemm_kernel_fn)(uint64_t kc, const float *a, const float *b,
+                                float *c, uint64_t ldc);
+
+typedef struct {
+  sgemm_kernel_fn fn;
+  uint64_t mr;
+  uint64_t nr;
+  const char *name;
+} sgemm_kernel_t;
+
+// Tiles are at most this many floats.
+#define SGEMM_MAX_TILE (8 * 32)
+
+void sgemm_kernel_scalar(uint64_t kc, const float *a, const float *b, float *c,
+                         uint64_t ldc);
+void sgemm_kernel_avx2(uint64_t kc, const float *a, const float *b, float *c,
+                       uint64_t ldc);
+void sgemm_kernel_avx512(uint64_t kc, const float *a, const float *b, float *c,
+                         uint64_t ldc);
+
+#define SGEMM_SCALAR_MR 4
+#define SGEMM_SCALAR_NR 8
+#define SGEMM_AVX2_MR 6
+#define SGEMM_AVX2_NR 16
+#define SGEMM_AVX512_MR 8
+#define SGEMM_AVX512_NR 32
+
+// The widest kernel this CPU supports, within the MUCH_SIMD cap.
+const sgemm_kernel_t *get_sgemm_kernel();
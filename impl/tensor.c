@@ -1,17 +1,353 @@
 #include "much/tensor.h"
-#ifdef __APPLE__
-#include <Accelerate/Accelerate.h>
-#else
-#include <cblas.h>
-#endif
+#include "much/kernels.h"
+#include "much/parallel.h"
+#include "much/sgemm.h"
 
 #include <math.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-static uint64_t tensor_alloc_count = 0;
+// Workers allocate concurrently; the counters only need to be exact once
+// they are quiescent.
+static _Atomic uint64_t tensor_alloc_count = 0;
+static _Atomic uint64_t tensor_live_count = 0;
+static _Thread_local arena_t *active_arena = NULL;
+static _Thread_local uint64_t no_grad_depth = 0;
 
-uint64_t get_tensor_alloc_count() { return tensor_alloc_count; }
+uint64_t get_tensor_alloc_count() {
+  return atomic_load_explicit(&tensor_alloc_count, memory_order_relaxed);
+}
+
+uint64_t get_tensor_live_count() {
+  return atomic_load_explicit(&tensor_live_count, memory_order_relaxed);
+}
+
+static void count_tensor_alloc() {
+  atomic_fetch_add_explicit(&tensor_alloc_count, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&tensor_live_count, 1, memory_order_relaxed);
+}
+
+arena_t *tensor_set_arena(arena_t *arena) {
+  arena_t *prev = active_arena;
+  active_arena = arena;
+  return prev;
+}
+
+arena_t *tensor_get_arena() { return active_arena; }
+
+void tensor_no_grad_enter() { no_grad_depth++; }
+
+void tensor_no_grad_exit() {
+  if (no_grad_depth == 0) {
+    raise_error(RuntimeError, "tensor_no_grad_exit without matching enter");
+  }
+  no_grad_depth--;
+}
+
+cbool_t tensor_grad_enabled() {
+  return no_grad_depth == 0 ? CBOOL_TRUE : CBOOL_FALSE;
+}
+
+// Whether an op over these inputs records a graph node. Unused inputs are
+// passed as NULL.
+static cbool_t needs_grad(tensor_f32_t *a, tensor_f32_t *b, tensor_f32_t *c) {
+  if (no_grad_depth != 0) {
+    return CBOOL_FALSE;
+  }
+  tensor_f32_t *inputs[] = {a, b, c};
+  for (int i = 0; i < 3; i++) {
+    if (inputs[i] != NULL && inputs[i]->meta.require_grad == CBOOL_TRUE) {
+      return CBOOL_TRUE;
+    }
+  }
+  return CBOOL_FALSE;
+}
+
+size_t dtype_size(dtype_t dtype) {
+  return dtype == DTYPE_F32 ? sizeof(float) : sizeof(uint16_t);
+}
+
+const char *dtype_name(dtype_t dtype) {
+  switch (dtype) {
+  case DTYPE_F32:
+    return "f32";
+  case DTYPE_BF16:
+    return "bf16";
+  case DTYPE_F16:
+    return "f16";
+  default:
+    return "unknown";
+  }
+}
+
+void dtype_to_f32(float *out, const void *in, dtype_t dtype, uint64_t n) {
+  const elementwise_kernels_t *k = get_kernels();
+  switch (dtype) {
+  case DTYPE_F32:
+    memcpy(out, in, n * sizeof(float));
+    break;
+  case DTYPE_BF16:
+    k->bf16_to_f32(out, (const uint16_t *)in, n);
+    break;
+  case DTYPE_F16:
+    k->f16_to_f32(out, (const uint16_t *)in, n);
+    break;
+  default:
+    raise_error(ValueError, "unknown dtype");
+  }
+}
+
+void dtype_from_f32(void *out, const float *in, dtype_t dtype, uint64_t n) {
+  const elementwise_kernels_t *k = get_kernels();
+  switch (dtype) {
+  case DTYPE_F32:
+    memcpy(out, in, n * sizeof(float));
+    break;
+  case DTYPE_BF16:
+    k->f32_to_bf16((uint16_t *)out, in, n);
+    break;
+  case DTYPE_F16:
+    k->f32_to_f16((uint16_t *)out, in, n);
+    break;
+  default:
+    raise_error(ValueError, "unknown dtype");
+  }
+}
+
+// Elements converted per step when 16-bit values pass through a stack
+// buffer of floats.
+#define CONVERT_CHUNK 512
+
+static void fill_dtype(void *dst, dtype_t dtype, float value, uint64_t n) {
+  if (dtype == DTYPE_F32) {
+    get_kernels()->fill((float *)dst, value, n);
+    return;
+  }
+  uint16_t bits;
+  dtype_from_f32(&bits, &value, dtype, 1);
+  uint16_t *out = (uint16_t *)dst;
+  for (uint64_t i = 0; i < n; i++) {
+    out[i] = bits;
+  }
+}
+
+// dst (stored as `dst_dtype`) += src (stored as `src_dtype`).
+static void accumulate_dtype(void *dst, dtype_t dst_dtype, const void *src,
+                             dtype_t src_dtype, uint64_t n) {
+  const elementwise_kernels_t *k = get_kernels();
+  if (dst_dtype == DTYPE_F32 && src_dtype == DTYPE_F32) {
+    k->add((float *)dst, (const float *)dst, (const float *)src, n);
+    return;
+  }
+  float acc[CONVERT_CHUNK];
+  float add[CONVERT_CHUNK];
+  size_t dst_size = dtype_size(dst_dtype);
+  size_t src_size = dtype_size(src_dtype);
+  for (uint64_t i = 0; i < n; i += CONVERT_CHUNK) {
+    uint64_t len = n - i < CONVERT_CHUNK ? n - i : CONVERT_CHUNK;
+    void *d = (uint8_t *)dst + i * dst_size;
+    dtype_to_f32(acc, d, dst_dtype, len);
+    dtype_to_f32(add, (const uint8_t *)src + i * src_size, src_dtype, len);
+    k->add(acc, acc, add, len);
+    dtype_from_f32(d, acc, dst_dtype, len);
+  }
+}
+
+// out (stored as `out_dtype`) = in (stored as `in_dtype`).
+static void convert_dtype(void *out, dtype_t out_dtype, const void *in,
+                          dtype_t in_dtype, uint64_t n) {
+  if (in_dtype == out_dtype) {
+    memcpy(out, in, n * dtype_size(out_dtype));
+  } else if (in_dtype == DTYPE_F32) {
+    dtype_from_f32(out, (const float *)in, out_dtype, n);
+  } else if (out_dtype == DTYPE_F32) {
+    dtype_to_f32((float *)out, in, in_dtype, n);
+  } else {
+    float values[CONVERT_CHUNK];
+    for (uint64_t i = 0; i < n; i += CONVERT_CHUNK) {
+      uint64_t len = n - i < CONVERT_CHUNK ? n - i : CONVERT_CHUNK;
+      dtype_to_f32(values, (const uint16_t *)in + i, in_dtype, len);
+      dtype_from_f32((uint16_t *)out + i, values, out_dtype, len);
+    }
+  }
+}
+
+// accumulate_dtype, or convert_dtype for the first write to a gradient.
+static void write_dtype(void *dst, dtype_t dst_dtype, const void *src,
+                        dtype_t src_dtype, uint64_t n, cbool_t accumulate) {
+  if (accumulate == CBOOL_TRUE) {
+    accumulate_dtype(dst, dst_dtype, src, src_dtype, n);
+  } else {
+    convert_dtype(dst, dst_dtype, src, src_dtype, n);
+  }
+}
+
+// Elements at the end of `t`'s row-major order that are laid out back to
+// back: the whole tensor when it is contiguous, else a suffix of its
+// dimensions (one row of a column slice), at least one element.
+static uint64_t contiguous_run(tensor_f32_t *t) {
+  uint64_t run = 1;
+  for (uint64_t d = t->meta.shape_length; d-- > 0;) {
+    if (t->meta.shape[d] != 1 && t->meta.strides[d] != run) {
+      break;
+    }
+    run *= t->meta.shape[d];
+  }
+  return run;
+}
+
+static uint64_t gcd_u64(uint64_t a, uint64_t b) {
+  while (b != 0) {
+    uint64_t r = a % b;
+    a = b;
+    b = r;
+  }
+  return a;
+}
+
+// Run length that is contiguous in both `a` and `b` (which may be NULL) at
+// every multiple of itself, so elementwise loops can hand whole runs to the
+// kernels.
+static uint64_t common_run(tensor_f32_t *a, tensor_f32_t *b) {
+  uint64_t run = contiguous_run(a);
+  return b == NULL ? run : gcd_u64(run, contiguous_run(b));
+}
+
+// Position of the element with row-major `index` relative to `t->data`.
+static uint64_t element_offset(tensor_f32_t *t, uint64_t index) {
+  uint64_t offset = 0;
+  for (uint64_t d = t->meta.shape_length; d-- > 0;) {
+    offset += (index % t->meta.shape[d]) * t->meta.strides[d];
+    index /= t->meta.shape[d];
+  }
+  return offset;
+}
+
+// Address of element `index` in `values`, the data or grad of `t`.
+static void *element_ptr(void *values, tensor_f32_t *t, uint64_t index) {
+  return (uint8_t *)values +
+         element_offset(t, index) * dtype_size(t->meta.dtype);
+}
+
+// Float operations per element of the elementwise kernels, for
+// parallel_grain.
+#define ARITHMETIC_COST 1
+#define TRANSCENDENTAL_COST 16
+
+// Calls `fn(ctx, i, len)` over [0, n) in pieces that never cross a
+// multiple of `run`, so each lies within a contiguous run of every
+// operand.
+typedef void (*run_fn)(void *ctx, uint64_t i, uint64_t len);
+
+typedef struct {
+  run_fn fn;
+  void *ctx;
+  uint64_t run;
+} run_loop_t;
+
+static void run_loop_range(void *arg, uint64_t begin, uint64_t end) {
+  run_loop_t *loop = (run_loop_t *)arg;
+  for (uint64_t i = begin; i < end;) {
+    uint64_t len = loop->run - i % loop->run;
+    if (len > end - i) {
+      len = end - i;
+    }
+    loop->fn(loop->ctx, i, len);
+    i += len;
+  }
+}
+
+// Splits the loop across the thread pool in chunks of at least `grain`.
+static void for_each_run(uint64_t n, uint64_t run, uint64_t grain, run_fn fn,
+                         void *ctx) {
+  run_loop_t loop = {fn, ctx, run};
+  parallel_for(0, n, grain, run_loop_range, &loop);
+}
+
+// The grain of a backward loop writing the gradients of both `a` and `b`.
+// Two views of one storage may share elements, so their loop stays on one
+// thread.
+static uint64_t grad_grain(tensor_f32_t *a, tensor_f32_t *b, uint64_t cost) {
+  return a->storage == b->storage ? UINT64_MAX : parallel_grain(cost);
+}
+
+// Operands of an elementwise loop. Forward ops write `out`, contiguous;
+// backward ops write the gradients of `a` and `b` from `self`'s. Any of
+// them may be stored in 16 bits.
+typedef struct {
+  const elementwise_kernels_t *k;
+  tensor_f32_t *out;
+  tensor_f32_t *self;
+  tensor_f32_t *a;
+  tensor_f32_t *b;
+  float scalar;
+  cbool_t acc_a;
+  cbool_t acc_b;
+} elementwise_t;
+
+// Elements of 16-bit operands an elementwise run widens at a time, into
+// float buffers on its stack.
+#define ELEMENTWISE_CHUNK 512
+
+static cbool_t stored_f32(tensor_f32_t *t) {
+  return t == NULL || t->meta.dtype == DTYPE_F32 ? CBOOL_TRUE : CBOOL_FALSE;
+}
+
+// Length of the next piece of a run [i, end): all of it when every operand
+// is float, otherwise as much as the stack buffers hold.
+static uint64_t piece_len(const elementwise_t *e, uint64_t i, uint64_t end) {
+  uint64_t n = end - i;
+  if (n > ELEMENTWISE_CHUNK &&
+      (stored_f32(e->out) != CBOOL_TRUE || stored_f32(e->self) != CBOOL_TRUE ||
+       stored_f32(e->a) != CBOOL_TRUE || stored_f32(e->b) != CBOOL_TRUE)) {
+    n = ELEMENTWISE_CHUNK;
+  }
+  return n;
+}
+
+// Elements [i, i + n) of `values`, the data or grad of `t`, within one
+// contiguous run: in place for a float tensor, otherwise widened into
+// `chunk`.
+static float *read_floats(float *chunk, void *values, tensor_f32_t *t,
+                          uint64_t i, uint64_t n) {
+  if (t->meta.dtype == DTYPE_F32) {
+    return (float *)values + element_offset(t, i);
+  }
+  dtype_to_f32(chunk, element_ptr(values, t, i), t->meta.dtype, n);
+  return chunk;
+}
+
+// Where a kernel writes elements [i, i + n) of `values`: in place for a
+// float tensor, otherwise `chunk` (holding the current values if `load`,
+// for kernels that accumulate) until store_floats narrows it.
+static float *write_floats(float *chunk, void *values, tensor_f32_t *t,
+                           uint64_t i, uint64_t n, cbool_t load) {
+  if (t->meta.dtype == DTYPE_F32 || load == CBOOL_TRUE) {
+    return read_floats(chunk, values, t, i, n);
+  }
+  return chunk;
+}
+
+static void store_floats(void *values, tensor_f32_t *t, uint64_t i,
+                         const float *floats, uint64_t n) {
+  if (t->meta.dtype != DTYPE_F32) {
+    dtype_from_f32(element_ptr(values, t, i), floats, t->meta.dtype, n);
+  }
+}
+
+cbool_t tensor_is_contiguous(tensor_f32_t *a) {
+  return contiguous_run(a) == a->meta.capacity ? CBOOL_TRUE : CBOOL_FALSE;
+}
+
+static void set_contiguous_strides(uint64_t *strides, const uint64_t *shape,
+                                   uint64_t shape_length) {
+  uint64_t stride = 1;
+  for (uint64_t d = shape_length; d-- > 0;) {
+    strides[d] = stride;
+    stride *= shape[d];
+  }
+}
 
 void init_tensor_meta(tensor_meta *self, uint64_t capacity, uint64_t *shape,
                       uint64_t shape_length, cbool_t require_grad) {
@@ -19,239 +355,1274 @@ void init_tensor_meta(tensor_meta *self, uint64_t capacity, uint64_t *shape,
     raise_error(NullPointer, "tensor_meta* self is NULL");
   }
 
-  if (shape == NULL) {
-    raise_error(NullPointer, "uint64_t* shape is NULL");
+  if (shape == NULL) {
+    raise_error(NullPointer, "uint64_t* shape is NULL");
+  }
+  self->capacity = capacity;
+  self->shape_length = shape_length;
+  self->require_grad = require_grad;
+  self->dtype = DTYPE_F32;
+  // One block: the shape followed by the strides.
+  self->shape = (uint64_t *)malloc(sizeof(uint64_t) * 2 * shape_length);
+  if (self->shape == NULL) {
+    raise_error(NullPointer, "malloc failed to allocate shape");
+  }
+  self->strides = self->shape + shape_length;
+  memcpy(self->shape, shape, shape_length * sizeof(uint64_t));
+  set_contiguous_strides(self->strides, shape, shape_length);
+}
+
+tensor_meta *new_tensor_meta(uint64_t capacity, uint64_t *shape,
+                             uint64_t shape_length, cbool_t require_grad) {
+  tensor_meta *ret = (tensor_meta *)malloc(sizeof(tensor_meta));
+  init_tensor_meta(ret, capacity, shape, shape_length, require_grad);
+  return ret;
+}
+
+void free_tensor_meta(tensor_meta *self) {
+  if (self != NULL) {
+    if (self->shape != NULL) {
+      free(self->shape);
+    }
+    free(self);
+  }
+}
+
+// Heap storage unless `arena` is given. The gradient buffer of `bytes`
+// comes later, from the first write.
+static tensor_storage_t *new_storage(arena_t *arena, void *data, size_t bytes,
+                                     cbool_t owns_data) {
+  tensor_storage_t *ret;
+  if (arena != NULL) {
+    ret = (tensor_storage_t *)arena_alloc(arena, sizeof(tensor_storage_t));
+  } else {
+    ret = (tensor_storage_t *)malloc(sizeof(tensor_storage_t));
+    if (ret == NULL) {
+      raise_error(NullPointer, "malloc failed to allocate tensor storage");
+    }
+  }
+  ret->data = data;
+  ret->grad = NULL;
+  ret->bytes = bytes;
+  ret->grad_stale = CBOOL_TRUE;
+  atomic_init(&ret->refcount, 1);
+  ret->data_owner = NULL;
+  ret->owns_data = owns_data;
+  ret->arena = arena;
+  return ret;
+}
+
+// References are only counted between heap tensors and heap storage.
+static void retain_storage(tensor_storage_t *storage) {
+  if (storage->arena == NULL) {
+    atomic_fetch_add_explicit(&storage->refcount, 1, memory_order_relaxed);
+  }
+}
+
+static void release_storage(tensor_storage_t *storage) {
+  if (storage->arena != NULL ||
+      atomic_fetch_sub_explicit(&storage->refcount, 1,
+                                memory_order_acq_rel) != 1) {
+    return;
+  }
+  if (storage->data_owner != NULL) {
+    release_storage(storage->data_owner);
+  } else if (storage->owns_data == CBOOL_TRUE) {
+    free(storage->data);
+  }
+  free(storage->grad);
+  free(storage);
+}
+
+// Points `t->grad` at its part of the storage's gradient, which views made
+// before the buffer existed do not know about.
+static void *sync_grad(tensor_f32_t *t) {
+  tensor_storage_t *storage = t->storage;
+  t->grad = storage->grad == NULL
+                ? NULL
+                : (float *)((uint8_t *)storage->grad +
+                            t->offset * dtype_size(t->meta.dtype));
+  return t->grad;
+}
+
+static void allocate_grad(tensor_storage_t *storage) {
+  if (storage->arena != NULL) {
+    storage->grad = arena_alloc(storage->arena, storage->bytes);
+  } else {
+    storage->grad = malloc(storage->bytes);
+    if (storage->grad == NULL) {
+      raise_error(NullPointer, "malloc failed to allocate tensor grad");
+    }
+  }
+  storage->grad_stale = CBOOL_TRUE;
+}
+
+static cbool_t grad_written(tensor_f32_t *t) {
+  return t->storage->grad != NULL && t->storage->grad_stale != CBOOL_TRUE
+             ? CBOOL_TRUE
+             : CBOOL_FALSE;
+}
+
+cbool_t tensor_grad_prepare(tensor_f32_t *t) {
+  tensor_storage_t *storage = t->storage;
+  if (storage->grad == NULL) {
+    allocate_grad(storage);
+  }
+  sync_grad(t);
+  if (storage->grad_stale != CBOOL_TRUE) {
+    return CBOOL_TRUE;
+  }
+  storage->grad_stale = CBOOL_FALSE;
+  if (t->offset == 0 && tensor_is_contiguous(t) == CBOOL_TRUE &&
+      t->meta.capacity * dtype_size(t->meta.dtype) == storage->bytes) {
+    return CBOOL_FALSE;
+  }
+  // A view covers only part of the buffer, and the rest must read as zero.
+  memset(storage->grad, 0, storage->bytes);
+  return CBOOL_TRUE;
+}
+
+void *tensor_grad(tensor_f32_t *t) {
+  tensor_storage_t *storage = t->storage;
+  if (storage->grad == NULL) {
+    allocate_grad(storage);
+  }
+  if (storage->grad_stale == CBOOL_TRUE) {
+    // All-zero bits are 0.0 in every dtype.
+    memset(storage->grad, 0, storage->bytes);
+    storage->grad_stale = CBOOL_FALSE;
+  }
+  return sync_grad(t);
+}
+
+void tensor_zero_grad(tensor_f32_t *t) { t->storage->grad_stale = CBOOL_TRUE; }
+
+static tensor_f32_t *new_arena_tensor_f32(arena_t *arena, uint64_t *shape,
+                                          uint64_t shape_length,
+                                          uint64_t capacity, dtype_t dtype,
+                                          cbool_t require_grad) {
+  tensor_f32_t *ret = (tensor_f32_t *)arena_alloc(arena, sizeof(tensor_f32_t));
+  size_t bytes = dtype_size(dtype) * capacity;
+  ret->meta.capacity = capacity;
+  ret->meta.shape_length = shape_length;
+  ret->meta.require_grad = require_grad;
+  ret->meta.dtype = dtype;
+  ret->meta.shape =
+      (uint64_t *)arena_alloc(arena, sizeof(uint64_t) * 2 * shape_length);
+  ret->meta.strides = ret->meta.shape + shape_length;
+  memcpy(ret->meta.shape, shape, shape_length * sizeof(uint64_t));
+  set_contiguous_strides(ret->meta.strides, shape, shape_length);
+
+  ret->data = (float *)arena_alloc(arena, bytes);
+  ret->grad = NULL;
+  ret->storage = new_storage(arena, ret->data, bytes, CBOOL_TRUE);
+  ret->offset = 0;
+
+  ret->backward_fn = NULL;
+  ret->op = OP_NONE;
+  memset(ret->op_args, 0, sizeof(ret->op_args));
+  ret->prev = NULL;
+  ret->num_prev = 0;
+  ret->visit_epoch = 0;
+  atomic_init(&ret->refcount, 1);
+  ret->in_arena = CBOOL_TRUE;
+  return ret;
+}
+
+tensor_f32_t *new_tensor_f32(uint64_t *shape, uint64_t shape_length,
+                             cbool_t require_grad) {
+  return new_tensor_dtype(shape, shape_length, DTYPE_F32, require_grad);
+}
+
+tensor_f32_t *new_tensor_dtype(uint64_t *shape, uint64_t shape_length,
+                               dtype_t dtype, cbool_t require_grad) {
+  uint64_t capacity = 1;
+  for (uint64_t i = 0; i < shape_length; i++) {
+    capacity *= shape[i];
+  }
+
+  if (active_arena != NULL) {
+    return new_arena_tensor_f32(active_arena, shape, shape_length, capacity,
+                                dtype, require_grad);
+  }
+
+  tensor_f32_t *ret = (tensor_f32_t *)malloc(sizeof(tensor_f32_t));
+  if (ret == NULL) {
+    raise_error(NullPointer, "malloc failed to allocate tensor_f32_t");
+  }
+
+  init_tensor_meta(&ret->meta, capacity, shape, shape_length, require_grad);
+  ret->meta.dtype = dtype;
+
+  ret->data = (float *)malloc(dtype_size(dtype) * capacity);
+  if (ret->data == NULL) {
+    raise_error(NullPointer, "malloc failed to allocate tensor data");
+  }
+
+  ret->grad = NULL;
+  ret->storage =
+      new_storage(NULL, ret->data, capacity * dtype_size(dtype), CBOOL_TRUE);
+  ret->offset = 0;
+
+  ret->backward_fn = NULL;
+  ret->op = OP_NONE;
+  memset(ret->op_args, 0, sizeof(ret->op_args));
+  ret->prev = NULL;
+  ret->num_prev = 0;
+  ret->visit_epoch = 0;
+  atomic_init(&ret->refcount, 1);
+  ret->in_arena = CBOOL_FALSE;
+
+  count_tensor_alloc();
+
+  return ret;
+}
+
+tensor_f32_t *tensor_f32_retain(tensor_f32_t *self) {
+  if (self != NULL && self->in_arena != CBOOL_TRUE) {
+    atomic_fetch_add_explicit(&self->refcount, 1, memory_order_relaxed);
+  }
+  return self;
+}
+
+// Releasing a tensor can cascade down a long chain of inputs, so the
+// tensors still to be released are kept on an explicit stack rather than
+// recursing once per node.
+#define RELEASE_INLINE_STACK 16
+
+void free_tensor_f32(tensor_f32_t *self) {
+  tensor_f32_t *inline_stack[RELEASE_INLINE_STACK];
+  tensor_f32_t **stack = inline_stack;
+  uint64_t capacity = RELEASE_INLINE_STACK;
+  uint64_t size = 0;
+  stack[size++] = self;
+
+  while (size > 0) {
+    tensor_f32_t *t = stack[--size];
+    if (t == NULL || t->in_arena == CBOOL_TRUE ||
+        atomic_fetch_sub_explicit(&t->refcount, 1, memory_order_acq_rel) !=
+            1) {
+      continue;
+    }
+    if (size + (uint64_t)t->num_prev > capacity) {
+      while (size + (uint64_t)t->num_prev > capacity) {
+        capacity *= 2;
+      }
+      tensor_f32_t **grown =
+          (tensor_f32_t **)malloc(sizeof(tensor_f32_t *) * capacity);
+      if (grown == NULL) {
+        raise_error(NullPointer, "malloc failed while releasing tensors");
+      }
+      memcpy(grown, stack, sizeof(tensor_f32_t *) * size);
+      if (stack != inline_stack) {
+        free(stack);
+      }
+      stack = grown;
+    }
+    for (int i = 0; i < t->num_prev; i++) {
+      stack[size++] = t->prev[i];
+    }
+
+    release_storage(t->storage);
+    if (t->meta.shape != NULL) {
+      free(t->meta.shape);
+    }
+    if (t->prev != NULL) {
+      free(t->prev);
+    }
+    free(t);
+    atomic_fetch_sub_explicit(&tensor_live_count, 1, memory_order_relaxed);
+  }
+  if (stack != inline_stack) {
+    free(stack);
+  }
+}
+
+tensor_f32_t *tensor_f32_wrap(float *data, uint64_t *shape,
+                              uint64_t shape_length, cbool_t require_grad) {
+  return tensor_wrap_dtype(data, shape, shape_length, DTYPE_F32, require_grad);
+}
+
+tensor_f32_t *tensor_wrap_dtype(void *data, uint64_t *shape,
+                                uint64_t shape_length, dtype_t dtype,
+                                cbool_t require_grad) {
+  tensor_f32_t *ret = (tensor_f32_t *)malloc(sizeof(tensor_f32_t));
+  if (ret == NULL) {
+    raise_error(NullPointer, "malloc failed to allocate tensor_f32_t");
+  }
+
+  uint64_t capacity = 1;
+  for (uint64_t i = 0; i < shape_length; i++) {
+    capacity *= shape[i];
+  }
+  init_tensor_meta(&ret->meta, capacity, shape, shape_length, require_grad);
+  ret->meta.dtype = dtype;
+  ret->data = (float *)data;
+
+  ret->grad = NULL;
+  ret->storage =
+      new_storage(NULL, ret->data, capacity * dtype_size(dtype), CBOOL_FALSE);
+  ret->offset = 0;
+
+  ret->backward_fn = NULL;
+  ret->op = OP_NONE;
+  memset(ret->op_args, 0, sizeof(ret->op_args));
+  ret->prev = NULL;
+  ret->num_prev = 0;
+  ret->visit_epoch = 0;
+  atomic_init(&ret->refcount, 1);
+  ret->in_arena = CBOOL_FALSE;
+
+  count_tensor_alloc();
+
+  return ret;
+}
+
+tensor_f32_t *tensor_f32_share(tensor_f32_t *src, cbool_t require_grad) {
+  if (tensor_is_contiguous(src) != CBOOL_TRUE) {
+    raise_error(ValueError, "only contiguous tensors can be shared");
+  }
+  tensor_f32_t *ret =
+      tensor_wrap_dtype(src->data, src->meta.shape, src->meta.shape_length,
+                        src->meta.dtype, require_grad);
+  if (src->storage->arena == NULL) {
+    retain_storage(src->storage);
+    ret->storage->data_owner = src->storage;
+  }
+  return ret;
+}
+
+// Forgets how `self` was produced, releasing the inputs it kept alive.
+static void drop_graph_edges(tensor_f32_t *self) {
+  tensor_f32_t **prev = self->prev;
+  int num_prev = self->num_prev;
+  self->prev = NULL;
+  self->num_prev = 0;
+  self->backward_fn = NULL;
+  self->op = OP_NONE;
+  memset(self->op_args, 0, sizeof(self->op_args));
+  if (prev == NULL || self->in_arena == CBOOL_TRUE) {
+    return;
+  }
+  for (int i = 0; i < num_prev; i++) {
+    free_tensor_f32(prev[i]);
+  }
+  free(prev);
+}
+
+void tensor_f32_set_backward(tensor_f32_t *self, op_kind_t op,
+                             grad_fn backward_fn, tensor_f32_t **prev,
+                             int num_prev) {
+  drop_graph_edges(self);
+  size_t size = sizeof(tensor_f32_t *) * num_prev;
+  if (self->in_arena == CBOOL_TRUE) {
+    if (active_arena == NULL) {
+      raise_error(RuntimeError, "arena tensor used after its arena was left");
+    }
+    self->prev = (tensor_f32_t **)arena_alloc(active_arena, size);
+  } else {
+    self->prev = (tensor_f32_t **)malloc(size);
+    if (self->prev == NULL) {
+      raise_error(NullPointer, "malloc failed to allocate prev");
+    }
+  }
+  memcpy(self->prev, prev, size);
+  self->num_prev = num_prev;
+  self->backward_fn = backward_fn;
+  self->op = op;
+  if (self->in_arena != CBOOL_TRUE) {
+    for (int i = 0; i < num_prev; i++) {
+      tensor_f32_retain(prev[i]);
+    }
+  }
+}
+
+// Sets every element of `values`, the data or grad of `t`.
+static void fill_elements(void *values, tensor_f32_t *t, float value) {
+  uint64_t run = contiguous_run(t);
+  for (uint64_t i = 0; i < t->meta.capacity; i += run) {
+    fill_dtype(element_ptr(values, t, i), t->meta.dtype, value, run);
+  }
+}
+
+void tensor_f32_fill(tensor_f32_t *self, float value) {
+  if (self == NULL || self->data == NULL) {
+    raise_error(NullPointer, "tensor or tensor data is NULL");
+  }
+  fill_elements(self->data, self, value);
+}
+
+// Values [first, first + n) of `rng` into `values`, as given by `fn`.
+typedef void (*rng_fill_fn)(const rng_t *rng, float *values, uint64_t first,
+                            uint64_t n, float a, float b);
+
+static void fill_random(tensor_f32_t *self, rng_t *rng, rng_fill_fn fn,
+                        float a, float b) {
+  if (self == NULL || self->data == NULL) {
+    raise_error(NullPointer, "tensor or tensor data is NULL");
+  }
+  rng_t stream;
+  if (rng == NULL) {
+    stream = rng_next_stream();
+    rng = &stream;
+  }
+  uint64_t first = rng->offset;
+  if (self->meta.dtype == DTYPE_F32 &&
+      tensor_is_contiguous(self) == CBOOL_TRUE) {
+    fn(rng, self->data, first, self->meta.capacity, a, b);
+  } else {
+    float values[CONVERT_CHUNK];
+    uint64_t run = contiguous_run(self);
+    uint64_t len;
+    for (uint64_t start = 0; start < self->meta.capacity; start += len) {
+      len = self->meta.capacity - start;
+      if (len > CONVERT_CHUNK) {
+        len = CONVERT_CHUNK;
+      }
+      // Chunks end at run boundaries so each is written in one piece.
+      if (len > run - start % run) {
+        len = run - start % run;
+      }
+      fn(rng, values, first + start, len, a, b);
+      dtype_from_f32(element_ptr(self->data, self, start), values,
+                     self->meta.dtype, len);
+    }
+  }
+  rng->offset = first + self->meta.capacity;
+}
+
+void tensor_f32_randn(tensor_f32_t *self, rng_t *rng, float mean, float std) {
+  // Normals start on a Box-Muller pair, as rng_normal's do.
+  if (rng != NULL) {
+    rng->offset = (rng->offset + 1) & ~1ull;
+  }
+  fill_random(self, rng, rng_normal_at, mean, std);
+}
+
+void tensor_f32_rand(tensor_f32_t *self, rng_t *rng, float lo, float hi) {
+  fill_random(self, rng, rng_uniform_at, lo, hi);
+}
+
+// A float matrix as sgemm sees it: `rows` x `cols` elements, neighbours
+// `row_stride` apart down a column and `col_stride` apart along a row.
+typedef struct {
+  float *data;
+  uint64_t rows;
+  uint64_t cols;
+  uint64_t row_stride;
+  uint64_t col_stride;
+} gemm_matrix_t;
+
+// `values` (data or grad) of a 2D float tensor.
+static gemm_matrix_t gemm_view(tensor_f32_t *t, float *values) {
+  return (gemm_matrix_t){values, t->meta.shape[0], t->meta.shape[1],
+                         t->meta.strides[0], t->meta.strides[1]};
+}
+
+static gemm_matrix_t gemm_dense(float *data, uint64_t rows, uint64_t cols) {
+  return (gemm_matrix_t){data, rows, cols, cols, 1};
+}
+
+static gemm_matrix_t gemm_t(gemm_matrix_t m) {
+  return (gemm_matrix_t){m.data, m.cols, m.rows, m.col_stride, m.row_stride};
+}
+
+// Whether `m` is row-major with a valid leading dimension, stored in `ld`.
+// Strides along a dimension of size one are irrelevant.
+static cbool_t gemm_row_major(gemm_matrix_t m, uint64_t *ld) {
+  if (m.cols > 1 && m.col_stride != 1) {
+    return CBOOL_FALSE;
+  }
+  *ld = m.rows > 1 ? m.row_stride : (m.cols > 0 ? m.cols : 1);
+  return *ld >= m.cols && *ld > 0 ? CBOOL_TRUE : CBOOL_FALSE;
+}
+
+// sgemm addresses an operand as row-major, or as the transpose of a
+// row-major matrix.
+static cbool_t gemm_layout(gemm_matrix_t m, sgemm_trans_t *trans,
+                           uint64_t *ld) {
+  if (gemm_row_major(m, ld) == CBOOL_TRUE) {
+    *trans = SGEMM_NO_TRANS;
+    return CBOOL_TRUE;
+  }
+  if (gemm_row_major(gemm_t(m), ld) == CBOOL_TRUE) {
+    *trans = SGEMM_TRANS;
+    return CBOOL_TRUE;
+  }
+  return CBOOL_FALSE;
+}
+
+static cbool_t gemm_addressable(tensor_f32_t *t) {
+  sgemm_trans_t trans;
+  uint64_t ld;
+  return gemm_layout(gemm_view(t, t->data), &trans, &ld);
+}
+
+// c = alpha * a * b + beta * c for strided matrices, none of them copied.
+// A column-major `c` is computed as c^T = b^T * a^T.
+static void strided_gemm(float alpha, gemm_matrix_t a, gemm_matrix_t b,
+                         float beta, gemm_matrix_t c) {
+  uint64_t ldc;
+  if (gemm_row_major(c, &ldc) != CBOOL_TRUE) {
+    strided_gemm(alpha, gemm_t(b), gemm_t(a), beta, gemm_t(c));
+    return;
+  }
+  sgemm_trans_t trans_a, trans_b;
+  uint64_t lda, ldb;
+  if (gemm_layout(a, &trans_a, &lda) != CBOOL_TRUE ||
+      gemm_layout(b, &trans_b, &ldb) != CBOOL_TRUE) {
+    raise_error(ValueError, "matrix layout cannot be passed to sgemm");
+  }
+  sgemm(trans_a, trans_b, c.rows, c.cols, a.cols, alpha, a.data, lda, b.data,
+        ldb, beta, c.data, ldc);
+}
+
+// Backward functions
+// Every input may be a strided view; its gradient shares its data's
+// layout. Outputs of ops, and so `self`, are always contiguous. Each write
+// to an input's gradient starts with tensor_grad_prepare, which decides
+// whether it overwrites or accumulates.
+
+static void scale_grad_run(void *ctx, uint64_t i, uint64_t len) {
+  elementwise_t *e = (elementwise_t *)ctx;
+  tensor_f32_t *a = e->a;
+  float dst[ELEMENTWISE_CHUNK];
+  float g[ELEMENTWISE_CHUNK];
+  for (uint64_t end = i + len, n; i < end; i += n) {
+    n = piece_len(e, i, end);
+    float *da = write_floats(dst, a->grad, a, i, n, e->acc_a);
+    e->k->scale_grad(da, read_floats(g, e->self->grad, e->self, i, n),
+                     e->scalar, n, e->acc_a);
+    store_floats(a->grad, a, i, da, n);
+  }
+}
+
+static void mul_grad_run(void *ctx, uint64_t i, uint64_t len) {
+  elementwise_t *e = (elementwise_t *)ctx;
+  tensor_f32_t *a = e->a;
+  tensor_f32_t *b = e->b;
+  float dst[ELEMENTWISE_CHUNK];
+  float g[ELEMENTWISE_CHUNK];
+  float x[ELEMENTWISE_CHUNK];
+  for (uint64_t end = i + len, n; i < end; i += n) {
+    n = piece_len(e, i, end);
+    float *dy = read_floats(g, e->self->grad, e->self, i, n);
+    if (a->meta.require_grad == CBOOL_TRUE) {
+      float *da = write_floats(dst, a->grad, a, i, n, e->acc_a);
+      e->k->mul_grad(da, dy, read_floats(x, b->data, b, i, n), n, e->acc_a);
+      store_floats(a->grad, a, i, da, n);
+    }
+    if (b->meta.require_grad == CBOOL_TRUE) {
+      float *db = write_floats(dst, b->grad, b, i, n, e->acc_b);
+      e->k->mul_grad(db, dy, read_floats(x, a->data, a, i, n), n, e->acc_b);
+      store_floats(b->grad, b, i, db, n);
+    }
+  }
+}
+
+static void div_grad_run(void *ctx, uint64_t i, uint64_t len) {
+  elementwise_t *e = (elementwise_t *)ctx;
+  tensor_f32_t *a = e->a;
+  tensor_f32_t *b = e->b;
+  float dst[ELEMENTWISE_CHUNK];
+  float g[ELEMENTWISE_CHUNK];
+  float x[ELEMENTWISE_CHUNK];
+  float y[ELEMENTWISE_CHUNK];
+  for (uint64_t end = i + len, n; i < end; i += n) {
+    n = piece_len(e, i, end);
+    float *dy = read_floats(g, e->self->grad, e->self, i, n);
+    float *bv = read_floats(y, b->data, b, i, n);
+    if (a->meta.require_grad == CBOOL_TRUE) {
+      float *da = write_floats(dst, a->grad, a, i, n, e->acc_a);
+      e->k->div_grad(da, dy, bv, n, e->acc_a);
+      store_floats(a->grad, a, i, da, n);
+    }
+    if (b->meta.require_grad == CBOOL_TRUE) {
+      float *db = write_floats(dst, b->grad, b, i, n, e->acc_b);
+      e->k->div_rhs_grad(db, dy, read_floats(x, a->data, a, i, n), bv, n,
+                         e->acc_b);
+      store_floats(b->grad, b, i, db, n);
+    }
+  }
+}
+
+// The gradient of a unary op whose derivative is computed from `from`
+// (the op's output or its input) by `grad`.
+static void unary_grad_run(elementwise_t *e, uint64_t i, uint64_t len,
+                           tensor_f32_t *from,
+                           void (*grad)(elementwise_t *e, float *dst,
+                                        const float *g, const float *v,
+                                        uint64_t n)) {
+  tensor_f32_t *a = e->a;
+  float dst[ELEMENTWISE_CHUNK];
+  float g[ELEMENTWISE_CHUNK];
+  float v[ELEMENTWISE_CHUNK];
+  for (uint64_t end = i + len, n; i < end; i += n) {
+    n = piece_len(e, i, end);
+    float *da = write_floats(dst, a->grad, a, i, n, e->acc_a);
+    grad(e, da, read_floats(g, e->self->grad, e->self, i, n),
+         read_floats(v, from->data, from, i, n), n);
+    store_floats(a->grad, a, i, da, n);
+  }
+}
+
+static void sigmoid_grad(elementwise_t *e, float *dst, const float *g,
+                         const float *y, uint64_t n) {
+  e->k->sigmoid_grad(dst, g, y, n, e->acc_a);
+}
+
+static void tanh_grad(elementwise_t *e, float *dst, const float *g,
+                      const float *y, uint64_t n) {
+  e->k->tanh_grad(dst, g, y, n, e->acc_a);
+}
+
+static void relu_grad(elementwise_t *e, float *dst, const float *g,
+                      const float *x, uint64_t n) {
+  e->k->leaky_relu_grad(dst, g, x, 0.01f, n, e->acc_a);
+}
+
+static void sigmoid_grad_run(void *ctx, uint64_t i, uint64_t len) {
+  elementwise_t *e = (elementwise_t *)ctx;
+  unary_grad_run(e, i, len, e->self, sigmoid_grad);
+}
+
+static void tanh_grad_run(void *ctx, uint64_t i, uint64_t len) {
+  elementwise_t *e = (elementwise_t *)ctx;
+  unary_grad_run(e, i, len, e->self, tanh_grad);
+}
+
+static void relu_grad_run(void *ctx, uint64_t i, uint64_t len) {
+  elementwise_t *e = (elementwise_t *)ctx;
+  unary_grad_run(e, i, len, e->a, relu_grad);
+}
+
+// A broadcast operand receives the sum of the output gradient over the
+// columns it was repeated across.
+static void accumulate_broadcast_grad(tensor_f32_t *self, tensor_f32_t *t,
+                                      float alpha) {
+  const elementwise_kernels_t *k = get_kernels();
+  cbool_t accumulate = tensor_grad_prepare(t);
+  if (t->meta.capacity == self->meta.capacity) {
+    elementwise_t e = {.k = k,
+                       .self = self,
+                       .a = t,
+                       .scalar = alpha,
+                       .acc_a = accumulate};
+    for_each_run(t->meta.capacity, common_run(t, NULL),
+                 parallel_grain(ARITHMETIC_COST), scale_grad_run, &e);
+    return;
+  }
+  uint64_t rows = t->meta.capacity;
+  uint64_t cols = self->meta.capacity / rows;
+  float g[ELEMENTWISE_CHUNK];
+  for (uint64_t r = 0; r < rows; r++) {
+    float sum = 0.0f;
+    for (uint64_t j = 0, n; j < cols; j += n) {
+      n = cols - j;
+      if (self->meta.dtype != DTYPE_F32 && n > ELEMENTWISE_CHUNK) {
+        n = ELEMENTWISE_CHUNK;
+      }
+      sum += k->sum(read_floats(g, self->grad, self, r * cols + j, n), n);
+    }
+    float value;
+    float *dst = write_floats(&value, t->grad, t, r, 1, accumulate);
+    *dst = accumulate == CBOOL_TRUE ? *dst + alpha * sum : alpha * sum;
+    store_floats(t->grad, t, r, dst, 1);
+  }
+}
+
+void add_backward(tensor_f32_t *self) {
+  tensor_f32_t *a = self->prev[0];
+  tensor_f32_t *b = self->prev[1];
+  if (a->meta.require_grad == CBOOL_TRUE) {
+    accumulate_broadcast_grad(self, a, 1.0f);
+  }
+  if (b->meta.require_grad == CBOOL_TRUE) {
+    accumulate_broadcast_grad(self, b, 1.0f);
+  }
+}
+
+void sub_backward(tensor_f32_t *self) {
+  tensor_f32_t *a = self->prev[0];
+  tensor_f32_t *b = self->prev[1];
+  if (a->meta.require_grad == CBOOL_TRUE) {
+    accumulate_broadcast_grad(self, a, 1.0f);
+  }
+  if (b->meta.require_grad == CBOOL_TRUE) {
+    accumulate_broadcast_grad(self, b, -1.0f);
+  }
+}
+
+void mul_backward(tensor_f32_t *self) {
+  tensor_f32_t *a = self->prev[0];
+  tensor_f32_t *b = self->prev[1];
+  const elementwise_kernels_t *k = get_kernels();
+  // When a and b are one tensor, b's pass adds to a's in every run.
+  cbool_t acc_a = a->meta.require_grad == CBOOL_TRUE ? tensor_grad_prepare(a)
+                                                     : CBOOL_FALSE;
+  cbool_t acc_b = b->meta.require_grad == CBOOL_TRUE ? tensor_grad_prepare(b)
+                                                     : CBOOL_FALSE;
+  elementwise_t e = {.k = k,
+                     .self = self,
+                     .a = a,
+                     .b = b,
+                     .acc_a = acc_a,
+                     .acc_b = acc_b};
+  for_each_run(self->meta.capacity, common_run(a, b),
+               grad_grain(a, b, ARITHMETIC_COST), mul_grad_run, &e);
+}
+
+void div_backward(tensor_f32_t *self) {
+  tensor_f32_t *a = self->prev[0];
+  tensor_f32_t *b = self->prev[1];
+  const elementwise_kernels_t *k = get_kernels();
+  cbool_t acc_a = a->meta.require_grad == CBOOL_TRUE ? tensor_grad_prepare(a)
+                                                     : CBOOL_FALSE;
+  cbool_t acc_b = b->meta.require_grad == CBOOL_TRUE ? tensor_grad_prepare(b)
+                                                     : CBOOL_FALSE;
+  elementwise_t e = {.k = k,
+                     .self = self,
+                     .a = a,
+                     .b = b,
+                     .acc_a = acc_a,
+                     .acc_b = acc_b};
+  for_each_run(self->meta.capacity, common_run(a, b),
+               grad_grain(a, b, ARITHMETIC_COST), div_grad_run, &e);
+}
+
+void sigmoid_backward(tensor_f32_t *self) {
+  tensor_f32_t *a = self->prev[0];
+  if (a->meta.require_grad == CBOOL_TRUE) {
+    elementwise_t e = {.k = get_kernels(),
+                       .self = self,
+                       .a = a,
+                       .acc_a = tensor_grad_prepare(a)};
+    for_each_run(a->meta.capacity, common_run(a, NULL),
+                 parallel_grain(ARITHMETIC_COST), sigmoid_grad_run, &e);
+  }
+}
+
+void tanh_backward(tensor_f32_t *self) {
+  tensor_f32_t *a = self->prev[0];
+  if (a->meta.require_grad == CBOOL_TRUE) {
+    elementwise_t e = {.k = get_kernels(),
+                       .self = self,
+                       .a = a,
+                       .acc_a = tensor_grad_prepare(a)};
+    for_each_run(a->meta.capacity, common_run(a, NULL),
+                 parallel_grain(ARITHMETIC_COST), tanh_grad_run, &e);
   }
-  self->capacity = capacity;
-  self->shape_length = shape_length;
-  self->require_grad = require_grad;
-  self->shape = (uint64_t *)malloc(sizeof(uint64_t) * shape_length);
-  if (self->shape == NULL) {
-    raise_error(NullPointer, "malloc failed to allocate shape");
+}
+
+void relu_backward(tensor_f32_t *self) {
+  tensor_f32_t *a = self->prev[0];
+  if (a->meta.require_grad == CBOOL_TRUE) {
+    elementwise_t e = {.k = get_kernels(),
+                       .self = self,
+                       .a = a,
+                       .acc_a = tensor_grad_prepare(a)};
+    for_each_run(a->meta.capacity, common_run(a, NULL),
+                 parallel_grain(ARITHMETIC_COST), relu_grad_run, &e);
   }
-  memcpy(self->shape, shape, shape_length * sizeof(uint64_t));
 }
 
-tensor_meta *new_tensor_meta(uint64_t capacity, uint64_t *shape,
-                             uint64_t shape_length, cbool_t require_grad) {
-  tensor_meta *ret = (tensor_meta *)malloc(sizeof(tensor_meta));
-  init_tensor_meta(ret, capacity, shape, shape_length, require_grad);
-  return ret;
+// Per-thread scratch buffers for tensor_f32_linear: the pre-activation
+// gradient and float copies of reduced-precision operands. Matmul uses the
+// same slots for its blocks of 16-bit operands. Reused across calls on the
+// same thread.
+typedef enum {
+  LINEAR_SCRATCH_DZ,
+  LINEAR_SCRATCH_GRAD,
+  LINEAR_SCRATCH_OUT,
+  LINEAR_SCRATCH_X,
+  LINEAR_SCRATCH_DX,
+  LINEAR_SCRATCH_WEIGHT,
+  LINEAR_SCRATCH_BIAS,
+  LINEAR_SCRATCH_SLOTS
+} linear_scratch_slot_t;
+
+// Floats of a reduced-precision weight widened at a time; small enough to
+// stay in cache between the conversion and the sgemm that reads it.
+#define LINEAR_WEIGHT_BLOCK (1 << 15)
+
+static _Thread_local float *linear_scratch[LINEAR_SCRATCH_SLOTS];
+static _Thread_local uint64_t linear_scratch_capacity[LINEAR_SCRATCH_SLOTS];
+
+static void release_linear_scratch() {
+  for (int slot = 0; slot < LINEAR_SCRATCH_SLOTS; slot++) {
+    free(linear_scratch[slot]);
+    linear_scratch[slot] = NULL;
+    linear_scratch_capacity[slot] = 0;
+  }
 }
 
-void free_tensor_meta(tensor_meta *self) {
-  if (self != NULL) {
-    if (self->shape != NULL) {
-      free(self->shape);
+static float *reserve_linear_scratch(linear_scratch_slot_t slot,
+                                     uint64_t size) {
+  if (size > linear_scratch_capacity[slot]) {
+    register_thread_scratch(release_linear_scratch);
+    float *scratch =
+        (float *)realloc(linear_scratch[slot], sizeof(float) * size);
+    if (scratch == NULL) {
+      raise_error(NullPointer, "realloc failed to allocate linear scratch");
     }
-    free(self);
+    linear_scratch[slot] = scratch;
+    linear_scratch_capacity[slot] = size;
   }
+  return linear_scratch[slot];
 }
 
-tensor_f32_t *new_tensor_f32(uint64_t *shape, uint64_t shape_length,
-                             cbool_t require_grad) {
-  tensor_f32_t *ret = (tensor_f32_t *)malloc(sizeof(tensor_f32_t));
-  if (ret == NULL) {
-    raise_error(NullPointer, "malloc failed to allocate tensor_f32_t");
+// `values` (data or grad of a tensor with `dtype`) as floats, widened into
+// `slot` unless they already are.
+static float *linear_f32(void *values, dtype_t dtype, uint64_t n,
+                         linear_scratch_slot_t slot) {
+  if (dtype == DTYPE_F32) {
+    return (float *)values;
   }
+  float *ret = reserve_linear_scratch(slot, n);
+  dtype_to_f32(ret, values, dtype, n);
+  return ret;
+}
 
-  uint64_t capacity = 1;
-  for (uint64_t i = 0; i < shape_length; i++) {
-    capacity *= shape[i];
+static uint64_t linear_block_rows(uint64_t in_features) {
+  uint64_t rows = LINEAR_WEIGHT_BLOCK / in_features;
+  return rows > 0 ? rows : 1;
+}
+
+// The input of a linear as a float matrix: a float view is read in place,
+// a (contiguous) reduced-precision input is widened into scratch.
+static gemm_matrix_t linear_input(tensor_f32_t *x) {
+  if (x->meta.dtype == DTYPE_F32) {
+    return gemm_view(x, x->data);
   }
+  return gemm_dense(linear_f32(x->data, x->meta.dtype, x->meta.capacity,
+                               LINEAR_SCRATCH_X),
+                    x->meta.shape[0], x->meta.shape[1]);
+}
 
-  init_tensor_meta(&ret->meta, capacity, shape, shape_length, require_grad);
+// sgemm reads float operands in any layout it can address; other layouts,
+// and reduced-precision operands (widened as flat arrays), are made
+// contiguous first.
+static tensor_f32_t *linear_operand(tensor_f32_t *t) {
+  cbool_t direct = t->meta.dtype == DTYPE_F32 ? gemm_addressable(t)
+                                              : tensor_is_contiguous(t);
+  return direct == CBOOL_TRUE ? t : tensor_f32_contiguous(t);
+}
 
-  ret->data = (float *)malloc(sizeof(float) * capacity);
-  if (ret->data == NULL) {
-    raise_error(NullPointer, "malloc failed to allocate tensor data");
-  }
+static float linear_slope(activation_t activation) {
+  return activation == ACTIVATION_RELU ? 0.0f : 0.01f;
+}
 
-  if (require_grad == CBOOL_TRUE) {
-    ret->grad = (float *)calloc(capacity, sizeof(float));
-    if (ret->grad == NULL) {
-      raise_error(NullPointer, "malloc failed to allocate tensor grad");
-    }
+// The fused activation, or its derivative, over contiguous floats, split
+// across the thread pool when large.
+typedef struct {
+  const elementwise_kernels_t *k;
+  activation_t activation;
+  float *dst;
+  const float *g;
+  const float *y;
+} linear_activation_t;
+
+static void activate_range(void *ctx, uint64_t begin, uint64_t end) {
+  linear_activation_t *p = (linear_activation_t *)ctx;
+  float *y = p->dst + begin;
+  if (p->activation == ACTIVATION_SIGMOID) {
+    p->k->sigmoid(y, y, end - begin);
   } else {
-    ret->grad = NULL;
+    p->k->leaky_relu(y, y, linear_slope(p->activation), end - begin);
   }
+}
 
-  ret->backward_fn = NULL;
-  ret->prev = NULL;
-  ret->num_prev = 0;
+// dst = g * activation'(y)
+static void activation_grad_range(void *ctx, uint64_t begin, uint64_t end) {
+  linear_activation_t *p = (linear_activation_t *)ctx;
+  if (p->activation == ACTIVATION_SIGMOID) {
+    p->k->sigmoid_grad(p->dst + begin, p->g + begin, p->y + begin,
+                       end - begin, CBOOL_FALSE);
+  } else {
+    p->k->leaky_relu_grad(p->dst + begin, p->g + begin, p->y + begin,
+                          linear_slope(p->activation), end - begin,
+                          CBOOL_FALSE);
+  }
+}
 
-  tensor_alloc_count++;
+// db[r] = the sum of row r of dz, one row per item.
+typedef struct {
+  const elementwise_kernels_t *k;
+  const float *dz;
+  float *db;
+  uint64_t batch;
+} row_sums_t;
 
-  return ret;
+static void row_sums_range(void *ctx, uint64_t begin, uint64_t end) {
+  row_sums_t *p = (row_sums_t *)ctx;
+  for (uint64_t r = begin; r < end; r++) {
+    p->db[r] = p->k->sum(p->dz + r * p->batch, p->batch);
+  }
 }
 
-void free_tensor_f32(tensor_f32_t *self) {
-  if (self != NULL) {
-    if (self->data != NULL) {
-      free(self->data);
+// prev = {x, weight, bias}; bias may be NULL. The activation derivative is
+// recovered from the output, so the pre-activation is never stored.
+static void linear_backward(tensor_f32_t *self, activation_t activation) {
+  tensor_f32_t *x = self->prev[0];
+  tensor_f32_t *w = self->prev[1];
+  tensor_f32_t *bias = self->prev[2];
+  uint64_t out_features = w->meta.shape[0];
+  uint64_t in_features = w->meta.shape[1];
+  uint64_t batch = x->meta.shape[1];
+  dtype_t w_dtype = w->meta.dtype;
+
+  const elementwise_kernels_t *k = get_kernels();
+  float *dz = linear_f32(self->grad, self->meta.dtype, self->meta.capacity,
+                         LINEAR_SCRATCH_GRAD);
+  if (activation != ACTIVATION_NONE) {
+    float *y = linear_f32(self->data, self->meta.dtype, self->meta.capacity,
+                          LINEAR_SCRATCH_OUT);
+    linear_activation_t pass = {k, activation, NULL, dz, y};
+    dz = reserve_linear_scratch(LINEAR_SCRATCH_DZ, self->meta.capacity);
+    pass.dst = dz;
+    parallel_for(0, self->meta.capacity, parallel_grain(ARITHMETIC_COST),
+                 activation_grad_range, &pass);
+  }
+
+  // Reduced-precision weights are widened and their gradients accumulated
+  // one block of rows at a time.
+  uint64_t block_rows = linear_block_rows(in_features);
+  if (w->meta.require_grad == CBOOL_TRUE) {
+    cbool_t accumulate = tensor_grad_prepare(w);
+    gemm_matrix_t x32 = linear_input(x);
+    if (w_dtype == DTYPE_F32) {
+      // w->grad (+)= dz * x^T
+      strided_gemm(1.0f, gemm_dense(dz, out_features, batch), gemm_t(x32),
+                   accumulate == CBOOL_TRUE ? 1.0f : 0.0f,
+                   gemm_view(w, w->grad));
+    } else {
+      float *dw = reserve_linear_scratch(LINEAR_SCRATCH_WEIGHT,
+                                         block_rows * in_features);
+      for (uint64_t r = 0; r < out_features; r += block_rows) {
+        uint64_t rows = out_features - r < block_rows ? out_features - r
+                                                      : block_rows;
+        strided_gemm(1.0f, gemm_dense(dz + r * batch, rows, batch),
+                     gemm_t(x32), 0.0f, gemm_dense(dw, rows, in_features));
+        write_dtype(w->grad16 + r * in_features, w_dtype, dw, DTYPE_F32,
+                    rows * in_features, accumulate);
+      }
     }
-    if (self->grad != NULL) {
-      free(self->grad);
+  }
+  if (bias != NULL && bias->meta.require_grad == CBOOL_TRUE) {
+    float *db = reserve_linear_scratch(LINEAR_SCRATCH_BIAS, out_features);
+    row_sums_t sums = {k, dz, db, batch};
+    parallel_for(0, out_features, parallel_grain(batch), row_sums_range,
+                 &sums);
+    cbool_t accumulate = tensor_grad_prepare(bias);
+    write_dtype(bias->grad, bias->meta.dtype, db, DTYPE_F32, out_features,
+                accumulate);
+  }
+  if (x->meta.require_grad == CBOOL_TRUE) {
+    cbool_t accumulate = tensor_grad_prepare(x);
+    gemm_matrix_t dx = gemm_view(x, x->grad);
+    // The first product into dx overwrites it unless x's gradient already
+    // holds something; a reduced-precision x gets a fresh float dx.
+    float beta = accumulate == CBOOL_TRUE ? 1.0f : 0.0f;
+    if (x->meta.dtype != DTYPE_F32) {
+      dx = gemm_dense(
+          reserve_linear_scratch(LINEAR_SCRATCH_DX, x->meta.capacity),
+          in_features, batch);
+      beta = 0.0f;
     }
-    if (self->meta.shape != NULL) {
-      free(self->meta.shape);
+    if (w_dtype == DTYPE_F32) {
+      // x->grad (+)= w^T * dz
+      strided_gemm(1.0f, gemm_t(gemm_view(w, w->data)),
+                   gemm_dense(dz, out_features, batch), beta, dx);
+    } else {
+      float *w32 = reserve_linear_scratch(LINEAR_SCRATCH_WEIGHT,
+                                          block_rows * in_features);
+      for (uint64_t r = 0; r < out_features; r += block_rows) {
+        uint64_t rows = out_features - r < block_rows ? out_features - r
+                                                      : block_rows;
+        dtype_to_f32(w32, w->data16 + r * in_features, w_dtype,
+                     rows * in_features);
+        strided_gemm(1.0f, gemm_t(gemm_dense(w32, rows, in_features)),
+                     gemm_dense(dz + r * batch, rows, batch), beta, dx);
+        beta = 1.0f;
+      }
     }
-    if (self->prev != NULL) {
-      free(self->prev);
+    if (x->meta.dtype != DTYPE_F32) {
+      write_dtype(x->grad, x->meta.dtype, dx.data, DTYPE_F32,
+                  x->meta.capacity, accumulate);
     }
-    free(self);
-    tensor_alloc_count--;
   }
 }
 
-void tensor_f32_fill(tensor_f32_t *self, float value) {
-  if (self == NULL || self->data == NULL) {
-    raise_error(NullPointer, "tensor or tensor data is NULL");
-  }
-  for (uint64_t i = 0; i < self->meta.capacity; i++) {
-    self->data[i] = value;
+void linear_backward_none(tensor_f32_t *self) {
+  linear_backward(self, ACTIVATION_NONE);
+}
+
+void linear_backward_relu(tensor_f32_t *self) {
+  linear_backward(self, ACTIVATION_RELU);
+}
+
+void linear_backward_leaky_relu(tensor_f32_t *self) {
+  linear_backward(self, ACTIVATION_LEAKY_RELU);
+}
+
+void linear_backward_sigmoid(tensor_f32_t *self) {
+  linear_backward(self, ACTIVATION_SIGMOID);
+}
+
+// Matmul computes a block of rows of its result at a time when an operand
+// is stored in 16 bits, widening the matching rows of `a` (and all of `b`,
+// like a linear's input) into linear scratch; float operands go to sgemm
+// whole.
+static uint64_t matmul_block_rows(tensor_f32_t *a, tensor_f32_t *b) {
+  if (a->meta.dtype == DTYPE_F32 && b->meta.dtype == DTYPE_F32) {
+    return a->meta.shape[0];
   }
+  uint64_t widest =
+      a->meta.shape[1] > b->meta.shape[1] ? a->meta.shape[1] : b->meta.shape[1];
+  return linear_block_rows(widest);
 }
 
-// Box-Muller transform
-void tensor_f32_randn(tensor_f32_t *self, float mean, float std) {
-  if (self == NULL || self->data == NULL) {
-    raise_error(NullPointer, "tensor or tensor data is NULL");
+// Rows [r, r + rows) of `values`, the data or grad of the matrix `t`: in
+// place for a float view, otherwise a float block in `slot`, widened from
+// the (contiguous) values when `load`.
+static gemm_matrix_t matmul_rows(tensor_f32_t *t, void *values, uint64_t r,
+                                 uint64_t rows, linear_scratch_slot_t slot,
+                                 cbool_t load) {
+  uint64_t cols = t->meta.shape[1];
+  if (t->meta.dtype == DTYPE_F32) {
+    gemm_matrix_t m = gemm_view(t, (float *)values);
+    m.data += r * m.row_stride;
+    m.rows = rows;
+    return m;
   }
-  for (uint64_t i = 0; i < self->meta.capacity; i += 2) {
-    float u1 = (float)rand() / (float)RAND_MAX;
-    float u2 = (float)rand() / (float)RAND_MAX;
-    float z1 = sqrtf(-2.0f * logf(u1)) * cosf(2.0f * M_PI * u2);
-    float z2 = sqrtf(-2.0f * logf(u1)) * sinf(2.0f * M_PI * u2);
-    self->data[i] = z1 * std + mean;
-    if (i + 1 < self->meta.capacity) {
-      self->data[i + 1] = z2 * std + mean;
-    }
+  float *block = reserve_linear_scratch(slot, rows * cols);
+  if (load == CBOOL_TRUE) {
+    dtype_to_f32(block, (uint16_t *)values + r * cols, t->meta.dtype,
+                 rows * cols);
   }
+  return gemm_dense(block, rows, cols);
 }
 
-// Backward functions
-void add_backward(tensor_f32_t *self) {
-  tensor_f32_t *a = self->prev[0];
-  tensor_f32_t *b = self->prev[1];
-  if (a->meta.require_grad == CBOOL_TRUE) {
-    for (uint64_t i = 0; i < a->meta.capacity; i++) {
-      a->grad[i] += self->grad[i];
-    }
-  }
-  if (b->meta.require_grad == CBOOL_TRUE) {
-    for (uint64_t i = 0; i < b->meta.capacity; i++) {
-      b->grad[i] += self->grad[i];
-    }
+// Narrows a block from matmul_rows back into `values` unless it was
+// computed in place.
+static void matmul_store_rows(tensor_f32_t *t, void *values, uint64_t r,
+                              gemm_matrix_t m) {
+  if (t->meta.dtype != DTYPE_F32) {
+    dtype_from_f32((uint16_t *)values + r * t->meta.shape[1], m.data,
+                   t->meta.dtype, m.rows * m.cols);
   }
 }
 
-void sub_backward(tensor_f32_t *self) {
+// prev = {a, b}. A 16-bit operand is contiguous (see linear_operand); its
+// gradient is written a block of rows at a time, or for b, summed over
+// the blocks in float first.
+void matmul_backward(tensor_f32_t *self) {
   tensor_f32_t *a = self->prev[0];
   tensor_f32_t *b = self->prev[1];
-  if (a->meta.require_grad == CBOOL_TRUE) {
-    for (uint64_t i = 0; i < a->meta.capacity; i++) {
-      a->grad[i] += self->grad[i];
+  cbool_t a_grad = a->meta.require_grad;
+  cbool_t b_grad = b->meta.require_grad;
+  cbool_t acc_a = a_grad == CBOOL_TRUE ? tensor_grad_prepare(a) : CBOOL_FALSE;
+  cbool_t acc_b = b_grad == CBOOL_TRUE ? tensor_grad_prepare(b) : CBOOL_FALSE;
+  gemm_matrix_t b32 = {NULL, 0, 0, 0, 0};
+  if (a_grad == CBOOL_TRUE) {
+    b32 = linear_input(b);
+  }
+  gemm_matrix_t db = {NULL, 0, 0, 0, 0};
+  float beta_b = acc_b == CBOOL_TRUE ? 1.0f : 0.0f;
+  if (b_grad == CBOOL_TRUE) {
+    db = gemm_view(b, b->grad);
+    if (b->meta.dtype != DTYPE_F32) {
+      db = gemm_dense(
+          reserve_linear_scratch(LINEAR_SCRATCH_DX, b->meta.capacity),
+          b->meta.shape[0], b->meta.shape[1]);
+      beta_b = 0.0f;
     }
   }
-  if (b->meta.require_grad == CBOOL_TRUE) {
-    for (uint64_t i = 0; i < b->meta.capacity; i++) {
-      b->grad[i] -= self->grad[i];
+  uint64_t m = a->meta.shape[0];
+  uint64_t block_rows = matmul_block_rows(a, b);
+  for (uint64_t r = 0; r < m; r += block_rows) {
+    uint64_t rows = m - r < block_rows ? m - r : block_rows;
+    gemm_matrix_t grad =
+        matmul_rows(self, self->grad, r, rows, LINEAR_SCRATCH_GRAD, CBOOL_TRUE);
+    if (a_grad == CBOOL_TRUE) {
+      // a->grad (+)= self->grad * b^T
+      gemm_matrix_t da =
+          matmul_rows(a, a->grad, r, rows, LINEAR_SCRATCH_DZ, CBOOL_FALSE);
+      strided_gemm(1.0f, grad, gemm_t(b32),
+                   acc_a == CBOOL_TRUE && a->meta.dtype == DTYPE_F32 ? 1.0f
+                                                                     : 0.0f,
+                   da);
+      if (a->meta.dtype != DTYPE_F32) {
+        write_dtype(a->grad16 + r * a->meta.shape[1], a->meta.dtype, da.data,
+                    DTYPE_F32, rows * a->meta.shape[1], acc_a);
+      }
+    }
+    if (b_grad == CBOOL_TRUE) {
+      // b->grad (+)= a^T * self->grad
+      gemm_matrix_t a32 =
+          matmul_rows(a, a->data, r, rows, LINEAR_SCRATCH_WEIGHT, CBOOL_TRUE);
+      strided_gemm(1.0f, gemm_t(a32), grad, beta_b, db);
+      beta_b = 1.0f;
     }
   }
+  if (b_grad == CBOOL_TRUE && b->meta.dtype != DTYPE_F32) {
+    write_dtype(b->grad, b->meta.dtype, db.data, DTYPE_F32, b->meta.capacity,
+                acc_b);
+  }
 }
 
-void mul_backward(tensor_f32_t *self) {
-  tensor_f32_t *a = self->prev[0];
-  tensor_f32_t *b = self->prev[1];
-  if (a->meta.require_grad == CBOOL_TRUE) {
-    for (uint64_t i = 0; i < a->meta.capacity; i++) {
-      a->grad[i] += self->grad[i] * b->data[i];
-    }
+// True when `v` is a per-row vector ([N] or [N, 1]) that can be broadcast
+// across the columns of the 2D tensor `m` ([N, B]), e.g. a bias over a batch.
+static cbool_t is_row_broadcast(tensor_f32_t *v, tensor_f32_t *m) {
+  if (m->meta.shape_length != 2 || v->meta.capacity != m->meta.shape[0]) {
+    return CBOOL_FALSE;
   }
-  if (b->meta.require_grad == CBOOL_TRUE) {
-    for (uint64_t i = 0; i < b->meta.capacity; i++) {
-      b->grad[i] += self->grad[i] * a->data[i];
-    }
+  if (v->meta.shape_length == 1) {
+    return CBOOL_TRUE;
   }
+  return v->meta.shape_length == 2 && v->meta.shape[1] == 1;
 }
 
-void div_backward(tensor_f32_t *self) {
-  tensor_f32_t *a = self->prev[0];
-  tensor_f32_t *b = self->prev[1];
-  if (a->meta.require_grad == CBOOL_TRUE) {
-    for (uint64_t i = 0; i < a->meta.capacity; i++) {
-      a->grad[i] += self->grad[i] / b->data[i];
-    }
+// Ops compute in float. Elementwise runs widen 16-bit operands a chunk at
+// a time and matmul a block of rows at a time, so no float copy of a whole
+// operand or result is made. The result keeps the operands' dtype when
+// they share one and is float otherwise.
+static dtype_t promote_dtype(tensor_f32_t *a, tensor_f32_t *b) {
+  if (b == NULL || a->meta.dtype == b->meta.dtype) {
+    return a->meta.dtype;
   }
-  if (b->meta.require_grad == CBOOL_TRUE) {
-    for (uint64_t i = 0; i < b->meta.capacity; i++) {
-      b->grad[i] -= self->grad[i] * a->data[i] / (b->data[i] * b->data[i]);
-    }
+  return DTYPE_F32;
+}
+
+// Drops an op's own reference to a temporary it made from `orig`; the
+// graph keeps it alive if `result` recorded it.
+static void release_temporary(tensor_f32_t *tmp, tensor_f32_t *orig) {
+  if (tmp != orig) {
+    free_tensor_f32(tmp);
   }
 }
 
-void matmul_backward(tensor_f32_t *self) {
-  tensor_f32_t *a = self->prev[0];
-  tensor_f32_t *b = self->prev[1];
-  if (a->meta.require_grad == CBOOL_TRUE) {
-    // a->grad += self->grad * b^T
-    uint64_t M = self->meta.shape[0];
-    uint64_t N = b->meta.shape[0];
-    uint64_t K = b->meta.shape[1];
-    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, M, N, K, 1.0f,
-                self->grad, K, b->data, K, 1.0f, a->grad, N);
+// out = kernel(a, b) for the binary elementwise kernels.
+static void binary_run(elementwise_t *e, uint64_t i, uint64_t len,
+                       void (*kernel)(float *, const float *, const float *,
+                                      uint64_t)) {
+  float out[ELEMENTWISE_CHUNK];
+  float x[ELEMENTWISE_CHUNK];
+  float y[ELEMENTWISE_CHUNK];
+  for (uint64_t end = i + len, n; i < end; i += n) {
+    n = piece_len(e, i, end);
+    float *dst = write_floats(out, e->out->data, e->out, i, n, CBOOL_FALSE);
+    kernel(dst, read_floats(x, e->a->data, e->a, i, n),
+           read_floats(y, e->b->data, e->b, i, n), n);
+    store_floats(e->out->data, e->out, i, dst, n);
   }
-  if (b->meta.require_grad == CBOOL_TRUE) {
-    // b->grad += a^T * self->grad
-    uint64_t M = a->meta.shape[1];
-    uint64_t N = self->meta.shape[1];
-    uint64_t K = a->meta.shape[0];
-    cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans, M, N, K, 1.0f, a->data,
-                M, self->grad, N, 1.0f, b->grad, N);
+}
+
+// out = kernel(a) for the unary elementwise kernels.
+static void unary_run(elementwise_t *e, uint64_t i, uint64_t len,
+                      void (*kernel)(float *, const float *, uint64_t)) {
+  float out[ELEMENTWISE_CHUNK];
+  float x[ELEMENTWISE_CHUNK];
+  for (uint64_t end = i + len, n; i < end; i += n) {
+    n = piece_len(e, i, end);
+    float *dst = write_floats(out, e->out->data, e->out, i, n, CBOOL_FALSE);
+    kernel(dst, read_floats(x, e->a->data, e->a, i, n), n);
+    store_floats(e->out->data, e->out, i, dst, n);
   }
 }
 
-void sigmoid_backward(tensor_f32_t *self) {
-  tensor_f32_t *a = self->prev[0];
-  if (a->meta.require_grad == CBOOL_TRUE) {
-    for (uint64_t i = 0; i < a->meta.capacity; i++) {
-      float s = self->data[i];
-      a->grad[i] += self->grad[i] * s * (1 - s);
-    }
+static void add_run(void *ctx, uint64_t i, uint64_t len) {
+  elementwise_t *e = (elementwise_t *)ctx;
+  binary_run(e, i, len, e->k->add);
+}
+
+// `b` is a column repeated across the rows of `a`; runs never cross a row,
+// so each one adds a single value of it.
+static void add_column_run(void *ctx, uint64_t i, uint64_t len) {
+  elementwise_t *e = (elementwise_t *)ctx;
+  uint64_t cols = e->a->meta.shape[1];
+  float column;
+  float value = *read_floats(&column, e->b->data, e->b, i / cols, 1);
+  float out[ELEMENTWISE_CHUNK];
+  float x[ELEMENTWISE_CHUNK];
+  for (uint64_t end = i + len, n; i < end; i += n) {
+    n = piece_len(e, i, end);
+    float *dst = write_floats(out, e->out->data, e->out, i, n, CBOOL_FALSE);
+    e->k->add_scalar(dst, read_floats(x, e->a->data, e->a, i, n), value, n);
+    store_floats(e->out->data, e->out, i, dst, n);
   }
 }
 
-void relu_backward(tensor_f32_t *self) {
-  tensor_f32_t *a = self->prev[0];
-  if (a->meta.require_grad == CBOOL_TRUE) {
-    for (uint64_t i = 0; i < a->meta.capacity; i++) {
-      if (a->data[i] > 0) {
-        a->grad[i] += self->grad[i];
-      } else {
-        a->grad[i] += self->grad[i] * 0.01f;
-      }
-    }
+static void sub_run(void *ctx, uint64_t i, uint64_t len) {
+  elementwise_t *e = (elementwise_t *)ctx;
+  binary_run(e, i, len, e->k->sub);
+}
+
+static void mul_run(void *ctx, uint64_t i, uint64_t len) {
+  elementwise_t *e = (elementwise_t *)ctx;
+  binary_run(e, i, len, e->k->mul);
+}
+
+static void div_run(void *ctx, uint64_t i, uint64_t len) {
+  elementwise_t *e = (elementwise_t *)ctx;
+  binary_run(e, i, len, e->k->div);
+}
+
+static void sigmoid_run(void *ctx, uint64_t i, uint64_t len) {
+  elementwise_t *e = (elementwise_t *)ctx;
+  unary_run(e, i, len, e->k->sigmoid);
+}
+
+static void tanh_run(void *ctx, uint64_t i, uint64_t len) {
+  elementwise_t *e = (elementwise_t *)ctx;
+  unary_run(e, i, len, e->k->tanh);
+}
+
+static void relu_run(void *ctx, uint64_t i, uint64_t len) {
+  elementwise_t *e = (elementwise_t *)ctx;
+  float out[ELEMENTWISE_CHUNK];
+  float x[ELEMENTWISE_CHUNK];
+  for (uint64_t end = i + len, n; i < end; i += n) {
+    n = piece_len(e, i, end);
+    float *dst = write_floats(out, e->out->data, e->out, i, n, CBOOL_FALSE);
+    e->k->leaky_relu(dst, read_floats(x, e->a->data, e->a, i, n), 0.01f, n);
+    store_floats(e->out->data, e->out, i, dst, n);
   }
 }
 
 tensor_f32_t *tensor_f32_add(tensor_f32_t *a, tensor_f32_t *b) {
+  tensor_f32_t *full = a;
+  tensor_f32_t *row = NULL;
   if (a->meta.capacity != b->meta.capacity) {
-    raise_error(ValueError, "tensor shapes are not compatible for addition");
+    if (is_row_broadcast(b, a) == CBOOL_TRUE) {
+      row = b;
+    } else if (is_row_broadcast(a, b) == CBOOL_TRUE) {
+      full = b;
+      row = a;
+    } else {
+      raise_error(ValueError, "tensor shapes are not compatible for addition");
+    }
   }
-  cbool_t require_grad =
-      a->meta.require_grad == CBOOL_TRUE || b->meta.require_grad == CBOOL_TRUE;
+  uint64_t start = profile_begin();
+  cbool_t require_grad = needs_grad(a, b, NULL);
   tensor_f32_t *ret =
-      new_tensor_f32(a->meta.shape, a->meta.shape_length, require_grad);
-  for (uint64_t i = 0; i < a->meta.capacity; i++) {
-    ret->data[i] = a->data[i] + b->data[i];
+      new_tensor_dtype(full->meta.shape, full->meta.shape_length,
+                       promote_dtype(a, b), require_grad);
+  uint64_t grain = parallel_grain(ARITHMETIC_COST);
+  if (row == NULL) {
+    elementwise_t e = {.k = get_kernels(), .out = ret, .a = a, .b = b};
+    for_each_run(ret->meta.capacity, common_run(a, b), grain, add_run, &e);
+  } else {
+    elementwise_t e = {
+        .k = get_kernels(), .out = ret, .a = full, .b = row};
+    uint64_t run = gcd_u64(common_run(full, NULL), full->meta.shape[1]);
+    for_each_run(ret->meta.capacity, run, grain, add_column_run, &e);
   }
+  profile_record(OP_ADD, PROFILE_FORWARD, start, ret->meta.capacity, 1, 0,
+                 dtype_size(ret->meta.dtype));
   if (require_grad) {
-    ret->backward_fn = add_backward;
-    ret->num_prev = 2;
-    ret->prev = (tensor_f32_t **)malloc(sizeof(tensor_f32_t *) * ret->num_prev);
-    ret->prev[0] = a;
-    ret->prev[1] = b;
+    tensor_f32_set_backward(ret, OP_ADD, add_backward,
+                            (tensor_f32_t *[]){a, b}, 2);
   }
   return ret;
 }
@@ -260,19 +1631,18 @@ tensor_f32_t *tensor_f32_sub(tensor_f32_t *a, tensor_f32_t *b) {
   if (a->meta.capacity != b->meta.capacity) {
     raise_error(ValueError, "tensor shapes are not compatible for subtraction");
   }
-  cbool_t require_grad =
-      a->meta.require_grad == CBOOL_TRUE || b->meta.require_grad == CBOOL_TRUE;
-  tensor_f32_t *ret =
-      new_tensor_f32(a->meta.shape, a->meta.shape_length, require_grad);
-  for (uint64_t i = 0; i < a->meta.capacity; i++) {
-    ret->data[i] = a->data[i] - b->data[i];
-  }
+  uint64_t start = profile_begin();
+  cbool_t require_grad = needs_grad(a, b, NULL);
+  tensor_f32_t *ret = new_tensor_dtype(a->meta.shape, a->meta.shape_length,
+                                       promote_dtype(a, b), require_grad);
+  elementwise_t e = {.k = get_kernels(), .out = ret, .a = a, .b = b};
+  for_each_run(ret->meta.capacity, common_run(a, b),
+               parallel_grain(ARITHMETIC_COST), sub_run, &e);
+  profile_record(OP_SUB, PROFILE_FORWARD, start, ret->meta.capacity, 1, 0,
+                 dtype_size(ret->meta.dtype));
   if (require_grad) {
-    ret->backward_fn = sub_backward;
-    ret->num_prev = 2;
-    ret->prev = (tensor_f32_t **)malloc(sizeof(tensor_f32_t *) * ret->num_prev);
-    ret->prev[0] = a;
-    ret->prev[1] = b;
+    tensor_f32_set_backward(ret, OP_SUB, sub_backward,
+                            (tensor_f32_t *[]){a, b}, 2);
   }
   return ret;
 }
@@ -282,19 +1652,18 @@ tensor_f32_t *tensor_f32_mul(tensor_f32_t *a, tensor_f32_t *b) {
     raise_error(ValueError,
                 "tensor shapes are not compatible for multiplication");
   }
-  cbool_t require_grad =
-      a->meta.require_grad == CBOOL_TRUE || b->meta.require_grad == CBOOL_TRUE;
-  tensor_f32_t *ret =
-      new_tensor_f32(a->meta.shape, a->meta.shape_length, require_grad);
-  for (uint64_t i = 0; i < a->meta.capacity; i++) {
-    ret->data[i] = a->data[i] * b->data[i];
-  }
+  uint64_t start = profile_begin();
+  cbool_t require_grad = needs_grad(a, b, NULL);
+  tensor_f32_t *ret = new_tensor_dtype(a->meta.shape, a->meta.shape_length,
+                                       promote_dtype(a, b), require_grad);
+  elementwise_t e = {.k = get_kernels(), .out = ret, .a = a, .b = b};
+  for_each_run(ret->meta.capacity, common_run(a, b),
+               parallel_grain(ARITHMETIC_COST), mul_run, &e);
+  profile_record(OP_MUL, PROFILE_FORWARD, start, ret->meta.capacity, 1, 0,
+                 dtype_size(ret->meta.dtype));
   if (require_grad) {
-    ret->backward_fn = mul_backward;
-    ret->num_prev = 2;
-    ret->prev = (tensor_f32_t **)malloc(sizeof(tensor_f32_t *) * ret->num_prev);
-    ret->prev[0] = a;
-    ret->prev[1] = b;
+    tensor_f32_set_backward(ret, OP_MUL, mul_backward,
+                            (tensor_f32_t *[]){a, b}, 2);
   }
   return ret;
 }
@@ -303,22 +1672,30 @@ tensor_f32_t *tensor_f32_div(tensor_f32_t *a, tensor_f32_t *b) {
   if (a->meta.capacity != b->meta.capacity) {
     raise_error(ValueError, "tensor shapes are not compatible for division");
   }
-  cbool_t require_grad =
-      a->meta.require_grad == CBOOL_TRUE || b->meta.require_grad == CBOOL_TRUE;
-  tensor_f32_t *ret =
-      new_tensor_f32(a->meta.shape, a->meta.shape_length, require_grad);
-  for (uint64_t i = 0; i < a->meta.capacity; i++) {
-    if (b->data[i] == 0.0f) {
-      raise_error(ValueError, "division by zero");
+  uint64_t start = profile_begin();
+  cbool_t require_grad = needs_grad(a, b, NULL);
+  tensor_f32_t *ret = new_tensor_dtype(a->meta.shape, a->meta.shape_length,
+                                       promote_dtype(a, b), require_grad);
+  elementwise_t e = {.k = get_kernels(), .out = ret, .a = a, .b = b};
+  // Checked up front so the divide loop itself stays branch-free.
+  uint64_t run = common_run(a, b);
+  float chunk[ELEMENTWISE_CHUNK];
+  for (uint64_t i = 0; i < b->meta.capacity; i += run) {
+    for (uint64_t j = i, n; j < i + run; j += n) {
+      n = piece_len(&e, j, i + run);
+      if (e.k->has_zero(read_floats(chunk, b->data, b, j, n), n) ==
+          CBOOL_TRUE) {
+        raise_error(ValueError, "division by zero");
+      }
     }
-    ret->data[i] = a->data[i] / b->data[i];
   }
+  for_each_run(ret->meta.capacity, run, parallel_grain(ARITHMETIC_COST),
+               div_run, &e);
+  profile_record(OP_DIV, PROFILE_FORWARD, start, ret->meta.capacity, 1, 0,
+                 dtype_size(ret->meta.dtype));
   if (require_grad) {
-    ret->backward_fn = div_backward;
-    ret->num_prev = 2;
-    ret->prev = (tensor_f32_t **)malloc(sizeof(tensor_f32_t *) * ret->num_prev);
-    ret->prev[0] = a;
-    ret->prev[1] = b;
+    tensor_f32_set_backward(ret, OP_DIV, div_backward,
+                            (tensor_f32_t *[]){a, b}, 2);
   }
   return ret;
 }
@@ -330,101 +1707,479 @@ tensor_f32_t *tensor_f32_matmul(tensor_f32_t *a, tensor_f32_t *b) {
   if (a->meta.shape[1] != b->meta.shape[0]) {
     raise_error(ValueError, "tensor shapes are not compatible for matmul");
   }
+  // Float views are passed to sgemm in place when their layout allows it.
+  tensor_f32_t *a_in = a;
+  tensor_f32_t *b_in = b;
+  a = linear_operand(a);
+  b = linear_operand(b);
 
-  cbool_t require_grad =
-      a->meta.require_grad == CBOOL_TRUE || b->meta.require_grad == CBOOL_TRUE;
+  uint64_t start = profile_begin();
+  cbool_t require_grad = needs_grad(a, b, NULL);
   uint64_t ret_shape[] = {a->meta.shape[0], b->meta.shape[1]};
-  tensor_f32_t *ret = new_tensor_f32(ret_shape, 2, require_grad);
-
-  uint64_t M = a->meta.shape[0];
-  uint64_t N = b->meta.shape[1];
-  uint64_t K = a->meta.shape[1];
+  tensor_f32_t *ret =
+      new_tensor_dtype(ret_shape, 2, promote_dtype(a, b), require_grad);
 
-  cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, M, N, K, 1.0f, a->data,
-              K, b->data, N, 0.0f, ret->data, N);
+  gemm_matrix_t b32 = linear_input(b);
+  uint64_t block_rows = matmul_block_rows(a, b);
+  for (uint64_t r = 0; r < ret_shape[0]; r += block_rows) {
+    uint64_t rows = ret_shape[0] - r < block_rows ? ret_shape[0] - r
+                                                  : block_rows;
+    gemm_matrix_t c =
+        matmul_rows(ret, ret->data, r, rows, LINEAR_SCRATCH_OUT, CBOOL_FALSE);
+    strided_gemm(1.0f,
+                 matmul_rows(a, a->data, r, rows, LINEAR_SCRATCH_WEIGHT,
+                             CBOOL_TRUE),
+                 b32, 0.0f, c);
+    matmul_store_rows(ret, ret->data, r, c);
+  }
 
+  profile_record(OP_MATMUL, PROFILE_FORWARD, start, ret->meta.shape[0],
+                 ret->meta.shape[1], a->meta.shape[1],
+                 dtype_size(ret->meta.dtype));
   if (require_grad) {
-    ret->backward_fn = matmul_backward;
-    ret->num_prev = 2;
-    ret->prev = (tensor_f32_t **)malloc(sizeof(tensor_f32_t *) * ret->num_prev);
-    ret->prev[0] = a;
-    ret->prev[1] = b;
+    tensor_f32_set_backward(ret, OP_MATMUL, matmul_backward,
+                            (tensor_f32_t *[]){a, b}, 2);
   }
+  release_temporary(a, a_in);
+  release_temporary(b, b_in);
   return ret;
 }
 
 tensor_f32_t *tensor_f32_sigmoid(tensor_f32_t *a) {
-  cbool_t require_grad = a->meta.require_grad == CBOOL_TRUE;
-  tensor_f32_t *ret =
-      new_tensor_f32(a->meta.shape, a->meta.shape_length, require_grad);
-  for (uint64_t i = 0; i < a->meta.capacity; i++) {
-    ret->data[i] = 1.0f / (1.0f + expf(-a->data[i]));
+  uint64_t start = profile_begin();
+  cbool_t require_grad = needs_grad(a, NULL, NULL);
+  tensor_f32_t *ret = new_tensor_dtype(a->meta.shape, a->meta.shape_length,
+                                       a->meta.dtype, require_grad);
+  elementwise_t e = {.k = get_kernels(), .out = ret, .a = a};
+  for_each_run(ret->meta.capacity, common_run(a, NULL),
+               parallel_grain(TRANSCENDENTAL_COST), sigmoid_run, &e);
+  profile_record(OP_SIGMOID, PROFILE_FORWARD, start, ret->meta.capacity, 1, 0,
+                 dtype_size(ret->meta.dtype));
+  if (require_grad) {
+    tensor_f32_set_backward(ret, OP_SIGMOID, sigmoid_backward,
+                            (tensor_f32_t *[]){a}, 1);
   }
+  return ret;
+}
+
+tensor_f32_t *tensor_f32_tanh(tensor_f32_t *a) {
+  uint64_t start = profile_begin();
+  cbool_t require_grad = needs_grad(a, NULL, NULL);
+  tensor_f32_t *ret = new_tensor_dtype(a->meta.shape, a->meta.shape_length,
+                                       a->meta.dtype, require_grad);
+  elementwise_t e = {.k = get_kernels(), .out = ret, .a = a};
+  for_each_run(ret->meta.capacity, common_run(a, NULL),
+               parallel_grain(TRANSCENDENTAL_COST), tanh_run, &e);
+  profile_record(OP_TANH, PROFILE_FORWARD, start, ret->meta.capacity, 1, 0,
+                 dtype_size(ret->meta.dtype));
   if (require_grad) {
-    ret->backward_fn = sigmoid_backward;
-    ret->num_prev = 1;
-    ret->prev = (tensor_f32_t **)malloc(sizeof(tensor_f32_t *));
-    ret->prev[0] = a;
+    tensor_f32_set_backward(ret, OP_TANH, tanh_backward,
+                            (tensor_f32_t *[]){a}, 1);
   }
   return ret;
 }
 
 tensor_f32_t *tensor_f32_relu(tensor_f32_t *a) {
-  cbool_t require_grad = a->meta.require_grad == CBOOL_TRUE;
+  uint64_t start = profile_begin();
+  cbool_t require_grad = needs_grad(a, NULL, NULL);
+  tensor_f32_t *ret = new_tensor_dtype(a->meta.shape, a->meta.shape_length,
+                                       a->meta.dtype, require_grad);
+  elementwise_t e = {.k = get_kernels(), .out = ret, .a = a};
+  for_each_run(ret->meta.capacity, common_run(a, NULL),
+               parallel_grain(ARITHMETIC_COST), relu_run, &e);
+  profile_record(OP_RELU, PROFILE_FORWARD, start, ret->meta.capacity, 1, 0,
+                 dtype_size(ret->meta.dtype));
+  if (require_grad) {
+    tensor_f32_set_backward(ret, OP_RELU, relu_backward,
+                            (tensor_f32_t *[]){a}, 1);
+  }
+  return ret;
+}
+
+void cast_backward(tensor_f32_t *self) {
+  tensor_f32_t *a = self->prev[0];
+  if (a->meta.require_grad == CBOOL_TRUE) {
+    cbool_t accumulate = tensor_grad_prepare(a);
+    uint64_t run = common_run(a, NULL);
+    for (uint64_t i = 0; i < a->meta.capacity; i += run) {
+      write_dtype(element_ptr(a->grad, a, i), a->meta.dtype,
+                  element_ptr(self->grad, self, i), self->meta.dtype, run,
+                  accumulate);
+    }
+  }
+}
+
+// Also gathers a strided `a` into a contiguous result.
+tensor_f32_t *tensor_f32_cast(tensor_f32_t *a, dtype_t dtype) {
+  uint64_t start = profile_begin();
+  cbool_t require_grad = needs_grad(a, NULL, NULL);
   tensor_f32_t *ret =
-      new_tensor_f32(a->meta.shape, a->meta.shape_length, require_grad);
-  for (uint64_t i = 0; i < a->meta.capacity; i++) {
-    ret->data[i] = a->data[i] > 0 ? a->data[i] : a->data[i] * 0.01f;
+      new_tensor_dtype(a->meta.shape, a->meta.shape_length, dtype, require_grad);
+  uint64_t run = common_run(a, NULL);
+  for (uint64_t i = 0; i < a->meta.capacity; i += run) {
+    convert_dtype(element_ptr(ret->data, ret, i), dtype,
+                  element_ptr(a->data, a, i), a->meta.dtype, run);
   }
+  profile_record(OP_CAST, PROFILE_FORWARD, start, ret->meta.capacity, 1, 0,
+                 dtype_size(dtype));
   if (require_grad) {
-    ret->backward_fn = relu_backward;
-    ret->num_prev = 1;
-    ret->prev = (tensor_f32_t **)malloc(sizeof(tensor_f32_t *));
-    ret->prev[0] = a;
+    tensor_f32_set_backward(ret, OP_CAST, cast_backward,
+                            (tensor_f32_t *[]){a}, 1);
   }
   return ret;
 }
 
-static cbool_t tensor_list_contains(tensor_f32_t *node, tensor_f32_t **list,
-                                    int list_size) {
-  for (int i = 0; i < list_size; i++) {
-    if (list[i] == node) {
-      return CBOOL_TRUE;
+tensor_f32_t *tensor_f32_contiguous(tensor_f32_t *a) {
+  if (tensor_is_contiguous(a) == CBOOL_TRUE) {
+    return a;
+  }
+  return tensor_f32_cast(a, a->meta.dtype);
+}
+
+void tensor_f32_accumulate_grad(tensor_f32_t *dst, tensor_f32_t *src) {
+  if (dst->meta.capacity != src->meta.capacity) {
+    raise_error(ValueError, "tensor shapes are not compatible for gradients");
+  }
+  if (grad_written(src) != CBOOL_TRUE) {
+    return;
+  }
+  sync_grad(src);
+  cbool_t accumulate = tensor_grad_prepare(dst);
+  uint64_t run = common_run(dst, src);
+  for (uint64_t i = 0; i < dst->meta.capacity; i += run) {
+    write_dtype(element_ptr(dst->grad, dst, i), dst->meta.dtype,
+                element_ptr(src->grad, src, i), src->meta.dtype, run,
+                accumulate);
+  }
+}
+
+// Gradients of a view are written straight into its base's storage; the
+// graph edge only makes the base's own backward run after them.
+void view_backward(tensor_f32_t *self) { (void)self; }
+
+// A tensor over `a`'s storage starting `offset` elements past `a->data`.
+static tensor_f32_t *new_view(tensor_f32_t *a, uint64_t *shape,
+                              uint64_t *strides, uint64_t shape_length,
+                              uint64_t offset) {
+  cbool_t require_grad = needs_grad(a, NULL, NULL);
+  uint64_t capacity = 1;
+  for (uint64_t i = 0; i < shape_length; i++) {
+    capacity *= shape[i];
+  }
+  tensor_f32_t *ret;
+  if (active_arena != NULL) {
+    ret = (tensor_f32_t *)arena_alloc(active_arena, sizeof(tensor_f32_t));
+    ret->meta.shape = (uint64_t *)arena_alloc(
+        active_arena, sizeof(uint64_t) * 2 * shape_length);
+    ret->meta.strides = ret->meta.shape + shape_length;
+    memcpy(ret->meta.shape, shape, shape_length * sizeof(uint64_t));
+    ret->meta.capacity = capacity;
+    ret->meta.shape_length = shape_length;
+    ret->meta.require_grad = require_grad;
+    ret->in_arena = CBOOL_TRUE;
+  } else {
+    ret = (tensor_f32_t *)malloc(sizeof(tensor_f32_t));
+    if (ret == NULL) {
+      raise_error(NullPointer, "malloc failed to allocate tensor_f32_t");
     }
+    init_tensor_meta(&ret->meta, capacity, shape, shape_length, require_grad);
+    ret->in_arena = CBOOL_FALSE;
+    retain_storage(a->storage);
+    count_tensor_alloc();
   }
-  return CBOOL_FALSE;
+  memcpy(ret->meta.strides, strides, shape_length * sizeof(uint64_t));
+  ret->meta.dtype = a->meta.dtype;
+
+  size_t size = dtype_size(a->meta.dtype);
+  ret->storage = a->storage;
+  ret->offset = a->offset + offset;
+  ret->data = (float *)((uint8_t *)a->data + offset * size);
+  sync_grad(ret);
+
+  ret->backward_fn = NULL;
+  ret->op = OP_NONE;
+  memset(ret->op_args, 0, sizeof(ret->op_args));
+  ret->prev = NULL;
+  ret->num_prev = 0;
+  ret->visit_epoch = 0;
+  atomic_init(&ret->refcount, 1);
+  if (require_grad) {
+    tensor_f32_set_backward(ret, OP_VIEW, view_backward,
+                            (tensor_f32_t *[]){a}, 1);
+  }
+  return ret;
 }
 
-static void tensor_list_append(tensor_f32_t *node, tensor_f32_t ***list,
-                               int *list_size) {
-  tensor_f32_t **new_list = (tensor_f32_t **)realloc(
-      *list, sizeof(tensor_f32_t *) * (*list_size + 1));
-  if (new_list == NULL) {
-    raise_error(NullPointer, "realloc failed while building graph");
+tensor_f32_t *tensor_f32_reshape(tensor_f32_t *a, uint64_t *shape,
+                                 uint64_t shape_length) {
+  uint64_t capacity = 1;
+  for (uint64_t i = 0; i < shape_length; i++) {
+    capacity *= shape[i];
+  }
+  if (capacity != a->meta.capacity) {
+    raise_error(ValueError, "reshape must keep the number of elements");
   }
-  new_list[*list_size] = node;
-  *list = new_list;
-  *list_size += 1;
+  if (tensor_is_contiguous(a) != CBOOL_TRUE) {
+    raise_error(ValueError, "reshape requires a contiguous tensor");
+  }
+  uint64_t strides[shape_length > 0 ? shape_length : 1];
+  set_contiguous_strides(strides, shape, shape_length);
+  return new_view(a, shape, strides, shape_length, 0);
 }
 
-static void build_graph_dfs(tensor_f32_t *node, tensor_f32_t ***graph,
-                            int *graph_size, tensor_f32_t ***visited,
-                            int *visited_size) {
-  if (node == NULL) {
-    return;
+tensor_f32_t *tensor_f32_transpose(tensor_f32_t *a, uint64_t dim0,
+                                   uint64_t dim1) {
+  uint64_t n = a->meta.shape_length;
+  if (dim0 >= n || dim1 >= n) {
+    raise_error(ValueError, "transpose dimension out of range");
+  }
+  uint64_t shape[n];
+  uint64_t strides[n];
+  memcpy(shape, a->meta.shape, n * sizeof(uint64_t));
+  memcpy(strides, a->meta.strides, n * sizeof(uint64_t));
+  shape[dim0] = a->meta.shape[dim1];
+  shape[dim1] = a->meta.shape[dim0];
+  strides[dim0] = a->meta.strides[dim1];
+  strides[dim1] = a->meta.strides[dim0];
+  return new_view(a, shape, strides, n, 0);
+}
+
+tensor_f32_t *tensor_f32_slice(tensor_f32_t *a, uint64_t dim, uint64_t start,
+                               uint64_t end, uint64_t step) {
+  uint64_t n = a->meta.shape_length;
+  if (dim >= n || step == 0 || start > end || end > a->meta.shape[dim]) {
+    raise_error(ValueError, "slice out of range");
+  }
+  uint64_t shape[n];
+  uint64_t strides[n];
+  memcpy(shape, a->meta.shape, n * sizeof(uint64_t));
+  memcpy(strides, a->meta.strides, n * sizeof(uint64_t));
+  shape[dim] = (end - start + step - 1) / step;
+  strides[dim] *= step;
+  return new_view(a, shape, strides, n, start * a->meta.strides[dim]);
+}
+
+tensor_f32_t *tensor_f32_narrow(tensor_f32_t *a, uint64_t dim, uint64_t start,
+                                uint64_t length) {
+  return tensor_f32_slice(a, dim, start, start + length, 1);
+}
+
+tensor_f32_t *tensor_f32_linear(tensor_f32_t *x, tensor_f32_t *weight,
+                                tensor_f32_t *bias, activation_t activation) {
+  if (x->meta.shape_length != 2 || weight->meta.shape_length != 2) {
+    raise_error(ValueError, "linear requires 2D input and weight");
+  }
+  if (weight->meta.shape[1] != x->meta.shape[0]) {
+    raise_error(ValueError, "tensor shapes are not compatible for linear");
+  }
+  uint64_t out_features = weight->meta.shape[0];
+  uint64_t in_features = weight->meta.shape[1];
+  uint64_t batch = x->meta.shape[1];
+  if (bias != NULL && bias->meta.capacity != out_features) {
+    raise_error(ValueError, "bias size does not match linear output");
+  }
+  tensor_f32_t *x_in = x;
+  tensor_f32_t *weight_in = weight;
+  tensor_f32_t *bias_in = bias;
+  x = linear_operand(x);
+  weight = linear_operand(weight);
+  if (bias != NULL) {
+    bias = tensor_f32_contiguous(bias);
+  }
+
+  uint64_t start = profile_begin();
+  cbool_t require_grad = needs_grad(x, weight, bias);
+  uint64_t ret_shape[] = {out_features, batch};
+  dtype_t dtype = weight->meta.dtype;
+  tensor_f32_t *ret = new_tensor_dtype(ret_shape, 2, dtype, require_grad);
+  float *y = dtype == DTYPE_F32
+                 ? ret->data
+                 : reserve_linear_scratch(LINEAR_SCRATCH_OUT,
+                                          ret->meta.capacity);
+  gemm_matrix_t x32 = linear_input(x);
+
+  // Preload the bias and let sgemm accumulate onto it with beta = 1.
+  const elementwise_kernels_t *k = get_kernels();
+  float beta = 0.0f;
+  if (bias != NULL) {
+    float *b32 = linear_f32(bias->data, bias->meta.dtype, out_features,
+                            LINEAR_SCRATCH_BIAS);
+    for (uint64_t r = 0; r < out_features; r++) {
+      k->fill(y + r * batch, b32[r], batch);
+    }
+    beta = 1.0f;
+  }
+  if (dtype == DTYPE_F32) {
+    strided_gemm(1.0f, gemm_view(weight, weight->data), x32, beta,
+                 gemm_dense(y, out_features, batch));
+  } else {
+    uint64_t block_rows = linear_block_rows(in_features);
+    float *w32 = reserve_linear_scratch(LINEAR_SCRATCH_WEIGHT,
+                                        block_rows * in_features);
+    for (uint64_t r = 0; r < out_features; r += block_rows) {
+      uint64_t rows =
+          out_features - r < block_rows ? out_features - r : block_rows;
+      dtype_to_f32(w32, weight->data16 + r * in_features, dtype,
+                   rows * in_features);
+      strided_gemm(1.0f, gemm_dense(w32, rows, in_features), x32, beta,
+                   gemm_dense(y + r * batch, rows, batch));
+    }
   }
 
-  if (tensor_list_contains(node, *visited, *visited_size) == CBOOL_TRUE) {
+  grad_fn backward_fn = linear_backward_none;
+  switch (activation) {
+  case ACTIVATION_NONE:
+    break;
+  case ACTIVATION_RELU:
+    backward_fn = linear_backward_relu;
+    break;
+  case ACTIVATION_LEAKY_RELU:
+    backward_fn = linear_backward_leaky_relu;
+    break;
+  case ACTIVATION_SIGMOID:
+    backward_fn = linear_backward_sigmoid;
+    break;
+  default:
+    raise_error(ValueError, "unknown activation");
+  }
+  if (activation != ACTIVATION_NONE) {
+    linear_activation_t pass = {k, activation, y, NULL, NULL};
+    parallel_for(0, ret->meta.capacity,
+                 parallel_grain(activation == ACTIVATION_SIGMOID
+                                    ? TRANSCENDENTAL_COST
+                                    : ARITHMETIC_COST),
+                 activate_range, &pass);
+  }
+  if (dtype != DTYPE_F32) {
+    dtype_from_f32(ret->data, y, dtype, ret->meta.capacity);
+  }
+
+  profile_record(OP_LINEAR, PROFILE_FORWARD, start, out_features, batch,
+                 in_features, dtype_size(dtype));
+  if (require_grad) {
+    tensor_f32_set_backward(ret, OP_LINEAR, backward_fn,
+                            (tensor_f32_t *[]){x, weight, bias}, 3);
+  }
+  release_temporary(x, x_in);
+  release_temporary(weight, weight_in);
+  if (bias != NULL) {
+    release_temporary(bias, bias_in);
+  }
+  return ret;
+}
+
+// Work buffers for backward(), kept per thread and grown geometrically so
+// that repeated backward passes over a graph of similar size do not
+// allocate.
+typedef struct {
+  tensor_f32_t *node;
+  int next_prev;
+} graph_frame_t;
+
+static _Atomic uint64_t graph_epoch = 0;
+static _Thread_local tensor_f32_t **graph_order = NULL;
+static _Thread_local graph_frame_t *graph_stack = NULL;
+static _Thread_local uint64_t graph_capacity = 0;
+
+static void release_graph_buffers() {
+  free(graph_order);
+  free(graph_stack);
+  graph_order = NULL;
+  graph_stack = NULL;
+  graph_capacity = 0;
+}
+
+static void reserve_graph_buffers(uint64_t size) {
+  if (size <= graph_capacity) {
     return;
   }
+  register_thread_scratch(release_graph_buffers);
+  uint64_t capacity = graph_capacity > 0 ? graph_capacity : 64;
+  while (capacity < size) {
+    capacity *= 2;
+  }
+  tensor_f32_t **order = (tensor_f32_t **)realloc(
+      graph_order, sizeof(tensor_f32_t *) * capacity);
+  graph_frame_t *stack =
+      (graph_frame_t *)realloc(graph_stack, sizeof(graph_frame_t) * capacity);
+  if (order == NULL || stack == NULL) {
+    raise_error(NullPointer, "realloc failed while building graph");
+  }
+  graph_order = order;
+  graph_stack = stack;
+  graph_capacity = capacity;
+}
 
-  tensor_list_append(node, visited, visited_size);
+// Iterative post-order DFS from `root`. Nodes are marked with a fresh epoch
+// instead of being looked up in a visited list, so each node and edge is
+// touched once. Returns the number of nodes written to graph_order, inputs
+// before the tensors computed from them.
+static uint64_t build_graph(tensor_f32_t *root) {
+  uint64_t epoch = ++graph_epoch;
+  uint64_t order_size = 0;
+  uint64_t stack_size = 0;
 
-  for (int i = 0; i < node->num_prev; i++) {
-    build_graph_dfs(node->prev[i], graph, graph_size, visited, visited_size);
+  reserve_graph_buffers(1);
+  root->visit_epoch = epoch;
+  graph_stack[stack_size++] = (graph_frame_t){root, 0};
+
+  while (stack_size > 0) {
+    graph_frame_t *top = &graph_stack[stack_size - 1];
+    if (top->next_prev < top->node->num_prev) {
+      tensor_f32_t *child = top->node->prev[top->next_prev++];
+      if (child != NULL && child->visit_epoch != epoch) {
+        child->visit_epoch = epoch;
+        // Every node is on the stack or in the order at most once.
+        reserve_graph_buffers(order_size + stack_size + 1);
+        graph_stack[stack_size++] = (graph_frame_t){child, 0};
+      }
+    } else {
+      // Held until the node's turn in backward(), whoever else lets go.
+      graph_order[order_size++] = tensor_f32_retain(top->node);
+      stack_size--;
+    }
   }
+  return order_size;
+}
 
-  tensor_list_append(node, graph, graph_size);
+// Files a node's backward function under its op, sized like its forward.
+static void profile_backward(tensor_f32_t *node, uint64_t start) {
+  if (start == 0) {
+    return;
+  }
+  tensor_f32_t *input = node->num_prev > 0 ? node->prev[0] : node;
+  uint64_t rows = node->meta.capacity;
+  uint64_t cols = 1;
+  uint64_t inner = 0;
+  switch (node->op) {
+  case OP_MATMUL:
+    rows = node->meta.shape[0];
+    cols = node->meta.shape[1];
+    inner = input->meta.shape[1];
+    break;
+  case OP_LINEAR:
+    rows = node->meta.shape[0];
+    cols = node->meta.shape[1];
+    inner = input->meta.shape[0];
+    break;
+  case OP_CONV2D:
+    // Output channels by output pixels, reducing over the weight's
+    // channels and taps.
+    rows = node->prev[1]->meta.shape[0];
+    cols = node->meta.capacity / rows;
+    inner = node->prev[1]->meta.capacity / rows;
+    break;
+  case OP_CROSSENTROPY:
+  case OP_SOFTMAX_CROSSENTROPY:
+  case OP_MSE:
+    // Scalar losses do their work over the whole input.
+    rows = input->meta.capacity;
+    break;
+  default:
+    break;
+  }
+  profile_record(node->op, PROFILE_BACKWARD, start, rows, cols, inner,
+                 dtype_size(node->meta.dtype));
 }
 
 void backward(tensor_f32_t *self) {
@@ -433,28 +2188,27 @@ void backward(tensor_f32_t *self) {
                 "Cannot call backward on a tensor that does not require grad");
   }
 
-  // Fill grad with 1s
-  for (uint64_t i = 0; i < self->meta.capacity; i++) {
-    self->grad[i] = 1.0f;
-  }
-
-  // Build the graph
-  tensor_f32_t **graph = NULL;
-  int graph_size = 0;
-  tensor_f32_t **visited = NULL;
-  int visited_size = 0;
+  // Seed the root gradient with 1s
+  tensor_grad_prepare(self);
+  fill_elements(self->grad, self, 1.0f);
 
-  build_graph_dfs(self, &graph, &graph_size, &visited, &visited_size);
+  uint64_t graph_size = build_graph(self);
 
-  // Backward pass
-  for (int i = graph_size - 1; i >= 0; i--) {
-    if (graph[i]->backward_fn != NULL) {
-      graph[i]->backward_fn(graph[i]);
+  // Backward pass. Every consumer of a node comes before it, so once its
+  // own backward function has run nothing reads the node again: its inputs
+  // are let go, and the node itself is freed unless someone still holds it.
+  for (uint64_t i = graph_size; i-- > 0;) {
+    tensor_f32_t *node = graph_order[i];
+    // A node no gradient reached passes none on.
+    if (node->backward_fn != NULL && grad_written(node) == CBOOL_TRUE) {
+      sync_grad(node);
+      uint64_t start = profile_begin();
+      node->backward_fn(node);
+      profile_backward(node, start);
     }
+    drop_graph_edges(node);
+    free_tensor_f32(node);
   }
-
-  free(graph);
-  free(visited);
 }
 
 void print_tensor(tensor_f32_t *self) {
@@ -475,12 +2229,18 @@ void print_tensor(tensor_f32_t *self) {
   printf("]\n");
   printf("    require_grad: %s\n",
          self->meta.require_grad == CBOOL_TRUE ? "True" : "False");
+  printf("    dtype: %s\n", dtype_name(self->meta.dtype));
   printf("  data: [");
 
   // Only print first 10 elements for brevity
   uint64_t limit = self->meta.capacity > 10 ? 10 : self->meta.capacity;
+  float values[10];
   for (uint64_t i = 0; i < limit; i++) {
-    printf("%.4f", self->data[i]);
+    dtype_to_f32(&values[i], element_ptr(self->data, self, i),
+                 self->meta.dtype, 1);
+  }
+  for (uint64_t i = 0; i < limit; i++) {
+    printf("%.4f", values[i]);
     if (i < limit - 1) {
       printf(", ");
     }
@@ -492,9 +2252,14 @@ void print_tensor(tensor_f32_t *self) {
 
   if (self->meta.require_grad == CBOOL_TRUE) {
     printf("  grad: [");
+    void *grad = tensor_grad(self);
     // Only print first 10 elements for brevity
     for (uint64_t i = 0; i < limit; i++) {
-      printf("%.4f", self->grad[i]);
+      dtype_to_f32(&values[i], element_ptr(grad, self, i),
+                   self->meta.dtype, 1);
+    }
+    for (uint64_t i = 0; i < limit; i++) {
+      printf("%.4f", values[i]);
       if (i < limit - 1) {
         printf(", ");
       }
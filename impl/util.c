@@ -1,8 +1,38 @@
 #include "much/util.h"
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-void raise_error(error_t error_type, const char *msg) {
+#define MAX_THREAD_SCRATCH 16
+
+static pthread_mutex_t thread_scratch_lock = PTHREAD_MUTEX_INITIALIZER;
+static thread_scratch_release_fn thread_scratch[MAX_THREAD_SCRATCH];
+static uint64_t num_thread_scratch = 0;
+
+_Noreturn void raise_error(error_t error_type, const char *msg) {
   fprintf(stderr, "Error: %s\n", msg);
   exit(error_type);
 }
+
+void register_thread_scratch(thread_scratch_release_fn release) {
+  pthread_mutex_lock(&thread_scratch_lock);
+  for (uint64_t i = 0; i < num_thread_scratch; i++) {
+    if (thread_scratch[i] == release) {
+      pthread_mutex_unlock(&thread_scratch_lock);
+      return;
+    }
+  }
+  if (num_thread_scratch == MAX_THREAD_SCRATCH) {
+    raise_error(RuntimeError, "too many kinds of thread scratch");
+  }
+  thread_scratch[num_thread_scratch++] = release;
+  pthread_mutex_unlock(&thread_scratch_lock);
+}
+
+void release_thread_scratch() {
+  pthread_mutex_lock(&thread_scratch_lock);
+  for (uint64_t i = 0; i < num_thread_scratch; i++) {
+    thread_scratch[i]();
+  }
+  pthread_mutex_unlock(&thread_scratch_lock);
+}
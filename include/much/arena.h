@@ -0,0 +1,25 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Bump allocator for short-lived allocations such as the tensors of one
+// training step. Everything handed out is released together by arena_reset.
+typedef struct ARENA_BLOCK {
+  struct ARENA_BLOCK *next;
+  size_t size;
+  size_t used;
+  unsigned char *base;
+} arena_block_t;
+
+typedef struct {
+  arena_block_t *blocks;
+  size_t capacity;
+} arena_t;
+
+arena_t *new_arena(size_t initial_size);
+
+void free_arena(arena_t *self);
+
+void *arena_alloc(arena_t *self, size_t size);
+
+void arena_reset(arena_t *self);
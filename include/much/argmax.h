@@ -2,3 +2,4 @@
 #include <stdint.h>
 
 uint64_t argmax(float* data, uint64_t len);
+uint64_t argmax_stride(float* data, uint64_t len, uint64_t stride);
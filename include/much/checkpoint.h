@@ -0,0 +1,109 @@
+#pragma once
+#include "much/optimizer.h"
+#include <pthread.h>
+#include <stdint.h>
+
+// On-disk layout, all integers little-endian:
+//   checkpoint_header_t
+//   checkpoint_entry_t[num_entries]
+//   payloads, each starting at a multiple of CHECKPOINT_ALIGN
+// Entry offsets are absolute file offsets, so a mapped file can be read in
+// place.
+#define CHECKPOINT_MAGIC "MUCHCKPT"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_ALIGN 64
+#define CHECKPOINT_NAME_SIZE 64
+#define CHECKPOINT_MAX_DIMS 4
+
+typedef enum CHECKPOINT_DTYPE {
+    CHECKPOINT_F32 = 1,
+    CHECKPOINT_I64 = 2,
+    CHECKPOINT_BF16 = 3,
+    CHECKPOINT_F16 = 4
+} checkpoint_dtype_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_entries;
+    uint64_t file_size;
+    uint8_t reserved[40];
+} checkpoint_header_t;
+
+typedef struct {
+    char name[CHECKPOINT_NAME_SIZE];  // NUL-terminated
+    uint32_t dtype;
+    uint32_t num_dims;
+    uint64_t dims[CHECKPOINT_MAX_DIMS];
+    uint64_t offset;
+    uint64_t size;  // payload bytes
+    uint8_t reserved[8];
+} checkpoint_entry_t;
+
+// Collects named arrays and writes them as one checkpoint. Every add copies
+// the data, so the caller may keep training while the writer saves in the
+// background.
+typedef struct {
+    checkpoint_entry_t* entries;
+    uint64_t num_entries;
+    uint64_t entries_capacity;
+    uint8_t* payload;  // laid out exactly as in the file, from offset 0
+    uint64_t payload_size;
+    uint64_t payload_capacity;
+
+    char* path;
+    pthread_t thread;
+    cbool_t saving;
+    cbool_t failed;
+} checkpoint_writer_t;
+
+checkpoint_writer_t* new_checkpoint_writer();
+void free_checkpoint_writer(checkpoint_writer_t* writer);
+// Drops all entries but keeps the buffers for the next checkpoint.
+void checkpoint_writer_clear(checkpoint_writer_t* writer);
+void checkpoint_add_f32(checkpoint_writer_t* writer, const char* name, const float* data,
+                        const uint64_t* shape, uint64_t num_dims);
+void checkpoint_add_i64(checkpoint_writer_t* writer, const char* name, int64_t value);
+void checkpoint_add_tensor(checkpoint_writer_t* writer, const char* name, tensor_f32_t* tensor);
+// Adds "<prefix>.weight" and "<prefix>.bias".
+void checkpoint_add_layer(checkpoint_writer_t* writer, const char* prefix, linear_layer_t* layer);
+// Adds the optimizer's type, step count, moment buffers and float master
+// weights (if any) under "<prefix>.".
+void checkpoint_add_optimizer(checkpoint_writer_t* writer, const char* prefix, optimizer_t* optimizer);
+
+// Writes to "<path>.tmp" and renames it over `path`, so readers never see a
+// partial file. Returns CBOOL_FALSE on I/O failure.
+cbool_t checkpoint_save(checkpoint_writer_t* writer, const char* path);
+// Starts checkpoint_save on a background thread; the writer must not be
+// touched until checkpoint_wait returns.
+void checkpoint_save_async(checkpoint_writer_t* writer, const char* path);
+// Blocks until a pending background save finishes and returns whether it
+// succeeded; returns CBOOL_TRUE if none is pending.
+cbool_t checkpoint_wait(checkpoint_writer_t* writer);
+
+// A checkpoint mapped copy-on-write: payloads are read in place, and
+// writing to a mapped tensor copies only the touched pages.
+typedef struct {
+    void* map;
+    uint64_t map_size;
+    const checkpoint_header_t* header;
+    const checkpoint_entry_t* entries;
+} checkpoint_t;
+
+checkpoint_t* checkpoint_open(const char* path);
+void checkpoint_close(checkpoint_t* checkpoint);
+// NULL if there is no entry with that name.
+const checkpoint_entry_t* checkpoint_find(checkpoint_t* checkpoint, const char* name);
+void* checkpoint_data(checkpoint_t* checkpoint, const checkpoint_entry_t* entry);
+int64_t checkpoint_get_i64(checkpoint_t* checkpoint, const char* name);
+
+// Zero-copy: the tensor reads the mapping and must be freed before
+// checkpoint_close.
+tensor_f32_t* checkpoint_map_tensor(checkpoint_t* checkpoint, const char* name, cbool_t require_grad);
+linear_layer_t* checkpoint_map_layer(checkpoint_t* checkpoint, const char* prefix, cbool_t require_grad);
+
+// Copy into existing state, for resuming training; shapes and dtypes must
+// match.
+void checkpoint_load_tensor(checkpoint_t* checkpoint, const char* name, tensor_f32_t* tensor);
+void checkpoint_load_layer(checkpoint_t* checkpoint, const char* prefix, linear_layer_t* layer);
+void checkpoint_load_optimizer(checkpoint_t* checkpoint, const char* prefix, optimizer_t* optimizer);
@@ -0,0 +1,35 @@
+#pragma once
+#include "much/tensor.h"
+
+// Convolution and pooling over NCHW batches: [images, channels, height,
+// width]. Inputs may be float or reduced-precision tensors; the convolution
+// reads float inputs of any strides in place, pooling makes strided ones
+// contiguous through a cast node. Results are contiguous float.
+
+// Output size along one axis of a window of `kernel` taps moved by `stride`
+// over `in` values padded by `padding` zeros on each side.
+uint64_t conv2d_out_size(uint64_t in, uint64_t kernel, uint64_t stride, uint64_t padding);
+
+// activation(conv(x, weight) + bias) as a single graph node. `weight` is a
+// contiguous float [out_channels, in_channels, kh, kw] and `bias` is
+// [out_channels] (or NULL); the result is [images, out_channels, oh, ow].
+// Each block of output pixels is unfolded (im2col) into a cache-sized
+// scratch matrix and multiplied by the weight with sgemm; images are split
+// across the thread pool, and backward sums the weight gradient of fixed
+// groups of images in order, so results do not depend on the thread count.
+tensor_f32_t* tensor_f32_conv2d(tensor_f32_t* x, tensor_f32_t* weight, tensor_f32_t* bias,
+                                uint64_t stride, uint64_t padding, activation_t activation);
+
+// Maximum or mean of each `kernel` x `kernel` window, moved by `stride`,
+// without padding. Max pooling passes gradients to the first maximum of
+// each window.
+tensor_f32_t* tensor_f32_max_pool2d(tensor_f32_t* x, uint64_t kernel, uint64_t stride);
+tensor_f32_t* tensor_f32_avg_pool2d(tensor_f32_t* x, uint64_t kernel, uint64_t stride);
+
+// Views between the column-per-sample batches used elsewhere and NCHW:
+// [channels * height * width, images] as [images, channels, height, width],
+// and any [images, ...] tensor as [features, images]. Nothing is copied
+// unless the latter's input is not contiguous.
+tensor_f32_t* tensor_f32_to_nchw(tensor_f32_t* x, uint64_t channels, uint64_t height,
+                                 uint64_t width);
+tensor_f32_t* tensor_f32_to_columns(tensor_f32_t* x);
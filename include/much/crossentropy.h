@@ -1,4 +1,17 @@
 #pragma once
 #include "much/tensor.h"
 
+// Softmax cross-entropy of logits [classes, batch] against one-hot (or soft)
+// float labels of the same shape, into `ret`.
 void crossentropy_forward(tensor_f32_t* ret, tensor_f32_t* logits, tensor_f32_t* labels);
+
+// Batch-mean softmax cross-entropy of logits [classes, batch] against one
+// class index per column, as a single graph node. One online pass over the
+// rows finds each column's maximum and normalizer, and the gradient is
+// formed in the same call and kept for backward.
+tensor_f32_t* softmax_crossentropy(tensor_f32_t* logits, const uint32_t* labels);
+
+// Graph-free softmax_crossentropy for compiled plans: returns the loss of
+// contiguous float logits and writes its gradient with respect to them,
+// laid out the same way, to `grad`.
+float crossentropy_loss_grad(tensor_f32_t* logits, const uint32_t* labels, float* grad);
@@ -0,0 +1,45 @@
+#pragma once
+#include "much/layer.h"
+#include <pthread.h>
+
+// One worker's replica of the model. Worker 0 trains the master layers
+// directly; the others borrow their weights and keep private gradients.
+typedef struct {
+    linear_layer_t** layers;
+    arena_t* arena;
+    float loss;  // sum of per-sample losses over the worker's shard
+    _Atomic uint64_t reduced_step;
+} dp_worker_t;
+
+// Data-parallel trainer for a stack of linear layers: hidden layers use
+// `hidden_activation`, the last one is followed by softmax cross-entropy.
+// Each step splits the batch columns across the workers, which run forward
+// and backward concurrently and then sum their gradients with a lock-free
+// binary-tree reduction into the master layers.
+typedef struct {
+    linear_layer_t** layers;
+    uint64_t num_layers;
+    activation_t hidden_activation;
+
+    dp_worker_t* workers;
+    uint64_t num_workers;
+    pthread_t* threads;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    uint64_t step;
+    cbool_t stop;
+
+    // Inputs of the current step.
+    tensor_f32_t* images;
+    const uint32_t* labels;
+} data_parallel_t;
+
+data_parallel_t* new_data_parallel(linear_layer_t** layers, uint64_t num_layers,
+                                   activation_t hidden_activation, uint64_t num_workers);
+void free_data_parallel(data_parallel_t* dp);
+
+// Overwrites the master layers' gradients with those of the batch-mean
+// loss over `images` ([in, batch]) and their class `labels` (one per column)
+// and returns that loss. The caller's thread acts as worker 0.
+float data_parallel_step(data_parallel_t* dp, tensor_f32_t* images, const uint32_t* labels);
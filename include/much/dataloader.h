@@ -0,0 +1,57 @@
+#pragma once
+#include "much/mnist.h"
+#include <pthread.h>
+
+// One prefetched batch. Its tensors belong to the loader and are reused;
+// they stay valid until the next dataloader_next call.
+typedef struct {
+    tensor_f32_t* images;  // [image_size, count]
+    uint32_t* labels;      // [count] class indices
+    uint64_t count;
+    uint64_t epoch;
+    cbool_t end_of_epoch;
+    cbool_t ready;
+} mnist_batch_t;
+
+// Gathers batches on a background thread into a bounded ring of reusable
+// slots. Epochs run back to back: the producer reshuffles and starts on
+// the next epoch while the trainer finishes the current one.
+typedef struct {
+    mnist_dataset_t* dataset;
+    uint64_t batch_size;
+    cbool_t shuffle;
+    uint64_t seed;
+    uint64_t first_epoch;
+
+    mnist_batch_t* slots;
+    uint64_t num_slots;
+    uint64_t* order;
+    // Running slot counts. Slots in [released, consumed) are held by the
+    // trainer and slots in [consumed, produced) are ready and waiting.
+    uint64_t produced;
+    uint64_t consumed;
+    uint64_t released;
+    cbool_t stop;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+
+    double stall_seconds;
+    uint64_t stalls;
+} dataloader_t;
+
+// `prefetch` is the number of batches that may be in flight; 0 picks a
+// default. Shuffling draws a fresh permutation per epoch from stream
+// RNG_DATA_STREAMS | epoch of `seed`; numbering starts at `first_epoch` so
+// a resumed run sees the same orders.
+dataloader_t* new_dataloader(mnist_dataset_t* dataset, uint64_t batch_size, uint64_t prefetch,
+                             cbool_t shuffle, uint64_t seed, uint64_t first_epoch);
+void free_dataloader(dataloader_t* loader);
+
+// Returns the next batch of the current epoch, or NULL once the epoch is
+// exhausted; the call after that returns the first batch of the next one.
+mnist_batch_t* dataloader_next(dataloader_t* loader);
+
+// Total time dataloader_next spent waiting for the producer.
+double dataloader_stall_seconds(dataloader_t* loader);
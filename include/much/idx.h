@@ -0,0 +1,30 @@
+#pragma once
+#include <stdint.h>
+
+#define IDX_MAX_DIMS 8
+
+typedef enum IDX_DTYPE {
+    IDX_U8 = 0x08,
+    IDX_I8 = 0x09,
+    IDX_I16 = 0x0B,
+    IDX_I32 = 0x0C,
+    IDX_F32 = 0x0D,
+    IDX_F64 = 0x0E
+} idx_dtype_t;
+
+// A read-only, memory-mapped IDX file. `data` points at the first element
+// inside the mapping, so items are read straight from the page cache.
+typedef struct {
+    void* map;
+    uint64_t map_size;
+    idx_dtype_t dtype;
+    uint64_t num_dims;
+    uint64_t dims[IDX_MAX_DIMS];
+    uint64_t item_size;  // bytes per entry of the first dimension
+    const uint8_t* data;
+} idx_file_t;
+
+idx_file_t* idx_open(const char* path);
+void idx_close(idx_file_t* file);
+// The `index`-th entry of the first dimension, inside the mapping.
+const void* idx_item(idx_file_t* file, uint64_t index);
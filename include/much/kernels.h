@@ -0,0 +1,133 @@
+#pragma once
+#include "much/util.h"
+#include <stdint.h>
+
+typedef enum SIMD_LEVEL {
+  SIMD_SCALAR,
+  SIMD_SSE4,
+  SIMD_AVX2,
+  SIMD_AVX512
+} simd_level_t;
+
+// Per-step constants of an Adam/AdamW update, hoisted out of the
+// per-parameter loop.
+typedef struct {
+  float beta1;
+  float beta2;
+  float step_size;      // lr / (1 - beta1^t)
+  float inv_sqrt_bias2; // 1 / sqrt(1 - beta2^t)
+  float epsilon;
+  float decay;          // 1 - lr * weight_decay; 1 for plain Adam
+} adam_step_t;
+
+// Elementwise kernels over contiguous float arrays. Outputs may alias their
+// inputs. The *_grad kernels write `dst = x` when `accumulate` is false and
+// `dst += x` when it is true, where x is the gradient contribution named in
+// the comment.
+typedef struct {
+  simd_level_t level;
+  const char *name;
+
+  void (*fill)(float *out, float value, uint64_t n);
+  void (*add)(float *out, const float *a, const float *b, uint64_t n);
+  void (*sub)(float *out, const float *a, const float *b, uint64_t n);
+  void (*mul)(float *out, const float *a, const float *b, uint64_t n);
+  void (*div)(float *out, const float *a, const float *b, uint64_t n);
+  // out = a + value
+  void (*add_scalar)(float *out, const float *a, float value, uint64_t n);
+  // out = a > 0 ? a : a * slope
+  void (*leaky_relu)(float *out, const float *a, float slope, uint64_t n);
+  float (*sum)(const float *a, uint64_t n);
+  cbool_t (*has_zero)(const float *a, uint64_t n);
+
+  // Transcendentals, from polynomials evaluated in every lane; every SIMD
+  // level rounds exactly like the scalar one. Error bounds are against
+  // correctly rounded results, from an exhaustive search over the float
+  // range (worst case found in parentheses); tests/kernels_accuracy_test.c
+  // checks them.
+  //
+  // out = exp(a), within 1 ulp (0.992). Saturates instead of overflowing,
+  // and underflows to about 1e-38 rather than 0.
+  void (*exp)(float *out, const float *a, uint64_t n);
+  // out = log(a) for positive normal a, within 1 ulp (0.829). Inputs below
+  // FLT_MIN, including 0, give log(FLT_MIN).
+  void (*log)(float *out, const float *a, uint64_t n);
+  // out = 1 / (1 + exp(-a)), within 2 ulp (1.999) where the result is a
+  // normal float.
+  void (*sigmoid)(float *out, const float *a, uint64_t n);
+  // out = tanh(a), within 3 ulp (2.997).
+  void (*tanh)(float *out, const float *a, uint64_t n);
+  // sin(a) and cos(a) at once, e.g. for Box-Muller. For |a| <= 8192 the
+  // absolute error is below 1e-7 (7.8e-8), and results of magnitude 0.01
+  // or more are within 2 ulp (1.562).
+  void (*sincos)(float *sin_out, float *cos_out, const float *a, uint64_t n);
+  // The fast tier: exp(r) from 1 + r + r^2 times a linear polynomial instead
+  // of a degree-5 one, for callers that can trade accuracy for throughput.
+  // exp_fast and sigmoid_fast have a relative error below 1.5e-4;
+  // tanh_fast has an absolute error below 1e-4.
+  void (*exp_fast)(float *out, const float *a, uint64_t n);
+  void (*sigmoid_fast)(float *out, const float *a, uint64_t n);
+  void (*tanh_fast)(float *out, const float *a, uint64_t n);
+  // Online softmax across n columns, one row of logits at a time: folds
+  // `x` into each column's running maximum and sum of exp(x - max).
+  // Start from the first row as `max` and 1 as `sum`.
+  void (*softmax_update)(float *max, float *sum, const float *x, uint64_t n);
+  // out = exp(x - max) * scale, e.g. scale = 1 / sum for probabilities.
+  void (*softmax_scale)(float *out, const float *x, const float *max,
+                        const float *scale, uint64_t n);
+
+  // Symmetric int8 quantization of one row of n columns, each column with
+  // its own scale.
+  // max = max(max, |a|)
+  void (*abs_max)(float *max, const float *a, uint64_t n);
+  // out = round(a * inv_scale), ties to even, clamped to [-127, 127]
+  void (*quantize_i8)(int8_t *out, const float *a, const float *inv_scale,
+                      uint64_t n);
+  // out = acc * scale * col_scale + bias
+  void (*dequantize_i32)(float *out, const int32_t *acc, float scale,
+                         const float *col_scale, float bias, uint64_t n);
+
+  // x = alpha * g
+  void (*scale_grad)(float *dst, const float *g, float alpha, uint64_t n,
+                     cbool_t accumulate);
+  // x = g * b
+  void (*mul_grad)(float *dst, const float *g, const float *b, uint64_t n,
+                   cbool_t accumulate);
+  // x = g / b
+  void (*div_grad)(float *dst, const float *g, const float *b, uint64_t n,
+                   cbool_t accumulate);
+  // x = -g * a / (b * b), the divisor's share of a / b
+  void (*div_rhs_grad)(float *dst, const float *g, const float *a,
+                       const float *b, uint64_t n, cbool_t accumulate);
+  // x = y > 0 ? g : g * slope, where y is the input or output of leaky_relu
+  void (*leaky_relu_grad)(float *dst, const float *g, const float *y,
+                          float slope, uint64_t n, cbool_t accumulate);
+  // x = g * s * (1 - s), where s is the output of sigmoid
+  void (*sigmoid_grad)(float *dst, const float *g, const float *s, uint64_t n,
+                       cbool_t accumulate);
+  // x = g * (1 - t * t), where t is the output of tanh
+  void (*tanh_grad)(float *dst, const float *g, const float *t, uint64_t n,
+                    cbool_t accumulate);
+
+  // One fused pass over m, v and param.
+  void (*adam)(float *param, const float *grad, float *m, float *v,
+               uint64_t n, const adam_step_t *step);
+  // vel = momentum * vel + grad; param -= lr * vel
+  void (*sgd_momentum)(float *param, const float *grad, float *vel,
+                       uint64_t n, float lr, float momentum);
+
+  // Conversions between float and 16-bit storage, rounding to nearest even.
+  void (*bf16_to_f32)(float *out, const uint16_t *in, uint64_t n);
+  void (*f32_to_bf16)(uint16_t *out, const float *in, uint64_t n);
+  void (*f16_to_f32)(float *out, const uint16_t *in, uint64_t n);
+  void (*f32_to_f16)(uint16_t *out, const float *in, uint64_t n);
+} elementwise_kernels_t;
+
+// Kernels for the best SIMD level this CPU supports, chosen on first use.
+// Setting MUCH_SIMD=scalar|sse4|avx2|avx512 caps the level.
+const elementwise_kernels_t *get_kernels();
+
+// Kernels for a specific level, or NULL if the build or CPU lacks it.
+const elementwise_kernels_t *get_kernels_for(simd_level_t level);
+
+simd_level_t detect_simd_level();
@@ -6,6 +6,36 @@ typedef struct {
     tensor_f32_t* bias;
 } linear_layer_t;
 
+// Weight initializers; biases start at zero.
+typedef enum INIT {
+    INIT_HE,      // normal, std sqrt(2 / in): for the ReLU family
+    INIT_XAVIER,  // uniform in +-sqrt(6 / (in + out)): for sigmoid, tanh or none
+} init_t;
+
+// New layers are He-initialized from the next stream of the global
+// generator (see rng_set_seed).
 linear_layer_t* new_linear_layer(uint64_t input_features, uint64_t output_features, cbool_t require_grad);
+// Same as new_linear_layer with parameters (and their gradients) stored as `dtype`.
+linear_layer_t* new_linear_layer_dtype(uint64_t input_features, uint64_t output_features,
+                                       cbool_t require_grad, dtype_t dtype);
+// Redraws the weights from `rng` (or a fresh global stream when NULL) and
+// zeroes the bias.
+void linear_layer_init(linear_layer_t* layer, init_t init, rng_t* rng);
 void free_linear_layer(linear_layer_t* layer);
 tensor_f32_t* linear_layer_forward(linear_layer_t* layer, tensor_f32_t* src);
+tensor_f32_t* linear_layer_forward_act(linear_layer_t* layer, tensor_f32_t* src, activation_t activation);
+
+// A 2D convolution over NCHW batches. Its weight [out, in, k, k] and bias
+// [out] sit in a linear_layer_t, so optimizers and checkpoints handle it
+// like any other layer through `&layer->params`.
+typedef struct {
+    linear_layer_t params;
+    uint64_t stride;
+    uint64_t padding;
+} conv2d_layer_t;
+
+// He-initialized with a fan-in of in_channels * kernel * kernel.
+conv2d_layer_t* new_conv2d_layer(uint64_t in_channels, uint64_t out_channels, uint64_t kernel,
+                                 uint64_t stride, uint64_t padding, cbool_t require_grad);
+void free_conv2d_layer(conv2d_layer_t* layer);
+tensor_f32_t* conv2d_layer_forward_act(conv2d_layer_t* layer, tensor_f32_t* src, activation_t activation);
@@ -1,11 +1,30 @@
 #pragma once
+#include "much/idx.h"
 #include "much/tensor.h"
 
+#define MNIST_NUM_CLASSES 10
+
+// Images and labels stay as uint8 inside the mapped IDX files; they are
+// only expanded to float when a batch is gathered.
 typedef struct {
-    tensor_f32_t** images;
-    tensor_f32_t** labels;
+    idx_file_t* image_file;
+    idx_file_t* label_file;
+    const uint8_t* pixels;  // num_items rows of image_size bytes
+    const uint8_t* labels;  // one class index per item
     uint64_t num_items;
+    uint64_t rows;
+    uint64_t cols;
+    uint64_t image_size;
 } mnist_dataset_t;
 
 mnist_dataset_t* load_mnist_dataset(const char* image_path, const char* label_path);
 void free_mnist_dataset(mnist_dataset_t* dataset);
+
+// Gathers samples into a column-per-sample batch, scaling pixels to [0, 1]
+// as they are read from the mapped files:
+// `images` is [image_size, count] and `labels` gets `count` class indices.
+// Either may be NULL.
+void mnist_gather_batch(mnist_dataset_t* dataset, uint64_t start, uint64_t count,
+                        tensor_f32_t* images, uint32_t* labels);
+void mnist_gather_indices(mnist_dataset_t* dataset, const uint64_t* indices, uint64_t count,
+                          tensor_f32_t* images, uint32_t* labels);
@@ -0,0 +1,46 @@
+#pragma once
+#include "much/layer.h"
+
+struct MODULE;
+
+// What a sequence needs from a layer. Activations are float [features,
+// batch] matrices, dense with `batch` columns.
+typedef struct {
+    // Output features for `in_features` inputs; raises if they do not fit.
+    uint64_t (*out_features)(struct MODULE* self, uint64_t in_features);
+    // Builds the autograd graph, like any op.
+    tensor_f32_t* (*forward)(struct MODULE* self, tensor_f32_t* x);
+    // Graph-free forward of `x` [in_features, batch] into a preallocated
+    // `y`.
+    void (*forward_into)(struct MODULE* self, const float* x, float* y, uint64_t in_features,
+                         uint64_t batch);
+    // Graph-free backward: turns `dy` (which it may overwrite) into `dx`,
+    // skipped when `dx` is NULL, and adds to the parameters' gradients.
+    // `x` and `y` are the buffers of the matching forward_into.
+    void (*backward_into)(struct MODULE* self, const float* x, const float* y, float* dy,
+                          float* dx, uint64_t in_features, uint64_t batch);
+    // Writes up to `max` parameter tensors to `params`; returns how many
+    // the module has.
+    uint64_t (*parameters)(struct MODULE* self, tensor_f32_t** params, uint64_t max);
+    void (*free)(struct MODULE* self);
+
+    // What backward_into reads, so a plan knows which activations to keep.
+    cbool_t backward_reads_x;
+    cbool_t backward_reads_y;
+    // forward_into may write `y` over `x`.
+    cbool_t in_place;
+    // What the profiler files a plan's calls to this module under.
+    op_kind_t op;
+} module_ops_t;
+
+typedef struct MODULE {
+    const module_ops_t* ops;
+    void* state;
+} module_t;
+
+// `layer` followed by `activation`. The module borrows the layer, which
+// must be float and outlive it.
+module_t* new_linear_module(linear_layer_t* layer, activation_t activation);
+// A standalone activation; ACTIVATION_LEAKY_RELU matches tensor_f32_relu.
+module_t* new_activation_module(activation_t activation);
+void free_module(module_t* module);
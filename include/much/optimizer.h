@@ -1,15 +1,35 @@
 #pragma once
 #include "much/layer.h"
 
+typedef enum OPTIMIZER_TYPE {
+    OPTIMIZER_SGD,
+    OPTIMIZER_ADAM,
+    OPTIMIZER_ADAMW
+} optimizer_type_t;
+
+// State for one layer's parameters: the weight followed by the bias.
 typedef struct {
+    optimizer_type_t type;
     float beta1;
     float beta2;
     float epsilon;
-    float* m;
-    float* v;
+    float momentum;
+    float weight_decay;
+    float* m;  // Adam first moment, SGD velocity
+    float* v;  // Adam second moment
+    // Float copy of bf16/fp16 parameters, made on the first update. Steps
+    // are applied here and rounded into the layer's storage.
+    float* master;
+    uint64_t num_params;
     int t;
-} adam_optimizer_t;
+} optimizer_t;
 
-adam_optimizer_t* new_adam_optimizer(uint64_t num_params);
-void free_adam_optimizer(adam_optimizer_t* optimizer);
-void adam_update(adam_optimizer_t* optimizer, linear_layer_t* layer, float learning_rate);
+optimizer_t* new_adam_optimizer(uint64_t num_params);
+// Adam with decoupled weight decay.
+optimizer_t* new_adamw_optimizer(uint64_t num_params, float weight_decay);
+// Plain SGD when momentum is 0.
+optimizer_t* new_sgd_optimizer(uint64_t num_params, float momentum);
+void free_optimizer(optimizer_t* optimizer);
+// Applies one step from the layer's gradients and marks them stale, so no
+// zero_grad pass is needed before the next backward.
+void optimizer_update(optimizer_t* optimizer, linear_layer_t* layer, float learning_rate);
@@ -0,0 +1,43 @@
+#pragma once
+#include "much/util.h"
+#include <stdint.h>
+
+// Processes [begin, end) of a parallel_for; called once per chunk.
+typedef void (*parallel_range_fn)(void *ctx, uint64_t begin, uint64_t end);
+
+// Splits [begin, end) into chunks of at least `grain` items and runs them on
+// a persistent pool of worker threads plus the calling thread. Returns once
+// every chunk has finished. Each thread starts on its own share of the
+// range and, when done, steals half of what is left of another's, so
+// uneven chunks and late-waking workers even out. A `grain` of 0 means
+// parallel_grain(1). Ranges no larger than `grain`, calls from workers and
+// calls made while another thread is using the pool run inline.
+void parallel_for(uint64_t begin, uint64_t end, uint64_t grain,
+                  parallel_range_fn fn, void *ctx);
+
+// A grain for loops whose items each cost about `cost` float operations:
+// enough items that a chunk outweighs handing it to another thread.
+uint64_t parallel_grain(uint64_t cost);
+
+// Threads used by parallel_for, including the caller. Defaults to
+// MUCH_NUM_THREADS or the number of cores this process may run on. With
+// MUCH_PIN_THREADS=1 each pool worker is pinned to a core of its own, so it
+// keeps its caches; the first core is left to the submitting threads, which
+// are never pinned.
+uint64_t parallel_get_num_threads();
+
+// Stops the current pool, whose workers free their thread scratch on the
+// way out; the next parallel_for starts one of the new size.
+void parallel_set_num_threads(uint64_t num_threads);
+
+// Marks the calling thread as a worker of some other parallel scheme, e.g.
+// a data-parallel replica: its parallel_for calls then run inline and its
+// BLAS calls single-threaded, so the two never stack up more threads than
+// there are cores. Pool workers are marked already.
+void parallel_mark_worker();
+
+cbool_t parallel_is_worker();
+
+// Threads a BLAS call made from this thread may use: 1 inside any worker,
+// otherwise the pool size, which is idle while the caller waits on BLAS.
+uint64_t parallel_blas_threads();
@@ -0,0 +1,78 @@
+#pragma once
+#include "much/util.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// What produced a graph node, and what the profiler files its time under.
+typedef enum OP_KIND {
+  OP_NONE,  // a leaf
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_MATMUL,
+  OP_SIGMOID,
+  OP_TANH,
+  OP_RELU,
+  OP_CAST,
+  OP_VIEW,
+  OP_LINEAR,
+  OP_CONV2D,
+  OP_MAX_POOL,
+  OP_AVG_POOL,
+  OP_CROSSENTROPY,
+  OP_SOFTMAX_CROSSENTROPY,
+  OP_MSE,
+  OP_OPTIMIZER,
+  OP_KIND_COUNT
+} op_kind_t;
+
+typedef enum PROFILE_PHASE {
+  PROFILE_FORWARD,
+  PROFILE_BACKWARD,
+  PROFILE_UPDATE,
+  PROFILE_PHASE_COUNT
+} profile_phase_t;
+
+const char *op_kind_name(op_kind_t op);
+const char *profile_phase_name(profile_phase_t phase);
+
+// Starts collecting, after clearing earlier results: a call count, time and
+// FLOP and byte estimates per op kind and phase, and with `max_events` > 0
+// a trace of up to that many op calls. Call it while no op is running.
+void profile_start(uint64_t max_events);
+void profile_stop();
+// Frees the trace and zeroes the counters.
+void profile_clear();
+
+// Closes a training step: the time since the previous one (or since
+// profile_start) becomes a span in the trace, and the report averages over
+// steps.
+void profile_step();
+
+// A table of op kinds by total time. Times are inclusive, so an op that
+// calls another (a matmul gathering a strided input, say) counts it too,
+// and ops on concurrent threads can add up to more than the step time.
+void profile_report(FILE *out);
+// The trace as Chrome trace-event JSON, for chrome://tracing or Perfetto.
+cbool_t profile_write_trace(const char *path);
+
+extern atomic_bool profile_enabled;
+uint64_t profile_now_ns();
+
+// Instrumented code brackets an op as
+//   uint64_t start = profile_begin();
+//   ...
+//   profile_record(OP_..., phase, start, rows, cols, inner, element_bytes);
+// Disabled, that is one relaxed load and a call that returns at once. The
+// op's result is rows x cols elements of `element_bytes`; `inner` is the
+// reduced dimension of a matmul or linear op and 0 otherwise.
+static inline uint64_t profile_begin() {
+  return atomic_load_explicit(&profile_enabled, memory_order_relaxed)
+             ? profile_now_ns()
+             : 0;
+}
+void profile_record(op_kind_t op, profile_phase_t phase, uint64_t start,
+                    uint64_t rows, uint64_t cols, uint64_t inner,
+                    size_t element_bytes);
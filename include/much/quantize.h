@@ -0,0 +1,41 @@
+#pragma once
+#include "much/layer.h"
+#include <stdint.h>
+
+// Inference-only int8 version of a linear_layer_t. Weights are quantized
+// symmetrically per output channel; inputs are quantized on the fly, per
+// batch column, or with one static scale after calibration. Products are
+// accumulated in int32 and rescaled to float before the bias and activation.
+typedef struct {
+    uint64_t in_features;
+    uint64_t out_features;
+    uint64_t padded_in;       // in_features rounded up for the int8 kernels
+    int8_t* weight;           // [out_features, padded_in], zero padded
+    float* weight_scale;      // [out_features]
+    int32_t* weight_row_sum;  // [out_features]
+    float* bias;              // [out_features]
+
+    float input_max;    // largest |x| seen by quantized_linear_observe
+    float input_scale;  // 0 until calibrated: dynamic per-column scales
+} quantized_linear_layer_t;
+
+// Quantizes a copy of `layer`'s parameters; the float layer is not needed
+// afterwards.
+quantized_linear_layer_t* new_quantized_linear_layer(linear_layer_t* layer);
+void free_quantized_linear_layer(quantized_linear_layer_t* layer);
+
+// Calibration: observe representative float inputs ([in_features, batch]),
+// then fix the static input scale from the largest magnitude seen.
+void quantized_linear_observe(quantized_linear_layer_t* layer, tensor_f32_t* x);
+void quantized_linear_calibrate(quantized_linear_layer_t* layer);
+
+// [in_features, batch] -> [out_features, batch]; never records a graph.
+tensor_f32_t* quantized_linear_forward(quantized_linear_layer_t* layer, tensor_f32_t* x,
+                                       activation_t activation);
+
+// Bytes of parameter storage as allocated, padding and row sums included,
+// for comparing with the float layer.
+uint64_t quantized_linear_weight_bytes(quantized_linear_layer_t* layer);
+
+// Name of the int8 GEMM kernel in use, e.g. "avx512-vnni".
+const char* quantized_gemm_name();
@@ -0,0 +1,40 @@
+#pragma once
+#include <stdint.h>
+
+// A counter-based generator (Philox4x32-10). Value k of a stream is a pure
+// function of (seed, stream, k), so any range of it can be produced on any
+// thread, and fills give the same result whatever the thread count.
+// Different streams of one seed are independent.
+typedef struct {
+  uint64_t seed;
+  uint64_t stream;
+  // Values drawn so far; the next draw starts here.
+  uint64_t offset;
+} rng_t;
+
+// Streams with the top bit set are left to the data loader's shuffles.
+#define RNG_DATA_STREAMS (1ull << 63)
+
+rng_t rng_init(uint64_t seed, uint64_t stream);
+
+// The global generator: each call to rng_next_stream() returns the next
+// stream of the seed last given to rng_set_seed (0 by default), so objects
+// created in the same order get the same values. Thread-safe.
+void rng_set_seed(uint64_t seed);
+rng_t rng_next_stream();
+
+// 64 random bits.
+uint64_t rng_next(rng_t *rng);
+// Uniform in [0, bound).
+uint64_t rng_below(rng_t *rng, uint64_t bound);
+
+// Values [first, first + n) of the stream, uniform in (lo, hi) or normal,
+// without moving `rng`. Large ranges are split across the thread pool.
+void rng_uniform_at(const rng_t *rng, float *out, uint64_t first, uint64_t n,
+                    float lo, float hi);
+void rng_normal_at(const rng_t *rng, float *out, uint64_t first, uint64_t n,
+                   float mean, float std);
+
+// The next n values, advancing `rng` past them.
+void rng_uniform(rng_t *rng, float *out, uint64_t n, float lo, float hi);
+void rng_normal(rng_t *rng, float *out, uint64_t n, float mean, float std);
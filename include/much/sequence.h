@@ -1,15 +1,56 @@
 #pragma once
 
-#include "much/layer.h"
+#include "much/module.h"
 #include <stdint.h>
 
+// Modules applied one after the other. The sequence owns its modules.
 typedef struct {
-    void** layers;
-    uint64_t num_layers;
-    // Layer types can be stored in another array if needed for forward pass
+    module_t** modules;
+    uint64_t num_modules;
 } sequence_t;
 
 sequence_t* new_sequence();
 void free_sequence(sequence_t* seq);
-void sequence_add_layer(sequence_t* seq, void* layer);
+void sequence_add(sequence_t* seq, module_t* module);
+// Runs every module's graph-building forward.
 tensor_f32_t* sequence_forward(sequence_t* seq, tensor_f32_t* src);
+// Writes up to `max` parameter tensors, in module order, and returns how
+// many there are.
+uint64_t sequence_parameters(sequence_t* seq, tensor_f32_t** params, uint64_t max);
+
+// A sequence compiled for inputs of `in_features` and at most `batch`
+// columns. Shapes are inferred once, and every activation and gradient
+// lives in a single workspace allocated up front. Activations share a
+// buffer once nothing reads them any more; with `training` set, those that
+// backward reads are kept until it has run. Replaying the plan builds no
+// graph and allocates nothing.
+typedef struct {
+    sequence_t* seq;
+    uint64_t batch;
+    cbool_t training;
+    // Features of the input and of each module's output.
+    uint64_t* features;
+    float* workspace;
+    // activations[0] is the caller's input; activations[i + 1] is module
+    // i's output, inside the workspace.
+    const float** activations;
+    // Two gradient buffers that backward alternates between.
+    float* grads[2];
+    // Wraps the last activation; reshaped to each call's batch.
+    tensor_f32_t* output;
+    // The gradient of `output`, for the caller to fill before backward.
+    float* output_grad;
+    uint64_t current_batch;
+    uint64_t workspace_bytes;
+} sequence_plan_t;
+
+sequence_plan_t* sequence_compile(sequence_t* seq, uint64_t in_features, uint64_t batch,
+                                  cbool_t training);
+void free_sequence_plan(sequence_plan_t* plan);
+// Runs the plan on `x`, a contiguous float [in_features, n] with n <= the
+// compiled batch. The result is `plan->output`, valid until the next call;
+// `x` must stay alive until sequence_plan_backward has run.
+tensor_f32_t* sequence_plan_forward(sequence_plan_t* plan, tensor_f32_t* x);
+// Backpropagates `plan->output_grad` through the last forward, adding to
+// the parameters' gradients. Needs a training plan.
+void sequence_plan_backward(sequence_plan_t* plan);
@@ -0,0 +1,35 @@
+#pragma once
+#include "much/util.h"
+#include <stdint.h>
+
+typedef enum SGEMM_TRANSPOSE { SGEMM_NO_TRANS, SGEMM_TRANS } sgemm_trans_t;
+
+typedef enum SGEMM_BACKEND {
+  SGEMM_AUTO,     // by shape
+  SGEMM_BUILTIN,  // the packed kernels in this library
+  SGEMM_BLAS      // cblas_sgemm, when the build has it
+} sgemm_backend_t;
+
+// c = alpha * op(a) * op(b) + beta * c for row-major matrices, where op(a)
+// is m x k, op(b) is k x n and c is m x n; the arguments mean what they do
+// to cblas_sgemm(CblasRowMajor, ...). With beta = 0, c is not read.
+void sgemm(sgemm_trans_t trans_a, sgemm_trans_t trans_b, uint64_t m,
+           uint64_t n, uint64_t k, float alpha, const float *a, uint64_t lda,
+           const float *b, uint64_t ldb, float beta, float *c, uint64_t ldc);
+
+// Small and skinny products run on the built-in kernels, where a library
+// call and its threading cost more than the arithmetic; large ones go to
+// BLAS when the build has it. MUCH_SGEMM=builtin|blas forces one side, as
+// does sgemm_set_backend. Without BLAS everything runs built in.
+void sgemm_set_backend(sgemm_backend_t backend);
+sgemm_backend_t sgemm_get_backend();
+cbool_t sgemm_has_blas();
+
+// Frees the calling thread's packing buffers; the next built-in product on
+// the thread allocates them again. Threads the library starts call this on
+// exit through release_thread_scratch.
+void sgemm_release_thread_buffers();
+
+// The built-in microkernel in use: "scalar", "avx2" or "avx512", following
+// the MUCH_SIMD cap.
+const char *sgemm_kernel_name();
@@ -1,29 +1,102 @@
 #pragma once
 
+#include "much/arena.h"
+#include "much/profile.h"
+#include "much/random.h"
 #include "much/util.h"
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+// Element type of a tensor's data and gradient. Reduced-precision tensors
+// are stored as 16-bit values and widened to float for arithmetic.
+typedef enum DTYPE { DTYPE_F32, DTYPE_BF16, DTYPE_F16 } dtype_t;
+
 typedef struct TENSOR_META {
   uint64_t capacity;
   uint64_t *shape;
+  // Elements between neighbours along each dimension, allocated together
+  // with `shape`. A new tensor is row-major contiguous; views may not be.
+  uint64_t *strides;
   uint64_t shape_length;
   cbool_t require_grad;
+  dtype_t dtype;
 } tensor_meta;
 
+typedef enum ACTIVATION_TYPE {
+  ACTIVATION_NONE,
+  ACTIVATION_RELU,
+  ACTIVATION_LEAKY_RELU,
+  ACTIVATION_SIGMOID
+} activation_t;
+
+// The buffers behind a tensor and all of its views. Heap tensors hold a
+// reference each and the last release frees the buffers; arena storage is
+// reclaimed by arena_reset instead.
+typedef struct TENSOR_STORAGE {
+  void *data;
+  // Allocated on the first gradient write, from `arena` when it is set.
+  void *grad;
+  // Size of `data`, and of `grad` once it exists.
+  size_t bytes;
+  // Set while `grad` holds nothing of the current pass: the next write
+  // overwrites it instead of accumulating, so gradients are never zeroed.
+  cbool_t grad_stale;
+  _Atomic uint64_t refcount;
+  // Storage whose `data` this one borrows (see tensor_f32_share); it is
+  // kept alive until this one is released.
+  struct TENSOR_STORAGE *data_owner;
+  // Cleared when `data` belongs to someone else, e.g. a memory map.
+  cbool_t owns_data;
+  // The arena holding this storage, or NULL for heap storage.
+  arena_t *arena;
+} tensor_storage_t;
+
 struct FLOAT_TESNOR;
 
+#define TENSOR_OP_ARGS 4
+
 typedef void (*grad_fn)(struct FLOAT_TESNOR *self);
 
 typedef struct FLOAT_TESNOR {
-  float *data;
-  float *grad;
+  // `data16`/`grad16` alias `data`/`grad` for bf16 and fp16 tensors.
+  union {
+    float *data;
+    uint16_t *data16;
+  };
+  union {
+    float *grad;
+    uint16_t *grad16;
+  };
   tensor_meta meta;
 
   grad_fn backward_fn;
+  // The op that produced the tensor, for the profiler; OP_NONE for leaves.
+  op_kind_t op;
   struct FLOAT_TESNOR** prev;
   int num_prev;
+  // Integer arguments of `op` that its backward function reads, e.g. a
+  // convolution's stride and padding; set by the op after
+  // tensor_f32_set_backward, which clears them.
+  uint64_t op_args[TENSOR_OP_ARGS];
+  // Stamp of the last backward() traversal that reached this tensor.
+  uint64_t visit_epoch;
+
+  // `data` and `grad` point `offset` elements into `storage`, and are laid
+  // out by `meta.strides`. `grad` is only up to date after tensor_grad or
+  // tensor_grad_prepare, since the storage allocates it lazily.
+  tensor_storage_t *storage;
+  uint64_t offset;
+
+  // References to a heap tensor: its creator's plus one per graph node
+  // that lists it in `prev`. Unused for arena tensors.
+  _Atomic uint64_t refcount;
+
+  // Set when the tensor lives in an arena; free_tensor_f32 leaves it alone
+  // and arena_reset reclaims it. Arena tensors hold no references, neither
+  // to storage nor to other tensors.
+  cbool_t in_arena;
 } tensor_f32_t;
 
 tensor_meta *new_tensor_meta(uint64_t capacity, uint64_t *shape,
@@ -37,11 +110,85 @@ void free_tensor_meta(tensor_meta *self);
 tensor_f32_t *new_tensor_f32(uint64_t *shape, uint64_t shape_length,
                              cbool_t require_grad);
 
+tensor_f32_t *new_tensor_dtype(uint64_t *shape, uint64_t shape_length,
+                               dtype_t dtype, cbool_t require_grad);
+
+// Bytes per element.
+size_t dtype_size(dtype_t dtype);
+const char *dtype_name(dtype_t dtype);
+
+// Conversions between float and `dtype` storage (a copy for DTYPE_F32).
+void dtype_to_f32(float *out, const void *in, dtype_t dtype, uint64_t n);
+void dtype_from_f32(void *out, const float *in, dtype_t dtype, uint64_t n);
+
+// Heap tensors are reference counted. Every constructor and op returns a
+// tensor holding one reference for the caller, and an op's result keeps
+// its inputs alive for backward(), so an intermediate can be released as
+// soon as it has been passed on. free_tensor_f32 drops a reference; the
+// last one frees the tensor along with inputs only it kept alive.
+tensor_f32_t *tensor_f32_retain(tensor_f32_t *self);
 void free_tensor_f32(tensor_f32_t *self);
 
+// A heap tensor over caller-owned `data`, which must outlive it (e.g. a
+// memory-mapped checkpoint). The gradient, if any, is owned as usual.
+tensor_f32_t *tensor_f32_wrap(float *data, uint64_t *shape,
+                              uint64_t shape_length, cbool_t require_grad);
+tensor_f32_t *tensor_wrap_dtype(void *data, uint64_t *shape,
+                                uint64_t shape_length, dtype_t dtype,
+                                cbool_t require_grad);
+
+// A new heap tensor with the same shape that reads and writes `src`'s data
+// but has its own gradient, e.g. a per-thread replica of a parameter. `src`
+// must be contiguous; its data stays alive until the replica is freed.
+tensor_f32_t *tensor_f32_share(tensor_f32_t *src, cbool_t require_grad);
+
+// Views share `a`'s storage, data and gradient alike: nothing is copied,
+// writes through either are seen by both, and gradients flowing into a view
+// land in `a`'s gradient. A heap view keeps the storage alive after `a` is
+// freed. Elementwise ops stream views in contiguous runs, and matmul and
+// linear hand 2D views with a unit stride in either dimension to sgemm
+// directly; other layouts are copied by tensor_f32_contiguous on the way.
+cbool_t tensor_is_contiguous(tensor_f32_t *a);
+// `a` with a new shape of the same capacity; `a` must be contiguous.
+tensor_f32_t *tensor_f32_reshape(tensor_f32_t *a, uint64_t *shape,
+                                 uint64_t shape_length);
+tensor_f32_t *tensor_f32_transpose(tensor_f32_t *a, uint64_t dim0,
+                                   uint64_t dim1);
+// Indices [start, start + length) of dimension `dim`.
+tensor_f32_t *tensor_f32_narrow(tensor_f32_t *a, uint64_t dim, uint64_t start,
+                                uint64_t length);
+// Indices start, start + step, ... below `end` of dimension `dim`.
+tensor_f32_t *tensor_f32_slice(tensor_f32_t *a, uint64_t dim, uint64_t start,
+                               uint64_t end, uint64_t step);
+// `a` itself when contiguous, otherwise a contiguous copy that passes
+// gradients back to `a`.
+tensor_f32_t *tensor_f32_contiguous(tensor_f32_t *a);
+
+// Routes every following new_tensor_f32 on this thread into `arena` (NULL
+// restores heap allocation). Returns the previously active arena.
+arena_t *tensor_set_arena(arena_t *arena);
+
+arena_t *tensor_get_arena();
+
+// While at least one no-grad scope is open on this thread, ops and losses
+// neither allocate gradients nor record backward edges, even when their
+// inputs require grad. Scopes nest; every enter needs a matching exit.
+void tensor_no_grad_enter();
+void tensor_no_grad_exit();
+cbool_t tensor_grad_enabled();
+
+// Records how `self` was produced: its op, backward function and inputs.
+void tensor_f32_set_backward(tensor_f32_t *self, op_kind_t op,
+                             grad_fn backward_fn, tensor_f32_t **prev,
+                             int num_prev);
+
 void tensor_f32_fill(tensor_f32_t *self, float value);
 
-void tensor_f32_randn(tensor_f32_t *self, float mean, float std);
+// Fill `self`, in element order, with the next values of `rng`, or of a
+// fresh stream of the global generator when `rng` is NULL. The values do
+// not depend on the number of threads.
+void tensor_f32_randn(tensor_f32_t *self, rng_t *rng, float mean, float std);
+void tensor_f32_rand(tensor_f32_t *self, rng_t *rng, float lo, float hi);
 
 tensor_f32_t* tensor_f32_add(tensor_f32_t *a, tensor_f32_t *b);
 tensor_f32_t* tensor_f32_sub(tensor_f32_t *a, tensor_f32_t *b);
@@ -49,10 +196,49 @@ tensor_f32_t* tensor_f32_mul(tensor_f32_t *a, tensor_f32_t *b);
 tensor_f32_t* tensor_f32_div(tensor_f32_t *a, tensor_f32_t *b);
 tensor_f32_t* tensor_f32_matmul(tensor_f32_t *a, tensor_f32_t *b);
 tensor_f32_t* tensor_f32_sigmoid(tensor_f32_t *a);
+tensor_f32_t* tensor_f32_tanh(tensor_f32_t *a);
 tensor_f32_t* tensor_f32_relu(tensor_f32_t *a);
 
+// A copy of `a` stored as `dtype`; gradients flow back through the cast.
+tensor_f32_t* tensor_f32_cast(tensor_f32_t *a, dtype_t dtype);
+
+// dst->grad += src->grad for tensors of the same size and any dtypes.
+void tensor_f32_accumulate_grad(tensor_f32_t *dst, tensor_f32_t *src);
+
+// Gradient buffers are allocated by their first write, which overwrites
+// rather than accumulates. Backward functions call tensor_grad_prepare
+// before writing all of `t`'s gradient in one go: it sets `t->grad` and
+// returns CBOOL_TRUE when the write must add to what is already there.
+cbool_t tensor_grad_prepare(tensor_f32_t *t);
+// `t`'s gradient for reading; zeros if nothing was written since it went
+// stale.
+void *tensor_grad(tensor_f32_t *t);
+// Marks the gradient of `t`'s storage, shared with its views, as stale
+// instead of clearing it: the next backward overwrites it.
+void tensor_zero_grad(tensor_f32_t *t);
+
+// Every op accepts reduced-precision inputs and computes in float. Most
+// route them through tensor_f32_cast and return float unless both inputs
+// share a dtype. tensor_f32_linear instead reads the weight in cache-sized
+// blocks straight from its 16-bit storage and returns the weight's dtype.
+
+// activation(weight * x + bias) as a single graph node. `x` is [in, batch],
+// `weight` is [out, in] and `bias` is [out] (or NULL); the result is
+// [out, batch]. ACTIVATION_LEAKY_RELU matches tensor_f32_relu.
+tensor_f32_t* tensor_f32_linear(tensor_f32_t *x, tensor_f32_t *weight,
+                                tensor_f32_t *bias, activation_t activation);
+
 void print_tensor(tensor_f32_t *self);
 
+// Number of tensors allocated on the heap since startup; arena tensors are
+// not counted.
 uint64_t get_tensor_alloc_count();
 
+// Number of heap tensors that are currently alive.
+uint64_t get_tensor_live_count();
+
+// Backpropagates from `self` through its graph once. Each node lets go of
+// its inputs as soon as its backward function has run, so activations and
+// gradients that nothing else refers to are freed during the pass rather
+// than after it. The graph cannot be replayed; run the forward pass again.
 void backward(tensor_f32_t *self);
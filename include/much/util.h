@@ -5,4 +5,13 @@ typedef enum BOOLEAN { CBOOL_FALSE = 0, CBOOL_TRUE = 1 } cbool_t;
 
 typedef enum ERROR_TYPE { NullPointer, RuntimeError, ValueError } error_t;
 
-void raise_error(error_t error_type, const char *msg);
\ No newline at end of file
+// Prints `msg` and exits with `error_type`; never returns.
+_Noreturn void raise_error(error_t error_type, const char *msg);
+
+// Thread-local scratch that modules grow on demand. A module registers a
+// function that frees the calling thread's buffers when it first allocates
+// them; threads the library starts run every registered function through
+// release_thread_scratch() before they exit.
+typedef void (*thread_scratch_release_fn)();
+void register_thread_scratch(thread_scratch_release_fn release);
+void release_thread_scratch();
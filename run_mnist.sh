@@ -1,2 +1,4 @@
 #!/bin/bash
-OPENBLAS_NUM_THREADS=23 ninja -C build && OPENBLAS_NUM_THREADS=4 ./build/much
+# much sizes its thread pool from the cores it may use (MUCH_NUM_THREADS
+# overrides) and hands BLAS the same count, so no OPENBLAS_NUM_THREADS here.
+ninja -C build && ./build/much "$@"
@@ -0,0 +1,647 @@
+#include "much/conv.h"
+#include "much/crossentropy.h"
+#include "much/data_parallel.h"
+#include "much/kernels.h"
+#include "much/layer.h"
+#include "much/mnist.h"
+#include "much/optimizer.h"
+#include "much/parallel.h"
+#include "much/sequence.h"
+#include "much/sgemm.h"
+#include "much/tensor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Microbenchmarks for ops, layers and training steps. Each result is the
+// time per call, the throughput in the benchmark's own items and the heap
+// tensors allocated per call, written as JSON so builds can be compared.
+
+#define DEFAULT_DATA_DIR "data"
+#define DEFAULT_MIN_SECONDS 0.2
+#define BATCH_SIZE 64
+#define OP_SIZE 256
+#define SYNTHETIC_ITEMS 4096
+#define IMAGE_SIDE 28
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [--filter SUBSTRING] [--min-time SECONDS] "
+          "[--data DIR] [--out PATH]\n",
+          prog);
+  exit(ValueError);
+}
+
+static double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+typedef void (*bench_fn)(void *state);
+
+typedef struct {
+  FILE *out;
+  const char *filter;
+  double min_seconds;
+  uint64_t written;
+} bench_t;
+
+// Calls `fn` once to warm up, then in doubling rounds until a round takes
+// at least `min_seconds`, and reports that round. `items` is the work done
+// by one call.
+static void bench_run(bench_t *bench, const char *name, const char *unit,
+                      double items, bench_fn fn, void *state) {
+  if (bench->filter != NULL && strstr(name, bench->filter) == NULL) {
+    return;
+  }
+  fn(state);
+  uint64_t iterations = 1;
+  double seconds;
+  uint64_t allocs;
+  for (;;) {
+    uint64_t allocs_before = get_tensor_alloc_count();
+    double start = now_seconds();
+    for (uint64_t i = 0; i < iterations; i++) {
+      fn(state);
+    }
+    seconds = now_seconds() - start;
+    allocs = get_tensor_alloc_count() - allocs_before;
+    if (seconds >= bench->min_seconds || iterations >= (1ull << 40)) {
+      break;
+    }
+    iterations *= 2;
+  }
+  fprintf(bench->out,
+          "%s\n    {\"name\": \"%s\", \"iterations\": %llu, "
+          "\"ns_per_iter\": %.1f, \"%s_per_second\": %.6g, "
+          "\"allocs_per_iter\": %.2f}",
+          bench->written > 0 ? "," : "", name,
+          (unsigned long long)iterations, seconds * 1e9 / iterations, unit,
+          items * iterations / seconds, (double)allocs / iterations);
+  fflush(bench->out);
+  bench->written++;
+}
+
+static tensor_f32_t *new_random(uint64_t rows, uint64_t cols, float lo,
+                                cbool_t require_grad) {
+  tensor_f32_t *t =
+      new_tensor_f32((uint64_t[]){rows, cols}, 2, require_grad);
+  tensor_f32_rand(t, NULL, lo, 1.0f);
+  return t;
+}
+
+// Ops
+
+// Casts go to bf16.
+static const op_kind_t bench_op_kinds[] = {
+    OP_ADD,     OP_SUB,  OP_MUL,  OP_DIV,    OP_MATMUL,
+    OP_SIGMOID, OP_TANH, OP_RELU, OP_LINEAR, OP_CAST};
+
+typedef struct {
+  op_kind_t kind;
+  tensor_f32_t *a;
+  tensor_f32_t *b;
+  tensor_f32_t *bias;
+  cbool_t backward;
+} op_state_t;
+
+static tensor_f32_t *op_apply(op_state_t *s) {
+  switch (s->kind) {
+  case OP_ADD:
+    return tensor_f32_add(s->a, s->b);
+  case OP_SUB:
+    return tensor_f32_sub(s->a, s->b);
+  case OP_MUL:
+    return tensor_f32_mul(s->a, s->b);
+  case OP_DIV:
+    return tensor_f32_div(s->a, s->b);
+  case OP_MATMUL:
+    return tensor_f32_matmul(s->a, s->b);
+  case OP_SIGMOID:
+    return tensor_f32_sigmoid(s->a);
+  case OP_TANH:
+    return tensor_f32_tanh(s->a);
+  case OP_RELU:
+    return tensor_f32_relu(s->a);
+  case OP_LINEAR:
+    return tensor_f32_linear(s->b, s->a, s->bias, ACTIVATION_LEAKY_RELU);
+  case OP_CAST:
+    return tensor_f32_cast(s->a, DTYPE_BF16);
+  case OP_CONV2D:
+    return tensor_f32_conv2d(s->b, s->a, s->bias, 1, 1, ACTIVATION_LEAKY_RELU);
+  case OP_MAX_POOL:
+    return tensor_f32_max_pool2d(s->a, 2, 2);
+  default:
+    return NULL;
+  }
+}
+
+static void op_step(void *state) {
+  op_state_t *s = (op_state_t *)state;
+  tensor_f32_t *y = op_apply(s);
+  if (s->backward == CBOOL_TRUE) {
+    backward(y);
+  }
+  free_tensor_f32(y);
+}
+
+static void bench_ops(bench_t *bench) {
+  char name[96];
+  for (size_t i = 0; i < sizeof(bench_op_kinds) / sizeof(op_kind_t); i++) {
+    op_kind_t kind = bench_op_kinds[i];
+    for (int pass = 0; pass < 2; pass++) {
+      cbool_t backward = pass == 1 ? CBOOL_TRUE : CBOOL_FALSE;
+      // Divisors stay away from zero.
+      op_state_t s = {kind,
+                      new_random(OP_SIZE, OP_SIZE, 0.5f, backward),
+                      new_random(OP_SIZE, OP_SIZE, 0.5f, backward), NULL,
+                      backward};
+      double items = (double)OP_SIZE * OP_SIZE;
+      const char *unit = "elements";
+      if (kind == OP_MATMUL) {
+        items = 2.0 * OP_SIZE * OP_SIZE * OP_SIZE;
+        unit = "flops";
+      } else if (kind == OP_LINEAR) {
+        // [out, in] weight on an [in, batch] input.
+        free_tensor_f32(s.b);
+        s.b = new_random(OP_SIZE, BATCH_SIZE, -1.0f, backward);
+        s.bias = new_tensor_f32((uint64_t[]){OP_SIZE}, 1, backward);
+        tensor_f32_fill(s.bias, 0.0f);
+        items = 2.0 * OP_SIZE * OP_SIZE * BATCH_SIZE;
+        unit = "flops";
+      }
+      snprintf(name, sizeof(name), "op/%s/%s", op_kind_name(kind),
+               backward == CBOOL_TRUE ? "forward_backward" : "forward");
+      bench_run(bench, name, unit, items, op_step, &s);
+      free_tensor_f32(s.a);
+      free_tensor_f32(s.b);
+      free_tensor_f32(s.bias);
+    }
+  }
+}
+
+// The CNN demo's second convolution ([16, 8, 3, 3] over 8 x 14 x 14
+// images, padded) and the pooling of its output
+
+static tensor_f32_t *new_random_nchw(uint64_t channels, uint64_t side,
+                                     cbool_t require_grad) {
+  tensor_f32_t *t = new_tensor_f32(
+      (uint64_t[]){BATCH_SIZE, channels, side, side}, 4, require_grad);
+  tensor_f32_rand(t, NULL, -1.0f, 1.0f);
+  return t;
+}
+
+static void bench_conv(bench_t *bench) {
+  const op_kind_t kinds[] = {OP_CONV2D, OP_MAX_POOL};
+  char name[96];
+  for (size_t i = 0; i < sizeof(kinds) / sizeof(op_kind_t); i++) {
+    for (int pass = 0; pass < 2; pass++) {
+      cbool_t backward = pass == 1 ? CBOOL_TRUE : CBOOL_FALSE;
+      op_state_t s = {kinds[i], NULL, NULL, NULL, backward};
+      double items;
+      const char *unit;
+      if (kinds[i] == OP_CONV2D) {
+        s.a = new_tensor_f32((uint64_t[]){16, 8, 3, 3}, 4, backward);
+        tensor_f32_randn(s.a, NULL, 0.0f, 0.1f);
+        s.b = new_random_nchw(8, 14, backward);
+        s.bias = new_tensor_f32((uint64_t[]){16}, 1, backward);
+        tensor_f32_fill(s.bias, 0.0f);
+        items = 2.0 * BATCH_SIZE * 16 * 14 * 14 * 8 * 3 * 3;
+        unit = "flops";
+      } else {
+        s.a = new_random_nchw(16, 14, backward);
+        items = (double)s.a->meta.capacity;
+        unit = "elements";
+      }
+      snprintf(name, sizeof(name), "op/%s/%s", op_kind_name(kinds[i]),
+               backward == CBOOL_TRUE ? "forward_backward" : "forward");
+      bench_run(bench, name, unit, items, op_step, &s);
+      free_tensor_f32(s.a);
+      free_tensor_f32(s.b);
+      free_tensor_f32(s.bias);
+    }
+  }
+}
+
+// sgemm at the demo's layer shapes, on each backend
+
+typedef struct {
+  sgemm_trans_t trans_a, trans_b;
+  uint64_t m, n, k;
+  float *a, *b, *c;
+} gemm_state_t;
+
+static void gemm_step(void *state) {
+  gemm_state_t *s = (gemm_state_t *)state;
+  sgemm(s->trans_a, s->trans_b, s->m, s->n, s->k, 1.0f, s->a,
+        s->trans_a == SGEMM_TRANS ? s->m : s->k, s->b,
+        s->trans_b == SGEMM_TRANS ? s->k : s->n, 0.0f, s->c, s->n);
+}
+
+static void bench_sgemm(bench_t *bench) {
+  // For each layer of 784-128-64-10: the forward product (out x in times
+  // in x batch), the weight gradient (dz times x^T) and the input
+  // gradient (w^T times dz).
+  uint64_t layers[][2] = {{784, 128}, {128, 64}, {64, 10}};
+  const char *backends[] = {"auto", "builtin", "blas"};
+  sgemm_backend_t saved = sgemm_get_backend();
+  char name[96];
+  rng_t rng = rng_init(0, 0);
+  for (size_t l = 0; l < sizeof(layers) / sizeof(layers[0]); l++) {
+    uint64_t in = layers[l][0], out = layers[l][1];
+    gemm_state_t shapes[] = {
+        {SGEMM_NO_TRANS, SGEMM_NO_TRANS, out, BATCH_SIZE, in, NULL, NULL, NULL},
+        {SGEMM_NO_TRANS, SGEMM_TRANS, out, in, BATCH_SIZE, NULL, NULL, NULL},
+        {SGEMM_TRANS, SGEMM_NO_TRANS, in, BATCH_SIZE, out, NULL, NULL, NULL}};
+    for (size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+      gemm_state_t s = shapes[i];
+      s.a = (float *)malloc(sizeof(float) * s.m * s.k);
+      s.b = (float *)malloc(sizeof(float) * s.k * s.n);
+      s.c = (float *)malloc(sizeof(float) * s.m * s.n);
+      if (s.a == NULL || s.b == NULL || s.c == NULL) {
+        raise_error(NullPointer, "malloc failed to allocate sgemm operands");
+      }
+      rng_uniform(&rng, s.a, s.m * s.k, -1.0f, 1.0f);
+      rng_uniform(&rng, s.b, s.k * s.n, -1.0f, 1.0f);
+      for (int backend = SGEMM_AUTO; backend <= SGEMM_BLAS; backend++) {
+        if (backend == SGEMM_BLAS && sgemm_has_blas() != CBOOL_TRUE) {
+          continue;
+        }
+        sgemm_set_backend((sgemm_backend_t)backend);
+        snprintf(name, sizeof(name), "sgemm/%s/%s%s/%llux%llux%llu",
+                 backends[backend], s.trans_a == SGEMM_TRANS ? "t" : "n",
+                 s.trans_b == SGEMM_TRANS ? "t" : "n", (unsigned long long)s.m,
+                 (unsigned long long)s.n, (unsigned long long)s.k);
+        bench_run(bench, name, "flops", 2.0 * s.m * s.n * s.k, gemm_step, &s);
+      }
+      free(s.a);
+      free(s.b);
+      free(s.c);
+    }
+  }
+  sgemm_set_backend(saved);
+}
+
+// Optimizers
+
+typedef struct {
+  optimizer_t *optimizer;
+  linear_layer_t *layer;
+} optimizer_state_t;
+
+static void optimizer_step(void *state) {
+  optimizer_state_t *s = (optimizer_state_t *)state;
+  optimizer_update(s->optimizer, s->layer, 0.001f);
+}
+
+static void bench_optimizers(bench_t *bench) {
+  const char *names[] = {"adam", "adamw", "sgd"};
+  char name[96];
+  for (int i = 0; i < 3; i++) {
+    linear_layer_t *layer = new_linear_layer(784, 128, CBOOL_TRUE);
+    uint64_t params =
+        layer->weight->meta.capacity + layer->bias->meta.capacity;
+    optimizer_state_t s = {NULL, layer};
+    if (i == 0) {
+      s.optimizer = new_adam_optimizer(params);
+    } else if (i == 1) {
+      s.optimizer = new_adamw_optimizer(params, 0.01f);
+    } else {
+      s.optimizer = new_sgd_optimizer(params, 0.9f);
+    }
+    snprintf(name, sizeof(name), "optimizer/%s/784x128", names[i]);
+    bench_run(bench, name, "params", (double)params, optimizer_step, &s);
+    free_optimizer(s.optimizer);
+    free_linear_layer(layer);
+  }
+}
+
+// Losses
+
+typedef struct {
+  tensor_f32_t *logits;
+  tensor_f32_t *onehot;
+  uint32_t labels[BATCH_SIZE];
+  cbool_t fused;
+} loss_state_t;
+
+static void loss_step(void *state) {
+  loss_state_t *s = (loss_state_t *)state;
+  tensor_f32_t *loss;
+  if (s->fused == CBOOL_TRUE) {
+    loss = softmax_crossentropy(s->logits, s->labels);
+  } else {
+    loss = new_tensor_f32((uint64_t[]){1}, 1, CBOOL_TRUE);
+    crossentropy_forward(loss, s->logits, s->onehot);
+  }
+  backward(loss);
+  free_tensor_f32(loss);
+}
+
+static void bench_losses(bench_t *bench) {
+  loss_state_t s;
+  s.logits = new_random(MNIST_NUM_CLASSES, BATCH_SIZE, -4.0f, CBOOL_TRUE);
+  s.onehot = new_tensor_f32((uint64_t[]){MNIST_NUM_CLASSES, BATCH_SIZE}, 2,
+                            CBOOL_FALSE);
+  tensor_f32_fill(s.onehot, 0.0f);
+  for (uint64_t c = 0; c < BATCH_SIZE; c++) {
+    s.labels[c] = (uint32_t)(c % MNIST_NUM_CLASSES);
+    s.onehot->data[s.labels[c] * BATCH_SIZE + c] = 1.0f;
+  }
+  s.fused = CBOOL_FALSE;
+  bench_run(bench, "loss/crossentropy_forward", "samples", BATCH_SIZE,
+            loss_step, &s);
+  s.fused = CBOOL_TRUE;
+  bench_run(bench, "loss/softmax_crossentropy", "samples", BATCH_SIZE,
+            loss_step, &s);
+  free_tensor_f32(s.logits);
+  free_tensor_f32(s.onehot);
+}
+
+// Data
+
+typedef struct {
+  const char *images;
+  const char *labels;
+  uint64_t num_items;
+} dataset_paths_t;
+
+static void load_step(void *state) {
+  dataset_paths_t *s = (dataset_paths_t *)state;
+  free_mnist_dataset(load_mnist_dataset(s->images, s->labels));
+}
+
+static void write_be32(FILE *f, uint32_t v) {
+  uint8_t bytes[4] = {(uint8_t)(v >> 24), (uint8_t)(v >> 16),
+                      (uint8_t)(v >> 8), (uint8_t)v};
+  fwrite(bytes, 1, 4, f);
+}
+
+// IDX files of random images and labels, for machines without MNIST.
+static void write_synthetic(const char *images, const char *labels) {
+  FILE *fi = fopen(images, "wb");
+  FILE *fl = fopen(labels, "wb");
+  if (fi == NULL || fl == NULL) {
+    raise_error(RuntimeError, "could not write synthetic MNIST files");
+  }
+  write_be32(fi, 0x00000803);
+  write_be32(fi, SYNTHETIC_ITEMS);
+  write_be32(fi, IMAGE_SIDE);
+  write_be32(fi, IMAGE_SIDE);
+  write_be32(fl, 0x00000801);
+  write_be32(fl, SYNTHETIC_ITEMS);
+  rng_t rng = rng_init(0, 0);
+  uint8_t pixels[IMAGE_SIDE * IMAGE_SIDE];
+  for (uint64_t i = 0; i < SYNTHETIC_ITEMS; i++) {
+    for (uint64_t p = 0; p < sizeof(pixels); p++) {
+      pixels[p] = (uint8_t)rng_below(&rng, 256);
+    }
+    uint8_t label = (uint8_t)rng_below(&rng, MNIST_NUM_CLASSES);
+    fwrite(pixels, 1, sizeof(pixels), fi);
+    fwrite(&label, 1, 1, fl);
+  }
+  fclose(fi);
+  fclose(fl);
+}
+
+// Training and inference steps of the demo's 784-128-64-10 network
+
+typedef struct {
+  mnist_dataset_t *dataset;
+  linear_layer_t *layers[3];
+  optimizer_t *optimizers[3];
+  data_parallel_t *trainer;
+  sequence_t *model;
+  sequence_plan_t *plan;
+  tensor_f32_t *images;
+  uint32_t labels[BATCH_SIZE];
+  uint64_t cursor;
+} train_state_t;
+
+static void next_batch(train_state_t *s) {
+  if (s->cursor + BATCH_SIZE > s->dataset->num_items) {
+    s->cursor = 0;
+  }
+  mnist_gather_batch(s->dataset, s->cursor, BATCH_SIZE, s->images, s->labels);
+  s->cursor += BATCH_SIZE;
+}
+
+static void update(train_state_t *s) {
+  for (int l = 0; l < 3; l++) {
+    optimizer_update(s->optimizers[l], s->layers[l], 0.001f);
+  }
+}
+
+static void train_dynamic_step(void *state) {
+  train_state_t *s = (train_state_t *)state;
+  next_batch(s);
+  data_parallel_step(s->trainer, s->images, s->labels);
+  update(s);
+}
+
+static void train_plan_step(void *state) {
+  train_state_t *s = (train_state_t *)state;
+  next_batch(s);
+  tensor_f32_t *logits = sequence_plan_forward(s->plan, s->images);
+  crossentropy_loss_grad(logits, s->labels, s->plan->output_grad);
+  sequence_plan_backward(s->plan);
+  update(s);
+}
+
+static void infer_step(void *state) {
+  train_state_t *s = (train_state_t *)state;
+  next_batch(s);
+  tensor_no_grad_enter();
+  tensor_f32_t *act1 = linear_layer_forward_act(s->layers[0], s->images,
+                                                ACTIVATION_LEAKY_RELU);
+  tensor_f32_t *act2 =
+      linear_layer_forward_act(s->layers[1], act1, ACTIVATION_LEAKY_RELU);
+  tensor_f32_t *logits = linear_layer_forward(s->layers[2], act2);
+  free_tensor_f32(act1);
+  free_tensor_f32(act2);
+  free_tensor_f32(logits);
+  tensor_no_grad_exit();
+}
+
+static void bench_training(bench_t *bench, mnist_dataset_t *dataset) {
+  train_state_t s = {.dataset = dataset, .cursor = 0};
+  uint64_t sizes[] = {784, 128, 64, 10};
+  for (int l = 0; l < 3; l++) {
+    s.layers[l] = new_linear_layer(sizes[l], sizes[l + 1], CBOOL_TRUE);
+    s.optimizers[l] = new_adam_optimizer(s.layers[l]->weight->meta.capacity +
+                                         s.layers[l]->bias->meta.capacity);
+  }
+  s.images = new_tensor_f32((uint64_t[]){dataset->image_size, BATCH_SIZE}, 2,
+                            CBOOL_FALSE);
+  s.trainer = new_data_parallel(s.layers, 3, ACTIVATION_LEAKY_RELU, 1);
+  s.model = new_sequence();
+  sequence_add(s.model, new_linear_module(s.layers[0], ACTIVATION_LEAKY_RELU));
+  sequence_add(s.model, new_linear_module(s.layers[1], ACTIVATION_LEAKY_RELU));
+  sequence_add(s.model, new_linear_module(s.layers[2], ACTIVATION_NONE));
+  s.plan = sequence_compile(s.model, dataset->image_size, BATCH_SIZE,
+                            CBOOL_TRUE);
+
+  bench_run(bench, "train/dynamic", "samples", BATCH_SIZE, train_dynamic_step,
+            &s);
+  bench_run(bench, "train/plan", "samples", BATCH_SIZE, train_plan_step, &s);
+  bench_run(bench, "infer/dynamic", "samples", BATCH_SIZE, infer_step, &s);
+
+  free_sequence_plan(s.plan);
+  free_sequence(s.model);
+  free_data_parallel(s.trainer);
+  free_tensor_f32(s.images);
+  for (int l = 0; l < 3; l++) {
+    free_optimizer(s.optimizers[l]);
+    free_linear_layer(s.layers[l]);
+  }
+}
+
+// A training step of the demo's CNN: two padded 3x3 convolutions (8 and 16
+// channels), each followed by 2x2 max pooling, and a linear classifier
+
+typedef struct {
+  mnist_dataset_t *dataset;
+  conv2d_layer_t *conv[2];
+  linear_layer_t *fc;
+  linear_layer_t *params[3];
+  optimizer_t *optimizers[3];
+  tensor_f32_t *images;
+  uint32_t labels[BATCH_SIZE];
+  uint64_t cursor;
+} cnn_state_t;
+
+static void train_cnn_step(void *state) {
+  cnn_state_t *s = (cnn_state_t *)state;
+  if (s->cursor + BATCH_SIZE > s->dataset->num_items) {
+    s->cursor = 0;
+  }
+  mnist_gather_batch(s->dataset, s->cursor, BATCH_SIZE, s->images, s->labels);
+  s->cursor += BATCH_SIZE;
+
+  tensor_f32_t *x = tensor_f32_to_nchw(s->images, 1, IMAGE_SIDE, IMAGE_SIDE);
+  for (int l = 0; l < 2; l++) {
+    tensor_f32_t *conv =
+        conv2d_layer_forward_act(s->conv[l], x, ACTIVATION_LEAKY_RELU);
+    free_tensor_f32(x);
+    x = tensor_f32_max_pool2d(conv, 2, 2);
+    free_tensor_f32(conv);
+  }
+  tensor_f32_t *features = tensor_f32_to_columns(x);
+  tensor_f32_t *logits = linear_layer_forward(s->fc, features);
+  tensor_f32_t *loss = softmax_crossentropy(logits, s->labels);
+  backward(loss);
+  free_tensor_f32(x);
+  free_tensor_f32(features);
+  free_tensor_f32(logits);
+  free_tensor_f32(loss);
+  for (int l = 0; l < 3; l++) {
+    optimizer_update(s->optimizers[l], s->params[l], 0.001f);
+  }
+}
+
+static void bench_cnn(bench_t *bench, mnist_dataset_t *dataset) {
+  cnn_state_t s = {.dataset = dataset, .cursor = 0};
+  s.conv[0] = new_conv2d_layer(1, 8, 3, 1, 1, CBOOL_TRUE);
+  s.conv[1] = new_conv2d_layer(8, 16, 3, 1, 1, CBOOL_TRUE);
+  s.fc = new_linear_layer(16 * 7 * 7, MNIST_NUM_CLASSES, CBOOL_TRUE);
+  s.params[0] = &s.conv[0]->params;
+  s.params[1] = &s.conv[1]->params;
+  s.params[2] = s.fc;
+  for (int l = 0; l < 3; l++) {
+    s.optimizers[l] = new_adam_optimizer(s.params[l]->weight->meta.capacity +
+                                         s.params[l]->bias->meta.capacity);
+  }
+  s.images = new_tensor_f32((uint64_t[]){dataset->image_size, BATCH_SIZE}, 2,
+                            CBOOL_FALSE);
+
+  bench_run(bench, "train/cnn", "samples", BATCH_SIZE, train_cnn_step, &s);
+
+  free_tensor_f32(s.images);
+  for (int l = 0; l < 3; l++) {
+    free_optimizer(s.optimizers[l]);
+  }
+  free_conv2d_layer(s.conv[0]);
+  free_conv2d_layer(s.conv[1]);
+  free_linear_layer(s.fc);
+}
+
+int main(int argc, char **argv) {
+  bench_t bench = {stdout, NULL, DEFAULT_MIN_SECONDS, 0};
+  const char *data_dir = DEFAULT_DATA_DIR;
+  const char *out_path = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      bench.filter = argv[++i];
+    } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+      bench.min_seconds = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--data") == 0 && i + 1 < argc) {
+      data_dir = argv[++i];
+    } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+      out_path = argv[++i];
+    } else {
+      usage(argv[0]);
+    }
+  }
+  if (out_path != NULL) {
+    bench.out = fopen(out_path, "w");
+    if (bench.out == NULL) {
+      raise_error(RuntimeError, "could not open the output file");
+    }
+  }
+  rng_set_seed(0);
+
+  // MNIST from `data_dir`, or synthetic files in a temporary directory
+  char images[4096];
+  char labels[4096];
+  char synthetic_dir[] = "/tmp/much_bench.XXXXXX";
+  snprintf(images, sizeof(images), "%s/train-images-idx3-ubyte", data_dir);
+  snprintf(labels, sizeof(labels), "%s/train-labels-idx1-ubyte", data_dir);
+  cbool_t synthetic = access(images, R_OK) != 0 || access(labels, R_OK) != 0
+                          ? CBOOL_TRUE
+                          : CBOOL_FALSE;
+  if (synthetic == CBOOL_TRUE) {
+    if (mkdtemp(synthetic_dir) == NULL) {
+      raise_error(RuntimeError, "could not create a temporary directory");
+    }
+    snprintf(images, sizeof(images), "%s/images", synthetic_dir);
+    snprintf(labels, sizeof(labels), "%s/labels", synthetic_dir);
+    write_synthetic(images, labels);
+  }
+  mnist_dataset_t *dataset = load_mnist_dataset(images, labels);
+
+  fprintf(bench.out,
+          "{\n  \"simd\": \"%s\",\n  \"sgemm_kernel\": \"%s\",\n"
+          "  \"blas\": %s,\n  \"threads\": %llu,\n"
+          "  \"data\": \"%s\",\n  \"batch_size\": %d,\n  \"results\": [",
+          get_kernels()->name, sgemm_kernel_name(),
+          sgemm_has_blas() == CBOOL_TRUE ? "true" : "false",
+          (unsigned long long)parallel_get_num_threads(),
+          synthetic == CBOOL_TRUE ? "synthetic" : data_dir, BATCH_SIZE);
+
+  bench_ops(&bench);
+  bench_conv(&bench);
+  bench_sgemm(&bench);
+  bench_optimizers(&bench);
+  bench_losses(&bench);
+  dataset_paths_t paths = {images, labels, dataset->num_items};
+  bench_run(&bench, "data/load_mnist_dataset", "items",
+            (double)paths.num_items, load_step, &paths);
+  bench_training(&bench, dataset);
+  bench_cnn(&bench, dataset);
+
+  fprintf(bench.out, "\n  ]\n}\n");
+  if (out_path != NULL) {
+    fclose(bench.out);
+  }
+
+  free_mnist_dataset(dataset);
+  if (synthetic == CBOOL_TRUE) {
+    unlink(images);
+    unlink(labels);
+    rmdir(synthetic_dir);
+  }
+  return 0;
+}
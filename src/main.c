@@ -1,10 +1,20 @@
+#include "much/arena.h"
 #include "much/argmax.h"
+#include "much/checkpoint.h"
+#include "much/conv.h"
 #include "much/crossentropy.h"
+#include "much/data_parallel.h"
+#include "much/dataloader.h"
 #include "much/layer.h"
 #include "much/mnist.h"
 #include "much/optimizer.h"
+#include "much/quantize.h"
+#include "much/sequence.h"
 #include "much/tensor.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #define MNIST_DATA_DIR "data"
 #define MNIST_FILE(name) MNIST_DATA_DIR "/" name
@@ -13,132 +23,485 @@
 #define TRAIN_LABELS MNIST_FILE("train-labels-idx1-ubyte")
 #define TEST_IMAGES MNIST_FILE("t10k-images-idx3-ubyte")
 #define TEST_LABELS MNIST_FILE("t10k-labels-idx1-ubyte")
-#define WEIGHTS_FILE MNIST_FILE("weights.bin")
-void zero_grad(linear_layer_t *layer) {
-  for (uint64_t i = 0; i < layer->weight->meta.capacity; i++) {
-    layer->weight->grad[i] = 0.0f;
+#define CHECKPOINT_FILE MNIST_FILE("checkpoint.bin")
+#define DEFAULT_BATCH_SIZE 64
+#define STEP_ARENA_SIZE (4 << 20)
+#define CALIBRATION_ITEMS 1024
+// Op calls kept for --trace; later ones are counted but dropped.
+#define TRACE_EVENTS (1 << 18)
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [--model mlp|cnn] [--batch-size N] "
+          "[--optimizer adam|adamw|sgd] "
+          "[--seed N] [--workers N] [--epochs N] [--checkpoint PATH] [--resume] "
+          "[--quantize] [--dtype f32|bf16|f16] [--plan] [--profile] "
+          "[--trace PATH]\n",
+          prog);
+  exit(ValueError);
+}
+
+static optimizer_t *new_layer_optimizer(const char *name,
+                                        linear_layer_t *layer) {
+  uint64_t num_params =
+      layer->weight->meta.capacity + layer->bias->meta.capacity;
+  if (strcmp(name, "adamw") == 0) {
+    return new_adamw_optimizer(num_params, 0.01f);
+  }
+  if (strcmp(name, "sgd") == 0) {
+    return new_sgd_optimizer(num_params, 0.9f);
+  }
+  return new_adam_optimizer(num_params);
+}
+
+// Snapshots the model and optimizer state and writes it in the background;
+// the previous save, if any, is finished first.
+static void save_checkpoint(checkpoint_writer_t *writer, const char *path,
+                            int64_t next_epoch, linear_layer_t **layers,
+                            optimizer_t **optimizers, int num_layers) {
+  if (checkpoint_wait(writer) != CBOOL_TRUE) {
+    fprintf(stderr, "Warning: failed to write checkpoint %s\n", path);
+  }
+  checkpoint_writer_clear(writer);
+  checkpoint_add_i64(writer, "epoch", next_epoch);
+  char prefix[32];
+  for (int i = 0; i < num_layers; i++) {
+    snprintf(prefix, sizeof(prefix), "layer%d", i + 1);
+    checkpoint_add_layer(writer, prefix, layers[i]);
+    snprintf(prefix, sizeof(prefix), "layer%d.optimizer", i + 1);
+    checkpoint_add_optimizer(writer, prefix, optimizers[i]);
+  }
+  checkpoint_save_async(writer, path);
+}
+
+static int64_t load_checkpoint(const char *path, linear_layer_t **layers,
+                               optimizer_t **optimizers, int num_layers) {
+  checkpoint_t *checkpoint = checkpoint_open(path);
+  char prefix[32];
+  for (int i = 0; i < num_layers; i++) {
+    snprintf(prefix, sizeof(prefix), "layer%d", i + 1);
+    checkpoint_load_layer(checkpoint, prefix, layers[i]);
+    snprintf(prefix, sizeof(prefix), "layer%d.optimizer", i + 1);
+    checkpoint_load_optimizer(checkpoint, prefix, optimizers[i]);
+  }
+  int64_t next_epoch = checkpoint_get_i64(checkpoint, "epoch");
+  checkpoint_close(checkpoint);
+  return next_epoch;
+}
+
+static double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Logits [10, batch] for a batch of images [784, batch].
+typedef tensor_f32_t *(*model_forward_fn)(void *model, tensor_f32_t *images);
+
+static tensor_f32_t *float_forward(void *model, tensor_f32_t *images) {
+  linear_layer_t **layers = (linear_layer_t **)model;
+  tensor_f32_t *act1 =
+      linear_layer_forward_act(layers[0], images, ACTIVATION_LEAKY_RELU);
+  tensor_f32_t *act2 =
+      linear_layer_forward_act(layers[1], act1, ACTIVATION_LEAKY_RELU);
+  tensor_f32_t *logits = linear_layer_forward(layers[2], act2);
+  // Reduced-precision layers produce 16-bit logits
+  if (logits->meta.dtype != DTYPE_F32) {
+    tensor_f32_t *narrow = logits;
+    logits = tensor_f32_cast(narrow, DTYPE_F32);
+    free_tensor_f32(narrow);
+  }
+  return logits;
+}
+
+// Two 3x3 convolutions, each followed by 2x2 max pooling, and a linear
+// classifier over the 16 resulting 7x7 feature maps.
+typedef struct {
+  conv2d_layer_t *conv1;
+  conv2d_layer_t *conv2;
+  linear_layer_t *fc;
+} cnn_t;
+
+static tensor_f32_t *cnn_forward(void *model, tensor_f32_t *images) {
+  cnn_t *cnn = (cnn_t *)model;
+  tensor_f32_t *x = tensor_f32_to_nchw(images, 1, 28, 28);
+  tensor_f32_t *conv1 =
+      conv2d_layer_forward_act(cnn->conv1, x, ACTIVATION_LEAKY_RELU);
+  tensor_f32_t *pool1 = tensor_f32_max_pool2d(conv1, 2, 2);
+  tensor_f32_t *conv2 =
+      conv2d_layer_forward_act(cnn->conv2, pool1, ACTIVATION_LEAKY_RELU);
+  tensor_f32_t *pool2 = tensor_f32_max_pool2d(conv2, 2, 2);
+  tensor_f32_t *features = tensor_f32_to_columns(pool2);
+  tensor_f32_t *logits = linear_layer_forward(cnn->fc, features);
+  free_tensor_f32(x);
+  free_tensor_f32(conv1);
+  free_tensor_f32(pool1);
+  free_tensor_f32(conv2);
+  free_tensor_f32(pool2);
+  free_tensor_f32(features);
+  return logits;
+}
+
+// One forward and backward pass of the CNN with every intermediate in
+// `arena`; returns the batch's mean loss.
+static float cnn_step(cnn_t *cnn, tensor_f32_t *images, const uint32_t *labels,
+                      arena_t *arena) {
+  tensor_set_arena(arena);
+  tensor_f32_t *logits = cnn_forward(cnn, images);
+  tensor_f32_t *loss = softmax_crossentropy(logits, labels);
+  backward(loss);
+  float ret = loss->data[0];
+  tensor_set_arena(NULL);
+  arena_reset(arena);
+  return ret;
+}
+
+static tensor_f32_t *quantized_forward(void *model, tensor_f32_t *images) {
+  quantized_linear_layer_t **layers = (quantized_linear_layer_t **)model;
+  tensor_f32_t *act1 =
+      quantized_linear_forward(layers[0], images, ACTIVATION_LEAKY_RELU);
+  tensor_f32_t *act2 =
+      quantized_linear_forward(layers[1], act1, ACTIVATION_LEAKY_RELU);
+  return quantized_linear_forward(layers[2], act2, ACTIVATION_NONE);
+}
+
+// Returns the accuracy over `dataset` and the time spent in `seconds`.
+static float evaluate(model_forward_fn forward, void *model,
+                      mnist_dataset_t *dataset, uint64_t batch_size,
+                      arena_t *arena, double *seconds) {
+  // Evaluation needs no gradients or graph
+  tensor_no_grad_enter();
+  double start = now_seconds();
+  uint64_t correct = 0;
+  for (uint64_t i = 0; i < dataset->num_items; i += batch_size) {
+    uint64_t n = dataset->num_items - i;
+    if (n > batch_size) {
+      n = batch_size;
+    }
+
+    tensor_set_arena(arena);
+    tensor_f32_t *images =
+        new_tensor_f32((uint64_t[]){dataset->image_size, n}, 2, CBOOL_FALSE);
+    mnist_gather_batch(dataset, i, n, images, NULL);
+    tensor_f32_t *logits = forward(model, images);
+
+    for (uint64_t b = 0; b < n; b++) {
+      if (argmax_stride(logits->data + b, MNIST_NUM_CLASSES, n) ==
+          dataset->labels[i + b]) {
+        correct++;
+      }
+    }
+
+    tensor_set_arena(NULL);
+    arena_reset(arena);
+  }
+  *seconds = now_seconds() - start;
+  tensor_no_grad_exit();
+  return (float)correct / dataset->num_items * 100.0f;
+}
+
+// Records the float model's activation ranges on a slice of the training
+// set and fixes each quantized layer's input scale from them.
+static void calibrate(quantized_linear_layer_t **qlayers,
+                      linear_layer_t **layers, mnist_dataset_t *dataset,
+                      uint64_t batch_size, arena_t *arena) {
+  uint64_t items = dataset->num_items < CALIBRATION_ITEMS ? dataset->num_items
+                                                          : CALIBRATION_ITEMS;
+  tensor_no_grad_enter();
+  for (uint64_t i = 0; i < items; i += batch_size) {
+    uint64_t n = items - i < batch_size ? items - i : batch_size;
+    tensor_set_arena(arena);
+    tensor_f32_t *images =
+        new_tensor_f32((uint64_t[]){dataset->image_size, n}, 2, CBOOL_FALSE);
+    mnist_gather_batch(dataset, i, n, images, NULL);
+    quantized_linear_observe(qlayers[0], images);
+    tensor_f32_t *act1 =
+        linear_layer_forward_act(layers[0], images, ACTIVATION_LEAKY_RELU);
+    quantized_linear_observe(qlayers[1], act1);
+    tensor_f32_t *act2 =
+        linear_layer_forward_act(layers[1], act1, ACTIVATION_LEAKY_RELU);
+    quantized_linear_observe(qlayers[2], act2);
+    tensor_set_arena(NULL);
+    arena_reset(arena);
   }
-  for (uint64_t i = 0; i < layer->bias->meta.capacity; i++) {
-    layer->bias->grad[i] = 0.0f;
+  tensor_no_grad_exit();
+  for (int l = 0; l < 3; l++) {
+    quantized_linear_calibrate(qlayers[l]);
   }
 }
 
-int main() {
+int main(int argc, char **argv) {
+  cbool_t use_cnn = CBOOL_FALSE;
+  uint64_t batch_size = DEFAULT_BATCH_SIZE;
+  const char *optimizer_name = "adam";
+  uint64_t seed = 0;
+  uint64_t num_workers = 1;
+  int epochs = 10;
+  const char *checkpoint_path = CHECKPOINT_FILE;
+  cbool_t resume = CBOOL_FALSE;
+  cbool_t quantize = CBOOL_FALSE;
+  dtype_t dtype = DTYPE_F32;
+  cbool_t planned = CBOOL_FALSE;
+  cbool_t profile = CBOOL_FALSE;
+  const char *trace_path = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--model") == 0 && i + 1 < argc) {
+      const char *name = argv[++i];
+      if (strcmp(name, "cnn") == 0) {
+        use_cnn = CBOOL_TRUE;
+      } else if (strcmp(name, "mlp") != 0) {
+        usage(argv[0]);
+      }
+    } else if (strcmp(argv[i], "--batch-size") == 0 && i + 1 < argc) {
+      batch_size = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--optimizer") == 0 && i + 1 < argc) {
+      optimizer_name = argv[++i];
+      if (strcmp(optimizer_name, "adam") != 0 &&
+          strcmp(optimizer_name, "adamw") != 0 &&
+          strcmp(optimizer_name, "sgd") != 0) {
+        usage(argv[0]);
+      }
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      seed = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+      num_workers = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--epochs") == 0 && i + 1 < argc) {
+      epochs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+      checkpoint_path = argv[++i];
+    } else if (strcmp(argv[i], "--resume") == 0) {
+      resume = CBOOL_TRUE;
+    } else if (strcmp(argv[i], "--quantize") == 0) {
+      quantize = CBOOL_TRUE;
+    } else if (strcmp(argv[i], "--plan") == 0) {
+      planned = CBOOL_TRUE;
+    } else if (strcmp(argv[i], "--profile") == 0) {
+      profile = CBOOL_TRUE;
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      trace_path = argv[++i];
+      profile = CBOOL_TRUE;
+    } else if (strcmp(argv[i], "--dtype") == 0 && i + 1 < argc) {
+      const char *name = argv[++i];
+      if (strcmp(name, "f32") == 0) {
+        dtype = DTYPE_F32;
+      } else if (strcmp(name, "bf16") == 0) {
+        dtype = DTYPE_BF16;
+      } else if (strcmp(name, "f16") == 0) {
+        dtype = DTYPE_F16;
+      } else {
+        usage(argv[0]);
+      }
+    } else {
+      usage(argv[0]);
+    }
+  }
+  if (batch_size == 0 || num_workers == 0) {
+    usage(argv[0]);
+  }
+  if (planned == CBOOL_TRUE && (num_workers != 1 || dtype != DTYPE_F32)) {
+    fprintf(stderr, "--plan trains float layers on one worker\n");
+    usage(argv[0]);
+  }
+  if (use_cnn == CBOOL_TRUE &&
+      (planned == CBOOL_TRUE || num_workers != 1 || dtype != DTYPE_F32 ||
+       quantize == CBOOL_TRUE)) {
+    fprintf(stderr, "--model cnn trains float layers on one worker\n");
+    usage(argv[0]);
+  }
+
   // Load the MNIST dataset
   mnist_dataset_t *train_dataset =
       load_mnist_dataset(TRAIN_IMAGES, TRAIN_LABELS);
   mnist_dataset_t *test_dataset = load_mnist_dataset(TEST_IMAGES, TEST_LABELS);
 
-  // Create a 3-layer neural network
-  linear_layer_t *layer1 = new_linear_layer(784, 128, CBOOL_TRUE);
-  linear_layer_t *layer2 = new_linear_layer(128, 64, CBOOL_TRUE);
-  linear_layer_t *layer3 = new_linear_layer(64, 10, CBOOL_TRUE);
+  // Create a 3-layer neural network; its parameters are stored as `dtype`
+  // while the optimizers keep float master copies. The seed fixes both the
+  // initial weights and the data order. The CNN's convolutions keep their
+  // parameters in linear layers too, so the optimizers and checkpoints
+  // below treat both models alike.
+  rng_set_seed(seed);
+  linear_layer_t *layers[3];
+  cnn_t cnn = {NULL, NULL, NULL};
+  if (use_cnn == CBOOL_TRUE) {
+    cnn.conv1 = new_conv2d_layer(1, 8, 3, 1, 1, CBOOL_TRUE);
+    cnn.conv2 = new_conv2d_layer(8, 16, 3, 1, 1, CBOOL_TRUE);
+    cnn.fc = new_linear_layer(16 * 7 * 7, 10, CBOOL_TRUE);
+    layers[0] = &cnn.conv1->params;
+    layers[1] = &cnn.conv2->params;
+    layers[2] = cnn.fc;
+  } else {
+    layers[0] = new_linear_layer_dtype(784, 128, CBOOL_TRUE, dtype);
+    layers[1] = new_linear_layer_dtype(128, 64, CBOOL_TRUE, dtype);
+    layers[2] = new_linear_layer_dtype(64, 10, CBOOL_TRUE, dtype);
+  }
   // Create optimizers
-  adam_optimizer_t *optimizer1 = new_adam_optimizer(
-      layer1->weight->meta.capacity + layer1->bias->meta.capacity);
-  adam_optimizer_t *optimizer2 = new_adam_optimizer(
-      layer2->weight->meta.capacity + layer2->bias->meta.capacity);
-  adam_optimizer_t *optimizer3 = new_adam_optimizer(
-      layer3->weight->meta.capacity + layer3->bias->meta.capacity);
+  optimizer_t *optimizers[3];
+  for (int l = 0; l < 3; l++) {
+    optimizers[l] = new_layer_optimizer(optimizer_name, layers[l]);
+  }
+
+  // Continue from the last completed epoch of a previous run
+  int start_epoch = 0;
+  if (resume == CBOOL_TRUE) {
+    start_epoch =
+        (int)load_checkpoint(checkpoint_path, layers, optimizers, 3);
+    printf("Resumed from %s at epoch %d\n", checkpoint_path, start_epoch);
+  }
+  checkpoint_writer_t *checkpoint_writer = new_checkpoint_writer();
+
+  // Each batch is split across the workers, whose gradients are summed
+  // into the layers above
+  data_parallel_t *trainer =
+      use_cnn == CBOOL_TRUE
+          ? NULL
+          : new_data_parallel(layers, 3, ACTIVATION_LEAKY_RELU, num_workers);
+
+  // Or the same network compiled once for the batch size, which replays
+  // without building a graph or allocating
+  sequence_t *model = NULL;
+  sequence_plan_t *plan = NULL;
+  if (planned == CBOOL_TRUE) {
+    model = new_sequence();
+    sequence_add(model, new_linear_module(layers[0], ACTIVATION_LEAKY_RELU));
+    sequence_add(model, new_linear_module(layers[1], ACTIVATION_LEAKY_RELU));
+    sequence_add(model, new_linear_module(layers[2], ACTIVATION_NONE));
+    plan = sequence_compile(model, 784, batch_size, CBOOL_TRUE);
+    printf("Plan workspace: %llu bytes\n",
+           (unsigned long long)plan->workspace_bytes);
+  }
 
   // Training parameters
-  float learning_rate = 0.001f;
-  int epochs = 10;
+  float learning_rate = strcmp(optimizer_name, "sgd") == 0 ? 0.01f : 0.001f;
+
+  // All evaluation tensors, and the CNN's training intermediates, come from
+  // this arena and are released at once
+  arena_t *step_arena = new_arena(STEP_ARENA_SIZE);
+
+  // Batches are shuffled and gathered on a background thread
+  dataloader_t *train_loader =
+      new_dataloader(train_dataset, batch_size, 0, CBOOL_TRUE, seed,
+                     (uint64_t)start_epoch);
 
   // Training loop
-  for (int epoch = 0; epoch < epochs; epoch++) {
+  if (profile == CBOOL_TRUE) {
+    profile_start(trace_path != NULL ? TRACE_EVENTS : 0);
+  }
+  for (int epoch = start_epoch; epoch < epochs; epoch++) {
     float total_loss = 0.0f;
-    for (uint64_t i = 0; i < train_dataset->num_items; i++) {
-      zero_grad(layer1);
-      zero_grad(layer2);
-      zero_grad(layer3);
-
-      // Forward pass
-      tensor_f32_t *out1 =
-          linear_layer_forward(layer1, train_dataset->images[i]);
-      tensor_f32_t *act1 = tensor_f32_relu(out1);
-      tensor_f32_t *out2 = linear_layer_forward(layer2, act1);
-      tensor_f32_t *act2 = tensor_f32_relu(out2);
-      tensor_f32_t *out3 = linear_layer_forward(layer3, act2);
-
-      // Calculate loss
-      tensor_f32_t *loss = new_tensor_f32((uint64_t[]){1}, 1, CBOOL_TRUE);
-      crossentropy_forward(loss, out3, train_dataset->labels[i]);
-      total_loss += loss->data[0];
-
-      // Backward pass
-      backward(loss);
+    uint64_t seen = 0;
+    mnist_batch_t *batch;
+    while ((batch = dataloader_next(train_loader)) != NULL) {
+      uint64_t n = batch->count;
+
+      // Forward and backward pass on every worker
+      if (plan != NULL) {
+        tensor_f32_t *logits = sequence_plan_forward(plan, batch->images);
+        total_loss += crossentropy_loss_grad(logits, batch->labels,
+                                             plan->output_grad) *
+                      n;
+        sequence_plan_backward(plan);
+      } else if (use_cnn == CBOOL_TRUE) {
+        total_loss +=
+            cnn_step(&cnn, batch->images, batch->labels, step_arena) * n;
+      } else {
+        total_loss +=
+            data_parallel_step(trainer, batch->images, batch->labels) * n;
+      }
 
       // Update weights
-      adam_update(optimizer1, layer1, learning_rate);
-      adam_update(optimizer2, layer2, learning_rate);
-      adam_update(optimizer3, layer3, learning_rate);
-
-      free_tensor_f32(out1);
-      free_tensor_f32(act1);
-      free_tensor_f32(out2);
-      free_tensor_f32(act2);
-      free_tensor_f32(out3);
-      free_tensor_f32(loss);
-
-      if (i > 0 && i % 1000 == 0) {
+      for (int l = 0; l < 3; l++) {
+        optimizer_update(optimizers[l], layers[l], learning_rate);
+      }
+      profile_step();
+
+      if (seen / 1000 != (seen + n) / 1000) {
         printf("Epoch %d, item %llu, loss: %.4f\n", epoch,
-               (unsigned long long)i, total_loss / i);
+               (unsigned long long)(seen + n), total_loss / (seen + n));
       }
+      seen += n;
     }
     printf("Epoch %d, final loss: %.4f\n", epoch,
            total_loss / train_dataset->num_items);
+    save_checkpoint(checkpoint_writer, checkpoint_path, epoch + 1, layers,
+                    optimizers, 3);
   }
+  printf("Heap tensor allocations: %llu\n",
+         (unsigned long long)get_tensor_alloc_count());
+  printf("Data loader stall: %.3f s\n", dataloader_stall_seconds(train_loader));
+  if (profile == CBOOL_TRUE) {
+    profile_stop();
+    profile_report(stdout);
+    if (trace_path != NULL && profile_write_trace(trace_path) != CBOOL_TRUE) {
+      fprintf(stderr, "Warning: failed to write trace %s\n", trace_path);
+    }
+    profile_clear();
+  }
+  free_dataloader(train_loader);
+  free_data_parallel(trainer);
+  free_sequence_plan(plan);
+  free_sequence(model);
 
   // Test the model
-  int correct = 0;
-  for (uint64_t i = 0; i < test_dataset->num_items; i++) {
-    tensor_f32_t *out1 = linear_layer_forward(layer1, test_dataset->images[i]);
-    tensor_f32_t *act1 = tensor_f32_relu(out1);
-    tensor_f32_t *out2 = linear_layer_forward(layer2, act1);
-    tensor_f32_t *act2 = tensor_f32_relu(out2);
-    tensor_f32_t *out3 = linear_layer_forward(layer3, act2);
-
-    if (argmax(out3->data, 10) == argmax(test_dataset->labels[i]->data, 10)) {
-      correct++;
+  double float_seconds;
+  float accuracy =
+      use_cnn == CBOOL_TRUE
+          ? evaluate(cnn_forward, &cnn, test_dataset, batch_size, step_arena,
+                     &float_seconds)
+          : evaluate(float_forward, layers, test_dataset, batch_size,
+                     step_arena, &float_seconds);
+  printf("Accuracy: %.2f%%\n", accuracy);
+
+  // Post-training int8 quantization, compared against the float model
+  if (quantize == CBOOL_TRUE) {
+    quantized_linear_layer_t *qlayers[3];
+    uint64_t float_bytes = 0;
+    uint64_t int8_bytes = 0;
+    for (int l = 0; l < 3; l++) {
+      qlayers[l] = new_quantized_linear_layer(layers[l]);
+      float_bytes += (layers[l]->weight->meta.capacity +
+                      layers[l]->bias->meta.capacity) *
+                     dtype_size(dtype);
+      int8_bytes += quantized_linear_weight_bytes(qlayers[l]);
+    }
+    calibrate(qlayers, layers, train_dataset, batch_size, step_arena);
+
+    double int8_seconds;
+    float int8_accuracy = evaluate(quantized_forward, qlayers, test_dataset,
+                                   batch_size, step_arena, &int8_seconds);
+    printf("Int8 accuracy (%s): %.2f%% (%+.2f)\n", quantized_gemm_name(),
+           int8_accuracy, int8_accuracy - accuracy);
+    printf("Weights: %llu bytes %s, %llu bytes int8\n",
+           (unsigned long long)float_bytes, dtype_name(dtype), (unsigned long long)int8_bytes);
+    printf("Inference: %.0f items/s float, %.0f items/s int8\n",
+           test_dataset->num_items / float_seconds,
+           test_dataset->num_items / int8_seconds);
+    for (int l = 0; l < 3; l++) {
+      free_quantized_linear_layer(qlayers[l]);
     }
+  }
 
-    free_tensor_f32(out1);
-    free_tensor_f32(act1);
-    free_tensor_f32(out2);
-    free_tensor_f32(act2);
-    free_tensor_f32(out3);
-  }
-  printf("Accuracy: %.2f%%\n",
-         (float)correct / test_dataset->num_items * 100.0f);
-
-  // Save the weights
-  FILE *weight_file = fopen(WEIGHTS_FILE, "wb");
-  if (weight_file) {
-    fwrite(layer1->weight->data, sizeof(float), layer1->weight->meta.capacity,
-           weight_file);
-    fwrite(layer1->bias->data, sizeof(float), layer1->bias->meta.capacity,
-           weight_file);
-    fwrite(layer2->weight->data, sizeof(float), layer2->weight->meta.capacity,
-           weight_file);
-    fwrite(layer2->bias->data, sizeof(float), layer2->bias->meta.capacity,
-           weight_file);
-    fwrite(layer3->weight->data, sizeof(float), layer3->weight->meta.capacity,
-           weight_file);
-    fwrite(layer3->bias->data, sizeof(float), layer3->bias->meta.capacity,
-           weight_file);
-    fclose(weight_file);
+  if (checkpoint_wait(checkpoint_writer) != CBOOL_TRUE) {
+    fprintf(stderr, "Warning: failed to write checkpoint %s\n",
+            checkpoint_path);
   }
+  free_checkpoint_writer(checkpoint_writer);
 
   // Free memory
   free_mnist_dataset(train_dataset);
   free_mnist_dataset(test_dataset);
-  free_linear_layer(layer1);
-  free_linear_layer(layer2);
-  free_linear_layer(layer3);
-  free_adam_optimizer(optimizer1);
-  free_adam_optimizer(optimizer2);
-  free_adam_optimizer(optimizer3);
+  if (use_cnn == CBOOL_TRUE) {
+    free_conv2d_layer(cnn.conv1);
+    free_conv2d_layer(cnn.conv2);
+    free_linear_layer(cnn.fc);
+  } else {
+    for (int l = 0; l < 3; l++) {
+      free_linear_layer(layers[l]);
+    }
+  }
+  for (int l = 0; l < 3; l++) {
+    free_optimizer(optimizers[l]);
+  }
+  free_arena(step_arena);
 
   return 0;
 }
@@ -0,0 +1,185 @@
+// Checks the error bounds documented in much/kernels.h for the accurate
+// transcendentals against libm in double precision, at every SIMD level:
+// on a sample spread evenly over the float bit patterns, plus every float
+// near the inputs where each kernel was found to be least accurate.
+#include "much/kernels.h"
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK 4096
+// Bit patterns between samples; odd, so every exponent and low mantissa
+// bit pattern comes up.
+#define SAMPLE_STRIDE 1021
+// Floats checked on each side of a known worst case.
+#define WINDOW 200000
+
+typedef enum { EXP, LOG, SIGMOID, TANH, SIN, COS } function_t;
+
+typedef struct {
+  function_t function;
+  const char *name;
+  float lo;
+  float hi;
+  // Documented bound, in ulp of the correctly rounded result.
+  double max_ulps;
+  // Where the exhaustive search found the largest error.
+  float worst;
+} accuracy_case_t;
+
+static const accuracy_case_t cases[] = {
+    {EXP, "exp", -87.33f, 88.02f, 1.0, -81.3917618f},
+    {LOG, "log", FLT_MIN, FLT_MAX, 1.0, 0.699976802f},
+    {SIGMOID, "sigmoid", -87.33f, FLT_MAX, 2.0, -3.449918e-4f},
+    {TANH, "tanh", -FLT_MAX, FLT_MAX, 3.0, -3.92960548f},
+    {SIN, "sin", -8192.0f, 8192.0f, 2.0, 2265.60815f},
+    {COS, "cos", -8192.0f, 8192.0f, 2.0, 7195.29883f},
+};
+
+// sincos: results below this magnitude are held to an absolute bound
+// instead.
+#define TRIG_ULP_MIN 0.01
+#define TRIG_ABS_MAX 1e-7
+
+static const elementwise_kernels_t *level;
+static uint64_t failures = 0;
+
+static double reference(function_t function, double x) {
+  switch (function) {
+  case EXP:
+    return exp(x);
+  case LOG:
+    return log(x);
+  case SIGMOID:
+    return 1.0 / (1.0 + exp(-x));
+  case TANH:
+    return tanh(x);
+  case SIN:
+    return sin(x);
+  default:
+    return cos(x);
+  }
+}
+
+// The spacing of floats around r, with subnormals spaced like FLT_MIN.
+static double ulp_of(double r) {
+  int exponent;
+  frexp(fabs(r), &exponent);
+  return ldexp(1.0, (exponent < -125 ? -125 : exponent) - 24);
+}
+
+static void run(function_t function, float *out, const float *in, uint64_t n) {
+  static float scratch[BLOCK];
+  switch (function) {
+  case EXP:
+    level->exp(out, in, n);
+    break;
+  case LOG:
+    level->log(out, in, n);
+    break;
+  case SIGMOID:
+    level->sigmoid(out, in, n);
+    break;
+  case TANH:
+    level->tanh(out, in, n);
+    break;
+  case SIN:
+    level->sincos(out, scratch, in, n);
+    break;
+  default:
+    level->sincos(scratch, out, in, n);
+    break;
+  }
+}
+
+static void check_block(const accuracy_case_t *c, const float *in,
+                        uint64_t n, double *worst, float *worst_x) {
+  float out[BLOCK];
+  run(c->function, out, in, n);
+  for (uint64_t i = 0; i < n; i++) {
+    double want = reference(c->function, in[i]);
+    double error = fabs(out[i] - want);
+    if (c->function == SIN || c->function == COS) {
+      if (error > TRIG_ABS_MAX) {
+        *worst = INFINITY;
+        *worst_x = in[i];
+      }
+      if (fabs(want) < TRIG_ULP_MIN) {
+        continue;
+      }
+    }
+    // exp's results below FLT_MIN are documented separately.
+    if (c->function == EXP && want < FLT_MIN) {
+      continue;
+    }
+    double ulps = error / ulp_of(want);
+    if (ulps > *worst) {
+      *worst = ulps;
+      *worst_x = in[i];
+    }
+  }
+}
+
+// Inputs collected for check_block.
+typedef struct {
+  float in[BLOCK];
+  uint64_t n;
+} batch_t;
+
+static void add(const accuracy_case_t *c, batch_t *b, float x, double *worst,
+                float *worst_x) {
+  if (isnan(x) || x < c->lo || x > c->hi) {
+    return;
+  }
+  b->in[b->n++] = x;
+  if (b->n == BLOCK) {
+    check_block(c, b->in, b->n, worst, worst_x);
+    b->n = 0;
+  }
+}
+
+static void check_case(const accuracy_case_t *c) {
+  static batch_t b;
+  b.n = 0;
+  double worst = 0;
+  float worst_x = 0;
+  for (uint64_t bits = 0; bits < (1ull << 32); bits += SAMPLE_STRIDE) {
+    uint32_t u = (uint32_t)bits;
+    float x;
+    memcpy(&x, &u, sizeof(x));
+    add(c, &b, x, &worst, &worst_x);
+  }
+  float x = c->worst;
+  for (int i = 0; i < WINDOW; i++) {
+    x = nextafterf(x, -INFINITY);
+  }
+  for (int i = 0; i < 2 * WINDOW; i++) {
+    add(c, &b, x, &worst, &worst_x);
+    x = nextafterf(x, INFINITY);
+  }
+  if (b.n > 0) {
+    check_block(c, b.in, b.n, &worst, &worst_x);
+  }
+
+  cbool_t ok = worst <= c->max_ulps ? CBOOL_TRUE : CBOOL_FALSE;
+  printf("%-6s %-8s worst %.4f ulp at %.9g (bound %.1f)%s\n", level->name,
+         c->name, worst, worst_x, c->max_ulps,
+         ok == CBOOL_TRUE ? "" : " FAILED");
+  if (ok != CBOOL_TRUE) {
+    failures++;
+  }
+}
+
+int main() {
+  for (int l = SIMD_SCALAR; l <= SIMD_AVX512; l++) {
+    level = get_kernels_for((simd_level_t)l);
+    if (level == NULL) {
+      continue;
+    }
+    for (uint64_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+      check_case(&cases[i]);
+    }
+  }
+  return failures == 0 ? 0 : 1;
+}
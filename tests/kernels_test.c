@@ -0,0 +1,327 @@
+// Checks every SIMD level's kernel table against the scalar one, entry by
+// entry, over lengths that exercise the vector body and the tail, at
+// unaligned offsets. Levels round alike, so results must match bit for bit;
+// only `sum` adds in a different order.
+#include "much/kernels.h"
+#include <float.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LEN 1000
+// Room for the largest offset.
+#define BUFFER_LEN (MAX_LEN + 16)
+
+static const uint64_t lengths[] = {0, 1, 7, 15, 17, 33, 1000};
+static const uint64_t offsets[] = {0, 1, 3};
+
+static const elementwise_kernels_t *level;
+static const elementwise_kernels_t *scalar;
+static uint64_t failures = 0;
+static uint64_t rng_state = 1;
+
+static float random_uniform(float lo, float hi) {
+  rng_state = rng_state * 6364136223846793005ull + 1442695040888963407ull;
+  float u = (float)(rng_state >> 40) / (float)(1ull << 24);
+  return lo + (hi - lo) * u;
+}
+
+static void fill_random(float *a, float lo, float hi) {
+  for (uint64_t i = 0; i < BUFFER_LEN; i++) {
+    a[i] = random_uniform(lo, hi);
+  }
+}
+
+// Magnitudes in [lo, hi] with random signs, e.g. for divisors.
+static void fill_signed(float *a, float lo, float hi) {
+  for (uint64_t i = 0; i < BUFFER_LEN; i++) {
+    float x = random_uniform(lo, hi);
+    a[i] = random_uniform(-1.0f, 1.0f) < 0 ? -x : x;
+  }
+}
+
+static void report(const char *kernel, uint64_t n, uint64_t offset,
+                   uint64_t i, double got, double want) {
+  if (failures < 20) {
+    fprintf(stderr, "%s %s: n=%llu offset=%llu [%llu]: got %.9g, want %.9g\n",
+            level->name, kernel, (unsigned long long)n,
+            (unsigned long long)offset, (unsigned long long)i, got, want);
+  }
+  failures++;
+}
+
+static void check_floats(const char *kernel, const float *got,
+                         const float *want, uint64_t n, uint64_t offset) {
+  for (uint64_t i = 0; i < n; i++) {
+    if (memcmp(&got[i], &want[i], sizeof(float)) != 0) {
+      report(kernel, n, offset, i, got[i], want[i]);
+      return;
+    }
+  }
+}
+
+static void check_bits(const char *kernel, const void *got, const void *want,
+                       uint64_t size, uint64_t n, uint64_t offset) {
+  if (memcmp(got, want, size) != 0) {
+    report(kernel, n, offset, 0, 0, 0);
+  }
+}
+
+static float in_a[BUFFER_LEN];
+static float in_b[BUFFER_LEN];
+static float in_c[BUFFER_LEN];
+static float got[BUFFER_LEN];
+static float want[BUFFER_LEN];
+static float got2[BUFFER_LEN];
+static float want2[BUFFER_LEN];
+static float got3[BUFFER_LEN];
+static float want3[BUFFER_LEN];
+
+typedef void (*unary_fn)(float *out, const float *a, uint64_t n);
+
+static void check_unary(const char *kernel, size_t entry, float lo, float hi,
+                        uint64_t n, uint64_t offset) {
+  unary_fn f = *(const unary_fn *)((const char *)level + entry);
+  unary_fn g = *(const unary_fn *)((const char *)scalar + entry);
+  fill_random(in_a, lo, hi);
+  f(got + offset, in_a + offset, n);
+  g(want + offset, in_a + offset, n);
+  check_floats(kernel, got + offset, want + offset, n, offset);
+}
+
+#define CHECK_UNARY(name, lo, hi)                                              \
+  check_unary(#name, offsetof(elementwise_kernels_t, name), lo, hi, n, offset)
+
+typedef void (*binary_fn)(float *out, const float *a, const float *b,
+                          uint64_t n);
+
+static void check_binary(const char *kernel, size_t entry, uint64_t n,
+                         uint64_t offset) {
+  binary_fn f = *(const binary_fn *)((const char *)level + entry);
+  binary_fn g = *(const binary_fn *)((const char *)scalar + entry);
+  fill_random(in_a, -4.0f, 4.0f);
+  fill_signed(in_b, 0.25f, 4.0f);
+  f(got + offset, in_a + offset, in_b + offset, n);
+  g(want + offset, in_a + offset, in_b + offset, n);
+  check_floats(kernel, got + offset, want + offset, n, offset);
+}
+
+#define CHECK_BINARY(name)                                                     \
+  check_binary(#name, offsetof(elementwise_kernels_t, name), n, offset)
+
+// Runs a gradient kernel call `CALL(k, dst, accumulate)` on both tables,
+// with `dst` starting from the same values, and compares.
+#define CHECK_GRAD(name, CALL)                                                 \
+  for (int accumulate = 0; accumulate < 2; accumulate++) {                     \
+    fill_random(got, -2.0f, 2.0f);                                             \
+    memcpy(want, got, sizeof(got));                                            \
+    cbool_t acc = accumulate ? CBOOL_TRUE : CBOOL_FALSE;                       \
+    CALL(level, got + offset, acc);                                            \
+    CALL(scalar, want + offset, acc);                                          \
+    check_floats(accumulate ? #name " (accumulate)" : #name, got + offset,     \
+                 want + offset, n, offset);                                    \
+  }
+
+#define SCALE_GRAD(k, dst, acc) k->scale_grad(dst, in_a + offset, 0.75f, n, acc)
+#define MUL_GRAD(k, dst, acc)                                                  \
+  k->mul_grad(dst, in_a + offset, in_b + offset, n, acc)
+#define DIV_GRAD(k, dst, acc)                                                  \
+  k->div_grad(dst, in_a + offset, in_b + offset, n, acc)
+#define DIV_RHS_GRAD(k, dst, acc)                                              \
+  k->div_rhs_grad(dst, in_a + offset, in_c + offset, in_b + offset, n, acc)
+#define LEAKY_RELU_GRAD(k, dst, acc)                                           \
+  k->leaky_relu_grad(dst, in_a + offset, in_c + offset, 0.01f, n, acc)
+#define SIGMOID_GRAD(k, dst, acc)                                              \
+  k->sigmoid_grad(dst, in_a + offset, in_c + offset, n, acc)
+#define TANH_GRAD(k, dst, acc)                                                 \
+  k->tanh_grad(dst, in_a + offset, in_c + offset, n, acc)
+
+static void check_level(uint64_t n, uint64_t offset) {
+  level->fill(got + offset, 1.5f, n);
+  scalar->fill(want + offset, 1.5f, n);
+  check_floats("fill", got + offset, want + offset, n, offset);
+
+  CHECK_BINARY(add);
+  CHECK_BINARY(sub);
+  CHECK_BINARY(mul);
+  CHECK_BINARY(div);
+
+  fill_random(in_a, -4.0f, 4.0f);
+  level->add_scalar(got + offset, in_a + offset, 0.3f, n);
+  scalar->add_scalar(want + offset, in_a + offset, 0.3f, n);
+  check_floats("add_scalar", got + offset, want + offset, n, offset);
+  level->leaky_relu(got + offset, in_a + offset, 0.01f, n);
+  scalar->leaky_relu(want + offset, in_a + offset, 0.01f, n);
+  check_floats("leaky_relu", got + offset, want + offset, n, offset);
+
+  // Vector sums add in a different order; compare against the error bound
+  // of naive summation.
+  double magnitude = 0;
+  for (uint64_t i = 0; i < n; i++) {
+    magnitude += fabs(in_a[offset + i]);
+  }
+  float got_sum = level->sum(in_a + offset, n);
+  float want_sum = scalar->sum(in_a + offset, n);
+  if (fabs((double)got_sum - want_sum) > 2.0 * n * FLT_EPSILON * magnitude) {
+    report("sum", n, offset, 0, got_sum, want_sum);
+  }
+
+  for (uint64_t z = 0; z <= n; z++) {
+    fill_signed(in_b, 0.25f, 4.0f);
+    if (z < n) {
+      in_b[offset + z] = 0.0f;
+    }
+    if (level->has_zero(in_b + offset, n) !=
+        scalar->has_zero(in_b + offset, n)) {
+      report("has_zero", n, offset, z, 0, 0);
+    }
+    // Every position is worth checking for short arrays only.
+    if (n > 64) {
+      z += n / 7;
+    }
+  }
+
+  CHECK_UNARY(exp, -100.0f, 100.0f);
+  CHECK_UNARY(log, 1e-3f, 1e3f);
+  CHECK_UNARY(sigmoid, -20.0f, 20.0f);
+  CHECK_UNARY(tanh, -10.0f, 10.0f);
+  CHECK_UNARY(exp_fast, -100.0f, 100.0f);
+  CHECK_UNARY(sigmoid_fast, -20.0f, 20.0f);
+  CHECK_UNARY(tanh_fast, -10.0f, 10.0f);
+
+  fill_random(in_a, -100.0f, 100.0f);
+  level->sincos(got + offset, got2 + offset, in_a + offset, n);
+  scalar->sincos(want + offset, want2 + offset, in_a + offset, n);
+  check_floats("sincos (sin)", got + offset, want + offset, n, offset);
+  check_floats("sincos (cos)", got2 + offset, want2 + offset, n, offset);
+
+  fill_random(in_a, -8.0f, 8.0f);
+  fill_random(in_b, -8.0f, 8.0f);
+  memcpy(got, in_b, sizeof(got));
+  memcpy(want, in_b, sizeof(want));
+  level->fill(got2 + offset, 1.0f, n);
+  scalar->fill(want2 + offset, 1.0f, n);
+  level->softmax_update(got + offset, got2 + offset, in_a + offset, n);
+  scalar->softmax_update(want + offset, want2 + offset, in_a + offset, n);
+  check_floats("softmax_update (max)", got + offset, want + offset, n, offset);
+  check_floats("softmax_update (sum)", got2 + offset, want2 + offset, n,
+               offset);
+  fill_random(in_c, 0.1f, 1.0f);
+  level->softmax_scale(got + offset, in_a + offset, in_b + offset,
+                       in_c + offset, n);
+  scalar->softmax_scale(want + offset, in_a + offset, in_b + offset,
+                        in_c + offset, n);
+  check_floats("softmax_scale", got + offset, want + offset, n, offset);
+
+  fill_random(in_a, -300.0f, 300.0f);
+  fill_random(got, 0.0f, 200.0f);
+  memcpy(want, got, sizeof(got));
+  level->abs_max(got + offset, in_a + offset, n);
+  scalar->abs_max(want + offset, in_a + offset, n);
+  check_floats("abs_max", got + offset, want + offset, n, offset);
+
+  // Scales that push some values past the clamp and land others on ties.
+  int8_t got_q[BUFFER_LEN];
+  int8_t want_q[BUFFER_LEN];
+  fill_random(in_b, 0.25f, 1.0f);
+  for (uint64_t i = 0; i < BUFFER_LEN; i += 5) {
+    in_a[i] = (float)(int)in_a[i] + 0.5f;
+    in_b[i] = 1.0f;
+  }
+  level->quantize_i8(got_q + offset, in_a + offset, in_b + offset, n);
+  scalar->quantize_i8(want_q + offset, in_a + offset, in_b + offset, n);
+  check_bits("quantize_i8", got_q + offset, want_q + offset, n, n, offset);
+
+  int32_t acc[BUFFER_LEN];
+  for (uint64_t i = 0; i < BUFFER_LEN; i++) {
+    acc[i] = (int32_t)random_uniform(-2e6f, 2e6f);
+  }
+  fill_random(in_b, 1e-4f, 1e-2f);
+  level->dequantize_i32(got + offset, acc + offset, 0.03f, in_b + offset,
+                        -0.2f, n);
+  scalar->dequantize_i32(want + offset, acc + offset, 0.03f, in_b + offset,
+                         -0.2f, n);
+  check_floats("dequantize_i32", got + offset, want + offset, n, offset);
+
+  fill_random(in_a, -2.0f, 2.0f);
+  fill_signed(in_b, 0.25f, 4.0f);
+  fill_random(in_c, -1.0f, 1.0f);
+  CHECK_GRAD(scale_grad, SCALE_GRAD)
+  CHECK_GRAD(mul_grad, MUL_GRAD)
+  CHECK_GRAD(div_grad, DIV_GRAD)
+  CHECK_GRAD(div_rhs_grad, DIV_RHS_GRAD)
+  CHECK_GRAD(leaky_relu_grad, LEAKY_RELU_GRAD)
+  CHECK_GRAD(sigmoid_grad, SIGMOID_GRAD)
+  CHECK_GRAD(tanh_grad, TANH_GRAD)
+
+  // Optimizer updates: parameters and state start equal on both sides.
+  adam_step_t step = {0.9f, 0.999f, 1e-3f / 0.1f, 1.0f / sqrtf(0.001f), 1e-8f,
+                      1.0f - 1e-3f * 1e-2f};
+  fill_random(in_a, -1.0f, 1.0f);
+  fill_random(got, -1.0f, 1.0f);
+  fill_random(got2, -0.1f, 0.1f);
+  fill_random(got3, 0.0f, 0.01f);
+  memcpy(want, got, sizeof(got));
+  memcpy(want2, got2, sizeof(got2));
+  memcpy(want3, got3, sizeof(got3));
+  level->adam(got + offset, in_a + offset, got2 + offset, got3 + offset, n,
+              &step);
+  scalar->adam(want + offset, in_a + offset, want2 + offset, want3 + offset, n,
+               &step);
+  check_floats("adam (param)", got + offset, want + offset, n, offset);
+  check_floats("adam (m)", got2 + offset, want2 + offset, n, offset);
+  check_floats("adam (v)", got3 + offset, want3 + offset, n, offset);
+  level->sgd_momentum(got + offset, in_a + offset, got2 + offset, n, 0.01f,
+                      0.9f);
+  scalar->sgd_momentum(want + offset, in_a + offset, want2 + offset, n, 0.01f,
+                       0.9f);
+  check_floats("sgd_momentum (param)", got + offset, want + offset, n, offset);
+  check_floats("sgd_momentum (vel)", got2 + offset, want2 + offset, n, offset);
+
+  // 16-bit conversions round to nearest even and must agree exactly,
+  // including around the f16 subnormal and overflow thresholds.
+  uint16_t got16[BUFFER_LEN];
+  uint16_t want16[BUFFER_LEN];
+  fill_signed(in_a, 0.0f, 70000.0f);
+  for (uint64_t i = 0; i < BUFFER_LEN; i += 3) {
+    in_a[i] *= 1e-9f;
+  }
+  level->f32_to_bf16(got16 + offset, in_a + offset, n);
+  scalar->f32_to_bf16(want16 + offset, in_a + offset, n);
+  check_bits("f32_to_bf16", got16 + offset, want16 + offset,
+             n * sizeof(uint16_t), n, offset);
+  level->bf16_to_f32(got + offset, want16 + offset, n);
+  scalar->bf16_to_f32(want + offset, want16 + offset, n);
+  check_bits("bf16_to_f32", got + offset, want + offset, n * sizeof(float), n,
+             offset);
+  level->f32_to_f16(got16 + offset, in_a + offset, n);
+  scalar->f32_to_f16(want16 + offset, in_a + offset, n);
+  check_bits("f32_to_f16", got16 + offset, want16 + offset,
+             n * sizeof(uint16_t), n, offset);
+  level->f16_to_f32(got + offset, want16 + offset, n);
+  scalar->f16_to_f32(want + offset, want16 + offset, n);
+  check_bits("f16_to_f32", got + offset, want + offset, n * sizeof(float), n,
+             offset);
+}
+
+int main() {
+  scalar = get_kernels_for(SIMD_SCALAR);
+  uint64_t levels = 0;
+  for (int l = SIMD_SSE4; l <= SIMD_AVX512; l++) {
+    level = get_kernels_for((simd_level_t)l);
+    if (level == NULL) {
+      continue;
+    }
+    levels++;
+    for (uint64_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+      for (uint64_t j = 0; j < sizeof(offsets) / sizeof(offsets[0]); j++) {
+        check_level(lengths[i], offsets[j]);
+      }
+    }
+  }
+  printf("kernels: %llu SIMD levels checked against scalar, %llu failures\n",
+         (unsigned long long)levels, (unsigned long long)failures);
+  return failures == 0 ? 0 : 1;
+}